@@ -4,5 +4,6 @@
 #include "http.hpp"
 #include "server.hpp"
 #include "client.hpp"
+#include "proxy.hpp"
 
 #endif // DOORMAT_DOORMAT_HPP_
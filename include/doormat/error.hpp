@@ -2,10 +2,12 @@
 #define DOORMAT_ERROR_HPP_
 
 #include "../../src/errors/error_codes.h"
+#include "../../src/errors/error_pages.h"
 
 namespace doormat 
 {
 	using errors::http_error_code;
+	using errors::error_pages;
 }
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef DOORMAT_PROXY_HPP_
+#define DOORMAT_PROXY_HPP_
+
+#include "../../src/cache/http_cache.h"
+#include "../../src/network/health_checker.h"
+#include "../../src/proxy/coalescer.h"
+#include "../../src/proxy/connection_pool.h"
+#include "../../src/proxy/reverse_proxy.h"
+
+namespace doormat {
+
+using ::proxy::upstream;
+using ::network::upstream_group;
+using ::network::health_checker;
+using ::proxy::connection_pool;
+using ::proxy::reverse_proxy;
+using ::proxy::coalescer;
+using ::cache::http_cache;
+using ::http::compression_policy;
+
+}
+
+#endif // DOORMAT_PROXY_HPP_
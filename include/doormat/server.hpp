@@ -2,10 +2,15 @@
 #define DOORMAT_SERVER_HPP_
 
 #include "../../src/http_server.h"
+#include "../../src/files/static_files.h"
+#include "../../src/routing/router.h"
+#include "../../src/filters/filter_chain.h"
 
 namespace doormat {
 
 using ::server::http_server;
+using ::files::static_files;
+using ::routing::router;
 
 }
 
@@ -0,0 +1,230 @@
+#include "cache_control.h"
+
+#include <time.h>
+#include <algorithm>
+#include <cctype>
+
+namespace cache
+{
+
+namespace
+{
+
+std::string trim(const std::string& s)
+{
+	auto begin = s.find_first_not_of(" \t");
+	if(begin == std::string::npos) return {};
+	auto end = s.find_last_not_of(" \t");
+	return s.substr(begin, end - begin + 1);
+}
+
+/** RFC 7234 1.2.1: too big values mean "forever", which is 2^31 seconds */
+const std::chrono::seconds forever{2147483648LL};
+
+std::experimental::optional<std::chrono::seconds> seconds(const std::string& value)
+{
+	if(value.empty() || !std::all_of(value.begin(), value.end(), [](char c){ return std::isdigit(c); }))
+		return {};
+	if(value.size() > 10) return forever;
+	return std::chrono::seconds{std::min(std::stoll(value), static_cast<long long>(forever.count()))};
+}
+
+bool cacheable_by_default(uint16_t status) noexcept
+{
+	switch(status)
+	{
+		case 200: case 203: case 204: case 300: case 301: case 404: case 405: case 410: case 414: case 501:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/** Weak comparison (RFC 7232, 2.3.2) */
+std::string opaque_tag(std::string tag)
+{
+	tag = trim(tag);
+	if(tag.compare(0, 2, "W/") == 0) tag.erase(0, 2);
+	return tag;
+}
+
+}
+
+directives parse_cache_control(const http::http_structured_data& msg)
+{
+	directives d;
+	for(const auto& value : msg.headers("cache-control"))
+	{
+		std::size_t begin = 0;
+		while(begin <= value.size())
+		{
+			auto end = value.find(',', begin);
+			if(end == std::string::npos) end = value.size();
+			auto token = trim(value.substr(begin, end - begin));
+			begin = end + 1;
+			if(token.empty()) continue;
+
+			auto eq = token.find('=');
+			auto name = trim(token.substr(0, eq));
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			std::string arg = eq == std::string::npos ? std::string{} : trim(token.substr(eq + 1));
+			if(arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') arg = arg.substr(1, arg.size() - 2);
+
+			if(name == "no-store") d.no_store = true;
+			// no-cache and private with a list of fields apply to those fields only: ignoring the list is safe
+			else if(name == "no-cache") d.no_cache = true;
+			else if(name == "private") d.is_private = true;
+			else if(name == "public") d.is_public = true;
+			else if(name == "must-revalidate" || name == "proxy-revalidate") d.must_revalidate = true;
+			else if(name == "only-if-cached") d.only_if_cached = true;
+			else if(name == "max-age") d.max_age = seconds(arg);
+			else if(name == "s-maxage") d.s_maxage = seconds(arg);
+			else if(name == "stale-while-revalidate") d.stale_while_revalidate = seconds(arg);
+			else if(name == "max-stale") d.max_stale = arg.empty() ? forever : seconds(arg);
+			else if(name == "min-fresh") d.min_fresh = seconds(arg);
+		}
+	}
+	return d;
+}
+
+directives request_cache_control(const http::http_request& req)
+{
+	auto d = parse_cache_control(req);
+	if(req.has("cache-control")) return d;
+	for(const auto& value : req.headers("pragma"))
+	{
+		auto lowercase = value;
+		std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(), ::tolower);
+		if(lowercase.find("no-cache") != std::string::npos) d.no_cache = true;
+	}
+	return d;
+}
+
+bool parse_http_date(const std::string& value, clock::time_point& date)
+{
+	static const char* const formats[] =
+	{
+		"%a, %d %b %Y %H:%M:%S GMT", // IMF-fixdate
+		"%A, %d-%b-%y %H:%M:%S GMT", // RFC 850
+		"%a %b %e %H:%M:%S %Y"       // asctime
+	};
+
+	for(auto format : formats)
+	{
+		struct tm tm{};
+		auto end = strptime(value.c_str(), format, &tm);
+		if(end == nullptr || *end != '\0') continue;
+		date = clock::from_time_t(timegm(&tm));
+		return true;
+	}
+	return false;
+}
+
+std::string format_http_date(clock::time_point date)
+{
+	auto t = clock::to_time_t(date);
+	struct tm tm{};
+	gmtime_r(&t, &tm);
+	char buf[32];
+	auto len = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return std::string(buf, len);
+}
+
+bool storable(const http::http_request& req, const http::http_response& res)
+{
+	if(req.method_code() != HTTP_GET) return false;
+	// neither is a complete representation
+	if(res.status_code() == 206 || res.status_code() == 304) return false;
+	auto req_cc = parse_cache_control(req);
+	auto res_cc = parse_cache_control(res);
+	if(req_cc.no_store || res_cc.no_store || res_cc.is_private) return false;
+	if(req.has("authorization") && !res_cc.is_public && !res_cc.must_revalidate && !res_cc.s_maxage)
+		return false;
+	// variants are not part of the key: they can not be told apart
+	if(res.has("vary")) return false;
+	// a cookie belongs to a single client
+	if(res.has("set-cookie")) return false;
+
+	return res.has("expires") || res_cc.max_age || res_cc.s_maxage || res_cc.is_public
+		|| cacheable_by_default(res.status_code());
+}
+
+clock::duration freshness_lifetime(const http::http_response& res)
+{
+	auto cc = parse_cache_control(res);
+	if(cc.s_maxage) return *cc.s_maxage;
+	if(cc.max_age) return *cc.max_age;
+
+	clock::time_point date = clock::now();
+	if(res.has(http::hf_date)) parse_http_date(res.date(), date);
+
+	if(res.has("expires"))
+	{
+		clock::time_point expires;
+		// an invalid Expires means "already expired"
+		if(!parse_http_date(res.header("expires"), expires) || expires <= date) return clock::duration::zero();
+		return expires - date;
+	}
+
+	clock::time_point last_modified;
+	if(cacheable_by_default(res.status_code()) && res.has("last-modified")
+		&& parse_http_date(res.header("last-modified"), last_modified) && last_modified < date)
+	{
+		// the usual 10% heuristic, bounded to a day (RFC 7234, 4.2.2)
+		return std::min<clock::duration>((date - last_modified) / 10, std::chrono::hours{24});
+	}
+	return clock::duration::zero();
+}
+
+clock::duration initial_age(const http::http_response& res, clock::time_point request_time, clock::time_point response_time)
+{
+	clock::duration apparent_age = clock::duration::zero();
+	clock::time_point date;
+	if(res.has(http::hf_date) && parse_http_date(res.date(), date) && response_time > date)
+		apparent_age = response_time - date;
+
+	clock::duration age_value = clock::duration::zero();
+	if(auto age = seconds(res.header("age"))) age_value = *age;
+	auto corrected_age_value = age_value + (response_time - request_time);
+	return std::max(apparent_age, corrected_age_value);
+}
+
+bool not_modified(const http::http_request& req, const http::http_response& res)
+{
+	if(res.status_code() != 200) return false;
+
+	if(req.has("if-none-match"))
+	{
+		if(!res.has("etag")) return false;
+		auto etag = opaque_tag(res.header("etag"));
+		for(const auto& value : req.headers("if-none-match"))
+		{
+			std::size_t begin = 0;
+			while(begin < value.size())
+			{
+				auto end = value.find(',', begin);
+				if(end == std::string::npos) end = value.size();
+				auto tag = trim(value.substr(begin, end - begin));
+				if(tag == "*" || opaque_tag(tag) == etag) return true;
+				begin = end + 1;
+			}
+		}
+		// If-Modified-Since must be ignored when If-None-Match is there
+		return false;
+	}
+
+	if(!req.has("if-modified-since") || !res.has("last-modified")) return false;
+	clock::time_point since, last_modified;
+	return parse_http_date(req.header("if-modified-since"), since)
+		&& parse_http_date(res.header("last-modified"), last_modified) && last_modified <= since;
+}
+
+void add_validators(http::http_request& req, const http::http_response& res)
+{
+	if(res.has("etag") && !req.has("if-none-match"))
+		req.header("if-none-match", res.header("etag"));
+	if(res.has("last-modified") && !req.has("if-modified-since"))
+		req.header("if-modified-since", res.header("last-modified"));
+}
+
+}
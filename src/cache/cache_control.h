@@ -0,0 +1,69 @@
+#ifndef DOORMAT_CACHE_CONTROL_H
+#define DOORMAT_CACHE_CONTROL_H
+
+#include <chrono>
+#include <string>
+#include <experimental/optional>
+
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+
+namespace cache
+{
+
+using clock = std::chrono::system_clock;
+
+/** \brief the Cache-Control directives a shared cache cares about (RFC 7234, 5.2), of requests and responses. */
+struct directives
+{
+	bool no_store{false};
+	bool no_cache{false};
+	bool is_private{false};
+	bool is_public{false};
+	/** must-revalidate or proxy-revalidate */
+	bool must_revalidate{false};
+	bool only_if_cached{false};
+	std::experimental::optional<std::chrono::seconds> max_age;
+	std::experimental::optional<std::chrono::seconds> s_maxage;
+	/** RFC 5861 */
+	std::experimental::optional<std::chrono::seconds> stale_while_revalidate;
+	/** Request only; without a value, any staleness is accepted */
+	std::experimental::optional<std::chrono::seconds> max_stale;
+	/** Request only */
+	std::experimental::optional<std::chrono::seconds> min_fresh;
+};
+
+/** \brief parses all the Cache-Control headers of a message. */
+directives parse_cache_control(const http::http_structured_data& msg);
+
+/** \brief as above, for a request: without Cache-Control, Pragma: no-cache is no-cache (RFC 7234, 5.4). */
+directives request_cache_control(const http::http_request& req);
+
+/** \brief parses an HTTP-date (IMF-fixdate, RFC 850 and asctime formats).
+ * \returns false if the date is not valid
+ * */
+bool parse_http_date(const std::string& value, clock::time_point& date);
+
+/** \returns the IMF-fixdate representation of the time point. */
+std::string format_http_date(clock::time_point date);
+
+/** \brief tells whether a shared cache is allowed to store the response (RFC 7234, 3). */
+bool storable(const http::http_request& req, const http::http_response& res);
+
+/** \brief computes how long the response stays fresh (RFC 7234, 4.2.1), heuristics included. */
+clock::duration freshness_lifetime(const http::http_response& res);
+
+/** \brief age of the response when it was received (RFC 7234, 4.2.3). */
+clock::duration initial_age(const http::http_response& res, clock::time_point request_time, clock::time_point response_time);
+
+/** \brief evaluates the conditional headers of the request against a response we hold (RFC 7232, 6).
+ * \returns true when a 304 can be sent instead of the response
+ * */
+bool not_modified(const http::http_request& req, const http::http_response& res);
+
+/** \brief adds to the request the validators needed to revalidate the response. */
+void add_validators(http::http_request& req, const http::http_response& res);
+
+}
+
+#endif //DOORMAT_CACHE_CONTROL_H
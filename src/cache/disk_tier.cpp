@@ -0,0 +1,271 @@
+#include "disk_tier.h"
+#include "../utils/log_wrapper.h"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace cache
+{
+
+namespace
+{
+
+constexpr auto magic = "doormat-cache 1\n";
+constexpr auto extension = ".entry";
+
+uint64_t fnv1a(const std::string& s) noexcept
+{
+	uint64_t h = 14695981039346656037ULL;
+	for(unsigned char c : s)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int64_t to_ms(clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+}
+
+std::string serialize_header(const std::string& key, const entry& e)
+{
+	std::string out{magic};
+	out += key + "\n";
+	out += std::to_string(to_ms(e.response_time().time_since_epoch())) + " " + std::to_string(to_ms(e.initial_age()))
+		+ " " + std::to_string(e.body().size) + "\n";
+	const auto& p = e.preamble();
+	out += std::to_string(p.status_code()) + " " + p.status_message() + "\n";
+	for(const auto& h : p.headers())
+		out += h.first + ": " + h.second + "\n";
+	out += "\n";
+	return out;
+}
+
+/** \brief reads a line from [pos, end) */
+bool next_line(const char*& pos, const char* end, std::string& line)
+{
+	auto nl = static_cast<const char*>(memchr(pos, '\n', end - pos));
+	if(!nl) return false;
+	line.assign(pos, nl);
+	pos = nl + 1;
+	return true;
+}
+
+bool write_all(int fd, const char* data, std::size_t size)
+{
+	while(size)
+	{
+		auto written = ::write(fd, data, size);
+		if(written < 0)
+		{
+			if(errno == EINTR) continue;
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+}
+
+disk_tier::disk_tier(std::string path, std::size_t capacity)
+	: dir{std::move(path)}
+	, capacity{capacity}
+{
+	if(!dir.empty() && dir.back() != '/') dir += '/';
+	if(::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+		LOGERROR("cannot create the cache directory ", dir, ": ", strerror(errno));
+	scan();
+}
+
+std::string disk_tier::file_name(const std::string& key) const
+{
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(fnv1a(key)));
+	return std::string{buf} + extension;
+}
+
+entry_ptr disk_tier::get(const std::string& key)
+{
+	auto name = file_name(key);
+	{
+		std::lock_guard<std::mutex> lock{mtx};
+		auto it = index.find(name);
+		if(it == index.end()) return nullptr;
+		lru.splice(lru.begin(), lru, it->second.position);
+	}
+
+	int fd = ::open((dir + name).c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		forget(name);
+		return nullptr;
+	}
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size > 0)
+		mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		forget(name);
+		return nullptr;
+	}
+
+	std::size_t size = st.st_size;
+	std::shared_ptr<const void> owner{mapping, [size](const void* p) { munmap(const_cast<void*>(p), size); }};
+	const char* pos = static_cast<const char*>(mapping);
+	const char* end = pos + size;
+
+	std::string line;
+	if(!next_line(pos, end, line) || line + "\n" != magic) return nullptr;
+	// two keys with the same hash: the file belongs to the other one
+	if(!next_line(pos, end, line) || line != key) return nullptr;
+
+	long long response_time_ms, initial_age_ms;
+	unsigned long long body_size;
+	if(!next_line(pos, end, line) || sscanf(line.c_str(), "%lld %lld %llu", &response_time_ms, &initial_age_ms, &body_size) != 3)
+		return nullptr;
+
+	http::http_response preamble;
+	preamble.protocol(http::proto_version::HTTP11);
+	preamble.remove_header(http::hf_connection);
+	if(!next_line(pos, end, line)) return nullptr;
+	auto space = line.find(' ');
+	preamble.status(static_cast<uint16_t>(std::atoi(line.c_str())), space == std::string::npos ? "" : line.substr(space + 1));
+
+	while(next_line(pos, end, line) && !line.empty())
+	{
+		auto colon = line.find(": ");
+		if(colon == std::string::npos) continue;
+		preamble.header(line.substr(0, colon), line.substr(colon + 2));
+	}
+	if(static_cast<std::size_t>(end - pos) != body_size)
+	{
+		LOGWARN("truncated cache entry ", name, ", dropping it");
+		erase(key);
+		return nullptr;
+	}
+
+	return std::make_shared<const entry>(std::move(preamble), body_view{std::move(owner), pos, body_size},
+		clock::time_point{std::chrono::milliseconds{response_time_ms}}, std::chrono::milliseconds{initial_age_ms});
+}
+
+bool disk_tier::put(const std::string& key, const entry& e)
+{
+	auto name = file_name(key);
+	std::string tmp;
+	{
+		std::lock_guard<std::mutex> lock{mtx};
+		tmp = dir + name + ".tmp" + std::to_string(sequence++);
+	}
+
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		LOGERROR("cannot write the cache entry ", tmp, ": ", strerror(errno));
+		return false;
+	}
+	auto header = serialize_header(key, e);
+	bool ok = write_all(fd, header.data(), header.size()) && write_all(fd, e.body().data, e.body().size);
+	::close(fd);
+	if(!ok || ::rename(tmp.c_str(), (dir + name).c_str()) != 0)
+	{
+		LOGERROR("cannot write the cache entry ", name, ": ", strerror(errno));
+		::unlink(tmp.c_str());
+		return false;
+	}
+
+	insert(name, header.size() + e.body().size);
+	return true;
+}
+
+void disk_tier::erase(const std::string& key)
+{
+	auto name = file_name(key);
+	forget(name);
+	::unlink((dir + name).c_str());
+}
+
+bool disk_tier::contains(const std::string& key) const
+{
+	auto name = file_name(key);
+	std::lock_guard<std::mutex> lock{mtx};
+	return index.count(name) > 0;
+}
+
+std::size_t disk_tier::used() const
+{
+	std::lock_guard<std::mutex> lock{mtx};
+	return in_use;
+}
+
+void disk_tier::insert(const std::string& name, std::size_t size)
+{
+	std::vector<std::string> victims;
+	{
+		std::lock_guard<std::mutex> lock{mtx};
+		auto it = index.find(name);
+		if(it != index.end())
+		{
+			in_use -= it->second.size;
+			lru.erase(it->second.position);
+			index.erase(it);
+		}
+		lru.push_front(name);
+		index.emplace(name, file_info{size, lru.begin()});
+		in_use += size;
+
+		while(in_use > capacity && lru.size() > 1)
+		{
+			auto& victim = lru.back();
+			auto v = index.find(victim);
+			in_use -= v->second.size;
+			index.erase(v);
+			victims.push_back(std::move(victim));
+			lru.pop_back();
+		}
+	}
+	// mapped victims stay readable until their last reader is done
+	for(auto& v : victims)
+		::unlink((dir + v).c_str());
+}
+
+void disk_tier::forget(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock{mtx};
+	auto it = index.find(name);
+	if(it == index.end()) return;
+	in_use -= it->second.size;
+	lru.erase(it->second.position);
+	index.erase(it);
+}
+
+void disk_tier::scan()
+{
+	DIR* d = opendir(dir.c_str());
+	if(!d) return;
+	while(auto ent = readdir(d))
+	{
+		std::string name{ent->d_name};
+		struct stat st;
+		if(stat((dir + name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+		if(utils::ends_with(name, extension))
+			insert(name, st.st_size);
+		else if(name.find(".tmp") != std::string::npos)
+			::unlink((dir + name).c_str()); // left behind by a crash
+	}
+	closedir(d);
+}
+
+}
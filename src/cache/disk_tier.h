@@ -0,0 +1,63 @@
+#ifndef DOORMAT_CACHE_DISK_TIER_H
+#define DOORMAT_CACHE_DISK_TIER_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "entry.h"
+
+namespace cache
+{
+
+/** \brief entries stored as files under a directory, bounded in bytes and evicted in LRU order.
+ *
+ * Each entry is a single file, named after a hash of its key, holding a small text header (key, timing,
+ * status line and headers) followed by the body. Files are written to a temporary name and renamed, so that
+ * readers never see a partial entry. A hit maps the file in memory: the body handed out points straight into
+ * the mapping, which stays alive as long as some body_view refers to it.
+ * The index is rebuilt from the directory content at construction; access is serialized by a single lock,
+ * which is never held while doing I/O.
+ * */
+class disk_tier
+{
+public:
+	disk_tier(std::string path, std::size_t capacity);
+	disk_tier(const disk_tier&) = delete;
+	disk_tier& operator=(const disk_tier&) = delete;
+
+	entry_ptr get(const std::string& key);
+	/** \returns false if the entry could not be written */
+	bool put(const std::string& key, const entry& e);
+	void erase(const std::string& key);
+	bool contains(const std::string& key) const;
+
+	std::size_t used() const;
+	const std::string& path() const noexcept { return dir; }
+
+private:
+	using lru_t = std::list<std::string>;
+	struct file_info
+	{
+		std::size_t size;
+		lru_t::iterator position;
+	};
+
+	std::string file_name(const std::string& key) const;
+	void insert(const std::string& name, std::size_t size);
+	void forget(const std::string& name);
+	void scan();
+
+	std::string dir;
+	std::size_t capacity;
+	mutable std::mutex mtx;
+	lru_t lru;
+	std::unordered_map<std::string, file_info> index;
+	std::size_t in_use{0};
+	std::size_t sequence{0};
+};
+
+}
+
+#endif //DOORMAT_CACHE_DISK_TIER_H
@@ -0,0 +1,93 @@
+#ifndef DOORMAT_CACHE_ENTRY_H
+#define DOORMAT_CACHE_ENTRY_H
+
+#include <memory>
+#include <string>
+
+#include "cache_control.h"
+
+namespace cache
+{
+
+/** \brief contiguous bytes kept alive by their owner: a string for the memory tier, a file mapping for the
+ * disk one. Copies share the same bytes.
+ * */
+struct body_view
+{
+	std::shared_ptr<const void> owner;
+	const char* data{nullptr};
+	std::size_t size{0};
+
+	static body_view from_string(std::string body)
+	{
+		auto s = std::make_shared<const std::string>(std::move(body));
+		return body_view{s, s->data(), s->size()};
+	}
+};
+
+/** \brief a stored response, together with what is needed to tell whether it can still be used. */
+class entry
+{
+public:
+	entry(http::http_response preamble, body_view body, clock::time_point response_time, clock::duration initial_age)
+		: _preamble{std::move(preamble)}
+		, _body{std::move(body)}
+		, _response_time{response_time}
+		, _initial_age{initial_age}
+		, _lifetime{freshness_lifetime(_preamble)}
+		, _directives{parse_cache_control(_preamble)}
+	{}
+
+	const http::http_response& preamble() const noexcept { return _preamble; }
+	const body_view& body() const noexcept { return _body; }
+	clock::time_point response_time() const noexcept { return _response_time; }
+	clock::duration initial_age() const noexcept { return _initial_age; }
+
+	/** \returns the current age (RFC 7234, 4.2.3) */
+	clock::duration age(clock::time_point now) const noexcept
+	{
+		return _initial_age + (now > _response_time ? now - _response_time : clock::duration::zero());
+	}
+
+	bool fresh(clock::time_point now) const noexcept { return !_directives.no_cache && age(now) < _lifetime; }
+
+	/** \returns true if the entry can be served, as it is, to a request with these directives (RFC 7234, 5.2.1):
+	 * max-age and min-fresh narrow freshness, max-stale accepts stale entries unless they must be revalidated.
+	 * */
+	bool acceptable(clock::time_point now, const directives& request) const noexcept
+	{
+		if(request.no_cache) return false;
+		auto current = age(now);
+		if(request.max_age && current > *request.max_age) return false;
+		if(request.min_fresh && current + *request.min_fresh >= _lifetime) return false;
+		if(fresh(now)) return true;
+		if(!request.max_stale || _directives.no_cache || _directives.must_revalidate) return false;
+		return current < _lifetime + *request.max_stale;
+	}
+
+	/** \returns true if the entry is stale, but can be served while it is being revalidated (RFC 5861, 3). */
+	bool stale_while_revalidate(clock::time_point now) const noexcept
+	{
+		if(_directives.must_revalidate || _directives.no_cache || !_directives.stale_while_revalidate) return false;
+		return age(now) < _lifetime + *_directives.stale_while_revalidate;
+	}
+
+	bool has_validators() const { return _preamble.has("etag") || _preamble.has("last-modified"); }
+
+	/** \returns the memory needed to hold the entry, roughly. */
+	std::size_t cost() const noexcept { return _body.size + _preamble.headers_count() * 64 + sizeof(entry); }
+
+private:
+	http::http_response _preamble;
+	body_view _body;
+	clock::time_point _response_time;
+	clock::duration _initial_age;
+	clock::duration _lifetime;
+	directives _directives;
+};
+
+using entry_ptr = std::shared_ptr<const entry>;
+
+}
+
+#endif //DOORMAT_CACHE_ENTRY_H
@@ -0,0 +1,128 @@
+#include "http_cache.h"
+#include "../utils/log_wrapper.h"
+
+namespace cache
+{
+
+namespace
+{
+
+/** Headers describing the connection or the framing of the body, rather than the representation. */
+bool framing(const std::string& name)
+{
+	return name == http::hf_content_len || name == http::hf_transfer_encoding || name == http::hf_connection
+		|| name == "keep-alive" || name == "age";
+}
+
+}
+
+http_cache::http_cache(settings s, key_builder keys)
+	: conf{std::move(s)}
+	, keys{std::move(keys)}
+	, hot{conf.memory_capacity}
+{
+	if(conf.path.empty()) return;
+	cold = std::make_unique<disk_tier>(conf.path, conf.disk_capacity);
+	disk_work = std::make_unique<boost::asio::io_service::work>(disk_io);
+	disk_thread = std::thread{[this]() { disk_io.run(); }};
+}
+
+http_cache::~http_cache()
+{
+	if(!disk_thread.joinable()) return;
+	// the entries being demoted are written before leaving
+	disk_work.reset();
+	disk_thread.join();
+}
+
+void http_cache::lookup(const std::string& key, boost::asio::io_service& io, lookup_callback_t cb)
+{
+	if(auto e = hot.get(key)) return cb(std::move(e));
+	if(!cold) return cb(nullptr);
+	on_disk([this, key, &io, cb = std::move(cb)]()
+	{
+		auto e = cold->get(key);
+		if(e)
+		{
+			// the body keeps pointing to the mapping: the promotion copies nothing. A response stored meanwhile is
+			// newer than the one on disk: it stays, and is the one found
+			insert(key, e, false);
+			if(auto stored = hot.get(key)) e = std::move(stored);
+		}
+		io.post([e, cb]() { cb(e); });
+	});
+}
+
+entry_ptr http_cache::store(const std::string& key, http::http_response preamble, std::string body,
+	clock::time_point request_time, clock::time_point response_time)
+{
+	if(body.size() > conf.max_object) return nullptr;
+
+	auto age = initial_age(preamble, request_time, response_time);
+	preamble.filter([](const http::http_structured_data::header_t& h) { return framing(h.first); });
+	preamble.chunked(false);
+	preamble.content_len(body.size());
+	auto e = std::make_shared<const entry>(std::move(preamble), body_view::from_string(std::move(body)),
+		response_time, age);
+
+	// the version on disk, if any, is obsolete
+	if(cold) on_disk([this, key]() { cold->erase(key); });
+	insert(key, e);
+	return e;
+}
+
+entry_ptr http_cache::freshen(const std::string& key, const entry& stale, const http::http_response& not_modified,
+	clock::time_point request_time, clock::time_point response_time)
+{
+	auto preamble = stale.preamble();
+	for(const auto& h : not_modified.headers())
+		if(!framing(h.first)) preamble.remove_header(h.first);
+	for(const auto& h : not_modified.headers())
+		if(!framing(h.first)) preamble.header(h.first, h.second);
+
+	auto e = std::make_shared<const entry>(std::move(preamble), stale.body(), response_time,
+		initial_age(not_modified, request_time, response_time));
+	if(cold) on_disk([this, key, e]() { if(cold->contains(key)) cold->put(key, *e); });
+	insert(key, e);
+	return e;
+}
+
+void http_cache::erase(const std::string& key)
+{
+	hot.erase(key);
+	if(cold) on_disk([this, key]() { cold->erase(key); });
+}
+
+bool http_cache::begin_revalidation(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock{revalidations_mtx};
+	return revalidations.insert(key).second;
+}
+
+void http_cache::end_revalidation(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock{revalidations_mtx};
+	revalidations.erase(key);
+}
+
+void http_cache::insert(const std::string& key, entry_ptr e, bool replace)
+{
+	auto victims = hot.put(key, std::move(e), replace);
+	if(!cold || victims.empty()) return;
+	on_disk([this, victims = std::move(victims)]()
+	{
+		for(auto& victim : victims)
+		{
+			if(cold->contains(victim.first)) continue;
+			if(!cold->put(victim.first, *victim.second))
+				LOGDEBUG("cache entry ", victim.first, " dropped");
+		}
+	});
+}
+
+void http_cache::on_disk(std::function<void()> job)
+{
+	disk_io.post(std::move(job));
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef DOORMAT_CACHE_HTTP_CACHE_H
+#define DOORMAT_CACHE_HTTP_CACHE_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#include <boost/asio/io_service.hpp>
+
+#include "key_builder.h"
+#include "memory_tier.h"
+#include "disk_tier.h"
+
+namespace cache
+{
+
+/** \brief two-tier HTTP response cache (RFC 7234).
+ *
+ * Hot entries live in a sharded in-memory LRU; entries evicted from it, or too big to ever fit in it, are
+ * demoted to the disk tier under the configured path, from which they are served through a read-only mapping
+ * and promoted back on a hit. Thread safe: every tier does its own locking.
+ * The disk is never touched on the caller's thread: reads, writes and removals are run in the order they are
+ * asked for by a thread of the cache's own, and lookups report their outcome to the io_service of the caller.
+ * */
+class http_cache
+{
+public:
+	struct settings
+	{
+		/** Directory of the disk tier; an empty path disables it. */
+		std::string path;
+		std::size_t memory_capacity{64 * 1024 * 1024};
+		std::size_t disk_capacity{1024 * 1024 * 1024};
+		/** Bigger bodies are not stored at all. */
+		std::size_t max_object{8 * 1024 * 1024};
+	};
+
+	using lookup_callback_t = std::function<void(entry_ptr)>;
+
+	explicit http_cache(settings s, key_builder keys = {});
+	http_cache(const http_cache&) = delete;
+	http_cache& operator=(const http_cache&) = delete;
+
+	/** \brief waits for the disk I/O asked for so far. */
+	~http_cache();
+
+	std::string key(const http::http_request& req) const { return keys(req); }
+
+	/** \brief finds the entry stored under the key, fresh or not, or nullptr.
+	 * A memory hit is reported right away; otherwise the disk is read and the outcome is posted to io.
+	 * */
+	void lookup(const std::string& key, boost::asio::io_service& io, lookup_callback_t cb);
+
+	/** \returns the entry kept in memory under the key, or nullptr: the disk is not read. */
+	entry_ptr find(const std::string& key) { return hot.get(key); }
+
+	/** \brief stores a response received at response_time for a request sent at request_time.
+	 * \returns the stored entry, or nullptr if the body is too big
+	 * */
+	entry_ptr store(const std::string& key, http::http_response preamble, std::string body,
+		clock::time_point request_time, clock::time_point response_time);
+
+	/** \brief updates the stored entry with the headers of a 304 received for its revalidation
+	 * (RFC 7234, 4.3.4).
+	 * \returns the updated entry
+	 * */
+	entry_ptr freshen(const std::string& key, const entry& stale, const http::http_response& not_modified,
+		clock::time_point request_time, clock::time_point response_time);
+
+	/** \brief invalidates the key in both tiers (RFC 7234, 4.4). */
+	void erase(const std::string& key);
+
+	/** \brief marks the key as being revalidated in the background.
+	 * \returns false if a revalidation of the key is already running
+	 * */
+	bool begin_revalidation(const std::string& key);
+	void end_revalidation(const std::string& key);
+
+	std::size_t max_object() const noexcept { return conf.max_object; }
+	const memory_tier& memory() const noexcept { return hot; }
+	const disk_tier* disk() const noexcept { return cold.get(); }
+
+private:
+	void insert(const std::string& key, entry_ptr e, bool replace = true);
+	/** \brief runs the job on the disk thread, after the ones asked for before it. */
+	void on_disk(std::function<void()> job);
+
+	settings conf;
+	key_builder keys;
+	memory_tier hot;
+	std::unique_ptr<disk_tier> cold;
+
+	boost::asio::io_service disk_io;
+	std::unique_ptr<boost::asio::io_service::work> disk_work;
+	std::thread disk_thread;
+
+	std::mutex revalidations_mtx;
+	std::unordered_set<std::string> revalidations;
+};
+
+}
+
+#endif //DOORMAT_CACHE_HTTP_CACHE_H
@@ -0,0 +1,113 @@
+#include "key_builder.h"
+#include "../utils/json.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace cache
+{
+
+namespace
+{
+
+constexpr auto default_part = "<default>";
+constexpr auto header_prefix = "<header:";
+
+std::vector<std::string> split_template(const std::string& t)
+{
+	std::vector<std::string> parts;
+	std::size_t begin = 0;
+	while(begin <= t.size())
+	{
+		auto end = t.find('$', begin);
+		if(end == std::string::npos) end = t.size();
+		if(end > begin) parts.emplace_back(t.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return parts;
+}
+
+std::string host_without_port(const http::http_request& req)
+{
+	std::string host = req.hostname().empty() ? req.urihost() : req.hostname();
+	// an IPv6 literal carries colons of its own
+	auto colon = host.rfind(':');
+	if(colon != std::string::npos && host.find(']', colon) == std::string::npos) host.erase(colon);
+	std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+	return host;
+}
+
+}
+
+key_builder::key_builder(const std::vector<rule>& rs)
+{
+	rules.reserve(rs.size());
+	for(const auto& r : rs)
+	{
+		boost::regex::flag_type flags = boost::regex::perl | boost::regex::icase;
+		rules.push_back(compiled_rule{
+			boost::regex{r.vhost, flags}, boost::regex{r.path, flags}, boost::regex{r.user_agent, flags},
+			r.vhost.empty(), r.path.empty(), r.user_agent.empty(), split_template(r.cache_key)});
+	}
+}
+
+key_builder key_builder::from_file(const std::string& file)
+{
+	std::ifstream in{file};
+	if(!in) throw std::runtime_error{"cannot open " + file};
+
+	std::vector<rule> rs;
+	try
+	{
+		auto conf = nlohmann::json::parse(in);
+		for(const auto& r : conf.at("cache_normalization"))
+		{
+			auto field = [&r](const char* name) { return r.count(name) ? r[name].get<std::string>() : std::string{}; };
+			rs.push_back(rule{field("vhost"), field("path"), field("user_agent"), field("cache_key")});
+		}
+		return key_builder{rs};
+	}
+	catch(const std::exception& e)
+	{
+		throw std::runtime_error{"invalid cache normalization file " + file + ": " + e.what()};
+	}
+}
+
+std::string key_builder::operator()(const http::http_request& req) const
+{
+	if(rules.empty()) return default_key(req);
+
+	auto host = host_without_port(req);
+	const auto& user_agent = req.header("user-agent");
+	for(const auto& r : rules)
+	{
+		if(!r.any_vhost && !boost::regex_search(host, r.vhost)) continue;
+		if(!r.any_path && !boost::regex_search(req.path(), r.path)) continue;
+		if(!r.any_user_agent && !boost::regex_search(user_agent, r.user_agent)) continue;
+
+		std::string key;
+		for(const auto& part : r.parts)
+		{
+			if(part == default_part)
+				key += default_key(req);
+			else if(part.size() > 9 && part.compare(0, 8, header_prefix) == 0 && part.back() == '>')
+			{
+				auto name = part.substr(8, part.size() - 9);
+				std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+				key += req.header(name);
+			}
+			else
+				key += part;
+		}
+		return key;
+	}
+	return default_key(req);
+}
+
+std::string key_builder::default_key(const http::http_request& req)
+{
+	return host_without_port(req) + req.path() + (req.query().empty() ? "" : "?" + req.query());
+}
+
+}
@@ -0,0 +1,61 @@
+#ifndef DOORMAT_CACHE_KEY_BUILDER_H
+#define DOORMAT_CACHE_KEY_BUILDER_H
+
+#include <string>
+#include <vector>
+#include <boost/regex.hpp>
+
+#include "../http/http_request.h"
+
+namespace cache
+{
+
+/** \brief builds cache keys, collapsing the requests that deserve the same response onto one key.
+ *
+ * Rules are evaluated in order and the first whose vhost, path and user agent expressions all match the
+ * request wins; a missing expression matches anything. The key template of a rule is a list of parts separated
+ * by '$': "<default>" stands for the default key (host without port, path and query), "<header:name>" for the
+ * value of a request header; anything else is copied as is. Requests matching no rule get the default key.
+ * */
+class key_builder
+{
+public:
+	struct rule
+	{
+		std::string vhost;
+		std::string path;
+		std::string user_agent;
+		std::string cache_key;
+	};
+
+	key_builder() = default;
+	explicit key_builder(const std::vector<rule>& rules);
+
+	/** \brief loads the rules from a {"cache_normalization": [...]} configuration file.
+	 * \throws std::runtime_error if the file can not be read or parsed
+	 * */
+	static key_builder from_file(const std::string& file);
+
+	std::string operator()(const http::http_request& req) const;
+
+	/** \returns the key used when no rule matches. */
+	static std::string default_key(const http::http_request& req);
+
+private:
+	struct compiled_rule
+	{
+		boost::regex vhost;
+		boost::regex path;
+		boost::regex user_agent;
+		bool any_vhost;
+		bool any_path;
+		bool any_user_agent;
+		std::vector<std::string> parts;
+	};
+
+	std::vector<compiled_rule> rules;
+};
+
+}
+
+#endif //DOORMAT_CACHE_KEY_BUILDER_H
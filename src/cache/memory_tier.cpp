@@ -0,0 +1,88 @@
+#include "memory_tier.h"
+
+#include <cassert>
+
+namespace cache
+{
+
+constexpr std::size_t memory_tier::default_shards;
+
+memory_tier::memory_tier(std::size_t capacity, std::size_t shards)
+	: shard_capacity{capacity / shards}
+	, shards(shards)
+{
+	assert(shards > 0);
+}
+
+memory_tier::shard& memory_tier::shard_of(const std::string& key) noexcept
+{
+	return shards[std::hash<std::string>{}(key) % shards.size()];
+}
+
+entry_ptr memory_tier::get(const std::string& key)
+{
+	auto& s = shard_of(key);
+	std::lock_guard<std::mutex> lock{s.mtx};
+	auto it = s.index.find(key);
+	if(it == s.index.end()) return nullptr;
+	s.lru.splice(s.lru.begin(), s.lru, it->second);
+	return it->second->second;
+}
+
+memory_tier::evicted_t memory_tier::put(const std::string& key, entry_ptr e, bool replace)
+{
+	evicted_t evicted;
+	if(e->cost() > shard_capacity)
+	{
+		evicted.emplace_back(key, std::move(e));
+		return evicted;
+	}
+
+	auto& s = shard_of(key);
+	std::lock_guard<std::mutex> lock{s.mtx};
+	auto it = s.index.find(key);
+	if(it != s.index.end())
+	{
+		if(!replace) return evicted;
+		s.used -= it->second->second->cost();
+		s.lru.erase(it->second);
+		s.index.erase(it);
+	}
+
+	s.used += e->cost();
+	s.lru.emplace_front(key, std::move(e));
+	s.index.emplace(key, s.lru.begin());
+	while(s.used > shard_capacity)
+	{
+		auto& victim = s.lru.back();
+		s.used -= victim.second->cost();
+		s.index.erase(victim.first);
+		evicted.push_back(std::move(victim));
+		s.lru.pop_back();
+	}
+	return evicted;
+}
+
+void memory_tier::erase(const std::string& key)
+{
+	auto& s = shard_of(key);
+	std::lock_guard<std::mutex> lock{s.mtx};
+	auto it = s.index.find(key);
+	if(it == s.index.end()) return;
+	s.used -= it->second->second->cost();
+	s.lru.erase(it->second);
+	s.index.erase(it);
+}
+
+std::size_t memory_tier::used() const
+{
+	std::size_t total{0};
+	for(auto& s : shards)
+	{
+		std::lock_guard<std::mutex> lock{s.mtx};
+		total += s.used;
+	}
+	return total;
+}
+
+}
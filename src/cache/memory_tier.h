@@ -0,0 +1,64 @@
+#ifndef DOORMAT_CACHE_MEMORY_TIER_H
+#define DOORMAT_CACHE_MEMORY_TIER_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "entry.h"
+
+namespace cache
+{
+
+/** \brief LRU of the hot entries, bounded in bytes.
+ * Keys are spread over independent shards, each with its own lock and its own share of the capacity, so that
+ * threads serving different objects do not contend.
+ * */
+class memory_tier
+{
+public:
+	using evicted_t = std::vector<std::pair<std::string, entry_ptr>>;
+
+	static constexpr std::size_t default_shards = 16;
+
+	explicit memory_tier(std::size_t capacity, std::size_t shards = default_shards);
+	memory_tier(const memory_tier&) = delete;
+	memory_tier& operator=(const memory_tier&) = delete;
+
+	/** \returns the entry, marking it as the most recently used, or nullptr. */
+	entry_ptr get(const std::string& key);
+
+	/** \brief inserts (or replaces) an entry.
+	 * \param replace false to keep the entry already stored under the key, if any
+	 * \returns the entries evicted to make room for it; an entry bigger than a shard is not inserted and is
+	 * returned as evicted.
+	 * */
+	evicted_t put(const std::string& key, entry_ptr e, bool replace = true);
+
+	void erase(const std::string& key);
+
+	/** \returns the bytes currently used, summed over all the shards. */
+	std::size_t used() const;
+
+private:
+	struct shard
+	{
+		using lru_t = std::list<std::pair<std::string, entry_ptr>>;
+
+		mutable std::mutex mtx;
+		lru_t lru;
+		std::unordered_map<std::string, lru_t::iterator> index;
+		std::size_t used{0};
+	};
+
+	shard& shard_of(const std::string& key) noexcept;
+
+	std::size_t shard_capacity;
+	std::vector<shard> shards;
+};
+
+}
+
+#endif //DOORMAT_CACHE_MEMORY_TIER_H
@@ -1,26 +1,37 @@
 #pragma once
 
 #include <memory>
+#include <algorithm>
 #include <functional>
 #include <type_traits>
+#include <cerrno>
+#include <cstring>
+#include <sys/sendfile.h>
 
 #include <boost/array.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/date_time/posix_time/posix_time_duration.hpp>
 
 #include "utils/reusable_buffer.h"
 #include "utils/log_wrapper.h"
 #include "protocol/http_handler.h"
+#include "network/record_sizer.h"
+#include "network/ktls.h"
+#include "network/early_data.h"
 
 namespace server
 {
 constexpr const size_t MAXINBYTESPERLOOP{8192};
+/** Bytes of a file handed to a single sendfile(2) call, so that a big file does not hog the io_service. */
+constexpr const size_t MAXFILEBYTESPERLOOP{512 * 1024};
 
 using interval = boost::posix_time::time_duration;
 using berror_code = boost::system::error_code;
 using tcp_socket = boost::asio::ip::tcp::socket;
 using ssl_socket = boost::asio::ssl::stream<tcp_socket>;
+using local_socket = boost::asio::local::stream_protocol::socket;
 
 class connector_interface
 {
@@ -33,11 +44,19 @@ public:
 	virtual void do_write() = 0;
 	virtual boost::asio::ip::address origin() const = 0;
 	virtual bool is_ssl() const noexcept = 0;
+	/** \returns true if the connector sends the files of the handler on its own (see http_handler::file_to_send):
+	 * plain connections and TLS ones the kernel encrypts for. */
+	virtual bool sends_files() const noexcept { return !is_ssl(); }
+	/** \returns true if the bytes read last came as TLS early data, which whoever captured it can replay */
+	virtual bool reading_early_data() const noexcept { return false; }
 	virtual void close()=0;
     virtual boost::asio::io_service & io_service() = 0;
 	virtual void set_timeout(std::chrono::milliseconds) = 0;
 	virtual void handler(std::shared_ptr<http_handler>) = 0;
 	virtual void start(bool tcp_no_delay = false) = 0;
+	/** Flow control: stops (and restarts) reading from the socket without closing it. */
+	virtual void pause_read() = 0;
+	virtual void resume_read() = 0;
 protected:
 	reusable_buffer<MAXINBYTESPERLOOP> _rb;
 	std::string _out;
@@ -57,6 +76,57 @@ class connector final: public connector_interface,
 
 	bool _writing {false};
 	bool _stopped {false};
+	bool _read_paused {false};
+	bool _read_pending {false};
+	/** Set while reading is paused: no read is in flight to keep the connector alive meanwhile */
+	std::shared_ptr<connector> _parked;
+
+	network::record_sizer _records;
+	/** Set if the kernel encrypts what is sent: writes go on the TCP socket as they are */
+	bool _kernel_tls {false};
+	/** Set while the handshake reading early data goes on: reads and writes go through it */
+	std::shared_ptr<network::early_data> _early;
+
+	static bool offloaded(ssl_socket& s) noexcept { return network::ktls::offloaded(s.native_handle()); }
+	template<typename plain_socket>
+	static bool offloaded(plain_socket&) noexcept { return false; }
+
+	static std::shared_ptr<network::early_data> early(ssl_socket& s) noexcept
+	{
+		auto e = network::early_data::of(s.native_handle());
+		return e && e->active() ? e : nullptr;
+	}
+	template<typename plain_socket>
+	static std::shared_ptr<network::early_data> early(plain_socket&) noexcept { return nullptr; }
+
+	/** \returns the socket the bytes go on: the TCP one under TLS, the socket itself otherwise */
+	static tcp_socket& plain(ssl_socket& s) noexcept { return s.next_layer(); }
+	template<typename plain_socket>
+	static plain_socket& plain(plain_socket& s) noexcept { return s; }
+
+	static boost::asio::ip::address peer(tcp_socket& s) noexcept
+	{
+		// unspecified once the peer is gone
+		boost::system::error_code ec;
+		return s.remote_endpoint(ec).address();
+	}
+	/** The peers of Unix sockets have no address: they are told apart by none of the rules going by address. */
+	static boost::asio::ip::address peer(local_socket&) noexcept { return {}; }
+
+	static void no_delay(tcp_socket& s, bool enabled) { s.set_option(boost::asio::ip::tcp::no_delay(enabled)); }
+	static void no_delay(local_socket&, bool) noexcept {}
+
+	/** \brief writes the buffers on the stream, or as they are on the TCP socket if the kernel encrypts them. */
+	template<typename buffers_type, typename callback_type>
+	void write(const buffers_type& buffers, callback_type&& callback)
+	{
+		if(_early && _early->active())
+			_early->async_write(boost::asio::const_buffer{buffers}, std::forward<callback_type>(callback));
+		else if(_kernel_tls)
+			boost::asio::async_write(plain(*_socket), buffers, std::forward<callback_type>(callback));
+		else
+			boost::asio::async_write(*_socket, buffers, std::forward<callback_type>(callback));
+	}
 
 	void cancel_deadline() noexcept
 	{
@@ -67,6 +137,105 @@ class connector final: public connector_interface,
 			//LOGERROR(this," ", err.message());
 	}
 
+	/** \brief sizes the TLS records of the next write: small ones while the connection is new or back from idle, so
+	 * that the peer can decrypt the first bytes as soon as their segment arrives. */
+	template<typename T = socket_type,typename std::enable_if<std::is_same<T, ssl_socket>::value, int>::type = 0>
+	void size_records() noexcept
+	{
+		// the kernel sizes its own records
+		if(!_kernel_tls)
+			SSL_set_max_send_fragment(_socket->native_handle(), _records.next());
+	}
+
+	template<typename T = socket_type,typename std::enable_if<!std::is_same<T, ssl_socket>::value, int>::type = 0>
+	void size_records() noexcept {}
+
+	/** \brief sends the next chunk of the file region the handler is waiting to write, if any, with sendfile(2);
+	 * TLS encrypted in user space leaves the files to the handler, which reads them along with the rest of the output.
+	 * \returns true if a file is being sent; do_write() is called again afterwards
+	 * */
+	bool send_file() noexcept
+	{
+		if(!sends_files())
+			return false;
+		auto f = _handler->file_to_send();
+		if(!f)
+			return false;
+
+		auto& socket = plain(*_socket);
+		berror_code ec;
+		if(!socket.native_non_blocking())
+			socket.native_non_blocking(true, ec);
+
+		off_t offset = f->offset;
+		auto sent = ::sendfile(socket.native_handle(), f->fd, &offset, std::min(f->length, MAXFILEBYTESPERLOOP));
+		auto self = this->shared_from_this();
+		_writing = true;
+		if(sent > 0 || (sent < 0 && errno == EINTR))
+		{
+			if(sent > 0)
+				_handler->file_sent(static_cast<size_t>(sent));
+			// go on from the next turn, giving the other connections a chance to run
+			io_service().post([self]()
+			{
+				self->_writing = false;
+				self->do_write();
+			});
+			return true;
+		}
+
+		if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			// the socket buffer is full: wait until it drains
+			socket.async_write_some(boost::asio::null_buffers(), [self](const berror_code& ec, size_t)
+			{
+				self->cancel_deadline();
+				self->_writing = false;
+				if(!ec)
+					self->do_write();
+				else if(ec != boost::system::errc::operation_canceled)
+					self->stop();
+			});
+			return true;
+		}
+
+		// the file got shorter or the socket failed: the body can not be completed
+		LOGERROR(this, " sendfile failed: ", sent ? std::strerror(errno) : "unexpected end of file");
+		_writing = false;
+		stop();
+		return true;
+	}
+
+	/** \brief writes the block of bytes the handler is waiting to send, if any, straight from where it lies.
+	 * \returns true if a block is being sent; do_write() is called again afterwards
+	 * */
+	bool send_block()
+	{
+		auto b = _handler->block_to_send();
+		if(!b)
+			return false;
+
+		_writing = true;
+		auto self = this->shared_from_this();
+		size_records();
+		// the owner keeps the bytes alive until the write completes
+		write(boost::asio::buffer(b->data, b->size),
+			[self, owner = b->owner](const berror_code& ec, size_t s)
+			{
+				self->cancel_deadline();
+				self->_writing = false;
+				if(!ec)
+				{
+					self->_records.sent(s);
+					self->_handler->block_sent();
+					self->do_write();
+				}
+				else if(ec != boost::system::errc::operation_canceled)
+					self->stop();
+			});
+		return true;
+	}
+
 	void schedule_deadline( const interval &msec )
 	{
 		auto self = this->shared_from_this();
@@ -82,6 +251,13 @@ class connector final: public connector_interface,
 		});
 	}
 
+	/** \brief lets a connector stopped while paused go, once the caller is done with it. */
+	void unpark()
+	{
+		if(_parked)
+			io_service().post([self = std::move(_parked)]() {});
+	}
+
 public:
 
 	void close() override
@@ -93,12 +269,18 @@ public:
 		: _socket(std::move(socket))
 		, _ttl(boost::posix_time::milliseconds(0))
 		, _timer(_socket->get_io_service())
+		, _kernel_tls(offloaded(*_socket))
+		, _early(early(*_socket))
 	{
 		//LOGTRACE(this," constructor");
 	}
 
 	bool is_ssl() const noexcept override { return  std::is_same<socket_type, ssl_socket>::value; }
 
+	bool sends_files() const noexcept override { return !is_ssl() || _kernel_tls; }
+
+	bool reading_early_data() const noexcept override { return _early && _early->early(); }
+
 	~connector() noexcept
 	{
 		//LOGTRACE(this," destructor start");
@@ -119,8 +301,7 @@ public:
 
 	boost::asio::ip::address origin() const override
 	{
-		boost::asio::ip::tcp::endpoint ep = _socket->lowest_layer().remote_endpoint();
-		return ep.address();
+		return peer(plain(*_socket));
 	}
 
 	//TODO: DRM-200:this method is required by ng_h2 apis, remove it once they'll be gone
@@ -138,7 +319,7 @@ public:
 	void start( bool tcp_no_delay = false ) override
 	{
 		assert( _handler );
-		_socket->lowest_layer().set_option( boost::asio::ip::tcp::no_delay(tcp_no_delay) );
+		no_delay( plain(*_socket), tcp_no_delay );
 		if (_handler->start())
 			do_read();
 	}
@@ -152,15 +333,25 @@ public:
 			_stopped = true;
 			_timer.cancel(ec);
 
+			// OpenSSL drops the session of a connection not shut down cleanly, which HTTP clients seldom wait for:
+			// it is kept for them to resume. With kernel TLS, it is marked as shut down without going through OpenSSL
+			auto ssl = _socket->native_handle();
+			if(_kernel_tls) SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+			else
+			{
+				SSL_set_quiet_shutdown(ssl, 1);
+				SSL_shutdown(ssl);
+			}
 			_socket->lowest_layer().shutdown(boost::asio::socket_base::shutdown_both, ec);
 			_socket->lowest_layer().cancel(ec);
 			//// Shutdown - does it cause a TCP RESET?
 			_socket->lowest_layer().close();
 			_ttl = boost::posix_time::milliseconds{0};
+			unpark();
 		}
 	}
 
-	template<typename T = socket_type,typename std::enable_if<std::is_same<T, tcp_socket>::value, int>::type = 0>
+	template<typename T = socket_type,typename std::enable_if<!std::is_same<T, ssl_socket>::value, int>::type = 0>
 	void stop() noexcept
 	{
 		if(!_stopped)
@@ -174,6 +365,25 @@ public:
 			_socket->lowest_layer().cancel(ec);
 			_socket->close();
 			_ttl = boost::posix_time::milliseconds{0};
+			unpark();
+		}
+	}
+
+	void pause_read() override
+	{
+		_read_paused = true;
+	}
+
+	void resume_read() override
+	{
+		if(!_read_paused)
+			return;
+		_read_paused = false;
+		if(_read_pending)
+		{
+			_read_pending = false;
+			auto self = std::move(_parked);
+			do_read();
 		}
 	}
 
@@ -182,15 +392,25 @@ public:
 		if(_stopped)
 			return;
 
+		if(_read_paused)
+		{
+			// the read will be issued once resume_read() is called
+			_read_pending = true;
+			_parked = this->shared_from_this();
+			return;
+		}
+
 		renew_ttl();
 		//LOGTRACE(this," triggered a read");
 
 		auto self = this->shared_from_this();
 		auto buf = _rb.reserve();
-		_socket->async_read_some( boost::asio::mutable_buffers_1(buf),
-			[self](const berror_code& ec, size_t bytes_transferred)
+		auto on_read = [self](const berror_code& ec, size_t bytes_transferred)
 			{
 				self->cancel_deadline();
+				// the handshake reading early data is over: the stream reads from now on
+				if(!ec && !bytes_transferred && self->_early)
+					return self->do_read();
 				if(!ec)
 				{
 					//LOGTRACE(self.get()," received:",bytes_transferred," Bytes");
@@ -213,7 +433,11 @@ public:
 					//LOGERROR(self.get()," error during read: ", ec.message());
 					self->stop();
 				}
-			});
+			};
+		if(_early && _early->active())
+			_early->async_read_some(buf, on_read);
+		else
+			_socket->async_read_some( boost::asio::mutable_buffers_1(buf), on_read);
 	}
 
 	void do_write() override
@@ -226,11 +450,16 @@ public:
 		_out = {};
 		if ( !_handler->on_write(_out) )
 		{
+			if(send_file() || send_block())
+				return;
+
 			auto cbs = _handler->write_feedbacks();
 			for(auto &cb: cbs)
 			{
 				io_service().post(cb.first);
 			}
+			// HTTP/1 has nothing serialized either: whoever is waiting for the socket to drain can go on
+			_handler->on_drained();
 			return;
 		}
 
@@ -247,19 +476,23 @@ public:
 
 		if( _out.empty() )
 		{
+			// nothing left to send: whoever is waiting for the socket to drain can go on
+			_handler->on_drained();
 			return;
 		}
 
 		//LOGTRACE(this," triggered a write of ", _out.size(), " bytes");
 		_writing = true;
 		auto self = this->shared_from_this(); //Let the connector live inside the callback
-		boost::asio::async_write(*_socket, boost::asio::buffer(_out.data(), _out.size()),
+		size_records();
+		write(boost::asio::buffer(_out.data(), _out.size()),
 			[self, cbs = _handler->write_feedbacks()](const berror_code& ec, size_t s)
 			{
 				self->cancel_deadline();
 				self->_writing = false;
 				if(!ec)
 				{
+					self->_records.sent(s);
 					for(auto &cb: cbs)
 					{
 						self->io_service().post(cb.first);
@@ -0,0 +1,88 @@
+#include "error_pages.h"
+#include "../http/server/response.h"
+#include "../utils/json.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace errors
+{
+
+namespace
+{
+
+std::string read_all(const std::string& file)
+{
+	std::ifstream in{file, std::ios::binary};
+	if(!in) throw std::runtime_error{"cannot open " + file};
+	std::ostringstream content;
+	content << in.rdbuf();
+	return content.str();
+}
+
+const std::shared_ptr<const http::prepared_response> no_page{nullptr};
+
+}
+
+constexpr uint16_t error_pages::first_status;
+constexpr uint16_t error_pages::last_status;
+
+error_pages error_pages::from_file(const std::string& file)
+{
+	std::ifstream in{file};
+	if(!in) throw std::runtime_error{"cannot open " + file};
+
+	error_pages pages;
+	try
+	{
+		auto conf = nlohmann::json::parse(in);
+		for(const auto& entry : conf.at("error_files"))
+			for(auto it = entry.begin(); it != entry.end(); ++it)
+			{
+				std::size_t end;
+				auto status = std::stoul(it.key(), &end);
+				if(end != it.key().size()) throw std::invalid_argument{"invalid status " + it.key()};
+				pages.add(static_cast<uint16_t>(std::min<unsigned long>(status, UINT16_MAX)),
+					read_all(it.value().get<std::string>()));
+			}
+	}
+	catch(const std::exception& e)
+	{
+		throw std::runtime_error{"invalid error files configuration " + file + ": " + e.what()};
+	}
+	return pages;
+}
+
+void error_pages::add(uint16_t status, std::string html)
+{
+	if(status < first_status || status > last_status)
+		throw std::out_of_range{"no error page for status " + std::to_string(status)};
+	http::http_response preamble;
+	preamble.protocol(http::proto_version::HTTP11);
+	preamble.status(status);
+	preamble.header(http::hf_content_type, http::hv_text_html);
+	pages[status - first_status] = std::make_shared<http::prepared_response>(std::move(preamble), std::move(html));
+}
+
+const std::shared_ptr<const http::prepared_response>& error_pages::get(uint16_t status) const noexcept
+{
+	if(status < first_status || status > last_status) return no_page;
+	return pages[status - first_status];
+}
+
+bool error_pages::send(http::response& res, uint16_t status, const http::http_request& req) const
+{
+	const auto& page = get(status);
+	if(!page) return false;
+	res.send(page, req);
+	return true;
+}
+
+std::size_t error_pages::size() const noexcept
+{
+	return std::count_if(pages.begin(), pages.end(), [](const auto& p) { return bool(p); });
+}
+
+}
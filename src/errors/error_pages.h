@@ -0,0 +1,58 @@
+#ifndef DOORMAT_ERROR_PAGES_H
+#define DOORMAT_ERROR_PAGES_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "../http/http_request.h"
+#include "../http/prepared_response.h"
+
+namespace http
+{
+class response;
+}
+
+namespace errors
+{
+
+/** \brief the pages sent along with error responses, loaded once and kept serialized.
+ *
+ * Errors pile up exactly when the server is overloaded: sending one of these pages allocates nothing and
+ * copies nothing, the same message being shared by all the connections (see http::prepared_response).
+ * Only 4xx and 5xx statuses can have a page. Immutable once loaded, it can be shared among threads.
+ * */
+class error_pages
+{
+public:
+	static constexpr uint16_t first_status = 400;
+	static constexpr uint16_t last_status = 599;
+
+	/** \brief loads the pages listed in a {"error_files": [{"404": "/path/to/404.html"}, ...]} configuration file.
+	 * \throws std::runtime_error if the configuration or any of the pages can not be read
+	 * */
+	static error_pages from_file(const std::string& file);
+
+	/** \brief sets the HTML page of an error status, replacing the previous one.
+	 * \throws std::out_of_range if the status is not an error one
+	 * */
+	void add(uint16_t status, std::string html);
+
+	/** \returns the prepared response for the status, or nullptr if it has no page. */
+	const std::shared_ptr<const http::prepared_response>& get(uint16_t status) const noexcept;
+
+	/** \brief answers the request with the page of the status, if any.
+	 * \returns false if the status has no page: nothing has been sent
+	 * */
+	bool send(http::response& res, uint16_t status, const http::http_request& req) const;
+
+	std::size_t size() const noexcept;
+
+private:
+	std::array<std::shared_ptr<const http::prepared_response>, last_status - first_status + 1> pages;
+};
+
+}
+
+#endif //DOORMAT_ERROR_PAGES_H
@@ -0,0 +1,235 @@
+#include "open_file_cache.h"
+#include "../utils/log_wrapper.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace files
+{
+
+namespace
+{
+
+constexpr std::size_t event_buffer = 16 * 1024;
+
+/** Anything which can make a cached entry of the directory obsolete. */
+constexpr uint32_t watched_events = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+	| IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+std::string dirname(const std::string& path)
+{
+	auto slash = path.rfind('/');
+	if(slash == std::string::npos) return ".";
+	if(slash == 0) return "/";
+	return path.substr(0, slash);
+}
+
+std::string join(const std::string& dir, const char* name)
+{
+	return dir == "/" ? dir + name : dir + '/' + name;
+}
+
+open_file_cache::file_ptr open_regular(const std::string& path, int& error)
+{
+	int fd;
+	do
+	{
+		// non blocking: opening a FIFO must not stall the thread
+		fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	} while(fd < 0 && errno == EINTR);
+	if(fd < 0)
+	{
+		error = errno;
+		return nullptr;
+	}
+
+	struct stat st;
+	if(::fstat(fd, &st) != 0)
+	{
+		error = errno;
+		::close(fd);
+		return nullptr;
+	}
+	if(!S_ISREG(st.st_mode))
+	{
+		error = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+		::close(fd);
+		return nullptr;
+	}
+	error = 0;
+	return std::make_shared<const open_file>(fd, st);
+}
+
+}
+
+open_file::~open_file()
+{
+	::close(descriptor);
+}
+
+http::file_segment segment(const std::shared_ptr<const open_file>& file, std::uint64_t offset, std::uint64_t length)
+{
+	return http::file_segment{file, file->fd(), static_cast<off_t>(offset), static_cast<std::size_t>(length)};
+}
+
+open_file_cache::open_file_cache(boost::asio::io_service& io, std::size_t capacity)
+	: capacity{capacity}
+	, notifier{io}
+	, events{new char[event_buffer], std::default_delete<char[]>()}
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0)
+	{
+		LOGERROR("inotify is not available, files will not be cached: ", std::strerror(errno));
+		return;
+	}
+	notifier.assign(fd);
+	read_events();
+}
+
+open_file_cache::~open_file_cache()
+{
+	boost::system::error_code ec;
+	notifier.close(ec);
+}
+
+open_file_cache::file_ptr open_file_cache::open(const std::string& path, int& error)
+{
+	auto dir = dirname(path);
+	bool cacheable;
+	std::uint64_t seen{0};
+	{
+		std::lock_guard<std::mutex> lock{mtx};
+		auto it = entries.find(path);
+		if(it != entries.end())
+		{
+			lru.splice(lru.begin(), lru, it->second.position);
+			error = it->second.error;
+			return it->second.file;
+		}
+		// the directory is watched before the file is opened, so that no change can go unnoticed
+		cacheable = watching() && watch(dir);
+		if(cacheable) seen = directories[dir].generation;
+	}
+
+	auto file = open_regular(path, error);
+	if(!cacheable) return file;
+
+	std::lock_guard<std::mutex> lock{mtx};
+	auto d = directories.find(dir);
+	if(d == directories.end()) return file;
+	if(!watching() || d->second.generation != seen || entries.count(path))
+	{
+		release(dir);
+		return file;
+	}
+	lru.push_front(path);
+	entries.emplace(path, entry{file, error, lru.begin()});
+	while(entries.size() > capacity)
+		erase(entries.find(lru.back()));
+	return file;
+}
+
+std::size_t open_file_cache::size() const
+{
+	std::lock_guard<std::mutex> lock{mtx};
+	return entries.size();
+}
+
+void open_file_cache::read_events()
+{
+	std::weak_ptr<char> alive = events;
+	notifier.async_read_some(boost::asio::buffer(events.get(), event_buffer),
+		[this, alive](const boost::system::error_code& ec, std::size_t size)
+		{
+			if(ec == boost::asio::error::operation_aborted || alive.expired()) return;
+
+			std::lock_guard<std::mutex> lock{mtx};
+			if(ec)
+			{
+				LOGERROR("cannot read inotify events, files will not be cached anymore: ", ec.message());
+				boost::system::error_code ignored;
+				notifier.close(ignored);
+				while(!entries.empty())
+					erase(entries.begin());
+				return;
+			}
+
+			for(std::size_t i = 0; i + sizeof(inotify_event) <= size;)
+			{
+				auto ev = reinterpret_cast<const inotify_event*>(events.get() + i);
+				i += sizeof(inotify_event) + ev->len;
+				if(ev->mask & IN_Q_OVERFLOW)
+				{
+					// some changes are lost: nothing can be trusted
+					while(!entries.empty())
+						erase(entries.begin());
+					continue;
+				}
+
+				auto w = watches.find(ev->wd);
+				if(w == watches.end()) continue;
+				auto dir = w->second;
+				++directories[dir].generation;
+				if(ev->len) invalidate(join(dir, ev->name));
+				else if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) invalidate_directory(dir);
+			}
+			read_events();
+		});
+}
+
+void open_file_cache::invalidate(const std::string& path)
+{
+	auto it = entries.find(path);
+	if(it != entries.end()) erase(it);
+}
+
+void open_file_cache::invalidate_directory(const std::string& dir)
+{
+	for(auto it = entries.begin(); it != entries.end();)
+	{
+		auto next = std::next(it);
+		if(dirname(it->first) == dir) erase(it);
+		it = next;
+	}
+}
+
+void open_file_cache::erase(std::unordered_map<std::string, entry>::iterator it)
+{
+	release(dirname(it->first));
+	lru.erase(it->second.position);
+	entries.erase(it);
+}
+
+bool open_file_cache::watch(const std::string& dir)
+{
+	auto d = directories.find(dir);
+	if(d != directories.end())
+	{
+		++d->second.users;
+		return true;
+	}
+
+	int wd = inotify_add_watch(notifier.native_handle(), dir.c_str(), watched_events);
+	if(wd < 0) return false;
+	// the same directory reached through another name: its events could not be told apart
+	auto w = watches.find(wd);
+	if(w != watches.end() && w->second != dir) return false;
+	watches[wd] = dir;
+	directories.emplace(dir, directory{wd, 1, 0});
+	return true;
+}
+
+void open_file_cache::release(const std::string& dir)
+{
+	auto d = directories.find(dir);
+	if(d == directories.end() || --d->second.users) return;
+	if(watching()) inotify_rm_watch(notifier.native_handle(), d->second.wd);
+	watches.erase(d->second.wd);
+	directories.erase(d);
+}
+
+}
@@ -0,0 +1,112 @@
+#ifndef DOORMAT_FILES_OPEN_FILE_CACHE_H
+#define DOORMAT_FILES_OPEN_FILE_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include "../http/file_segment.h"
+
+namespace files
+{
+
+/** \brief a regular file opened for reading, along with its metadata at the time it was opened.
+ * The descriptor is closed when the last reference goes away.
+ * */
+class open_file
+{
+public:
+	open_file(int fd, const struct stat& st) noexcept : descriptor{fd}, st(st) {}
+	open_file(const open_file&) = delete;
+	open_file& operator=(const open_file&) = delete;
+	~open_file();
+
+	int fd() const noexcept { return descriptor; }
+	const struct stat& stat() const noexcept { return st; }
+	std::uint64_t size() const noexcept { return static_cast<std::uint64_t>(st.st_size); }
+
+private:
+	int descriptor;
+	struct stat st;
+};
+
+/** \returns a region of the file, which keeps it open until it has been sent. */
+http::file_segment segment(const std::shared_ptr<const open_file>& file, std::uint64_t offset, std::uint64_t length);
+
+/** \brief keeps recently served files open, so that serving them again costs no open(2) nor stat(2).
+ *
+ * Missing files are remembered as well. The directories holding the cached paths are watched with inotify, and
+ * any change to one of their entries (a write, a rename over it, a deletion, a creation) drops the entry on the
+ * io_service the cache was created with; stale data can be served only in the meanwhile. When inotify is not
+ * available nothing is cached. Bounded in entries, evicted in LRU order; thread safe.
+ * The cache must be destroyed from the thread running its io_service, or once the io_service is stopped.
+ * */
+class open_file_cache
+{
+public:
+	using file_ptr = std::shared_ptr<const open_file>;
+
+	explicit open_file_cache(boost::asio::io_service& io, std::size_t capacity = 1024);
+	open_file_cache(const open_file_cache&) = delete;
+	open_file_cache& operator=(const open_file_cache&) = delete;
+	~open_file_cache();
+
+	/** \brief opens a regular file for reading.
+	 * \param error set to the errno value describing why the file can not be served, 0 on success
+	 * \returns the file, or nullptr
+	 * */
+	file_ptr open(const std::string& path, int& error);
+
+	/** \returns the number of entries, missing files included */
+	std::size_t size() const;
+	/** \returns true if changes to the files are being tracked, and hence they are cached */
+	bool watching() const noexcept { return notifier.is_open(); }
+
+private:
+	struct entry
+	{
+		file_ptr file;
+		int error;
+		std::list<std::string>::iterator position;
+	};
+
+	struct directory
+	{
+		int wd;
+		/** Entries in the directory, and lookups about to add one */
+		std::size_t users;
+		/** Bumped on every change, so that a file changed while it was being opened is not cached */
+		std::uint64_t generation;
+	};
+
+	void read_events();
+	void invalidate(const std::string& path);
+	void invalidate_directory(const std::string& dir);
+	void erase(std::unordered_map<std::string, entry>::iterator it);
+	/** \brief starts watching the directory, or adds a user to its watch.
+	 * \returns false if the directory can not be watched
+	 * */
+	bool watch(const std::string& dir);
+	void release(const std::string& dir);
+
+	std::size_t capacity;
+	mutable std::mutex mtx;
+	std::list<std::string> lru;
+	std::unordered_map<std::string, entry> entries;
+	std::unordered_map<std::string, directory> directories;
+	std::unordered_map<int, std::string> watches;
+
+	boost::asio::posix::stream_descriptor notifier;
+	/** Buffer for inotify events; pending reads check it is still alive before touching the cache */
+	std::shared_ptr<char> events;
+};
+
+}
+
+#endif //DOORMAT_FILES_OPEN_FILE_CACHE_H
@@ -0,0 +1,368 @@
+#include "static_files.h"
+#include "../cache/cache_control.h"
+#include "../errors/error_pages.h"
+#include "../http/compression.h"
+#include "../http/server/request.h"
+#include "../http/server/response.h"
+#include "../http/server/server_connection.h"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <limits>
+#include <random>
+
+namespace files
+{
+
+namespace
+{
+
+std::string trim(const std::string& s)
+{
+	auto begin = s.find_first_not_of(" \t");
+	if(begin == std::string::npos) return {};
+	auto end = s.find_last_not_of(" \t");
+	return s.substr(begin, end - begin + 1);
+}
+
+/** \brief parses a non-empty string of digits, saturating on overflow. */
+bool parse_position(const std::string& s, std::uint64_t& value)
+{
+	if(s.empty()) return false;
+	value = 0;
+	for(auto c : s)
+	{
+		if(c < '0' || c > '9') return false;
+		std::uint64_t digit = c - '0';
+		if(value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+			value = std::numeric_limits<std::uint64_t>::max();
+		else
+			value = value * 10 + digit;
+	}
+	return true;
+}
+
+int hex_value(char c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/** \brief percent-decodes the request path and resolves its "." and ".." segments.
+ * \returns false if the path is not valid or climbs above the root
+ * */
+bool normalize(const std::string& raw, std::string& path)
+{
+	std::string decoded;
+	decoded.reserve(raw.size());
+	for(std::size_t i = 0; i < raw.size(); ++i)
+	{
+		if(raw[i] != '%')
+		{
+			decoded.push_back(raw[i]);
+			continue;
+		}
+		if(i + 2 >= raw.size()) return false;
+		auto high = hex_value(raw[i + 1]), low = hex_value(raw[i + 2]);
+		if(high < 0 || low < 0) return false;
+		decoded.push_back(static_cast<char>(high * 16 + low));
+		i += 2;
+	}
+	if(decoded.empty() || decoded[0] != '/' || decoded.find('\0') != std::string::npos) return false;
+
+	std::vector<std::string> segments;
+	std::size_t begin = 1;
+	while(begin <= decoded.size())
+	{
+		auto end = decoded.find('/', begin);
+		if(end == std::string::npos) end = decoded.size();
+		auto segment = decoded.substr(begin, end - begin);
+		begin = end + 1;
+		if(segment.empty() || segment == ".") continue;
+		if(segment == "..")
+		{
+			if(segments.empty()) return false;
+			segments.pop_back();
+		}
+		else segments.push_back(std::move(segment));
+	}
+
+	path.clear();
+	for(const auto& s : segments)
+		path.append(http::slash).append(s);
+	if(path.empty() || decoded.back() == '/') path.append(http::slash);
+	return true;
+}
+
+http::http_response preamble(const http::http_request& req, uint16_t status)
+{
+	http::http_response r;
+	r.protocol(req.protocol_version());
+	r.status(status);
+	if(req.channel() != http::proto_version::HTTP20)
+		r.keepalive(req.keepalive());
+	return r;
+}
+
+bool respond(http::response& res, http::http_response r)
+{
+	r.content_len(0);
+	res.headers(std::move(r));
+	res.end();
+	return true;
+}
+
+void send(http::response& res, const std::string& data)
+{
+	auto d = std::make_unique<char[]>(data.size());
+	std::copy(data.begin(), data.end(), d.get());
+	res.body(http::response::data_t{std::move(d)}, data.size());
+}
+
+/** \brief tells whether the ranges can be served, given the If-Range header of the request (RFC 7233, 3.2) */
+bool if_range_matches(const http::http_request& req, const std::string& etag, const std::string& last_modified)
+{
+	if(!req.has("if-range")) return true;
+	auto value = trim(req.header("if-range"));
+	// a weak entity tag never matches
+	if(!value.empty() && (value[0] == '"' || value.compare(0, 2, "W/") == 0)) return value == etag;
+	cache::clock::time_point date, modified;
+	return cache::parse_http_date(value, date) && cache::parse_http_date(last_modified, modified) && date == modified;
+}
+
+std::string content_range(const byte_range& r, std::uint64_t size)
+{
+	return "bytes " + std::to_string(r.first) + '-' + std::to_string(r.last) + '/' + std::to_string(size);
+}
+
+}
+
+range_status parse_range(const std::string& value, std::uint64_t size, std::vector<byte_range>& ranges,
+	std::size_t max_ranges)
+{
+	ranges.clear();
+	auto v = trim(value);
+	static const std::string unit{"bytes="};
+	if(v.size() <= unit.size() || !utils::icompare(v.substr(0, unit.size()), unit)) return range_status::ignored;
+
+	bool specified{false};
+	std::size_t begin = unit.size();
+	while(begin < v.size())
+	{
+		auto end = v.find(',', begin);
+		if(end == std::string::npos) end = v.size();
+		auto spec = trim(v.substr(begin, end - begin));
+		begin = end + 1;
+		// empty list elements are allowed
+		if(spec.empty()) continue;
+
+		auto dash = spec.find('-');
+		if(dash == std::string::npos) return range_status::ignored;
+		auto first_pos = spec.substr(0, dash), last_pos = spec.substr(dash + 1);
+		specified = true;
+
+		std::uint64_t first, last;
+		if(first_pos.empty())
+		{
+			// suffix: the final bytes
+			if(!parse_position(last_pos, last)) return range_status::ignored;
+			if(last == 0 || size == 0) continue;
+			ranges.push_back(byte_range{size - std::min(last, size), size - 1});
+			continue;
+		}
+
+		if(!parse_position(first_pos, first)) return range_status::ignored;
+		if(last_pos.empty()) last = std::numeric_limits<std::uint64_t>::max();
+		else if(!parse_position(last_pos, last) || last < first) return range_status::ignored;
+		if(first >= size) continue;
+		ranges.push_back(byte_range{first, std::min(last, size - 1)});
+	}
+
+	if(!specified) return range_status::ignored;
+	if(ranges.empty()) return range_status::unsatisfiable;
+
+	std::sort(ranges.begin(), ranges.end(), [](const byte_range& a, const byte_range& b) { return a.first < b.first; });
+	std::size_t last = 0;
+	for(std::size_t i = 1; i < ranges.size(); ++i)
+	{
+		if(ranges[i].first <= ranges[last].last + 1)
+			ranges[last].last = std::max(ranges[last].last, ranges[i].last);
+		else
+			ranges[++last] = ranges[i];
+	}
+	ranges.resize(last + 1);
+
+	if(ranges.size() > max_ranges)
+	{
+		ranges.clear();
+		return range_status::ignored;
+	}
+	return range_status::satisfiable;
+}
+
+std::string strong_etag(const struct stat& st)
+{
+	std::uint64_t mtime = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	return '"' + utils::from<std::uint64_t>(st.st_size) + '-' + utils::from<std::uint64_t>(mtime) + '-'
+		+ utils::from<std::uint64_t>(st.st_ino) + '"';
+}
+
+static_files::static_files(boost::asio::io_service& io, settings s)
+	: state{std::make_shared<shared_state>()}
+{
+	std::random_device rd;
+	state->boundary = "doormat" + utils::from<std::uint64_t>((std::uint64_t{rd()} << 32) | rd());
+	state->files = std::make_unique<open_file_cache>(io, s.open_files);
+	// paths are appended to the root, which hence must not end with a slash
+	while(!s.root.empty() && s.root.back() == '/') s.root.pop_back();
+	state->conf = std::move(s);
+}
+
+void static_files::operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+	std::shared_ptr<http::response> res) const
+{
+	std::weak_ptr<http::server_connection> connection = conn;
+	req->on_headers([self = *this, connection, res](std::shared_ptr<http::request> req)
+	{
+		if(self.serve(req->preamble(), *res)) return;
+		if(auto c = connection.lock()) c->close();
+	});
+}
+
+void static_files::attach(const std::shared_ptr<http::server_connection>& conn) const
+{
+	conn->on_request(*this);
+}
+
+bool static_files::serve(const http::http_request& req, http::response& res) const
+{
+	const auto& conf = state->conf;
+	auto method = req.method_code();
+	if(method != HTTP_GET && method != HTTP_HEAD)
+	{
+		auto r = preamble(req, 405);
+		r.header(http::hf_allow, "GET, HEAD");
+		return respond(res, std::move(r));
+	}
+
+	auto fail = [&conf, &req, &res](uint16_t status)
+	{
+		if(conf.error_pages && conf.error_pages->send(res, status, req)) return true;
+		return respond(res, preamble(req, status));
+	};
+
+	std::string path;
+	if(!normalize(req.path(), path)) return fail(400);
+	if(path.back() == '/') path += conf.index;
+
+	int error;
+	auto full = conf.root + path;
+	auto file = state->files->open(full, error);
+	if(!file)
+	{
+		if(error == EISDIR)
+		{
+			auto r = preamble(req, 301);
+			r.header("location", req.path() + http::slash + (req.query().empty() ? "" : http::questionmark + req.query()));
+			return respond(res, std::move(r));
+		}
+		uint16_t status = error == ENOENT || error == ENOTDIR || error == ENAMETOOLONG ? 404 : error == EACCES ? 403 : 500;
+		return fail(status);
+	}
+
+	auto r = preamble(req, 200);
+	r.header(http::hf_content_type, http::content_type(http::content_type(path)));
+	if(!conf.cache_control.empty()) r.header("cache-control", conf.cache_control);
+	if(conf.gzip_siblings)
+	{
+		int ignored;
+		if(auto gz = state->files->open(full + ".gz", ignored))
+		{
+			// the representation depends on the client either way
+			r.header("vary", "Accept-Encoding");
+			if(http::negotiate_encoding(req.header(http::hf_accept_encoding)) == http::tranfer_encoding::gzip)
+			{
+				file = std::move(gz);
+				r.header(http::hf_content_encoding, http::hv_gzip);
+			}
+		}
+	}
+
+	auto etag = strong_etag(file->stat());
+	auto last_modified = cache::format_http_date(cache::clock::from_time_t(file->stat().st_mtime));
+	r.header("etag", etag);
+	r.header("last-modified", last_modified);
+	r.header("accept-ranges", "bytes");
+
+	if(cache::not_modified(req, r))
+	{
+		r.status(304);
+		r.remove_header(http::hf_content_type);
+		r.remove_header(http::hf_content_encoding);
+		r.remove_header("accept-ranges");
+		return respond(res, std::move(r));
+	}
+
+	auto size = file->size();
+	std::vector<byte_range> ranges;
+	auto ranged = range_status::ignored;
+	if(method == HTTP_GET && req.has("range") && if_range_matches(req, etag, last_modified))
+		ranged = parse_range(req.header("range"), size, ranges, conf.max_ranges);
+
+	if(ranged == range_status::unsatisfiable)
+	{
+		r.status(416);
+		r.header("content-range", "bytes */" + std::to_string(size));
+		return respond(res, std::move(r));
+	}
+
+	if(ranged == range_status::ignored)
+	{
+		r.content_len(size);
+		res.headers(std::move(r));
+		if(method == HTTP_GET && size && !res.file(segment(file, 0, size))) return false;
+		res.end();
+		return true;
+	}
+
+	r.status(206);
+	if(ranges.size() == 1)
+	{
+		r.header("content-range", content_range(ranges[0], size));
+		r.content_len(ranges[0].length());
+		res.headers(std::move(r));
+		if(!res.file(segment(file, ranges[0].first, ranges[0].length()))) return false;
+		res.end();
+		return true;
+	}
+
+	// multipart/byteranges (RFC 7233, 4.1): the length is known in advance, nothing has to be chunked
+	auto type = r.header(http::hf_content_type);
+	r.remove_header(http::hf_content_type);
+	r.header(http::hf_content_type, "multipart/byteranges; boundary=" + state->boundary);
+	std::vector<std::string> parts;
+	std::uint64_t length = 0;
+	for(const auto& range : ranges)
+	{
+		parts.emplace_back(std::string{http::crlf} + "--" + state->boundary + http::crlf
+			+ http::hf_content_type + http::colon_space + type + http::crlf
+			+ "content-range" + http::colon_space + content_range(range, size) + http::crlf + http::crlf);
+		length += parts.back().size() + range.length();
+	}
+	auto closing = std::string{http::crlf} + "--" + state->boundary + "--" + http::crlf;
+	r.content_len(length + closing.size());
+	res.headers(std::move(r));
+	for(std::size_t i = 0; i < ranges.size(); ++i)
+	{
+		send(res, parts[i]);
+		if(!res.file(segment(file, ranges[i].first, ranges[i].length()))) return false;
+	}
+	send(res, closing);
+	res.end();
+	return true;
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef DOORMAT_FILES_STATIC_FILES_H
+#define DOORMAT_FILES_STATIC_FILES_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "open_file_cache.h"
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+
+namespace http
+{
+class request;
+class response;
+class server_connection;
+}
+
+namespace errors
+{
+class error_pages;
+}
+
+namespace files
+{
+
+/** \brief an inclusive interval of byte positions (RFC 7233, 2.1). */
+struct byte_range
+{
+	std::uint64_t first;
+	std::uint64_t last;
+
+	std::uint64_t length() const noexcept { return last - first + 1; }
+};
+
+enum class range_status
+{
+	/** No valid byte range set: the whole representation is to be sent */
+	ignored,
+	satisfiable,
+	/** 416 */
+	unsatisfiable
+};
+
+/** \brief parses a Range header value against a representation of the given size.
+ * Ranges are sorted and the overlapping or adjacent ones coalesced; sets with more than max_ranges ranges left
+ * are ignored, since they are more likely an attack than a legitimate request.
+ * \param ranges filled with the ranges to be sent when they are satisfiable
+ * */
+range_status parse_range(const std::string& value, std::uint64_t size, std::vector<byte_range>& ranges,
+	std::size_t max_ranges = 16);
+
+/** \returns a strong entity tag for the file, changing whenever it is replaced or modified. */
+std::string strong_etag(const struct stat& st);
+
+/** \brief serves the files under a directory, as http::server_connection request callback.
+ *
+ * Only GET and HEAD are allowed. Files are kept open by an open_file_cache and sent straight from the page cache
+ * on plaintext HTTP/1.x connections. Responses carry a strong ETag and Last-Modified, and conditional requests
+ * are answered with 304; single and multiple byte ranges are served, the latter as multipart/byteranges.
+ * When a client accepts gzip and the file has a precompressed ".gz" sibling, the sibling is sent instead.
+ * */
+class static_files
+{
+public:
+	struct settings
+	{
+		/** Directory the request paths are resolved against. */
+		std::string root;
+		/** File served for the paths ending with a slash. */
+		std::string index{"index.html"};
+		/** Value of the Cache-Control header of the responses; none if empty. */
+		std::string cache_control;
+		/** Serve path.gz, when present, to the clients accepting gzip. */
+		bool gzip_siblings{true};
+		std::size_t max_ranges{16};
+		/** Files (found or missing) kept in the open_file_cache. */
+		std::size_t open_files{1024};
+		/** Pages sent along with the 400, 403, 404 and 500 responses; none if missing. */
+		std::shared_ptr<const errors::error_pages> error_pages;
+	};
+
+	/** \param io the io_service on which the open file cache tracks changes to the files */
+	static_files(boost::asio::io_service& io, settings s);
+
+	void operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+		std::shared_ptr<http::response> res) const;
+
+	/** \brief answers a request.
+	 * \returns false if the file could not be read while sending it: the connection has to be closed
+	 * */
+	bool serve(const http::http_request& req, http::response& res) const;
+
+	/** \brief serves every request received on the connection. */
+	void attach(const std::shared_ptr<http::server_connection>& conn) const;
+
+	const open_file_cache& cache() const noexcept { return *state->files; }
+
+private:
+	struct shared_state
+	{
+		settings conf;
+		std::string boundary;
+		std::unique_ptr<open_file_cache> files;
+	};
+
+	std::shared_ptr<shared_state> state;
+};
+
+}
+
+#endif //DOORMAT_FILES_STATIC_FILES_H
@@ -0,0 +1,66 @@
+#include "filter_chain.h"
+
+#include <chrono>
+
+namespace filters
+{
+
+verdict dynamic_chain::on_request(http::http_request& req, http::response& res)
+{
+	for(auto& f : filters)
+		if(f->on_request(req, res) == verdict::answered) return verdict::answered;
+	return verdict::proceed;
+}
+
+void dynamic_chain::on_response(const http::http_request& req, http::http_response& res)
+{
+	for(auto f = filters.rbegin(); f != filters.rend(); ++f)
+		(*f)->on_response(req, res);
+}
+
+void response_headers::add(std::string name, std::string value)
+{
+	headers.emplace_back(std::move(name), std::move(value));
+}
+
+void response_headers::on_response(const http::http_request&, http::http_response& res)
+{
+	for(const auto& h : headers)
+		if(!res.has(h.first)) res.header(h.first, h.second);
+}
+
+compression::compression(std::shared_ptr<const http::compression_policy> policy)
+	: policy{std::move(policy)}
+{}
+
+verdict compression::on_request(http::http_request& req, http::response& res)
+{
+	res.compress(policy, req);
+	return verdict::proceed;
+}
+
+rate_limit::rate_limit(std::shared_ptr<network::rate_limiter> limiter, std::string header,
+	std::shared_ptr<const http::prepared_response> answer)
+	: limiter{std::move(limiter)}, header{std::move(header)}, answer{std::move(answer)}
+{
+	if(this->answer) return;
+	http::http_response preamble;
+	preamble.status(429);
+	preamble.header(http::hf_content_type, http::hv_text_plain);
+	// a client waiting this long finds a token: the time of one, rounded up to seconds
+	auto wait = std::chrono::duration_cast<std::chrono::seconds>(this->limiter->interval() +
+		std::chrono::seconds{1} - std::chrono::nanoseconds{1});
+	preamble.header("retry-after", std::to_string(wait.count()));
+	this->answer = std::make_shared<const http::prepared_response>(std::move(preamble), "Too Many Requests\n");
+}
+
+verdict rate_limit::on_request(http::http_request& req, http::response& res)
+{
+	auto allowed = !header.empty() && req.has(header) ? limiter->acquire(req.header(header)) :
+		limiter->acquire(req.origin());
+	if(allowed) return verdict::proceed;
+	res.send(answer, req);
+	return verdict::answered;
+}
+
+}
@@ -0,0 +1,234 @@
+#ifndef DOORMAT_FILTERS_FILTER_CHAIN_H
+#define DOORMAT_FILTERS_FILTER_CHAIN_H
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+#include "../http/compression.h"
+#include "../http/server/request.h"
+#include "../http/server/response.h"
+#include "../http/server/server_connection.h"
+#include "../network/rate_limiter.h"
+
+namespace filters
+{
+
+/** \brief what a filter makes of a request. */
+enum class verdict
+{
+	/** Hand the request to the next filter, and eventually to the handler. */
+	proceed,
+	/** The filter answered the request through the response: nothing else sees it. */
+	answered
+};
+
+/** \brief the events of the server request path a filter can hook, all doing nothing: filters derive from it and
+ * hide the ones they care about. Chains call them by name, hence they are not virtual.
+ * */
+struct filter
+{
+	/** \brief called once the headers of a request have been received; the preamble can be changed.
+	 * \param res to answer the request, or to set up the response (e.g. to compress it)
+	 * */
+	verdict on_request(http::http_request&, http::response&) { return verdict::proceed; }
+
+	/** \brief called with the preamble of the response to a request, before it is sent; that includes the responses
+	 * given by filters. */
+	void on_response(const http::http_request&, http::http_response&) {}
+};
+
+/** \brief filters composed at compile time: each event is a sequence of direct calls the compiler can inline
+ * into one function, with no indirection nor copy between a filter and the next.
+ *
+ * Requests go through the filters in order; responses go through them backwards, so that the first filter sees
+ * the request first and the response last. A chain is a filter itself, and can be nested in other chains.
+ * */
+template<typename... filters_t>
+class chain : public filter
+{
+	/** Tells copies and moves from the construction out of filters. */
+	template<typename... args_t>
+	struct is_chain : std::false_type {};
+	template<typename arg_t>
+	struct is_chain<arg_t> : std::is_same<std::decay_t<arg_t>, chain> {};
+
+public:
+	chain() = default;
+
+	template<typename... args_t, typename = std::enable_if_t<sizeof...(args_t) == sizeof...(filters_t)
+		&& sizeof...(args_t) != 0 && !is_chain<args_t...>::value>>
+	explicit chain(args_t&&... f)
+		: filters{std::forward<args_t>(f)...}
+	{}
+
+	verdict on_request(http::http_request& req, http::response& res)
+	{
+		return request<0>(req, res);
+	}
+
+	void on_response(const http::http_request& req, http::http_response& res)
+	{
+		response<sizeof...(filters_t)>(req, res);
+	}
+
+	template<std::size_t i>
+	auto& get() noexcept { return std::get<i>(filters); }
+
+private:
+	template<std::size_t i>
+	std::enable_if_t<(i < sizeof...(filters_t)), verdict> request(http::http_request& req, http::response& res)
+	{
+		if(std::get<i>(filters).on_request(req, res) == verdict::answered) return verdict::answered;
+		return request<i + 1>(req, res);
+	}
+
+	template<std::size_t i>
+	std::enable_if_t<(i == sizeof...(filters_t)), verdict> request(http::http_request&, http::response&)
+	{
+		return verdict::proceed;
+	}
+
+	template<std::size_t i>
+	std::enable_if_t<(i > 0)> response(const http::http_request& req, http::http_response& res)
+	{
+		std::get<i - 1>(filters).on_response(req, res);
+		response<i - 1>(req, res);
+	}
+
+	template<std::size_t i>
+	std::enable_if_t<(i == 0)> response(const http::http_request&, http::http_response&) {}
+
+	std::tuple<filters_t...> filters;
+};
+
+template<typename... filters_t>
+chain<std::decay_t<filters_t>...> make_chain(filters_t&&... f)
+{
+	return chain<std::decay_t<filters_t>...>{std::forward<filters_t>(f)...};
+}
+
+/** \brief filters chosen at run time, e.g. from the configuration: each of them costs a virtual call per event.
+ * Filters known together at compile time are better added as one static chain.
+ * */
+class dynamic_chain : public filter
+{
+public:
+	template<typename filter_t>
+	void add(filter_t&& f)
+	{
+		filters.push_back(std::make_unique<model<std::decay_t<filter_t>>>(std::forward<filter_t>(f)));
+	}
+
+	verdict on_request(http::http_request& req, http::response& res);
+	void on_response(const http::http_request& req, http::http_response& res);
+
+	std::size_t size() const noexcept { return filters.size(); }
+
+private:
+	struct erased
+	{
+		virtual ~erased() = default;
+		virtual verdict on_request(http::http_request& req, http::response& res) = 0;
+		virtual void on_response(const http::http_request& req, http::http_response& res) = 0;
+	};
+
+	template<typename filter_t>
+	struct model final : erased
+	{
+		template<typename arg_t>
+		explicit model(arg_t&& f) : f{std::forward<arg_t>(f)} {}
+
+		verdict on_request(http::http_request& req, http::response& res) override { return f.on_request(req, res); }
+		void on_response(const http::http_request& req, http::http_response& res) override { f.on_response(req, res); }
+
+		filter_t f;
+	};
+
+	std::vector<std::unique_ptr<erased>> filters;
+};
+
+/** \brief adds headers to every response, e.g. security policies; the headers the response has already are left
+ * alone.
+ * */
+class response_headers : public filter
+{
+public:
+	void add(std::string name, std::string value);
+	void on_response(const http::http_request& req, http::http_response& res);
+
+private:
+	std::vector<std::pair<std::string, std::string>> headers;
+};
+
+/** \brief compresses the responses the policy allows, for the clients accepting it. */
+class compression : public filter
+{
+public:
+	explicit compression(std::shared_ptr<const http::compression_policy> policy);
+	verdict on_request(http::http_request& req, http::response& res);
+
+private:
+	std::shared_ptr<const http::compression_policy> policy;
+};
+
+/** \brief answers with a 429 the requests of the clients over their rate, told apart by their address or by the
+ * value of a header (e.g. an API key). The limiter can be shared with other filters, so that they draw from the same
+ * buckets; limiting connections at accept time takes another one, see http_server::set_connection_limiter.
+ * */
+class rate_limit : public filter
+{
+public:
+	/** \param header the header telling clients apart; the requests without it go by address, as all do if empty
+	 * \param answer the response to the requests kept out; a bare 429 if null
+	 * */
+	explicit rate_limit(std::shared_ptr<network::rate_limiter> limiter, std::string header = {},
+		std::shared_ptr<const http::prepared_response> answer = nullptr);
+	verdict on_request(http::http_request& req, http::response& res);
+
+private:
+	std::shared_ptr<network::rate_limiter> limiter;
+	std::string header;
+	std::shared_ptr<const http::prepared_response> answer;
+};
+
+/** \brief makes a request callback running the requests through the chain, and then handing them to the handler.
+ *
+ * The handler is called once the headers have been received, as routing::router::route expects: the preamble is
+ * there and the other events of the request can be subscribed. Every response to a request that got there goes
+ * through on_response, prepared ones and those a filter answers with included; what the connection sends on its
+ * own (e.g. to shed load) does not. The response does not keep the request alive: handlers hold it until they
+ * answer. The chain is shared by all the requests, hence its filters keep no state about a single request, and
+ * must bear concurrent calls if the callback is used by several threads.
+ * */
+template<typename chain_t, typename handler_t>
+http::server_connection::request_callback filtered(std::shared_ptr<chain_t> chain, handler_t handler)
+{
+	return [chain = std::move(chain), handler = std::move(handler)](std::shared_ptr<http::server_connection> conn,
+		std::shared_ptr<http::request> req, std::shared_ptr<http::response> res)
+	{
+		std::weak_ptr<http::server_connection> connection = conn;
+		req->on_headers([chain, handler, connection, res](std::shared_ptr<http::request> req)
+		{
+			auto conn = connection.lock();
+			if(!conn) return;
+			// the request holds this callback, hence the response
+			std::weak_ptr<http::request> request = req;
+			res->filter_headers([chain, request](http::http_response& preamble)
+			{
+				if(auto req = request.lock()) chain->on_response(req->preamble(), preamble);
+			});
+			if(chain->on_request(req->preamble(), *res) == verdict::answered) return;
+			handler(std::move(conn), std::move(req), res);
+		});
+	};
+}
+
+}
+
+#endif //DOORMAT_FILTERS_FILTER_CHAIN_H
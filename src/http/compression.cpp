@@ -0,0 +1,317 @@
+#include "compression.h"
+#include "../utils/json.hpp"
+#include "../utils/log_wrapper.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+namespace http
+{
+
+namespace
+{
+
+/** zlib streams kept by a thread, waiting to be reused; one list per (coding, level) pair. */
+struct stream_pool
+{
+	static constexpr std::size_t max_idle = 8;
+
+	~stream_pool()
+	{
+		for(auto& l : idle)
+			for(auto s : l.second)
+			{
+				deflateEnd(s);
+				delete s;
+			}
+	}
+
+	z_stream* acquire(int key, tranfer_encoding e, int level)
+	{
+		auto& l = idle[key];
+		if(!l.empty())
+		{
+			auto s = l.back();
+			l.pop_back();
+			return s;
+		}
+
+		auto s = new z_stream{};
+		// 16 + 15: gzip wrapper around a 32KB window; deflate is the zlib format (RFC 7230, 4.2.2)
+		int window_bits = e == tranfer_encoding::gzip ? 16 + MAX_WBITS : MAX_WBITS;
+		if(deflateInit2(s, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			delete s;
+			throw std::runtime_error{"cannot initialize zlib"};
+		}
+		return s;
+	}
+
+	void release(int key, z_stream* s)
+	{
+		auto& l = idle[key];
+		if(l.size() >= max_idle || deflateReset(s) != Z_OK)
+		{
+			deflateEnd(s);
+			delete s;
+			return;
+		}
+		l.push_back(s);
+	}
+
+	std::unordered_map<int, std::vector<z_stream*>> idle;
+};
+
+constexpr std::size_t stream_pool::max_idle;
+
+thread_local stream_pool streams;
+
+int pool_key(tranfer_encoding e, int level) noexcept
+{
+	return static_cast<int>(e) * 16 + level;
+}
+
+std::string trim_lower(const std::string& s)
+{
+	auto begin = s.find_first_not_of(" \t");
+	if(begin == std::string::npos) return {};
+	auto end = s.find_last_not_of(" \t");
+	auto out = s.substr(begin, end - begin + 1);
+	std::transform(out.begin(), out.end(), out.begin(), ::tolower);
+	return out;
+}
+
+}
+
+compression_policy compression_policy::from_file(const std::string& file)
+{
+	std::ifstream in{file};
+	if(!in) throw std::runtime_error{"cannot open " + file};
+
+	compression_policy p;
+	std::string line;
+	try
+	{
+		while(std::getline(in, line))
+		{
+			if(line.find("\"gzip\"") == std::string::npos) continue;
+			auto conf = nlohmann::json::parse(line).at("gzip");
+			if(conf.count("compression_level")) p.level = conf["compression_level"].get<int>();
+			if(conf.count("compression_min_size")) p.min_size = conf["compression_min_size"].get<std::size_t>();
+			if(conf.count("compression_mime_types"))
+				p.mime_types = conf["compression_mime_types"].get<std::vector<std::string>>();
+		}
+	}
+	catch(const std::exception& e)
+	{
+		throw std::runtime_error{"invalid gzip section in " + file + ": " + e.what()};
+	}
+	if(p.level < Z_BEST_SPEED || p.level > Z_BEST_COMPRESSION)
+		throw std::runtime_error{"invalid compression level in " + file};
+	return p;
+}
+
+bool compression_policy::compressible(const http_response& res) const
+{
+	auto status = res.status_code();
+	if(status < 200 || status == 204 || status == 206 || status == 304) return false;
+	if(res.has(hf_content_encoding)) return false;
+	if(!res.chunked() && res.content_len() < min_size) return false;
+	if(res.has("cache-control", [](const std::string& v) { return v.find("no-transform") != std::string::npos; }))
+		return false;
+
+	auto type = trim_lower(res.header(hf_content_type).substr(0, res.header(hf_content_type).find(';')));
+	if(type.empty()) return false;
+	return std::any_of(mime_types.begin(), mime_types.end(), [&type](const std::string& m)
+	{
+		if(m.size() > 2 && m.compare(m.size() - 2, 2, "/*") == 0)
+			return type.compare(0, m.size() - 1, m, 0, m.size() - 1) == 0;
+		return m == type;
+	});
+}
+
+tranfer_encoding negotiate_encoding(const std::string& accept_encoding)
+{
+	double gzip{0}, deflate{0}, any{-1};
+	std::size_t begin = 0;
+	while(begin < accept_encoding.size())
+	{
+		auto end = accept_encoding.find(',', begin);
+		if(end == std::string::npos) end = accept_encoding.size();
+		auto item = accept_encoding.substr(begin, end - begin);
+		begin = end + 1;
+
+		auto semicolon = item.find(';');
+		auto coding = trim_lower(item.substr(0, semicolon));
+		double q = 1;
+		if(semicolon != std::string::npos)
+		{
+			auto params = trim_lower(item.substr(semicolon + 1));
+			if(params.compare(0, 2, "q=") == 0) q = std::strtod(params.c_str() + 2, nullptr);
+		}
+
+		if(coding == "gzip" || coding == "x-gzip") gzip = q;
+		else if(coding == "deflate") deflate = q;
+		else if(coding == "*") any = q;
+	}
+	// "*" covers the codings not listed explicitly
+	if(any >= 0)
+	{
+		if(accept_encoding.find("gzip") == std::string::npos) gzip = any;
+		if(accept_encoding.find("deflate") == std::string::npos) deflate = any;
+	}
+
+	if(gzip > 0 && gzip >= deflate) return tranfer_encoding::gzip;
+	if(deflate > 0) return tranfer_encoding::deflate;
+	return tranfer_encoding::identity;
+}
+
+const char* encoding_name(tranfer_encoding e) noexcept
+{
+	switch(e)
+	{
+		case tranfer_encoding::gzip: return hv_gzip;
+		case tranfer_encoding::deflate: return "deflate";
+		default: return "identity";
+	}
+}
+
+deflater::deflater(tranfer_encoding e, int level)
+	: key{pool_key(e, level)}
+{
+	assert(e == tranfer_encoding::gzip || e == tranfer_encoding::deflate);
+	strm = streams.acquire(key, e, level);
+}
+
+deflater::~deflater()
+{
+	streams.release(key, strm);
+}
+
+std::string deflater::compress(const char* data, std::size_t size)
+{
+	return run(data, size, Z_NO_FLUSH);
+}
+
+std::string deflater::flush()
+{
+	if(!held) return {};
+	return run(nullptr, 0, Z_SYNC_FLUSH);
+}
+
+std::string deflater::finish()
+{
+	if(finished) return {};
+	return run(nullptr, 0, Z_FINISH);
+}
+
+std::string deflater::run(const char* data, std::size_t size, int mode)
+{
+	assert(!finished);
+	std::string out;
+	strm->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	strm->avail_in = static_cast<uInt>(size);
+	char buf[16 * 1024];
+	int r;
+	do
+	{
+		strm->next_out = reinterpret_cast<Bytef*>(buf);
+		strm->avail_out = sizeof(buf);
+		r = deflate(strm, mode);
+		if(r == Z_STREAM_ERROR)
+		{
+			LOGERROR("zlib stream error");
+			break;
+		}
+		out.append(buf, sizeof(buf) - strm->avail_out);
+	} while(strm->avail_out == 0 || (mode == Z_FINISH && r != Z_STREAM_END));
+
+	if(mode == Z_FINISH) finished = true;
+	// zlib keeps the tail of its input until told to flush
+	held = mode == Z_NO_FLUSH && (held || size > 0);
+	return out;
+}
+
+std::string deflater::compress_all(tranfer_encoding e, int level, const char* data, std::size_t size)
+{
+	deflater d{e, level};
+	auto out = d.compress(data, size);
+	out += d.finish();
+	return out;
+}
+
+compressed_variants::body_t compressed_variants::get(const std::string& key, tranfer_encoding e, int level,
+	const char* data, std::size_t size)
+{
+	auto variant = key + '\n' + encoding_name(e);
+	{
+		std::lock_guard<std::mutex> lock{mtx};
+		auto it = index.find(variant);
+		if(it != index.end())
+		{
+			lru.splice(lru.begin(), lru, it->second);
+			return it->second->second;
+		}
+	}
+
+	// two threads may both compress the same body: it is cheaper than holding the lock meanwhile
+	auto body = std::make_shared<const std::string>(deflater::compress_all(e, level, data, size));
+	if(body->size() > capacity) return body;
+
+	std::lock_guard<std::mutex> lock{mtx};
+	auto it = index.find(variant);
+	if(it != index.end()) return it->second->second;
+	lru.emplace_front(variant, body);
+	index.emplace(variant, lru.begin());
+	in_use += body->size();
+	while(in_use > capacity)
+	{
+		auto& victim = lru.back();
+		in_use -= victim.second->size();
+		index.erase(victim.first);
+		lru.pop_back();
+	}
+	return body;
+}
+
+std::size_t compressed_variants::used() const
+{
+	std::lock_guard<std::mutex> lock{mtx};
+	return in_use;
+}
+
+void mark_encoded(http_response& res, tranfer_encoding e)
+{
+	res.header(hf_content_encoding, encoding_name(e));
+	if(!res.has("vary", [](const std::string& v) { return utils::icompare(v, hf_accept_encoding); }))
+		res.header("vary", "Accept-Encoding");
+	// the compressed representation is not byte-for-byte the one the strong validator refers to
+	auto etag = res.header("etag");
+	if(!etag.empty() && etag.compare(0, 2, "W/") != 0)
+	{
+		res.remove_header("etag");
+		res.header("etag", "W/" + etag);
+	}
+}
+
+void compressed_preamble(http_response& res, tranfer_encoding e, proto_version protocol, proto_version channel)
+{
+	mark_encoded(res, e);
+	res.content_len(0);
+	res.remove_header(hf_content_len);
+	if(channel == proto_version::HTTP20) return;
+	if(protocol == proto_version::HTTP10)
+	{
+		res.chunked(false);
+		res.keepalive(false);
+		return;
+	}
+	res.chunked(true);
+}
+
+}
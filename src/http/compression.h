@@ -0,0 +1,131 @@
+#ifndef DOORMAT_COMPRESSION_H
+#define DOORMAT_COMPRESSION_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "http_commons.h"
+#include "http_request.h"
+#include "http_response.h"
+
+struct z_stream_s;
+
+namespace http
+{
+
+/** \brief which responses get compressed, and how hard: the "gzip" section of the configuration.
+ * */
+struct compression_policy
+{
+	/** zlib level, from 1 (fastest) to 9 (smallest) */
+	int level{6};
+	/** Bodies whose length is known and smaller than this are sent as they are. */
+	std::size_t min_size{0};
+	/** Media types worth compressing; a "*" subtype matches any of them. */
+	std::vector<std::string> mime_types{hv_text_html, hv_text_css, hv_text_plain, hv_application_json};
+
+	/** \brief reads the policy from a configuration file holding one JSON object per line, among which
+	 * {"gzip" : {"compression_level" : 9, "compression_min_size" : 0, "compression_mime_types" : [...]}}.
+	 * \throws std::runtime_error if the file can not be read or the section is not valid
+	 * */
+	static compression_policy from_file(const std::string& file);
+
+	/** \brief tells whether the response is to be compressed: it must have a body, not be encoded already,
+	 * not forbid transformations and be of one of the configured types.
+	 * */
+	bool compressible(const http_response& res) const;
+};
+
+/** \brief picks the coding to be used from an Accept-Encoding value (RFC 7231, 5.3.4): gzip is preferred over
+ * deflate when the client likes both the same.
+ * \returns tranfer_encoding::identity if the body has to be sent as it is
+ * */
+tranfer_encoding negotiate_encoding(const std::string& accept_encoding);
+
+/** \returns the Content-Encoding token of a coding */
+const char* encoding_name(tranfer_encoding e) noexcept;
+
+/** \brief streaming gzip / deflate compressor.
+ *
+ * zlib streams are expensive to set up (hundreds of KB of tables each): they are reset and kept in a per-thread
+ * free list when a deflater is destroyed, so that the next response compressed on the same thread reuses them.
+ * */
+class deflater
+{
+public:
+	deflater(tranfer_encoding e, int level);
+	deflater(const deflater&) = delete;
+	deflater& operator=(const deflater&) = delete;
+	~deflater();
+
+	/** \brief compresses some input; the output may well be empty, since zlib holds data back until it has
+	 * enough to emit a good block.
+	 * */
+	std::string compress(const char* data, std::size_t size);
+	/** \returns everything held back so far, byte aligned so that the peer can decode it right away */
+	std::string flush();
+	/** \returns the end of the stream; nothing can be compressed afterwards */
+	std::string finish();
+
+	/** \returns true if some input went in since the last flush */
+	bool pending() const noexcept { return held; }
+
+	/** \brief compresses a whole body at once. */
+	static std::string compress_all(tranfer_encoding e, int level, const char* data, std::size_t size);
+
+private:
+	std::string run(const char* data, std::size_t size, int mode);
+
+	z_stream_s* strm;
+	int key;
+	bool held{false};
+	bool finished{false};
+};
+
+/** \brief compressed copies of bodies which are sent over and over (cached or static ones), so that each is
+ * compressed once instead of once per request. Bounded in bytes, evicted in LRU order; thread safe.
+ * */
+class compressed_variants
+{
+public:
+	using body_t = std::shared_ptr<const std::string>;
+
+	explicit compressed_variants(std::size_t capacity = 32 * 1024 * 1024) : capacity{capacity} {}
+
+	/** \brief returns the variant stored under the key, or compresses the body to create it.
+	 * \param key must change whenever the identity body does (e.g. it includes its ETag)
+	 * */
+	body_t get(const std::string& key, tranfer_encoding e, int level, const char* data, std::size_t size);
+
+	std::size_t used() const;
+
+private:
+	using lru_t = std::list<std::pair<std::string, body_t>>;
+
+	std::size_t capacity;
+	mutable std::mutex mtx;
+	lru_t lru;
+	std::unordered_map<std::string, lru_t::iterator> index;
+	std::size_t in_use{0};
+};
+
+/** \brief marks the preamble as the one of an encoded representation: Content-Encoding and Vary are set and
+ * a strong ETag becomes a weak one, since it refers to different bytes.
+ * */
+void mark_encoded(http_response& res, tranfer_encoding e);
+
+/** \brief rewrites the preamble of a response about to be compressed on the fly: the length is unknown from now
+ * on, so an HTTP/1.1 body becomes chunked and an HTTP/1.0 one is delimited by the end of the connection.
+ * \param protocol the protocol of the request being answered
+ * \param channel the channel the request came from
+ * */
+void compressed_preamble(http_response& res, tranfer_encoding e, proto_version protocol, proto_version channel);
+
+}
+
+#endif //DOORMAT_COMPRESSION_H
@@ -22,4 +22,30 @@ void connection::on_timeout(std::chrono::milliseconds ms, timeout_callback tcb)
 	set_timeout(ms);
 }
 
+void connection::pause_reading()
+{
+	if(read_pauses++ == 0) reading(false);
+}
+
+void connection::resume_reading()
+{
+	if(read_pauses == 0) return;
+	if(--read_pauses == 0) reading(true);
+}
+
+void connection::when_drained(drain_callback dcb)
+{
+	drain_cbs.emplace_back(std::move(dcb));
+	// the output may be over already, in which case nothing else would tell
+	draining();
+}
+
+void connection::drained()
+{
+	if(drain_cbs.empty()) return;
+	auto cbs = std::move(drain_cbs);
+	drain_cbs = {};
+	for(auto &cb : cbs) cb();
+}
+
 }
@@ -6,6 +6,7 @@
 #include <experimental/optional>
 #include <chrono>
 #include <memory>
+#include <vector>
 #include <iostream>
 
 #include "connection_error.h"
@@ -18,6 +19,7 @@ struct connection : std::enable_shared_from_this<connection>
 {
 	using error_callback = std::function<void(std::shared_ptr<connection>, const http::connection_error &)>;
 	using timeout_callback = std::function<void(std::shared_ptr<connection>)>;
+	using drain_callback = std::function<void()>;
 
 	/** Register callbacks */
 	void on_error(error_callback);
@@ -32,6 +34,14 @@ struct connection : std::enable_shared_from_this<connection>
 	virtual void set_persistent(bool persistent = true) {this->persistent = persistent; }
     virtual void close() = 0;
 
+	/** Flow control: stops reading from the peer until a matching resume_reading() is called.
+	 * Calls nest, so that many users (e.g. many streams of the same session) can pause the same connection. */
+	void pause_reading();
+	void resume_reading();
+	bool reading_paused() const noexcept { return read_pauses > 0; }
+	/** One-shot notification fired the next time all the pending output has been written */
+	void when_drained(drain_callback);
+
 	virtual ~connection() = default;
 protected:
 	bool persistent{true};
@@ -41,7 +51,13 @@ protected:
 	inline void init(){ myself = this->shared_from_this(); }
 	inline void deinit() { myself = nullptr; }
 	virtual void cleared() {}
+	virtual void reading(bool enabled) {}
+	/** Asks for the pending output to be written: a connection with nothing left to write drains at once */
+	virtual void draining() {}
+	void drained();
 private:
+	std::size_t read_pauses{0};
+	std::vector<drain_callback> drain_cbs;
 	http::connection_error current{error_code::success};
 	std::experimental::optional<timeout_callback> timeout_cb;
 	std::experimental::optional<error_callback> error_cb;
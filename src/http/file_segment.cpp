@@ -0,0 +1,25 @@
+#include "file_segment.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+namespace http
+{
+
+std::size_t file_segment::read(char* out, std::size_t size)
+{
+	size = std::min(size, length);
+	ssize_t r;
+	do
+	{
+		r = ::pread(fd, out, size, offset);
+	} while(r < 0 && errno == EINTR);
+	if(r <= 0) return 0;
+
+	offset += r;
+	length -= r;
+	return static_cast<std::size_t>(r);
+}
+
+}
@@ -0,0 +1,31 @@
+#ifndef DOORMAT_FILE_SEGMENT_H
+#define DOORMAT_FILE_SEGMENT_H
+
+#include <memory>
+#include <cstddef>
+#include <sys/types.h>
+
+namespace http
+{
+
+/** \brief a region of an open file, to be sent as part of a body without being copied in user space.
+ *
+ * The owner keeps the descriptor open until the region has been written; plaintext HTTP/1.x connections send it
+ * with sendfile(2), any other channel reads it in chunks.
+ * */
+struct file_segment
+{
+	std::shared_ptr<const void> owner;
+	int fd{-1};
+	off_t offset{0};
+	std::size_t length{0};
+
+	/** \brief reads up to size bytes from the front of the region into out, and advances past them.
+	 * \returns the number of bytes read; 0 if the file is shorter than expected or can not be read
+	 * */
+	std::size_t read(char* out, std::size_t size);
+};
+
+}
+
+#endif //DOORMAT_FILE_SEGMENT_H
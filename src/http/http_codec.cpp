@@ -37,6 +37,16 @@ std::string http_codec::encode_body(const std::string& data)
 	return msg;
 }
 
+std::pair<std::string, std::string> http_codec::encode_body_framing(std::size_t size)
+{
+	assert(_encoder_state == encoder_state::HEADER||_encoder_state == encoder_state::BODY);
+	_encoder_state = encoder_state::BODY;
+
+	if(!_chunked || !size)
+		return {};
+	return {from<size_t>(size).append(http::crlf), http::crlf};
+}
+
 std::string http_codec::encode_trailer(const std::string& key, const std::string& data)
 {
 	assert(_encoder_state == encoder_state::BODY||_encoder_state == encoder_state::TRAILER);
@@ -4,6 +4,8 @@
 #include <memory>
 #include <cassert>
 #include <functional>
+#include <string>
+#include <utility>
 
 struct http_parser;
 
@@ -49,6 +51,10 @@ public:
 	}
 
 	std::string encode_body(const std::string& data);
+	/** \brief framing of a body chunk which is written on its own, e.g. straight from a file.
+	 * \returns what has to be written before and after the size bytes of the chunk
+	 * */
+	std::pair<std::string, std::string> encode_body_framing(std::size_t size);
 	std::string encode_trailer(const std::string& key, const std::string& data);
 	std::string encode_eom();
 
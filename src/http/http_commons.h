@@ -140,6 +140,10 @@ content_type_t content_type( const std::string& filename )
 		return content_type_t::application_x_font_woff;
 	else if(ends_with(filename, ".ttf"))
 		return content_type_t::application_x_font_ttf;
+	else if(ends_with(filename, ".txt"))
+		return content_type_t::text_plain;
+	else if(ends_with(filename, ".json"))
+		return content_type_t::application_json;
 	else
 		return content_type_t::text_html;
 }
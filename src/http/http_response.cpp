@@ -41,6 +41,7 @@ namespace http
 			case 416: return "Requested Range Not Satisfiable";
 			case 417: return "Expectation Failed";
 			case 418: return "I'm a teapot";
+			case 425: return "Too Early";
 			case 500: return "Internal Server Error";
 			case 501: return "Not Implemented";
 			case 502: return "Bad Gateway";
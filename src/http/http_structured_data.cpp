@@ -44,6 +44,7 @@ void http_structured_data::header( const std::string& key, const std::string& va
 	std::string value{value_out}; // ugly string/dstring proxying
 	if( lowercase_key == http::hf_connection || lowercase_key == http::hf_host  || lowercase_key == http::hf_via || lowercase_key == http::hf_accept_encoding)
 	{
+		if( lowercase_key == http::hf_connection ) add_connection_options(value);
 		remove_header(lowercase_key);
 	}
 	else if( lowercase_key == http::hf_content_len )
@@ -60,6 +61,25 @@ void http_structured_data::header( const std::string& key, const std::string& va
 	_headers.insert( std::make_pair( std::move(lowercase_key), value ) );
 }
 
+void http_structured_data::add_connection_options( const std::string& value ) noexcept
+{
+	std::size_t begin = 0;
+	while ( begin < value.size() )
+	{
+		auto end = std::min( value.find(',', begin), value.size() );
+		auto first = value.find_first_not_of( " \t", begin );
+		if ( first < end )
+		{
+			auto last = value.find_last_not_of( " \t", end - 1 );
+			std::string option = value.substr( first, last - first + 1 );
+			std::transform(option.begin(), option.end(), option.begin(), ::tolower);
+			if ( std::find( _connection_options.begin(), _connection_options.end(), option ) == _connection_options.end() )
+				_connection_options.push_back( std::move(option) );
+		}
+		begin = end + 1;
+	}
+}
+
 const std::string& http_structured_data::header( const std::string& key ) const noexcept
 {
 	auto&& element = _headers.find( key );
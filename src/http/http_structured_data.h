@@ -5,6 +5,7 @@
 #include <limits>
 #include <memory>
 #include <typeindex>
+#include <vector>
 
 #include "http_commons.h"
 
@@ -29,6 +30,8 @@ private:
 	proto_version _protocol {proto_version::UNSET};
 	proto_version _channel {proto_version::UNSET};
 	std::multimap<std::string, std::string> _headers;
+	/** Lowercase, they outlive the Connection header, which is rewritten with the persistency */
+	std::vector<std::string> _connection_options;
 
 	bool _chunked {false};
 	bool _keepalive {false};
@@ -41,6 +44,8 @@ private:
 	// These headers must be populated in client wrapper, where the destination is known!
 	std::vector<std::string> destination_headers;
 
+	void add_connection_options( const std::string& value ) noexcept;
+
 protected:
 	http_structured_data ( std::type_index type );
 	http_structured_data ( const http_structured_data& c ) = default;
@@ -67,6 +72,9 @@ public:
 	// I feel lucky, I'd take only the first hit
 	const std::string& header( const std::string& key ) const noexcept;
 	std::list<std::string> headers( const std::string& key ) const noexcept;
+	/** \returns the options listed by all the Connection headers ever set (RFC 7230, 6.1), e.g. the names of the
+	 * hop-by-hop headers of the message */
+	const std::vector<std::string>& connection_options() const noexcept { return _connection_options; }
 
 	// HTTP2ng needs this
 	headers_map headers() const;
@@ -0,0 +1,72 @@
+#include "prepared_response.h"
+
+namespace http
+{
+
+namespace
+{
+
+/** Headers describing the framing of the message or the connection: we set them on our own. */
+bool framing(const http_structured_data::header_t& h)
+{
+	return h.first == hf_content_len || h.first == hf_transfer_encoding || h.first == hf_connection
+		|| h.first == "keep-alive";
+}
+
+}
+
+prepared_response::prepared_response(http_response preamble, std::string body)
+	: head{std::move(preamble)}
+	, content{std::move(body)}
+{
+	head.filter(framing);
+	head.chunked(false);
+	head.content_len(content.size());
+
+	for(auto protocol : {proto_version::HTTP10, proto_version::HTTP11})
+		for(auto keepalive : {false, true})
+		{
+			http_response r{head};
+			r.protocol(protocol);
+			r.keepalive(keepalive);
+			auto i = variant(protocol, keepalive);
+			messages[i] = r.serialize();
+			head_sizes[i] = messages[i].size();
+			messages[i].append(content);
+		}
+
+	// HTTP/2 has no connection management headers; the pseudo-header comes first (RFC 7540, 8.1.2.1)
+	fields.emplace_back(":status", std::to_string(status()));
+	for(const auto& h : head.headers())
+		if(h.first != hf_connection)
+			fields.emplace_back(h.first, h.second);
+	// fields do not move anymore: the header list can point into them
+	nva.reserve(fields.size());
+	for(const auto& f : fields)
+		nva.push_back(nghttp2_nv{(uint8_t*) f.first.data(), (uint8_t*) f.second.data(), f.first.size(),
+			f.second.size(), NGHTTP2_NV_FLAG_NO_COPY_NAME | NGHTTP2_NV_FLAG_NO_COPY_VALUE});
+}
+
+std::size_t prepared_response::variant(proto_version protocol, bool keepalive) noexcept
+{
+	return (protocol == proto_version::HTTP10 ? 0 : 2) + (keepalive ? 1 : 0);
+}
+
+const std::string& prepared_response::h1(proto_version protocol, bool keepalive) const noexcept
+{
+	return messages[variant(protocol, keepalive)];
+}
+
+std::size_t prepared_response::h1_head_size(proto_version protocol, bool keepalive) const noexcept
+{
+	return head_sizes[variant(protocol, keepalive)];
+}
+
+shared_block h1_message(const std::shared_ptr<const prepared_response>& res, proto_version protocol, bool keepalive,
+	bool head)
+{
+	const auto& message = res->h1(protocol, keepalive);
+	return shared_block{res, message.data(), head ? res->h1_head_size(protocol, keepalive) : message.size()};
+}
+
+}
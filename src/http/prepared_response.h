@@ -0,0 +1,64 @@
+#ifndef DOORMAT_PREPARED_RESPONSE_H
+#define DOORMAT_PREPARED_RESPONSE_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nghttp2/nghttp2.h>
+
+#include "http_commons.h"
+#include "http_response.h"
+#include "shared_block.h"
+
+namespace http
+{
+
+/** \brief a response serialized once and sent over and over (e.g. an error page).
+ *
+ * Every HTTP/1.x variant (protocol version and connection persistence) is kept as a complete message, head and
+ * body, and HTTP/2 gets a ready header list pointing into the object: sending it copies and allocates nothing.
+ * Immutable once built, hence it can be shared among threads; it can not be copied nor moved, since the HTTP/2
+ * header list refers to its own strings.
+ * */
+class prepared_response
+{
+public:
+	/** \param preamble status and headers; framing and connection management headers are set on our own */
+	prepared_response(http_response preamble, std::string body);
+	prepared_response(const prepared_response&) = delete;
+	prepared_response& operator=(const prepared_response&) = delete;
+
+	uint16_t status() const noexcept { return head.status_code(); }
+	/** \returns the preamble, with its length set */
+	const http_response& preamble() const noexcept { return head; }
+	const std::string& body() const noexcept { return content; }
+
+	/** \returns the whole HTTP/1.x message */
+	const std::string& h1(proto_version protocol, bool keepalive) const noexcept;
+	/** \returns the size of the head of the HTTP/1.x message, which is all a HEAD request gets */
+	std::size_t h1_head_size(proto_version protocol, bool keepalive) const noexcept;
+
+	const nghttp2_nv* h2_headers() const noexcept { return nva.data(); }
+	std::size_t h2_headers_count() const noexcept { return nva.size(); }
+
+private:
+	static std::size_t variant(proto_version protocol, bool keepalive) noexcept;
+
+	http_response head;
+	std::string content;
+	std::array<std::string, 4> messages;
+	std::array<std::size_t, 4> head_sizes;
+	std::vector<std::pair<std::string, std::string>> fields;
+	std::vector<nghttp2_nv> nva;
+};
+
+/** \returns the bytes answering a request over HTTP/1.x, owned by the prepared response.
+ * \param head true to send only the head, as HEAD requests want
+ * */
+shared_block h1_message(const std::shared_ptr<const prepared_response>& res, proto_version protocol, bool keepalive,
+	bool head);
+
+}
+
+#endif //DOORMAT_PREPARED_RESPONSE_H
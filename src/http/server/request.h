@@ -58,6 +58,8 @@ public:
 
 	/** Connection retrieve method*/
 	std::shared_ptr<http::server_connection> get_connection();
+	/** \returns the io_service serving the request, to which its work is posted back */
+	boost::asio::io_service& io_service() noexcept { return io; }
 
 private:
 
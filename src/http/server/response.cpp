@@ -1,4 +1,6 @@
 #include "response.h"
+#include "../../utils/log_wrapper.h"
+#include <algorithm>
 #include <functional>
 #include <memory>
 
@@ -13,10 +15,27 @@ response::response(std::function<void()> content_notification, boost::asio::io_s
 	};
 
 	bcb = [this, content_notification](data_t d, size_t s) {
-		content.append(d.get(), s);
+		if(files.empty()) content.append(d.get(), s);
+		else files.back().after.append(d.get(), s);
 		content_notification();
 	};
 
+	fcb = [this, content_notification](file_segment f) {
+		files.push(stored_output{std::move(f), {}, {}});
+		content_notification();
+	};
+
+	kcb = [this, content_notification](shared_block b) {
+		files.push(stored_output{{}, std::move(b), {}});
+		content_notification();
+	};
+
+	pcb = [this](std::shared_ptr<const prepared_response> p, const http_request& req) {
+		// the end is notified afterwards, through ccb
+		prepared.emplace(h1_message(p, req.protocol_version(), req.keepalive(), req.method_code() == HTTP_HEAD),
+			req.keepalive());
+	};
+
 	tcb =[this, content_notification](std::string&& k, std::string&& v) {
 		trailers.emplace(std::make_pair(std::move(k), std::move(v)));
 		content_notification();
@@ -35,12 +54,214 @@ response::response(std::function<void(http_response&&)> hcb, std::function<void(
     hcb{std::move(hcb)}, bcb{std::move(bcb)}, tcb{std::move(tcb)}, ccb{std::move(ccb)}, io{io}
 {}
 
+response::response(std::function<void(http_response&&)> hcb, std::function<void(data_t, size_t)> bcb, std::function<void(std::string&&, std::string&&)> tcb,
+				   std::function<void()> ccb, std::function<void(std::shared_ptr<const prepared_response>, const http_request&)> pcb,
+				   boost::asio::io_service&io ) :
+    hcb{std::move(hcb)}, bcb{std::move(bcb)}, pcb{std::move(pcb)}, tcb{std::move(tcb)}, ccb{std::move(ccb)}, io{io}
+{}
+
+
+void response::compress(std::shared_ptr<const compression_policy> policy, const http_request& req)
+{
+	coding = negotiate_encoding(req.header(hf_accept_encoding));
+	if(coding == tranfer_encoding::identity) return;
+	compression = std::move(policy);
+	request_protocol = req.protocol_version();
+	request_channel = req.channel();
+	head_request = req.method_code() == HTTP_HEAD;
+}
+
+void response::headers(http_response &&res)
+{
+	if(headers_filter)
+	{
+		auto filter = std::move(headers_filter);
+		headers_filter = nullptr;
+		filter(res);
+	}
+	if(compression && compression->compressible(res))
+	{
+		if(head_request)
+		{
+			// the headers of the GET, without a body to frame: its compressed length is not known
+			mark_encoded(res, coding);
+			res.content_len(0);
+			res.remove_header(hf_content_len);
+		}
+		else
+		{
+			compressed_preamble(res, coding, request_protocol, request_channel);
+			encoder = std::make_unique<deflater>(coding, compression->level);
+		}
+	}
+	hcb(std::move(res));
+}
+
+void response::body(data_t d, size_t s)
+{
+	if(!reading.empty())
+	{
+		reading.back().second.append(d.get(), s);
+		return;
+	}
+	emit(std::move(d), s);
+}
+
+void response::emit(data_t d, size_t s)
+{
+	if(!encoder) return bcb(std::move(d), s);
+	compressed(encoder->compress(d.get(), s));
+	schedule_flush();
+}
+
+bool response::file(file_segment f)
+{
+	if(fcb && !encoder)
+	{
+		fcb(std::move(f));
+		return true;
+	}
+	if(!f.length) return true;
+	reading.emplace_back(std::move(f), std::string{});
+	// a region queued behind another one is read when its turn comes
+	return reading.size() > 1 || read_chunk();
+}
+
+bool response::read_chunk()
+{
+	static constexpr std::size_t chunk = 64 * 1024;
+	auto& f = reading.front().first;
+	auto size = std::min(f.length, chunk);
+	auto d = std::make_unique<char[]>(size);
+	auto r = f.read(d.get(), size);
+	if(!r)
+	{
+		reading.clear();
+		held_trailers.clear();
+		end_held = false;
+		return false;
+	}
+	emit(std::move(d), r);
+
+	if(!f.length)
+	{
+		auto after = std::move(reading.front().second);
+		reading.pop_front();
+		if(!after.empty())
+		{
+			auto size = after.size();
+			auto a = std::make_unique<char[]>(size);
+			std::copy(after.begin(), after.end(), a.get());
+			emit(std::move(a), size);
+		}
+		if(reading.empty())
+		{
+			std::vector<std::pair<std::string, std::string>> held;
+			std::swap(held, held_trailers);
+			for(auto& t : held)
+				trailer(std::move(t.first), std::move(t.second));
+			if(end_held)
+			{
+				end_held = false;
+				end();
+			}
+			return true;
+		}
+	}
+
+	auto next = [self = this->shared_from_this()]()
+	{
+		self->io.post([self]() { self->read_on(); });
+	};
+	if(pace.drained) pace.drained(std::move(next));
+	else next();
+	return true;
+}
+
+void response::read_on()
+{
+	// the response failed meanwhile
+	if(reading.empty()) return;
+	if(read_chunk()) return;
+	LOGERROR("file can not be read, the body is aborted");
+	if(pace.abort) pace.abort();
+}
+
+void response::block(shared_block b)
+{
+	if(kcb && !encoder) return kcb(std::move(b));
+	if(!b.size) return;
+	auto d = std::make_unique<char[]>(b.size);
+	std::copy(b.data, b.data + b.size, d.get());
+	body(std::move(d), b.size);
+}
+
+void response::trailer(std::string&& k, std::string&& v)
+{
+	if(!reading.empty())
+	{
+		held_trailers.emplace_back(std::move(k), std::move(v));
+		return;
+	}
+	if(encoder) compressed(encoder->finish());
+	tcb(std::move(k), std::move(v));
+}
+
+void response::compressed(std::string data)
+{
+	if(data.empty()) return;
+	auto size = data.size();
+	auto ptr = std::make_unique<char[]>(size);
+	std::copy(data.begin(), data.end(), ptr.get());
+	bcb(std::move(ptr), size);
+}
+
+void response::schedule_flush()
+{
+	if(flush_scheduled || !encoder->pending()) return;
+	flush_scheduled = true;
+	io.post([self = this->shared_from_this()]()
+	{
+		self->flush_scheduled = false;
+		if(self->encoder) self->compressed(self->encoder->flush());
+	});
+}
 
-void response::headers(http_response &&res) { hcb(std::move(res));  }
-void response::body(data_t d, size_t s){ bcb(std::move(d), s);  }
-void response::trailer(std::string&& k, std::string&& v) { tcb(std::move(k), std::move(v)); }
 void response::end()
 {
+	if(!reading.empty())
+	{
+		end_held = true;
+		return;
+	}
+	if(encoder) compressed(encoder->finish());
+	io.post([self = this->shared_from_this()](){
+		self->ccb(); self->myself = (self->ended) ? nullptr : self;
+	});
+}
+
+void response::send(std::shared_ptr<const prepared_response> p, const http_request& req)
+{
+	auto filter = std::move(headers_filter);
+	headers_filter = nullptr;
+	if(!pcb || filter)
+	{
+		// a filter gets a copy of the preamble to alter, the serialized message is left alone
+		auto r = p->preamble();
+		r.protocol(req.protocol_version());
+		if(req.channel() != proto_version::HTTP20)
+			r.keepalive(req.keepalive());
+		if(filter) filter(r);
+		hcb(std::move(r));
+		if(req.method_code() != HTTP_HEAD && !p->body().empty())
+		{
+			const auto& b = p->body();
+			auto d = std::make_unique<char[]>(b.size());
+			std::copy(b.begin(), b.end(), d.get());
+			bcb(std::move(d), b.size());
+		}
+	}
+	else pcb(std::move(p), req);
 	io.post([self = this->shared_from_this()](){
 		self->ccb(); self->myself = (self->ended) ? nullptr : self;
 	});
@@ -68,6 +289,8 @@ response::state response::get_state() noexcept
 		return state::headers_received;
 	}
 	if(content.size()) return state::body_received;
+	if(files.size()) return state::file_received;
+	if(prepared) return state::prepared_received;
 	if(trailers.size()) return state::trailer_received;
 	if(ended) return state::ended;
 	return state::pending;
@@ -87,6 +310,18 @@ std::string response::get_body() {
 	return ret;
 }
 
+response::stored_output response::get_file() {
+	auto f = std::move(files.front());
+	files.pop();
+	return f;
+}
+
+std::pair<shared_block, bool> response::get_prepared() {
+	auto p = std::move(*prepared);
+	prepared = std::experimental::nullopt;
+	return p;
+}
+
 std::pair<std::string, std::string> response::get_trailer() {
 	auto trailer = trailers.front();
 	trailers.pop();
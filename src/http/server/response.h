@@ -4,11 +4,17 @@
 #include <iostream>
 #include <experimental/optional>
 #include <functional>
+#include <deque>
 #include <memory>
+#include <queue>
+#include <vector>
 #include <string>
 #include <boost/asio/io_service.hpp>
 
 #include "../http_response.h"
+#include "../compression.h"
+#include "../file_segment.h"
+#include "../prepared_response.h"
 #include "../connection_error.h"
 
 namespace server
@@ -33,6 +39,15 @@ public:
 	using error_callback_t = std::function<void()>;
 	using write_callback_t = std::function<void(std::shared_ptr<response>)>;
 	using data_t = std::unique_ptr<const char[]>;
+	using headers_filter_t = std::function<void(http_response&)>;
+
+	/** \brief how the protocol paces the reading of files: drained(cb) calls cb once the body handed over so far
+	 * has been taken, abort() gives up on a body which can not be completed */
+	struct pacer
+	{
+		std::function<void(std::function<void()>)> drained;
+		std::function<void()> abort;
+	};
 
 	enum class state 
 	{
@@ -40,32 +55,93 @@ public:
 		pending,
 		headers_received,
 		body_received,
+		file_received,
+		prepared_received,
 		trailer_received,
 		ended
 	};
 
 	response(std::function<void()> content_notification, boost::asio::io_service&io);
 	response(std::function<void(http_response&&)>, std::function<void(data_t, size_t)>, std::function<void(std::string&&, std::string&&)>, std::function<void()>, boost::asio::io_service&io);
+	/** \brief as above, with a callback receiving prepared responses whole, along with the request they answer;
+	 * the callback given for the end is called afterwards */
+	response(std::function<void(http_response&&)>, std::function<void(data_t, size_t)>, std::function<void(std::string&&, std::string&&)>, std::function<void()>,
+		std::function<void(std::shared_ptr<const prepared_response>, const http_request&)>, boost::asio::io_service&io);
 
 	void headers(http_response &&res);
 	void body(data_t d, size_t);
+	/** \brief appends a region of a file to the body. Plaintext HTTP/1.x connections send it straight from the
+	 * page cache; otherwise, or when the body is being compressed, it is read 64 KiB at a time, the next chunk once
+	 * the pacer tells the previous one has been taken. What is given after it waits for the region to be read.
+	 * \returns false if the first chunk could not be read: the body can not be completed and the connection
+	 * should be closed. A later failure aborts the body through the pacer.
+	 * */
+	bool file(file_segment f);
+	/** \brief appends to the body bytes kept alive by their owner. HTTP/1.x connections write them as they are;
+	 * otherwise, or when the body is being compressed, they are copied. */
+	void block(shared_block b);
 	void trailer(std::string&& k, std::string&& v);
 	void end();
+	/** \brief sends a whole prepared response and ends, in place of headers(), body() and end(): the serialized
+	 * message is shared, not copied, unless a headers filter has to alter the preamble. Compression does not apply.
+	 * \param req the request being answered, which tells the protocol and the persistence of the connection
+	 * */
+	void send(std::shared_ptr<const prepared_response> p, const http_request& req);
 	void send_continue() { continue_required = true; notify_continue();  }
+	/** \brief compresses the body on the fly, provided that the client accepts a coding we support and that
+	 * the policy allows compressing the response. To be called before headers().
+	 * Compressed data is flushed when the producer of the body has nothing more to give in the current
+	 * io_service turn, so that small chunks are batched without delaying a streaming response indefinitely.
+	 * HEAD responses get the headers the GET would, with nothing to compress.
+	 * */
+	void compress(std::shared_ptr<const compression_policy> policy, const http_request& req);
 	void on_error(error_callback_t ecb);
 	void on_write(write_callback_t wcb);
+	/** \brief sets a function altering the preamble given to headers() before anything else happens to it, as
+	 * filters do; it is dropped once used. It applies to prepared responses as well, which are then copied.
+	 * */
+	void filter_headers(headers_filter_t f) { headers_filter = std::move(f); }
+	/** \brief keeps an object until the response has been written, or has failed: what has to know when the
+	 * exchange is over (e.g. a permit of network::concurrency_limiter) can be tied to it.
+	 * */
+	void keep(std::shared_ptr<void> p) { kept = std::move(p); }
+	/** \brief set by the protocol handlers; without a pacer, the next chunk of a file is read on the next turn */
+	void paced_by(pacer p) { pace = std::move(p); }
 
 	state get_state() noexcept;
 	http_response preamble();
 
 
 private:
+	/** \brief a file region or, when its data is set, a block, followed by the body given after it */
+	struct stored_output
+	{
+		file_segment segment;
+		shared_block block;
+		std::string after;
+	};
+
 	std::string get_body();
+	/** \returns the next file region or block, along with the body bytes to be sent after it */
+	stored_output get_file();
+	/** \returns the HTTP/1.x message to be written, and whether the connection persists after it */
+	std::pair<shared_block, bool> get_prepared();
 	std::pair<std::string, std::string> get_trailer();
+	void compressed(std::string data);
+	void schedule_flush();
+	/** \brief hands body data to the protocol, through the encoder if any */
+	void emit(data_t d, size_t s);
+	/** \brief reads the next chunk of the file region in front of the queue and schedules the following one
+	 * \returns false if it could not be read */
+	bool read_chunk();
+	void read_on();
 
     void error(http::connection_error err)
     {
 	    ended = true;
+	    reading.clear();
+	    headers_filter = nullptr;
+	    kept = nullptr;
 	    if(error_callback)
 		    io.post([self = this->shared_from_this()](){ self->error_callback();});
 	    myself = nullptr;
@@ -74,6 +150,8 @@ private:
 	void cleared()
 	{
 		ended = true;
+		headers_filter = nullptr;
+		kept = nullptr;
 		if(write_callback)
 			io.post([self = this->shared_from_this()](){self->write_callback(self);});
 		myself = nullptr;
@@ -84,17 +162,41 @@ private:
 	bool continue_required{false};
 	error_callback_t error_callback;
 	write_callback_t write_callback;
+	/** Reset when used: it may keep the request alive. */
+	headers_filter_t headers_filter;
+	std::shared_ptr<void> kept;
 	std::experimental::optional<http_response> response_headers;
 	std::string content;
+	/** File regions and blocks waiting to be sent; the body received after each of them is kept beside it. */
+	std::queue<stored_output> files;
 	std::queue<std::pair<std::string, std::string>> trailers;
+	std::experimental::optional<std::pair<shared_block, bool>> prepared;
 	std::function<void()> content_notification;
 
 	std::function<void(http_response&&)> hcb;
 	std::function<void(data_t, size_t)> bcb;
+	std::function<void(file_segment)> fcb;
+	std::function<void(shared_block)> kcb;
+	std::function<void(std::shared_ptr<const prepared_response>, const http_request&)> pcb;
 	std::function<void(std::string&&, std::string&&)> tcb;
 	std::function<void()> ccb;
 	std::function<void()> notify_continue;
 
+	pacer pace;
+	/** File regions being read, each with the body given after it; trailers and the end wait for them */
+	std::deque<std::pair<file_segment, std::string>> reading;
+	std::vector<std::pair<std::string, std::string>> held_trailers;
+	bool end_held{false};
+
+	std::shared_ptr<const compression_policy> compression{nullptr};
+	tranfer_encoding coding{tranfer_encoding::identity};
+	proto_version request_protocol{proto_version::UNSET};
+	proto_version request_channel{proto_version::UNSET};
+	/** HEAD responses get the headers of the compressed representation, but no encoder */
+	bool head_request{false};
+	std::unique_ptr<deflater> encoder{nullptr};
+	bool flush_scheduled{false};
+
 	/** Ptr-to-self: to grant the user that, until finished() or error() event is propagated, the client_response will be alive*/
 	std::shared_ptr<response> myself{nullptr};
 
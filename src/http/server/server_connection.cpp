@@ -1,4 +1,9 @@
 #include "server_connection.h"
+#include "static_routes.h"
+#include "request.h"
+#include "response.h"
+#include "../http_request.h"
+#include "../../network/concurrency_limiter.h"
 
 namespace http {
 
@@ -7,8 +12,53 @@ void server_connection::on_request(request_callback rcb)
 	request_cb = std::move(rcb);
 }
 
+void server_connection::use_static_routes(std::shared_ptr<const static_routes> r)
+{
+	routes = std::move(r);
+}
+
+const std::shared_ptr<const prepared_response>& server_connection::static_answer(const http_request& req,
+	bool early_data) const noexcept
+{
+	static const std::shared_ptr<const prepared_response> none{nullptr};
+	if(early_data && req.method_code() != HTTP_GET && req.method_code() != HTTP_HEAD)
+	{
+		// a replay of it could change something: the client sends it again after the handshake (RFC 8470)
+		static const std::shared_ptr<const prepared_response> too_early = []()
+		{
+			http_response preamble;
+			preamble.status(425);
+			preamble.header(hf_content_type, hv_text_plain);
+			return std::make_shared<const prepared_response>(std::move(preamble), "Too Early\n");
+		}();
+		return too_early;
+	}
+	if(!routes) return none;
+	return routes->find(req.method_code(), req.path());
+}
+
+void server_connection::use_concurrency_limiter(std::shared_ptr<network::concurrency_limiter> l,
+	std::shared_ptr<const prepared_response> answer)
+{
+	limiter = std::move(l);
+	overloaded = std::move(answer);
+}
+
 void server_connection::user_feedback(std::shared_ptr<http::request> req, std::shared_ptr<http::response> res)
 {
+	if(limiter)
+	{
+		if(auto permit = limiter->acquire()) res->keep(std::move(permit));
+		else
+		{
+			// shed before any work of the user: the preamble arrives with the headers event
+			req->on_headers([res, answer = overloaded](std::shared_ptr<http::request> req)
+			{
+				res->send(answer, req->preamble());
+			});
+			return;
+		}
+	}
 	if(request_cb) request_cb(std::static_pointer_cast<server_connection>(this->shared_from_this()), req, res);
 }
 
@@ -6,11 +6,19 @@
 
 #include "../connection.h"
 
+namespace network
+{
+class concurrency_limiter;
+}
+
 namespace http 
 {
 
 class request;
 class response;
+class http_request;
+class prepared_response;
+class static_routes;
 
 class server_connection : public connection
 {
@@ -21,13 +29,31 @@ public:
 	/** Register callbacks */
 	void on_request(request_callback rcb);
 
+	/** \brief answers the requests matching the routes on the spot, without calling the request callback. */
+	void use_static_routes(std::shared_ptr<const static_routes> routes);
+
+	/** \brief serves only the requests the limiter lets in, from their headers to the end of their response; the
+	 * others get the prepared answer (e.g. a 503) without the request callback being involved.
+	 * */
+	void use_concurrency_limiter(std::shared_ptr<network::concurrency_limiter> limiter,
+		std::shared_ptr<const prepared_response> overloaded);
+
 protected:
+	/** \returns the answer of the static route matching the request, or nullptr
+	 * \param early_data true if the request came as TLS early data: only GET and HEAD are served, the others get a
+	 * 425 the client retries after the handshake
+	 * */
+	const std::shared_ptr<const prepared_response>& static_answer(const http_request& req,
+		bool early_data = false) const noexcept;
 	void user_feedback(std::shared_ptr<http::request>, std::shared_ptr<http::response>);
 	virtual std::pair<std::shared_ptr<http::request>, std::shared_ptr<http::response>> get_user_handlers()= 0;
 	void cleared() override {}
 
 private:
 	request_callback request_cb;
+	std::shared_ptr<const static_routes> routes;
+	std::shared_ptr<network::concurrency_limiter> limiter;
+	std::shared_ptr<const prepared_response> overloaded;
 };
 
 } // namespace http
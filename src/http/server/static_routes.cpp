@@ -0,0 +1,43 @@
+#include "static_routes.h"
+
+namespace http
+{
+
+namespace
+{
+
+const std::shared_ptr<const prepared_response> no_route{nullptr};
+
+}
+
+void static_routes::add(http_method method, std::string path, std::shared_ptr<const prepared_response> answer)
+{
+	auto& a = routes[std::move(path)];
+	for(auto& r : a)
+		if(r.first == method)
+		{
+			r.second = std::move(answer);
+			return;
+		}
+	a.emplace_back(method, std::move(answer));
+}
+
+void static_routes::add(http_method method, std::string path, http_response preamble, std::string body)
+{
+	add(method, std::move(path), std::make_shared<const prepared_response>(std::move(preamble), std::move(body)));
+}
+
+const std::shared_ptr<const prepared_response>& static_routes::find(http_method method, const std::string& path) const noexcept
+{
+	auto it = routes.find(path);
+	if(it == routes.end()) return no_route;
+	const std::shared_ptr<const prepared_response>* get{&no_route};
+	for(const auto& r : it->second)
+	{
+		if(r.first == method) return r.second;
+		if(method == HTTP_HEAD && r.first == HTTP_GET) get = &r.second;
+	}
+	return *get;
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef DOORMAT_STATIC_ROUTES_H
+#define DOORMAT_STATIC_ROUTES_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../prepared_response.h"
+
+namespace http
+{
+
+/** \brief fixed answers to exact (method, path) pairs, such as the health checks of load balancers.
+ *
+ * Connections answer these requests as soon as their headers are decoded, without creating request and response
+ * objects nor involving the request callback; their bodies, if any, are discarded. The query is not part of
+ * the match. HEAD requests get the head of the GET answer when they have none of their own.
+ * */
+class static_routes
+{
+public:
+	/** \brief sets the answer to a method and path, replacing the previous one. */
+	void add(http_method method, std::string path, std::shared_ptr<const prepared_response> answer);
+	void add(http_method method, std::string path, http_response preamble, std::string body = {});
+
+	/** \returns the answer to the request, or nullptr if no route matches. */
+	const std::shared_ptr<const prepared_response>& find(http_method method, const std::string& path) const noexcept;
+
+	bool empty() const noexcept { return routes.empty(); }
+
+private:
+	using answers = std::vector<std::pair<http_method, std::shared_ptr<const prepared_response>>>;
+	std::unordered_map<std::string, answers> routes;
+};
+
+}
+
+#endif //DOORMAT_STATIC_ROUTES_H
@@ -0,0 +1,22 @@
+#ifndef DOORMAT_SHARED_BLOCK_H
+#define DOORMAT_SHARED_BLOCK_H
+
+#include <memory>
+#include <cstddef>
+
+namespace http
+{
+
+/** \brief bytes owned by someone else (e.g. a prepared response), written as they are: the owner keeps them alive
+ * until the write is over, so that sending them costs neither a copy nor an allocation.
+ * */
+struct shared_block
+{
+	std::shared_ptr<const void> owner;
+	const char* data{nullptr};
+	std::size_t size{0};
+};
+
+}
+
+#endif //DOORMAT_SHARED_BLOCK_H
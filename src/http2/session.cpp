@@ -86,6 +86,26 @@ http2::stream* session::create_stream( std::int32_t id )
 	}; // The pointed object will commit suicide
 
 	stream_data->id( id );
+
+	int rv = nghttp2_session_set_stream_user_data( session_data.get(), id, stream_data );
+	if ( rv != 0 ) LOGERROR ( "nghttp2_session_set_stream_user_data ",  nghttp2_strerror( rv ) );
+
+	++stream_counter;
+	LOGTRACE(" stream is ", stream_data, " stream counter ", stream_counter );
+	return stream_data;
+}
+
+void session::on_request_headers( stream* stream_data )
+{
+	// a static route answers without the user being involved
+	const auto& answer = static_answer( stream_data->preamble() );
+	if ( answer )
+	{
+		stream_data->on_prepared( answer, stream_data->preamble().method_code() == HTTP_HEAD );
+		stream_data->on_eom();
+		return;
+	}
+
 	//todo: replace.
 	auto req_handler = std::make_shared<http::request>(this->get_shared(), connector()->io_service());
 	auto res_handler = std::make_shared<http::response>([stream_data](http::http_response&& res)
@@ -100,16 +120,15 @@ http2::stream* session::create_stream( std::int32_t id )
 	},
 	[stream_data]() {
 		stream_data->on_eom();
+	},
+	[stream_data](auto&& p, const http::http_request& req) {
+		stream_data->on_prepared(std::move(p), req.method_code() == HTTP_HEAD);
 	},connector()->io_service());
+	res_handler->paced_by({[stream_data](std::function<void()> cb) { stream_data->when_consumed(std::move(cb)); },
+		[stream_data]() { stream_data->abort(); }});
 	user_feedback(req_handler, res_handler);
     stream_data->set_handlers(req_handler, res_handler);
-
-	int rv = nghttp2_session_set_stream_user_data( session_data.get(), id, stream_data );
-	if ( rv != 0 ) LOGERROR ( "nghttp2_session_set_stream_user_data ",  nghttp2_strerror( rv ) );
-
-	++stream_counter;
-	LOGTRACE(" stream is ", stream_data, " stream counter ", stream_counter );
-	return stream_data;
+	stream_data->on_request_header_complete();
 }
 
 void session::go_away()
@@ -268,6 +287,21 @@ void session::set_timeout(std::chrono::milliseconds ms) {
 	}
 }
 
+void session::reading(bool enabled)
+{
+	// the whole session is paused: every stream sharing it will wait
+	if(auto s = connector())
+	{
+		if(enabled) s->resume_read();
+		else s->pause_read();
+	}
+}
+
+void session::on_drained()
+{
+	http::server_connection::drained();
+}
+
 void session::on_connector_nulled()
 { 
 	//todo: send events to all streams involved!
@@ -316,7 +350,7 @@ int session::on_frame_recv_callback(nghttp2_session *session_, const nghttp2_fra
 		if ( frame->hd.type == NGHTTP2_HEADERS )
 		{
 			if ( frame->headers.cat == NGHTTP2_HCAT_REQUEST )
-				stream_data->on_request_header_complete();
+				s_this->on_request_headers( stream_data );
 			else
 				LOGERROR("Strangeness in HTTP2 Headers");
 		}
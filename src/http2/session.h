@@ -38,6 +38,8 @@ class session : public server::http_handler, public http::server_connection
 	void send_connection_header();
 
 	stream* create_stream( std::int32_t id );
+	/** Answers the request from a static route, or hands it to the user along with its response */
+	void on_request_headers( stream* s );
 
 	void go_away();
 
@@ -48,6 +50,8 @@ class session : public server::http_handler, public http::server_connection
 	
 	// TODO
 	void set_timeout(std::chrono::milliseconds) override;
+	void reading(bool enabled) override;
+	void draining() override { if(connector()) do_write(); }
 
 	std::pair<std::shared_ptr<http::request>, std::shared_ptr<http::response>> get_user_handlers() override;
 	std::shared_ptr<session> get_shared();
@@ -78,6 +82,7 @@ public:
 
     void do_write() override;
     void on_connector_nulled() override;
+    void on_drained() override;
 
     void finished_stream() noexcept;
     virtual ~session();
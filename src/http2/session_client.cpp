@@ -249,6 +249,21 @@ void session_client::set_timeout(std::chrono::milliseconds ms) {
 	}
 }
 
+void session_client::reading(bool enabled)
+{
+	// the whole session is paused: every stream sharing it will wait
+	if(auto s = connector())
+	{
+		if(enabled) s->resume_read();
+		else s->pause_read();
+	}
+}
+
+void session_client::on_drained()
+{
+	http::client_connection::drained();
+}
+
 void session_client::on_connector_nulled()
 {
 	//todo: send events to all streams involved!
@@ -49,6 +49,8 @@ class session_client : public server::http_handler, public http::client_connecti
 
 	// TODO
 	void set_timeout(std::chrono::milliseconds) override;
+	void reading(bool enabled) override;
+	void draining() override { if(connector()) do_write(); }
 
 	std::pair<std::shared_ptr<http::client_response>, std::shared_ptr<http::client_request>> get_user_handlers() override;
 	std::shared_ptr<session_client> get_shared();
@@ -79,6 +81,7 @@ public:
 
 	void do_write() override;
 	void on_connector_nulled() override;
+	void on_drained() override;
 
 	void finished_stream() noexcept;
 	virtual ~session_client();
@@ -58,22 +58,23 @@ void stream::on_request_header_complete()
 
 void stream::add_header(std::string key, std::string value)
 {
-	if(!_headers_sent) return request.header(std::move(key), std::move(value));
+	if(!_headers_sent && !prepared) return request.header(std::move(key), std::move(value));
 
-	req->trailer(std::move(key), std::move(value));
+	// answered by a static route: the rest of the request is discarded
+	if(req) req->trailer(std::move(key), std::move(value));
 }
 
 void stream::on_request_body( data_t d, size_t size )
 {
 	//managed_chain->on_request_body( std::move( c ) );
-   req->body(std::move(d), size);
+	if(req) req->body(std::move(d), size);
 }
 
 void stream::on_request_finished()
 {
 	LOGTRACE("stream ", this, " request end detected");
 	//managed_chain->on_request_finished();
-    req->finished();
+	if(req) req->finished();
 	// something is wrong here!
 	//std::cout << "setting req "<< this << " to nullptr [1]" << std::endl;
 	req = nullptr; //we don't grant anymore the existence of the request after the on_finished callback has been triggered.
@@ -105,6 +106,7 @@ void stream::on_eom()
 
 bool stream::body_empty() const noexcept
 {
+	if ( prepared ) return prepared_offset == prepared->body().size();
 	return body.size() == 0 || ( body.size() == 1 && body.front().size() == body_index );
 }
 
@@ -115,6 +117,7 @@ bool stream::defer() const noexcept
 
 std::size_t stream::body_length() const noexcept
 {
+	if ( prepared ) return prepared->body().size() - prepared_offset;
 	std::size_t r{0};
 	bool first{true};
 	for ( const std::string& chunk : body )
@@ -149,6 +152,7 @@ ssize_t stream::data_source_read_callback ( nghttp2_session *session_, std::int3
 	{
 		LOGTRACE("stream::data_source_read_callback deferred");
 		s_this->resume_needed_ = true;
+		s_this->consumed();
 		return NGHTTP2_ERR_DEFERRED;
 	}
 
@@ -161,7 +165,13 @@ ssize_t stream::data_source_read_callback ( nghttp2_session *session_, std::int3
 	}
 
 	size_t r{0U};
-	if ( !s_this->body_empty() )
+	if ( s_this->prepared )
+	{
+		r = std::min( s_this->body_length(), length );
+		std::memcpy( buf, s_this->prepared->body().data() + s_this->prepared_offset, r );
+		s_this->prepared_offset += r;
+	}
+	else if ( !s_this->body_empty() )
 	{
 		//*data_flags |= NGHTTP2_DATA_FLAG_NO_COPY; needed sooner or later
 		auto& first = s_this->body.front();
@@ -176,6 +186,7 @@ ssize_t stream::data_source_read_callback ( nghttp2_session *session_, std::int3
 			s_this->body.pop_front();
 			s_this->body_index = 0;
 		}
+		if ( s_this->body_empty() ) s_this->consumed();
 	}
 
 	if ( s_this->body_eof() || s_this->is_last_frame( length ) )
@@ -202,6 +213,16 @@ void stream::flush() noexcept
 // 			assert( r == 0);
 			resume_needed_ = false;
 		}
+		else if ( ! headers_sent && prepared )
+		{
+			// without a data provider the headers end the stream
+			int r = nghttp2_submit_response( s_owner->next_layer(), id_, prepared->h2_headers(),
+				prepared->h2_headers_count(), body_empty() ? nullptr : &prd );
+			LOGTRACE( "id: ", id_, " nghttp2_submit_response :: ", nghttp2_strerror(r) );
+			assert( r == 0 );
+			headers_sent = true;
+			body_sent = body_empty();
+		}
 		else if ( ! headers_sent )
 		{
 			int r = nghttp2_submit_response( s_owner->next_layer(), id_, nva, nvlen, &prd );
@@ -248,6 +269,30 @@ void stream::on_body( data_t data, size_t size )
 	flush();
 }
 
+void stream::when_consumed( std::function<void()> cb )
+{
+	if ( closed_ ) return abort();
+	consumed_cbs.push_back( std::move( cb ) );
+	if ( body_empty() ) consumed();
+}
+
+void stream::consumed()
+{
+	std::vector<std::function<void()>> cbs;
+	std::swap( cbs, consumed_cbs );
+	for ( auto& cb : cbs ) cb();
+}
+
+void stream::abort() noexcept
+{
+	LOGTRACE("stream:", this, " abort");
+	// nothing more is coming: the stream goes once closed
+	eof_ = true;
+	if ( closed_ ) return die();
+	nghttp2_submit_rst_stream( s_owner->next_layer(), NGHTTP2_FLAG_NONE, id_, NGHTTP2_INTERNAL_ERROR );
+	s_owner->do_write();
+}
+
 void stream::create_headers( nghttp2_nv** a ) noexcept
 {
 	*a = reinterpret_cast<nghttp2_nv*> (
@@ -275,6 +320,8 @@ void stream::die() noexcept
 	else
 	{
 		closed_ = true;
+		// a body being read waits for nghttp2, which is done with the stream
+		consumed();
 	}
 
 }
@@ -331,6 +378,14 @@ void stream::on_header(  http::http_response && resp )
 	flush();
 }
 
+void stream::on_prepared( std::shared_ptr<const http::prepared_response> p, bool head )
+{
+	LOGTRACE("stream:", this, " on_prepared");
+	status = p->status();
+	prepared_offset = head ? p->body().size() : 0;
+	prepared = std::move( p );
+}
+
 void stream::on_trailer( std::string&& key, std::string&& value )
 {
 	LOGTRACE("stream:", this, " on_trailer");
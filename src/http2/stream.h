@@ -7,10 +7,13 @@
 #include <cstddef>
 #include <string>
 #include <memory>
+#include <vector>
+#include <functional>
 
 #include "session.h"
 #include "../http/http_structured_data.h"
 #include "../http/http_request.h"
+#include "../http/prepared_response.h"
 #include "../protocol/http_handler.h"
 
 namespace http
@@ -33,6 +36,8 @@ class stream final
 	bool closed_{false};
 	std::list<std::string> body{};
 	std::size_t body_index{0};
+	/** Called once nghttp2 has taken the whole body queued so far */
+	std::vector<std::function<void()>> consumed_cbs;
 	nghttp2_nv* nva{nullptr}; // headers HTTP2
 	std::size_t nvlen{0};
 	http::http_structured_data::headers_map trailers;
@@ -42,6 +47,9 @@ class stream final
 	std::shared_ptr<session> s_owner{nullptr};
 	http::http_structured_data::headers_map prepared_headers;
 	http::http_request request{};
+	/** A response sent as it is: its header list and its body are used in place */
+	std::shared_ptr<const http::prepared_response> prepared{nullptr};
+	std::size_t prepared_offset{0};
 	
 	nghttp2_data_provider prd;
 	
@@ -57,6 +65,7 @@ class stream final
 	std::size_t body_length() const noexcept;
 	bool is_last_frame( std::size_t length ) const noexcept;
 	bool body_eof() const noexcept;
+	void consumed();
 	bool _headers_sent{false};
 	std::function<void(stream*, session*)> destructor;
 public:
@@ -72,6 +81,8 @@ public:
 	//fixme
 	void path( const std::string& p ) { request.path( p ); }
 	std::string path() const { return request.path(); }
+	/** The request as decoded so far; it is handed to the user once its headers are complete */
+	const http::http_request& preamble() const noexcept { return request; }
 	void method( const std::string& p ) { request.method( p ); }
 	void uri_host( const std::string& p ) noexcept;
 	void scheme( const std::string& p ) noexcept { request.schema( p ); }
@@ -94,7 +105,15 @@ public:
 	void on_header(http::http_response &&);
 	void on_body(data_t, size_t);
 	void on_trailer(std::string&&, std::string&&);
+	/** \brief sends a prepared response; on_eom() is expected next.
+	 * \param head true if the request is a HEAD one, which gets no body */
+	void on_prepared(std::shared_ptr<const http::prepared_response> p, bool head);
 	void on_eom();
+	/** \brief calls cb once the body queued so far has been taken by nghttp2, which does so as the flow control
+	 * window allows; a stream the peer has closed is aborted instead */
+	void when_consumed(std::function<void()> cb);
+	/** \brief resets a stream whose body can not be completed */
+	void abort() noexcept;
 
 	void flush() noexcept;
 	void die() noexcept;
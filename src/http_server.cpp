@@ -2,7 +2,14 @@
 #include "utils/log_wrapper.h"
 #include "http/server/server_connection.h"
 #include "http/client/client_connection.h"
+#include "network/ktls.h"
+#include "network/early_data.h"
+#include "network/pooled_handshake.h"
+#include "network/communicator/local_communicator_factory.h"
 #include <boost/lexical_cast.hpp>
+#include <array>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace boost::asio;
@@ -16,8 +23,11 @@ namespace details {
         string err{" ("};
         err += boost::lexical_cast<string>(ERR_GET_LIB(ec.value()));
         err += ",";
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+        // OpenSSL 3 has no function codes any longer
         err += boost::lexical_cast<string>(ERR_GET_FUNC(ec.value()));
         err += ",";
+#endif
         err += boost::lexical_cast<string>(ERR_GET_REASON(ec.value()));
         err += ") ";
 
@@ -28,6 +38,32 @@ namespace details {
     }
 }
 
+namespace
+{
+
+using slots = std::array<network::connection_cap::slot, 3>;
+
+/** \brief takes a slot of each of the caps there are; when one has none left, it gets resume and the slots
+ * taken are given back.
+ * \returns false if some slot is missing
+ * */
+bool reserve(std::array<network::connection_cap*, 3> caps, slots& taken, const std::function<void()>& resume)
+{
+	for(std::size_t i = 0; i < caps.size(); ++i)
+	{
+		if(!caps[i]) continue;
+		taken[i] = caps[i]->acquire(resume);
+		if(!taken[i])
+		{
+			taken = slots{};
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
 http_server::http_server(size_t connect_timeout, uint16_t ssl_port, uint16_t http_port)
 	:
 	 _connect_timeout( boost::posix_time::milliseconds(connect_timeout)),
@@ -36,33 +72,178 @@ http_server::http_server(size_t connect_timeout, uint16_t ssl_port, uint16_t htt
      http_port{http_port}
 {}
 
+void http_server::listen_local(std::string path)
+{
+	if(running.load()) throw std::invalid_argument{"Could not listen on a Unix socket when the server is running"};
+	if(path.empty()) throw std::invalid_argument{"The path of a Unix socket can not be empty"};
+	local_paths.push_back(std::move(path));
+}
+
 void http_server::on_client_connect(connect_callback cb) noexcept
 {
     connect_cb.emplace(std::move(cb));
 }
 
+void http_server::add_static_route(http_method method, std::string path, http::http_response preamble, std::string body)
+{
+	if(running.load()) throw std::invalid_argument{"Could not add static routes when the server is running"};
+	if(!routes) routes = std::make_shared<http::static_routes>();
+	routes->add(method, std::move(path), std::move(preamble), std::move(body));
+}
+
+void http_server::set_access_rules(std::shared_ptr<const network::cidr_matcher> rules)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set access rules when the server is running"};
+	access = std::move(rules);
+}
+
+void http_server::set_connection_limiter(std::shared_ptr<network::rate_limiter> limiter)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the connection limiter when the server is running"};
+	connection_limiter = std::move(limiter);
+}
+
+void http_server::set_connection_cap(std::shared_ptr<network::connection_cap> cap)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the connection cap when the server is running"};
+	connections = std::move(cap);
+}
+
+void http_server::set_listener_cap(std::size_t max)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the listener cap when the server is running"};
+	listener_connections = max;
+}
+
+void http_server::set_handshake_cap(std::shared_ptr<network::connection_cap> cap)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the handshake cap when the server is running"};
+	handshakes = std::move(cap);
+}
+
+void http_server::set_handshake_pool(std::shared_ptr<network::handshake_pool> pool)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the handshake pool when the server is running"};
+	handshake_workers = std::move(pool);
+}
+
+void http_server::set_backlog(int size)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the backlog when the server is running"};
+	if(size <= 0) throw std::invalid_argument{"The backlog must be positive"};
+	backlog = size;
+}
+
+void http_server::set_concurrency_limiter(std::shared_ptr<network::concurrency_limiter> limiter,
+	std::shared_ptr<const http::prepared_response> answer)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the concurrency limiter when the server is running"};
+	request_limiter = std::move(limiter);
+	overloaded = std::move(answer);
+	if(overloaded || !request_limiter) return;
+	http::http_response preamble;
+	preamble.status(503);
+	preamble.header(http::hf_content_type, http::hv_text_plain);
+	preamble.header("retry-after", "1");
+	overloaded = std::make_shared<const http::prepared_response>(std::move(preamble), "Service Unavailable\n");
+}
+
+void http_server::set_certificate_cache(std::size_t contexts)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the certificate cache when the server is running"};
+	sni.set_context_cache(contexts);
+}
+
+void http_server::set_tls(ssl_utils::tls_settings settings)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the TLS settings when the server is running"};
+	sni.set_tls(std::move(settings));
+}
+
+void http_server::set_ocsp_fetcher(std::shared_ptr<ssl_utils::ocsp::fetcher> fetcher)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the OCSP fetcher when the server is running"};
+	sni.set_ocsp_fetcher(std::move(fetcher));
+}
+
+void http_server::set_kernel_tls(bool enabled)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set kernel TLS when the server is running"};
+	kernel_tls = enabled;
+}
+
+void http_server::set_session_tickets(std::shared_ptr<ssl_utils::ticket_keys> keys)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the session tickets when the server is running"};
+	tickets = std::move(keys);
+}
+
+void http_server::set_session_cache(std::shared_ptr<ssl_utils::session_cache> cache)
+{
+	if(running.load()) throw std::invalid_argument{"Could not set the session cache when the server is running"};
+	sessions = std::move(cache);
+}
+
+bool http_server::admitted(tcp_socket& socket) const noexcept
+{
+	if(!access && !connection_limiter) return true;
+	boost::system::error_code ec;
+	auto peer = socket.remote_endpoint(ec);
+	if(!ec && (!access || access->allowed(peer.address()))
+		&& (!connection_limiter || connection_limiter->acquire(peer.address())))
+		return true;
+	socket.close(ec);
+	return false;
+}
+
+void http_server::connected(std::shared_ptr<http::server_connection> conn)
+{
+	if(routes) conn->use_static_routes(routes);
+	if(request_limiter) conn->use_concurrency_limiter(request_limiter, overloaded);
+	if(connect_cb) (*connect_cb)(std::move(conn));
+}
+
 void http_server::start(boost::asio::io_service &io) noexcept
 {
     if(running) return;
     running = true;
+	accepting = std::make_shared<bool>(true);
+	if(request_limiter)
+	{
+		lag = std::make_shared<network::lag_probe>(io, request_limiter);
+		lag->start();
+	}
+	if(listener_connections)
+	{
+		plain_connections = std::make_shared<network::connection_cap>(listener_connections);
+		ssl_connections = std::make_shared<network::connection_cap>(listener_connections);
+	}
+	// contexts are built on the first handshake for one of their names
+	sni.on_context([this](SSL_CTX* ctx)
+	{
+		_handlers.register_protocol_selection_callbacks(ctx);
+		// every SNI context resumes the sessions of the others
+		if(tickets) tickets->attach(ctx);
+		if(sessions) sessions->attach(ctx);
+	});
+	if(sni.tls().max_early_data && (!sessions || tickets))
+		LOGWARN("TLS early data needs a session cache without session tickets: no handshake will read it");
 	_ssl = _ssl && sni.load_certificates();
 	if(_ssl)
 	{
-		_ssl_ctx = &(sni.begin()->context);
-		for(auto&& iter = sni.begin(); iter != sni.end(); ++iter)
-			_handlers.register_protocol_selection_callbacks(iter->context.native_handle());
+		if(certificate_watch.count()) sni.watch(certificate_watch);
+		else if(sni.fetches_ocsp()) LOGWARN("OCSP responses are fetched only while the certificates are watched");
 		listen(io, true);
     }
 
     listen(io);
+	bind_local(io);
 
 	if(plain_acceptor) start_accept(*plain_acceptor);
 
-    if(ssl_acceptor)
-	{
-		assert(_ssl_ctx != nullptr);
-		start_accept(*_ssl_ctx, *ssl_acceptor);
-	}
+	for(auto& acceptor : local_acceptors) start_local_accept(acceptor);
+
+    if(ssl_acceptor) start_tls_accept(*ssl_acceptor);
 
 	//LOGINFO("Starting doormat on ports ", http_port ,",", ssl_port,", with ", 1, " threads");
 }
@@ -72,36 +253,79 @@ void http_server::stop( ) noexcept
 	if(running)
 	{
 		running = false;
+		accepting.reset();
+		if(lag) lag->stop();
+		sni.unwatch();
 		boost::system::error_code ec;
 		if(plain_acceptor) plain_acceptor->close(ec);
 		if(ssl_acceptor) ssl_acceptor->close(ec);
+		for(auto& acceptor : local_acceptors) acceptor.close(ec);
+		for(auto& file : local_files)
+		{
+			// a file replaced by another server, e.g. the next run, is not ours to remove
+			struct stat st;
+			if(::stat(file.path.c_str(), &st) == 0 && st.st_dev == file.device && st.st_ino == file.inode)
+				::unlink(file.path.c_str());
+		}
+		local_files.clear();
 	}
 }
 
-void http_server::start_accept(ssl_context& ssl_ctx, tcp_acceptor& acceptor)
+std::function<void()> http_server::resume(boost::asio::io_service& io, std::function<void()> accept)
+{
+	// called by whoever closes a connection or ends a handshake, on any thread
+	return [&io, alive = std::weak_ptr<bool>{accepting}, accept = std::move(accept)]()
+	{
+		io.post([alive, accept]()
+		{
+			if(alive.lock()) accept();
+		});
+	};
+}
+
+void http_server::start_tls_accept(tcp_acceptor& acceptor)
 {
 	if(running.load() == false)
 		return;
-	auto socket = std::make_shared<ssl_socket>(acceptor.get_io_service(), ssl_ctx);
-	acceptor.async_accept(socket->lowest_layer(),[this, &ssl_ctx, &acceptor, socket]( const boost::system::error_code &ec)
+	// connections are accepted only with room for them; the others wait in the backlog
+	slots taken;
+	if(!reserve({connections.get(), ssl_connections.get(), handshakes.get()}, taken,
+		resume(acceptor.get_io_service(), [this, &acceptor]() { start_tls_accept(acceptor); })))
+		return;
+	auto handshake = std::move(taken[2]);
+	// certificates reloaded since the last accept come with a default context of their own
+	auto ssl_ctx = sni.default_context();
+	auto socket = std::shared_ptr<ssl_socket>(new ssl_socket(acceptor.get_io_service(), *ssl_ctx),
+		// the slots go with the socket, and so with the connection
+		[taken](ssl_socket* s) { delete s; });
+	acceptor.async_accept(socket->lowest_layer(),[this, &acceptor, socket, handshake]( const boost::system::error_code &ec)
 	{
 		//LOGTRACE("secure_accept_cb called");
 
 		if(ec == boost::system::errc::operation_canceled)
 			return;
 
-		if (!ec)
+		if (!ec && admitted(socket->next_layer()))
 		{
             auto connection_timer = std::make_shared<boost::asio::deadline_timer>(acceptor.get_io_service());
             connection_timer->expires_from_now(_connect_timeout);
-            connection_timer->async_wait([socket, connection_timer](const boost::system::error_code &ec)
+            auto pooled = bool(handshake_workers);
+            // the pool runs its handshakes on their own
+            auto early = sni.tls().max_early_data && !pooled;
+            connection_timer->async_wait([socket, connection_timer, pooled, early](const boost::system::error_code &ec)
             {
                 if(ec) return;
 	            boost::system::error_code shutdown_error;
-	            socket->shutdown(shutdown_error);
+	            // a handshake running on the pool or reading early data owns the stream: only the TCP socket can be
+	            // touched
+	            if(pooled || early)
+		            socket->lowest_layer().shutdown(boost::asio::socket_base::shutdown_both, shutdown_error);
+	            else
+		            socket->shutdown(shutdown_error);
             });
-			auto handshake_cb = [this, connection_timer, socket](const boost::system::error_code &ec)
+			auto handshake_cb = [this, connection_timer, socket, handshake](const boost::system::error_code &ec) mutable
 			{
+				handshake.reset();
 				//LOGTRACE("handshake_cb called");
 				if(ec != boost::system::errc::operation_canceled)
                 {
@@ -109,24 +333,50 @@ void http_server::start_accept(ssl_context& ssl_ctx, tcp_acceptor& acceptor)
                 }
                 if (!ec)
 				{
+					resumptions.count(socket->native_handle());
+					// the handshake reading early data may still go on
+					auto reading = network::early_data::of(socket->native_handle());
+					if(kernel_tls && !(reading && reading->active()))
+						network::ktls::enable(socket->native_handle(), socket->next_layer().native_handle());
 					auto h = _handlers.negotiate_handler(socket);
                     // the check on h != nullptr is needed, because the protocol negotiation could fail.
                     // in the case without tls, instead, it is not needed as an handler (http1.x) will
                     // always be provided.
-					if(h != nullptr && connect_cb)
+					if(h != nullptr)
 					{
-						return (*connect_cb)(h);
+						return connected(std::move(h));
 					}
 				}
 				//LOGERROR(this," async accept failed:", ec.message());
 				if(ec.category() == boost::asio::error::get_ssl_category())
 					details::log_ssl_errors(ec);
 			};
-            socket->async_handshake(ssl::stream_base::server, handshake_cb);
+			if(early)
+			{
+				// the connection starts with the first early data, before the handshake is over
+				auto reading = std::make_shared<network::early_data>(socket);
+				reading->async_handshake([reading, handshake_cb](const boost::system::error_code &ec) mutable
+				{
+					handshake_cb(ec);
+				});
+			}
+			else if(!handshake_workers)
+			{
+				socket->async_handshake(ssl::stream_base::server, handshake_cb);
+			}
+			else
+			{
+				// the pool computes, the socket is read and written here
+				auto pooled = std::make_shared<network::pooled_handshake>(socket, handshake_workers);
+				pooled->async_handshake([pooled, handshake_cb](const boost::system::error_code &ec) mutable
+				{
+					handshake_cb(ec);
+				});
+			}
 		}
 	//	else //LOGERROR(ec.message());
 
-		start_accept(ssl_ctx, acceptor);
+		start_tls_accept(acceptor);
 	});
 }
 
@@ -135,21 +385,23 @@ void http_server::start_accept(tcp_acceptor& acceptor)
 	if(running.load() == false)
 		return;
 
-	auto socket = std::make_shared<tcp_socket>(acceptor.get_io_service());
+	slots taken;
+	if(!reserve({connections.get(), plain_connections.get(), nullptr}, taken,
+		resume(acceptor.get_io_service(), [this, &acceptor]() { start_accept(acceptor); })))
+		return;
+	auto socket = std::shared_ptr<tcp_socket>(new tcp_socket(acceptor.get_io_service()),
+		[taken](tcp_socket* s) { delete s; });
 	acceptor.async_accept(socket->lowest_layer(),[this, &acceptor, socket](const boost::system::error_code& ec)
 	{
 		//LOGTRACE("accept_cb called");
 		if(ec == boost::system::errc::operation_canceled)
 			return;
 
-		if (!ec)
+		if (!ec && admitted(*socket))
 		{
 			//auto conn = std::make_shared<tcp_connector>(_connect_timeout, _read_timeout, socket);
 			auto h = _handlers.build_handler(handler_type::ht_h1, http::proto_version::UNSET, socket);
-            if(connect_cb)
-            {
-                (*connect_cb)(h);
-            }
+			connected(std::move(h));
 			return start_accept(acceptor);
 		}
 		else //LOGERROR(ec.message());
@@ -158,7 +410,29 @@ void http_server::start_accept(tcp_acceptor& acceptor)
 	});
 }
 
-tcp_acceptor http_server::make_acceptor(boost::asio::io_service& io, tcp::endpoint endpoint, boost::system::error_code& ec)
+void http_server::start_local_accept(local_acceptor& acceptor)
+{
+	if(running.load() == false)
+		return;
+
+	slots taken;
+	if(!reserve({connections.get(), nullptr, nullptr}, taken,
+		resume(acceptor.get_io_service(), [this, &acceptor]() { start_local_accept(acceptor); })))
+		return;
+	auto socket = std::shared_ptr<local_socket>(new local_socket(acceptor.get_io_service()),
+		[taken](local_socket* s) { delete s; });
+	acceptor.async_accept(*socket, [this, &acceptor, socket](const boost::system::error_code& ec)
+	{
+		if(ec == boost::system::errc::operation_canceled)
+			return;
+
+		if(!ec)
+			connected(_handlers.build_handler(handler_type::ht_h1, http::proto_version::UNSET, socket));
+		start_local_accept(acceptor);
+	});
+}
+
+tcp_acceptor http_server::make_acceptor(boost::asio::io_service& io, tcp::endpoint endpoint, int backlog, boost::system::error_code& ec)
 {
 	auto acceptor = tcp::acceptor(io);
 	int set = 1;
@@ -170,7 +444,7 @@ tcp_acceptor http_server::make_acceptor(boost::asio::io_service& io, tcp::endpoi
 	if(!ec)
 		acceptor.bind(endpoint, ec);
 	if(!ec)
-		acceptor.listen(socket_base::max_connections, ec);
+		acceptor.listen(backlog, ec);
 
 	return acceptor;
 }
@@ -189,7 +463,7 @@ void http_server::listen(boost::asio::io_service &io, bool ssl )
 	{
 		for (; it != tcp::resolver::iterator(); ++it)
 		{
-            auto _acceptor = make_acceptor(io, *it, ec);
+            auto _acceptor = make_acceptor(io, *it, backlog, ec);
             if(!ec)
                 acceptor = std::move(_acceptor);
 		}
@@ -205,10 +479,66 @@ void http_server::listen(boost::asio::io_service &io, bool ssl )
 	}
 }
 
+void http_server::bind_local(boost::asio::io_service &io)
+{
+	local_acceptors.clear();
+	local_files.clear();
+	for(auto& path : local_paths)
+	{
+		boost::system::error_code ec;
+		struct stat st;
+		local_acceptor acceptor{io};
+		try
+		{
+			// throws if the path is too long
+			auto endpoint = network::local_connector_factory::endpoint(path);
+			// the socket of a previous run would keep the new one from binding: it is replaced once nobody answers
+			// on it any longer. A live server, and anything but a socket, is left alone
+			if(path[0] != '@' && ::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+			{
+				boost::system::error_code probe_ec;
+				boost::asio::local::stream_protocol::socket probe{io};
+				probe.connect(endpoint, probe_ec);
+				if(probe_ec == boost::asio::error::connection_refused)
+					::unlink(path.c_str());
+			}
+			acceptor.open(endpoint.protocol(), ec);
+			if(!ec)
+				acceptor.bind(endpoint, ec);
+			if(!ec)
+				acceptor.listen(backlog, ec);
+		}
+		catch(const std::exception& e)
+		{
+			LOGERROR("cannot listen on the Unix socket ", path, ": ", e.what());
+			continue;
+		}
+		if(ec)
+		{
+			LOGERROR("cannot listen on the Unix socket ", path, ": ", ec.message());
+			continue;
+		}
+		if(path[0] != '@' && ::stat(path.c_str(), &st) == 0)
+			local_files.push_back({path, st.st_dev, st.st_ino});
+		local_acceptors.push_back(std::move(acceptor));
+	}
+}
+
 void http_server::add_certificate(const std::string &cert, const std::string &key, const std::string &pass)
 {
 	if(running.load()) throw std::invalid_argument{"Could not add certificate when the server is running"};
 	sni.add_certificate(cert, key, pass);
 }
 
+bool http_server::reload_certificates(std::vector<ssl_utils::sni_solver::files> certificates)
+{
+	return sni.reload(std::move(certificates));
+}
+
+void http_server::watch_certificates(std::chrono::milliseconds interval)
+{
+	if(running.load()) throw std::invalid_argument{"Could not watch the certificates when the server is running"};
+	certificate_watch = interval;
+}
+
 }//namespace
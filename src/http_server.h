@@ -3,6 +3,9 @@
 #include <string>
 #include <memory>
 #include <atomic>
+#include <list>
+#include <vector>
+#include <sys/types.h>
 
 #include <experimental/optional>
 #include <boost/asio.hpp>
@@ -10,7 +13,14 @@
 #include <fstream>
 
 #include "utils/sni_solver.h"
+#include "utils/tls_sessions.h"
 #include "protocol/handler_factory.h"
+#include "http/server/static_routes.h"
+#include "network/cidr_matcher.h"
+#include "network/rate_limiter.h"
+#include "network/connection_cap.h"
+#include "network/concurrency_limiter.h"
+#include "network/handshake_pool.h"
 
 namespace http {
 class server_connection;
@@ -21,6 +31,7 @@ namespace server
 
 using ssl_context = boost::asio::ssl::context;
 using tcp_acceptor = boost::asio::ip::tcp::acceptor;
+using local_acceptor = boost::asio::local::stream_protocol::acceptor;
 
 /** \brief http_server class allows to spawn an http server listenign on a tls and on a http port.
  *  Default ports are 443 and 80.
@@ -31,7 +42,6 @@ class http_server
 	std::atomic_bool running{false};
 	handler_factory _handlers;
 	interval _connect_timeout;
-	ssl_context* _ssl_ctx = nullptr; // a non-owner pointer to the ssl_context
 	ssl_utils::sni_solver sni;
 	bool _ssl;
 	uint16_t ssl_port;
@@ -39,10 +49,53 @@ class http_server
 	std::experimental::optional<tcp_acceptor> plain_acceptor;
 	std::experimental::optional<tcp_acceptor> ssl_acceptor;
 	void start_accept(tcp_acceptor&);
-	void start_accept(ssl_context& , tcp_acceptor& );
-	static tcp_acceptor make_acceptor(boost::asio::io_service &io, boost::asio::ip::tcp::endpoint endpoint, boost::system::error_code&);
+	/** \brief as above, for TLS: the connections get the default context current when they are accepted */
+	void start_tls_accept(tcp_acceptor&);
+	/** \brief as above, for a Unix socket: the connections are plain ones */
+	void start_local_accept(local_acceptor&);
+	/** \returns the callback a cap calls to resume accepting, once it has a free slot again */
+	std::function<void()> resume(boost::asio::io_service& io, std::function<void()> accept);
+	static tcp_acceptor make_acceptor(boost::asio::io_service &io, boost::asio::ip::tcp::endpoint endpoint, int backlog, boost::system::error_code&);
 	void listen(boost::asio::io_service &io, bool ssl = false );
+	/** \brief listens on the Unix sockets, replacing the files of the sockets left by a previous run: those nobody
+	 * listens on any longer */
+	void bind_local(boost::asio::io_service &io);
+	std::vector<std::string> local_paths;
+	/** A list, the accepts referring to their acceptor */
+	std::list<local_acceptor> local_acceptors;
+	/** The files of the sockets bound, removed on stop unless someone else has replaced them meanwhile */
+	struct local_file
+	{
+		std::string path;
+		dev_t device;
+		ino_t inode;
+	};
+	std::vector<local_file> local_files;
 	std::experimental::optional<connect_callback> connect_cb;
+	std::shared_ptr<http::static_routes> routes;
+	std::shared_ptr<const network::cidr_matcher> access;
+	std::shared_ptr<network::rate_limiter> connection_limiter;
+	std::shared_ptr<network::connection_cap> connections;
+	std::shared_ptr<network::connection_cap> handshakes;
+	std::shared_ptr<network::handshake_pool> handshake_workers;
+	std::size_t listener_connections{0};
+	std::shared_ptr<network::connection_cap> plain_connections;
+	std::shared_ptr<network::connection_cap> ssl_connections;
+	int backlog{boost::asio::socket_base::max_connections};
+	std::shared_ptr<network::concurrency_limiter> request_limiter;
+	std::shared_ptr<const http::prepared_response> overloaded;
+	std::shared_ptr<network::lag_probe> lag;
+	std::shared_ptr<ssl_utils::ticket_keys> tickets;
+	std::shared_ptr<ssl_utils::session_cache> sessions;
+	ssl_utils::resumption_counters resumptions;
+	std::chrono::milliseconds certificate_watch{0};
+	bool kernel_tls{false};
+	/** Set while the server accepts: the callbacks resuming accepts outlive neither the server nor its run */
+	std::shared_ptr<bool> accepting;
+	void connected(std::shared_ptr<http::server_connection> conn);
+	/** \returns false if the peer is not let in, or over its rate of connections, in which case the socket is
+	 * closed */
+	bool admitted(tcp_socket& socket) const noexcept;
 public:
 	// If ssl_port is 0 tls is disabled
 	//todo remove read_timeout and connect_timeout
@@ -50,11 +103,122 @@ public:
 
 	http_server(const http_server&) = delete;
 	http_server& operator=(const http_server&) = delete;
+	~http_server() { stop(); }
 
 	void add_certificate(const std::string &cert, const std::string &key, const std::string &pass);
 
+	/** \brief replaces the certificates while the server runs, leaving the listeners and the connections alone: the
+	 * next handshakes get the new ones. The files are read on the calling thread, which should not be one running
+	 * the server.
+	 * \returns false, the certificates in use being kept, if they could not be loaded
+	 * */
+	bool reload_certificates(std::vector<ssl_utils::sni_solver::files> certificates);
+
+	/** \brief reloads the certificates whenever one of their files changes, checking them every interval while the
+	 * server runs; it can not be called once the server is running.
+	 * */
+	void watch_certificates(std::chrono::milliseconds interval);
+
+	/** \brief staples to the handshakes the OCSP responses the fetcher gets for the certificates when they are due,
+	 * checked along with the certificates (see watch_certificates). Without a fetcher, the responses stapled are the
+	 * ones other programs write next to the certificates (see ssl_utils::ocsp). It can not be called once the
+	 * server is running.
+	 * */
+	void set_ocsp_fetcher(std::shared_ptr<ssl_utils::ocsp::fetcher> fetcher);
+
+	/** \brief accepts plain connections on the Unix stream socket at the path as well, e.g. for a sidecar on the
+	 * same host: there is no TCP stack in between. A path starting with '@' names an abstract socket (Linux), with no
+	 * file; the file of any other is replaced when the server starts, unless a server still listens on it, and removed
+	 * when it stops, unless another server has bound it meanwhile. The peers have no address, so the access rules and
+	 * the connection limiter do not apply to them; the connection cap does. It can be called for several paths, not
+	 * once the server is running.
+	 * */
+	void listen_local(std::string path);
+
 	void on_client_connect(connect_callback cb) noexcept;
 
+	/** \brief answers the requests for the method and path with a fixed response, as soon as their headers are
+	 * decoded: no request nor response object is created and the connect callback is not involved.
+	 * Meant for health checks and the like; it can not be called once the server is running.
+	 * */
+	void add_static_route(http_method method, std::string path, http::http_response preamble, std::string body = {});
+
+	/** \brief closes the connections of the peers the rules keep out as soon as they are accepted, before any
+	 * handshake or read; it can not be called once the server is running.
+	 * */
+	void set_access_rules(std::shared_ptr<const network::cidr_matcher> rules);
+
+	/** \brief closes the connections of the peers opening them faster than the limiter allows as soon as they are
+	 * accepted, one token a connection; requests are limited on their own, see filters::rate_limit. It can not be
+	 * called once the server is running.
+	 * */
+	void set_connection_limiter(std::shared_ptr<network::rate_limiter> limiter);
+
+	/** \brief bounds the connections open at once: once they are all taken, accepting pauses until one is closed,
+	 * and the peers wait in the backlog of the listening socket. The cap can be shared by several servers (e.g. one
+	 * per thread) to bound the whole process. It can not be called once the server is running.
+	 * */
+	void set_connection_cap(std::shared_ptr<network::connection_cap> cap);
+
+	/** \brief as above, for the connections of each listener (plain and TLS) on its own; 0 for no bound. */
+	void set_listener_cap(std::size_t max);
+
+	/** \brief bounds the TLS handshakes running at once, so that their CPU can not starve the connections
+	 * established: the TLS listener pauses until a handshake is over. It can be shared as the connection cap.
+	 * */
+	void set_handshake_cap(std::shared_ptr<network::connection_cap> cap);
+
+	/** \brief runs the computations of the TLS handshakes on the threads of the pool instead of the io_service,
+	 * which does their reads and writes (see network::pooled_handshake). The connections the pool has no room for
+	 * are closed. It can be shared as the handshake cap, and can not be set once the server is
+	 * running.
+	 * */
+	void set_handshake_pool(std::shared_ptr<network::handshake_pool> pool);
+
+	/** \brief sets the length of the queue of the connections the kernel completes while the server does not
+	 * accept them, by default the largest the system allows (SOMAXCONN); it can not be called once the server is
+	 * running.
+	 * */
+	void set_backlog(int size);
+
+	/** \brief sheds the requests beyond the limit the limiter adapts to the load: they get the answer, by default a
+	 * bare 503, before the connect callback sees them. The lag of the io_service the server runs on is measured
+	 * and told to the limiter, which can be shared by several servers. It can not be called once the server is
+	 * running.
+	 * */
+	void set_concurrency_limiter(std::shared_ptr<network::concurrency_limiter> limiter,
+		std::shared_ptr<const http::prepared_response> answer = nullptr);
+
+	/** \brief bounds the TLS contexts kept besides the default one, for the certificates of the names rarely
+	 * asked: the others are built again on their next handshake. 0, the default, keeps all of them. It can not be
+	 * called once the server is running.
+	 * */
+	void set_certificate_cache(std::size_t contexts);
+
+	/** \brief lets returning TLS clients resume their session with tickets encrypted under the keys, which can be
+	 * shared by several servers (e.g. one per thread) so that a ticket issued by one is accepted by all of them.
+	 * Tickets are off by default; it can not be called once the server is running.
+	 * */
+	void set_session_tickets(std::shared_ptr<ssl_utils::ticket_keys> keys);
+
+	/** \brief as above, for the clients resuming their session by ID, whose sessions are kept in the cache. */
+	void set_session_cache(std::shared_ptr<ssl_utils::session_cache> cache);
+
+	/** \brief sets the protocol versions, ciphers, groups and early data of the TLS contexts (see
+	 * ssl_utils::tls_settings). It can not be called once the server is running.
+	 * */
+	void set_tls(ssl_utils::tls_settings settings);
+
+	/** \brief hands the encryption of what is sent on the TLS connections over to the kernel once their handshake
+	 * is over, so that responses, files included, are written as they are on the socket (see network::ktls). The
+	 * connections the kernel or their cipher do not allow it for go on in user space. Off by default; it can not be
+	 * called once the server is running.
+	 * */
+	void set_kernel_tls(bool enabled);
+
+	/** \returns the TLS handshakes completed so far, and how many of them resumed a session */
+	const ssl_utils::resumption_counters& tls_resumptions() const noexcept { return resumptions; }
+
 	void start(boost::asio::io_service &io) noexcept;
 	void stop() noexcept;
 };
@@ -0,0 +1,278 @@
+#include "cidr_matcher.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace network
+{
+
+namespace
+{
+
+constexpr uint64_t ones = ~uint64_t{0};
+
+template<typename key_t>
+key_t masked(key_t k, unsigned length) noexcept
+{
+	if(length <= 64)
+	{
+		k.high &= length ? ones << (64 - length) : 0;
+		k.low = 0;
+	}
+	else k.low &= ones << (128 - length);
+	return k;
+}
+
+template<typename key_t>
+unsigned bit(const key_t& k, unsigned i) noexcept
+{
+	return i < 64 ? (k.high >> (63 - i)) & 1 : (k.low >> (127 - i)) & 1;
+}
+
+/** \returns the number of leading bits the keys share */
+template<typename key_t>
+unsigned common_length(const key_t& a, const key_t& b) noexcept
+{
+	if(auto x = a.high ^ b.high) return __builtin_clzll(x);
+	if(auto x = a.low ^ b.low) return 64 + __builtin_clzll(x);
+	return 128;
+}
+
+/** \returns whether the key starts with the prefix of the given length */
+template<typename key_t>
+bool holds(const key_t& prefix, unsigned length, const key_t& k) noexcept
+{
+	if(length <= 64) return (k.high & (length ? ones << (64 - length) : 0)) == prefix.high;
+	return k.high == prefix.high && (k.low & (ones << (128 - length))) == prefix.low;
+}
+
+/** \returns the 16 bits of the key following the first offset ones */
+template<typename key_t>
+std::size_t index(const key_t& k, unsigned offset) noexcept
+{
+	if(offset <= 48) return (k.high >> (48 - offset)) & 0xffff;
+	if(offset >= 64) return (k.low >> (112 - offset)) & 0xffff;
+	return ((k.high << (offset - 48)) | (k.low >> (112 - offset))) & 0xffff;
+}
+
+/** Sets with fewer blocks of a family are better off without the table of that family. */
+constexpr std::size_t shortcut_threshold = 1024;
+
+}
+
+cidr_matcher::rule cidr_matcher::parse(const std::string& cidr, bool allow)
+{
+	auto slash = cidr.find('/');
+	boost::system::error_code ec;
+	auto network = boost::asio::ip::address::from_string(cidr.substr(0, slash), ec);
+	if(ec) throw std::invalid_argument{"invalid network address in " + cidr};
+
+	unsigned max = network.is_v4() ? 32 : 128;
+	unsigned length = max;
+	if(slash != std::string::npos)
+	{
+		auto digits = cidr.substr(slash + 1);
+		if(digits.empty() || digits.size() > 3 || digits.find_first_not_of("0123456789") != std::string::npos)
+			throw std::invalid_argument{"invalid prefix length in " + cidr};
+		length = std::stoul(digits);
+		if(length > max) throw std::invalid_argument{"prefix length out of range in " + cidr};
+	}
+	return rule{network, static_cast<uint8_t>(length), allow};
+}
+
+cidr_matcher cidr_matcher::from_file(const std::string& file)
+{
+	std::ifstream in{file};
+	if(!in) throw std::runtime_error{"cannot open " + file};
+
+	std::vector<rule> rules;
+	bool allows{false};
+	std::string line;
+	std::size_t number{0};
+	while(std::getline(in, line))
+	{
+		++number;
+		std::istringstream fields{line};
+		std::string action, block, extra;
+		if(!(fields >> action) || action[0] == '#') continue;
+		if((action != "allow" && action != "deny") || !(fields >> block) || fields >> extra)
+			throw std::runtime_error{file + ":" + std::to_string(number) + ": expected \"allow|deny <block>\""};
+		try
+		{
+			rules.push_back(parse(block, action == "allow"));
+		}
+		catch(const std::invalid_argument& e)
+		{
+			throw std::runtime_error{file + ":" + std::to_string(number) + ": " + e.what()};
+		}
+		allows = allows || rules.back().allow;
+	}
+	return cidr_matcher{rules, !allows};
+}
+
+cidr_matcher::cidr_matcher(const std::vector<rule>& rules, bool allow_others)
+	: allow_others{allow_others}
+{
+	// the root stands for ::/0, which holds every address: insertions and lookups start from it
+	nodes.push_back(node{key{0, 0}, 0, verdict::none, {-1, -1}});
+	std::size_t v4{0}, v6{0};
+	key v6_base{0, 0};
+	unsigned v6_common{128};
+	for(const auto& r : rules)
+	{
+		auto k = to_key(r.network);
+		auto length = r.network.is_v4() ? std::min<unsigned>(r.length, 32) + 96 : std::min<unsigned>(r.length, 128);
+		insert(k, static_cast<uint8_t>(length), r.allow ? verdict::allow : verdict::deny);
+		if(r.network.is_v4())
+		{
+			++v4;
+			continue;
+		}
+		k = masked(k, length);
+		v6_common = v6++ ? std::min({v6_common, common_length(v6_base, k), length}) : length;
+		v6_base = k;
+	}
+	nodes.shrink_to_fit();
+
+	if(v4 >= shortcut_threshold)
+		shortcuts.push_back(make_shortcut(key{0, uint64_t{0xffff} << 32}, 96));
+	if(v6 >= shortcut_threshold)
+	{
+		auto offset = std::min(v6_common, 112u);
+		shortcuts.push_back(make_shortcut(masked(v6_base, offset), static_cast<uint8_t>(offset)));
+	}
+}
+
+cidr_matcher::shortcut cidr_matcher::make_shortcut(key base, uint8_t offset) const
+{
+	shortcut s{base, offset, std::vector<shortcut::entry>(1 << 16)};
+	unsigned end = offset + 16;
+	for(uint64_t i = 0; i < s.entries.size(); ++i)
+	{
+		// the first address of the range, walked down to the first node telling its addresses apart
+		auto k = base;
+		if(offset >= 64) k.low |= i << (112 - offset);
+		else if(offset <= 48) k.high |= i << (48 - offset);
+		else
+		{
+			k.high |= i >> (offset - 48);
+			k.low |= i << (112 - offset);
+		}
+
+		auto& e = s.entries[i];
+		e = shortcut::entry{-1, verdict::none};
+		int32_t current = 0;
+		while(current >= 0)
+		{
+			const auto& n = nodes[current];
+			if(n.length >= end)
+			{
+				e.node = current;
+				break;
+			}
+			if(!holds(n.prefix, n.length, k)) break;
+			if(n.value != verdict::none) e.best = n.value;
+			current = n.children[bit(k, n.length)];
+		}
+	}
+	return s;
+}
+
+cidr_matcher::key cidr_matcher::to_key(const boost::asio::ip::address& a) noexcept
+{
+	if(a.is_v4()) return key{0, (uint64_t{0xffff} << 32) | a.to_v4().to_ulong()};
+	auto bytes = a.to_v6().to_bytes();
+	key k{0, 0};
+	for(std::size_t i = 0; i < 8; ++i)
+	{
+		k.high = (k.high << 8) | bytes[i];
+		k.low = (k.low << 8) | bytes[i + 8];
+	}
+	return k;
+}
+
+void cidr_matcher::insert(key k, uint8_t length, verdict value)
+{
+	k = masked(k, length);
+	auto add = [this](key k, uint8_t length, verdict value)
+	{
+		nodes.push_back(node{k, length, value, {-1, -1}});
+		return static_cast<int32_t>(nodes.size() - 1);
+	};
+
+	// every node on the way holds k, and is shorter
+	int32_t current = 0;
+	while(true)
+	{
+		if(nodes[current].length == length)
+		{
+			nodes[current].value = value;
+			return;
+		}
+
+		auto side = bit(k, nodes[current].length);
+		auto child = nodes[current].children[side];
+		if(child < 0)
+		{
+			auto leaf = add(k, length, value);
+			nodes[current].children[side] = leaf;
+			return;
+		}
+
+		auto child_prefix = nodes[child].prefix;
+		auto child_length = nodes[child].length;
+		auto common = std::min({common_length(k, child_prefix), unsigned{length}, unsigned{child_length}});
+		if(common == child_length)
+		{
+			current = child;
+			continue;
+		}
+
+		if(common == length)
+		{
+			// the new block holds the child
+			auto inner = add(k, length, value);
+			nodes[inner].children[bit(child_prefix, length)] = child;
+			nodes[current].children[side] = inner;
+			return;
+		}
+
+		// both diverge after their common prefix: a branch without a verdict of its own
+		auto branch = add(masked(k, common), static_cast<uint8_t>(common), verdict::none);
+		auto leaf = add(k, length, value);
+		nodes[branch].children[bit(k, common)] = leaf;
+		nodes[branch].children[bit(child_prefix, common)] = child;
+		nodes[current].children[side] = branch;
+		return;
+	}
+}
+
+bool cidr_matcher::allowed(const boost::asio::ip::address& a) const noexcept
+{
+	auto k = to_key(a);
+	auto result = verdict::none;
+	int32_t current = 0;
+	for(const auto& s : shortcuts)
+		if(holds(s.base, s.offset, k))
+		{
+			const auto& e = s.entries[index(k, s.offset)];
+			current = e.node;
+			result = e.best;
+			break;
+		}
+
+	while(current >= 0)
+	{
+		const auto& n = nodes[current];
+		// the bits skipped since the parent must match too
+		if(!holds(n.prefix, n.length, k)) break;
+		if(n.value != verdict::none) result = n.value;
+		if(n.length == 128) break;
+		current = n.children[bit(k, n.length)];
+	}
+	return result == verdict::none ? allow_others : result == verdict::allow;
+}
+
+}
@@ -0,0 +1,103 @@
+#ifndef DOORMAT_NETWORK_CIDR_MATCHER_H
+#define DOORMAT_NETWORK_CIDR_MATCHER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/asio/ip/address.hpp>
+
+namespace network
+{
+
+/** \brief tells whether addresses are let in, by the longest of the CIDR blocks of a set that holds them.
+ *
+ * Blocks of both families live in a single path-compressed binary trie (a Patricia trie), IPv4 ones as the
+ * IPv4-mapped IPv6 blocks they amount to, so that clients of dual-stack sockets are matched alike. Nodes are laid
+ * out in one array and only branch where blocks differ; visiting one costs a couple of 64-bit comparisons.
+ * Large sets get a table per family, indexed by the 16 bits following the prefix all the blocks of the family
+ * share (e.g. the first 16 bits of IPv4 addresses), which tells where the lookup continues in the trie: most
+ * lookups then visit a few nodes only, instead of one per level of a deep trie.
+ *
+ * The matcher can not be changed once built, hence lookups need no lock; to change the rules, build another one.
+ * */
+class cidr_matcher
+{
+public:
+	struct rule
+	{
+		boost::asio::ip::address network;
+		/** Prefix length, in bits of the network's own family. */
+		uint8_t length;
+		bool allow;
+	};
+
+	/** \brief parses a block in CIDR notation, as in "10.0.0.0/8" or "2001:db8::/32"; the bits beyond the prefix
+	 * are ignored. An address alone is a block of its own.
+	 * \throws std::invalid_argument if the block is not valid
+	 * */
+	static rule parse(const std::string& cidr, bool allow = true);
+
+	/** \brief reads a file with one "allow <block>" or "deny <block>" per line; empty lines and the ones starting
+	 * with '#' are skipped. The addresses no block holds are let in only if the file allows nothing.
+	 * \throws std::runtime_error if the file can not be read or a line is not valid
+	 * */
+	static cidr_matcher from_file(const std::string& file);
+
+	/** \param allow_others whether the addresses no rule holds are let in
+	 * When rules repeat a block, the last one wins.
+	 * */
+	cidr_matcher(const std::vector<rule>& rules, bool allow_others);
+
+	bool allowed(const boost::asio::ip::address& a) const noexcept;
+
+	/** \returns the number of nodes of the trie */
+	std::size_t size() const noexcept { return nodes.size(); }
+
+private:
+	/** \brief an IPv6 address, or prefix, as two big-endian halves. */
+	struct key
+	{
+		uint64_t high;
+		uint64_t low;
+	};
+
+	enum class verdict : uint8_t { none, allow, deny };
+
+	struct node
+	{
+		key prefix;
+		/** Bits of the prefix; the key bit of this index picks the child. */
+		uint8_t length;
+		verdict value;
+		int32_t children[2];
+	};
+
+	/** \brief the trie node and verdict reached by the addresses starting with base and the index bits. */
+	struct shortcut
+	{
+		struct entry
+		{
+			/** The node the lookup goes on with, if any. */
+			int32_t node;
+			verdict best;
+		};
+
+		key base;
+		/** Bits of the base; the following 16 index the entries. */
+		uint8_t offset;
+		std::vector<entry> entries;
+	};
+
+	static key to_key(const boost::asio::ip::address& a) noexcept;
+	void insert(key k, uint8_t length, verdict value);
+	shortcut make_shortcut(key base, uint8_t offset) const;
+
+	std::vector<node> nodes;
+	/** Empty, or one for IPv4 and possibly one for IPv6. */
+	std::vector<shortcut> shortcuts;
+	bool allow_others;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_CIDR_MATCHER_H
@@ -6,10 +6,14 @@
 namespace network 
 {
 
+constexpr int dns_connector_factory::resolve_timeout;
+constexpr int dns_connector_factory::connect_timeout;
+
 dns_connector_factory::dns_connector_factory(boost::asio::io_service& io, std::chrono::milliseconds connector_timeout)
 	: io{io}
 	, conn_timeout{connector_timeout}
 	, dead{std::make_shared<bool>(false)}
+	, local{io, connector_timeout}
 {}
 
 dns_connector_factory::~dns_connector_factory()
@@ -22,6 +26,9 @@ void dns_connector_factory::get_connector(const std::string& address, uint16_t p
 {
 	if ( stopping ) return error_cb(1);
 
+	if ( local_connector_factory::is_local(address) )
+		return local.get_connector(address, port, tls, std::move(connector_cb), std::move(error_cb));
+
 	dns_resolver(address, port, tls, std::move(connector_cb), std::move(error_cb));
 }
 
@@ -119,9 +126,11 @@ http::proto_version dns_connector_factory::chose_protocol(std::shared_ptr<dns_co
 
 	//ALPN
 	SSL_get0_alpn_selected(ssl_handle, &proto, &len);
+#ifndef OPENSSL_NO_NEXTPROTONEG
 	if( !len )
 		//NPN
 		SSL_get0_next_proto_negotiated(ssl_handle, &proto, &len);
+#endif
 
 	http::proto_version v = http::proto_version::HTTP10;
 	if(len >= 2 && proto[0] == 'h' && proto[1] == '2')
@@ -226,6 +235,7 @@ bool select_h1(const unsigned char **out, unsigned char *outlen,
 		 select_proto(out, outlen, in, inlen, HTTP1_0_ALPN);
 }
 
+#ifndef OPENSSL_NO_NEXTPROTONEG
 int client_select_next_proto_cb(SSL *ssl, unsigned char **out,
 								unsigned char *outlen, const unsigned char *in,
 								unsigned int inlen, void *arg)
@@ -237,6 +247,7 @@ int client_select_next_proto_cb(SSL *ssl, unsigned char **out,
 	}
 	return SSL_TLSEXT_ERR_OK;
 }
+#endif
 
 const std::vector<unsigned char>& get_default_alpn()
 {
@@ -264,10 +275,17 @@ const std::vector<unsigned char>& get_default_alpn()
 
 boost::asio::ssl::context dns_connector_factory::init_ssl_ctx()
 {
-	boost::asio::ssl::context ctx{boost::asio::ssl::context::sslv23};
-	// enable NPN for http2
+	boost::asio::ssl::context ctx{boost::asio::ssl::context::sslv23_client};
 	auto ctx_h = ctx.native_handle();
+	// TLS 1.3 as well where OpenSSL has it, and X25519 first
+	SSL_CTX_set_options(ctx_h, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_CTX_set1_groups_list(ctx_h, "X25519:P-256:P-384");
+#endif
+#ifndef OPENSSL_NO_NEXTPROTONEG
+	// enable NPN for http2
 	SSL_CTX_set_next_proto_select_cb(ctx_h, client_select_next_proto_cb, nullptr);
+#endif
 	// enable ALPN for http2
 	SSL_CTX_set_alpn_protos(ctx_h, get_default_alpn().data(), get_default_alpn().size());
 	return ctx;
@@ -2,6 +2,7 @@
 #define DOORMAT_DNS_CONNECTOR_FACTORY_H
 
 #include "communicator_factory.h"
+#include "local_communicator_factory.h"
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
@@ -12,6 +13,7 @@
 namespace network
 {
 
+/** \brief connects to the upstreams by name or address; the "unix:" ones are left to a local_connector_factory. */
 class dns_connector_factory : public connector_factory
 {
 public:
@@ -19,7 +21,7 @@ public:
 	~dns_connector_factory();
 
 	void get_connector(const std::string& address, uint16_t port, bool tls, connector_callback_t, error_callback_t) override;
-	void stop() override { stopping = true; }
+	void stop() override { stopping = true; local.stop(); }
 
 private:
 	using ssl_socket_t = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
@@ -40,6 +42,7 @@ private:
 	std::chrono::milliseconds conn_timeout;
 	// ugly workaround to ensure in callbacks that we are still alive
 	std::shared_ptr<bool> dead;
+	local_connector_factory local;
 
 
 	static thread_local boost::asio::ssl::context ctx;
@@ -0,0 +1,105 @@
+#include "local_communicator_factory.h"
+#include "../../connector.h"
+
+#include <stdexcept>
+
+// every member is compiled, not only the ones the factory uses
+template class server::connector<server::local_socket>;
+
+namespace network
+{
+
+namespace
+{
+
+const std::string scheme{"unix:"};
+
+}
+
+constexpr int local_connector_factory::connect_timeout;
+
+local_connector_factory::local_connector_factory(boost::asio::io_service& io, std::chrono::milliseconds connector_timeout)
+	: io{io}
+	, conn_timeout{connector_timeout}
+	, dead{std::make_shared<bool>(false)}
+{}
+
+local_connector_factory::~local_connector_factory()
+{
+	*dead = true;
+}
+
+bool local_connector_factory::is_local(const std::string& address) noexcept
+{
+	return address.compare(0, scheme.size(), scheme) == 0;
+}
+
+boost::asio::local::stream_protocol::endpoint local_connector_factory::endpoint(const std::string& address)
+{
+	auto path = is_local(address) ? address.substr(scheme.size()) : address;
+	if(path.empty())
+		throw std::invalid_argument{"The path of a Unix socket can not be empty"};
+	// the name of an abstract socket starts with a null byte
+	if(path[0] == '@')
+		path[0] = '\0';
+	return {path};
+}
+
+void local_connector_factory::get_connector(const std::string& address, uint16_t, bool tls,
+	connector_callback_t connector_cb, error_callback_t error_cb)
+{
+	if ( stopping ) return error_cb(1);
+
+	boost::asio::local::stream_protocol::endpoint ep;
+	try
+	{
+		ep = endpoint(address);
+	}
+	catch(const std::exception& e)
+	{
+		LOGERROR("invalid Unix socket address ", address, ": ", e.what());
+		return error_cb(3);
+	}
+	if ( tls )
+	{
+		LOGERROR("TLS is not spoken over Unix sockets: ", address);
+		return error_cb(3);
+	}
+
+	auto socket = std::make_shared<server::local_socket>(io);
+	auto connect_timer =
+		std::make_shared<boost::asio::deadline_timer>(io);
+	connect_timer->expires_from_now(boost::posix_time::milliseconds(connect_timeout));
+	connect_timer->async_wait([socket, connect_timer, error_cb](const boost::system::error_code &ec)
+	{
+		if(!ec)
+		{
+			socket->cancel();
+			error_cb(4);
+		}
+	});
+	socket->async_connect(ep,
+		[this, socket, connector_cb = std::move(connector_cb), error_cb, connect_timer, dead=dead]
+		(const boost::system::error_code &ec)
+		{
+			if(*dead)
+				return;
+			connect_timer->cancel();
+			if ( ec )
+			{
+				// the timer told the error already
+				if(ec != boost::system::errc::operation_canceled)
+				{
+					LOGERROR(ec.message());
+					error_cb(3);
+				}
+				return;
+			}
+
+			auto connector = std::make_shared<server::connector<server::local_socket>>(std::move(socket));
+			connector->set_timeout(conn_timeout);
+			connector_cb(std::move(connector), http::proto_version::HTTP11);
+		});
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef DOORMAT_LOCAL_CONNECTOR_FACTORY_H
+#define DOORMAT_LOCAL_CONNECTOR_FACTORY_H
+
+#include "communicator_factory.h"
+
+#include <boost/asio.hpp>
+
+#include <memory>
+#include <chrono>
+
+namespace network
+{
+
+/** \brief connects to the upstreams listening on Unix stream sockets on the same host, e.g. a sidecar: there is no
+ * TCP stack in between, nor a name to resolve.
+ *
+ * The address is "unix:" followed by the path of the socket, or by '@' and the name of an abstract socket (Linux);
+ * the port is ignored, and TLS is not spoken over them.
+ * */
+class local_connector_factory : public connector_factory
+{
+public:
+	local_connector_factory(boost::asio::io_service &io, std::chrono::milliseconds connector_timeout);
+	~local_connector_factory();
+
+	void get_connector(const std::string& address, uint16_t port, bool tls, connector_callback_t, error_callback_t) override;
+	void stop() override { stopping = true; }
+
+	/** \returns true if the address is the one of a Unix socket, starting with "unix:" */
+	static bool is_local(const std::string& address) noexcept;
+
+	/** \returns the endpoint of the Unix socket of the address, abstract if its path starts with '@' */
+	static boost::asio::local::stream_protocol::endpoint endpoint(const std::string& address);
+
+private:
+	bool stopping{false};
+	boost::asio::io_service &io;
+	std::chrono::milliseconds conn_timeout;
+	// ugly workaround to ensure in callbacks that we are still alive
+	std::shared_ptr<bool> dead;
+
+	static constexpr int connect_timeout = 2000;
+};
+
+}
+
+#endif //DOORMAT_LOCAL_CONNECTOR_FACTORY_H
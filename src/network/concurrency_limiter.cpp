@@ -0,0 +1,102 @@
+#include "concurrency_limiter.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace network
+{
+
+concurrency_limiter::concurrency_limiter(settings s)
+	: config{s}, current{static_cast<double>(s.initial_limit)}, last_decrease{0}
+{
+	if(s.min_limit == 0 || s.min_limit > s.max_limit || s.initial_limit < s.min_limit || s.initial_limit > s.max_limit)
+		throw std::invalid_argument{"the limits must satisfy 0 < min <= initial <= max"};
+	if(!(s.backoff > 0 && s.backoff < 1)) throw std::invalid_argument{"the backoff must be between 0 and 1"};
+}
+
+concurrency_limiter::concurrency_limiter()
+	: concurrency_limiter{settings{}}
+{}
+
+concurrency_limiter::permit concurrency_limiter::acquire()
+{
+	auto n = ++serving;
+	if(n > limit())
+	{
+		--serving;
+		++refused;
+		return nullptr;
+	}
+	return permit{this, [self = shared_from_this(), start = clock::now(), n](concurrency_limiter*)
+	{
+		--self->serving;
+		auto now = clock::now();
+		self->on_latency(now - start, n, now);
+	}};
+}
+
+void concurrency_limiter::on_lag(std::chrono::nanoseconds lag, clock::time_point now) noexcept
+{
+	if(lag > config.lag_target) decrease(now);
+}
+
+void concurrency_limiter::on_latency(std::chrono::nanoseconds latency, std::size_t in_flight, clock::time_point now) noexcept
+{
+	if(config.latency_target.count() && latency > config.latency_target) return decrease(now);
+	// a limit nobody comes close to says nothing of the capacity: it must not grow for nothing
+	if(2 * in_flight >= limit()) increase();
+}
+
+void concurrency_limiter::increase() noexcept
+{
+	auto l = current.load();
+	while(l < config.max_limit && !current.compare_exchange_weak(l, std::min<double>(l + 1 / l, config.max_limit)));
+}
+
+void concurrency_limiter::decrease(clock::time_point now) noexcept
+{
+	auto t = now.time_since_epoch().count();
+	auto last = last_decrease.load();
+	if((last && t - last < std::chrono::duration_cast<clock::duration>(config.cooldown).count()) || !last_decrease.compare_exchange_strong(last, t)) return;
+	auto l = current.load();
+	while(!current.compare_exchange_weak(l, std::max<double>(l * config.backoff, config.min_limit)));
+}
+
+lag_probe::lag_probe(boost::asio::io_service& io, std::shared_ptr<concurrency_limiter> limiter,
+	std::chrono::milliseconds interval)
+	: io{io}, timer{io}, limiter{std::move(limiter)}, interval{interval}
+{}
+
+void lag_probe::start()
+{
+	if(running.exchange(true)) return;
+	schedule();
+}
+
+void lag_probe::stop()
+{
+	running = false;
+	boost::system::error_code ec;
+	timer.cancel(ec);
+}
+
+void lag_probe::schedule()
+{
+	timer.expires_from_now(interval);
+	timer.async_wait([self = shared_from_this()](const boost::system::error_code& ec)
+	{
+		if(ec || !self->running) return;
+		// the handler waits behind all the work queued so far
+		self->io.post([self, posted = concurrency_limiter::clock::now()]()
+		{
+			if(!self->running) return;
+			auto now = concurrency_limiter::clock::now();
+			auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(now - posted);
+			self->lag = lag.count();
+			self->limiter->on_lag(lag, now);
+			self->schedule();
+		});
+	});
+}
+
+}
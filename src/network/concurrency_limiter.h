@@ -0,0 +1,103 @@
+#ifndef DOORMAT_NETWORK_CONCURRENCY_LIMITER_H
+#define DOORMAT_NETWORK_CONCURRENCY_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace network
+{
+
+/** \brief bounds the requests served at once by a limit that adapts to the load, so that an overloaded server
+ * turns requests away at once instead of serving all of them late.
+ *
+ * The limit follows AIMD: it grows by one every limit requests served in time while it is being used, and shrinks
+ * by a factor when the server falls behind, i.e. when the io_services run their handlers late (see lag_probe) or
+ * when a request takes longer than the latency target. Decreases are spaced by a cooldown, so that a burst of late
+ * samples caused by a single stall counts once. Shared by the threads, it takes no lock.
+ * */
+class concurrency_limiter : public std::enable_shared_from_this<concurrency_limiter>
+{
+public:
+	using clock = std::chrono::steady_clock;
+	/** Held while a request is served; the request is over when its last copy is gone. */
+	using permit = std::shared_ptr<void>;
+
+	struct settings
+	{
+		std::size_t initial_limit{64};
+		std::size_t min_limit{4};
+		std::size_t max_limit{4096};
+		/** The most a handler may wait to be run once posted before the server is deemed behind. */
+		std::chrono::nanoseconds lag_target{std::chrono::milliseconds{20}};
+		/** The most a request may take, from its headers to the end of its response; 0 ignores latency. */
+		std::chrono::nanoseconds latency_target{std::chrono::seconds{1}};
+		/** The factor the limit is multiplied by when the server falls behind. */
+		double backoff{0.75};
+		std::chrono::nanoseconds cooldown{std::chrono::milliseconds{100}};
+	};
+
+	/** \throws std::invalid_argument if the settings make no sense */
+	explicit concurrency_limiter(settings s);
+	concurrency_limiter();
+
+	/** \returns a permit to serve a request, or null if the limit has been reached; it must be owned by a
+	 * std::shared_ptr */
+	permit acquire();
+
+	/** \brief tells how late a handler has been run by an io_service. */
+	void on_lag(std::chrono::nanoseconds lag, clock::time_point now = clock::now()) noexcept;
+
+	/** \brief tells how long a request took; permits do it when they are given back. */
+	void on_latency(std::chrono::nanoseconds latency, std::size_t in_flight, clock::time_point now = clock::now()) noexcept;
+
+	std::size_t limit() const noexcept { return static_cast<std::size_t>(current.load()); }
+	std::size_t in_flight() const noexcept { return serving.load(); }
+	/** \returns the number of requests turned away */
+	uint64_t shed() const noexcept { return refused.load(); }
+
+private:
+	void increase() noexcept;
+	void decrease(clock::time_point now) noexcept;
+
+	const settings config;
+	std::atomic<double> current;
+	std::atomic<std::size_t> serving{0};
+	std::atomic<uint64_t> refused{0};
+	/** In ticks of the clock; 0 before the first. */
+	std::atomic<clock::rep> last_decrease;
+};
+
+/** \brief measures how late an io_service runs the handlers posted to it, every interval, and tells the limiter:
+ * the lag grows with the work queued before them, before requests are served late.
+ * It must be owned by a std::shared_ptr; it runs until stop() is called.
+ * */
+class lag_probe : public std::enable_shared_from_this<lag_probe>
+{
+public:
+	lag_probe(boost::asio::io_service& io, std::shared_ptr<concurrency_limiter> limiter,
+		std::chrono::milliseconds interval = std::chrono::milliseconds{100});
+
+	void start();
+	void stop();
+
+	/** \returns the last lag measured */
+	std::chrono::nanoseconds last() const noexcept { return std::chrono::nanoseconds{lag.load()}; }
+
+private:
+	void schedule();
+
+	boost::asio::io_service& io;
+	boost::asio::steady_timer timer;
+	std::shared_ptr<concurrency_limiter> limiter;
+	std::chrono::milliseconds interval;
+	std::atomic<std::chrono::nanoseconds::rep> lag{0};
+	std::atomic<bool> running{false};
+};
+
+}
+
+#endif //DOORMAT_NETWORK_CONCURRENCY_LIMITER_H
@@ -0,0 +1,54 @@
+#include "connection_cap.h"
+
+#include <stdexcept>
+
+namespace network
+{
+
+connection_cap::connection_cap(std::size_t max)
+	: limit{max}
+{
+	if(max == 0) throw std::invalid_argument{"a connection cap must allow one at least"};
+}
+
+connection_cap::slot connection_cap::acquire()
+{
+	auto t = taken.load();
+	while(t < limit)
+		if(taken.compare_exchange_weak(t, t + 1))
+			return slot{this, [self = shared_from_this()](connection_cap*) { self->release(); }};
+	return nullptr;
+}
+
+connection_cap::slot connection_cap::acquire(std::function<void()> resume)
+{
+	if(auto s = acquire()) return s;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		waiters.push_back(std::move(resume));
+		waiting = true;
+	}
+	// a slot given back before the waiter was there would not call it
+	if(taken.load() < limit) wake();
+	return nullptr;
+}
+
+void connection_cap::release() noexcept
+{
+	--taken;
+	if(waiting.load()) wake();
+}
+
+void connection_cap::wake() noexcept
+{
+	std::vector<std::function<void()>> ready;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		ready.swap(waiters);
+		waiting = false;
+	}
+	// all of them try again: the ones losing the race wait anew
+	for(auto& r : ready) r();
+}
+
+}
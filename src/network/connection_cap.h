@@ -0,0 +1,52 @@
+#ifndef DOORMAT_NETWORK_CONNECTION_CAP_H
+#define DOORMAT_NETWORK_CONNECTION_CAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace network
+{
+
+/** \brief a bound on things open at once, e.g. connections or TLS handshakes, shared by the threads opening them.
+ *
+ * Each of them holds a slot, given back when the last copy of the slot is gone: tying it to the object the slot
+ * stands for (e.g. a socket) is enough. Who finds no free slot can leave a callback, called once by the thread
+ * giving the next one back; it should post the retry to its own io_service.
+ * It must be owned by a std::shared_ptr.
+ * */
+class connection_cap : public std::enable_shared_from_this<connection_cap>
+{
+public:
+	using slot = std::shared_ptr<void>;
+
+	/** \throws std::invalid_argument if max is 0 */
+	explicit connection_cap(std::size_t max);
+
+	/** \returns a slot, or null if all of them are taken */
+	slot acquire();
+
+	/** \brief as above; when all the slots are taken, resume is called as soon as one is given back. */
+	slot acquire(std::function<void()> resume);
+
+	/** \returns the number of slots taken */
+	std::size_t size() const noexcept { return taken.load(); }
+	std::size_t max() const noexcept { return limit; }
+
+private:
+	void release() noexcept;
+	void wake() noexcept;
+
+	const std::size_t limit;
+	std::atomic<std::size_t> taken{0};
+	std::atomic<bool> waiting{false};
+	std::mutex mutex;
+	std::vector<std::function<void()>> waiters;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_CONNECTION_CAP_H
@@ -0,0 +1,266 @@
+#include "early_data.h"
+
+#include <algorithm>
+#include <cstring>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/err.h>
+
+namespace network
+{
+
+namespace
+{
+
+void forget(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+	delete static_cast<std::weak_ptr<early_data>*>(ptr);
+}
+
+int index()
+{
+	static const int i = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, forget);
+	return i;
+}
+
+boost::system::error_code error_of(SSL* ssl, int result)
+{
+	if(SSL_get_error(ssl, result) == SSL_ERROR_ZERO_RETURN)
+		return boost::asio::error::eof;
+	auto e = ERR_get_error();
+	if(!e) return boost::asio::error::connection_reset;
+	return {static_cast<int>(e), boost::asio::error::get_ssl_category()};
+}
+
+}
+
+early_data::early_data(std::shared_ptr<ssl_socket> s)
+	: stream{std::move(s)}
+	, ssl{stream->native_handle()}
+	, stream_bio{SSL_get_rbio(ssl)}
+	, in{BIO_new(BIO_s_mem())}
+	, out{BIO_new(BIO_s_mem())}
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	BIO_up_ref(stream_bio);
+#else
+	CRYPTO_add(&stream_bio->references, 1, CRYPTO_LOCK_BIO);
+#endif
+	// an empty BIO asks for more bytes instead of telling the end of the stream
+	BIO_set_mem_eof_return(in, -1);
+	SSL_set_bio(ssl, in, out);
+	SSL_set_accept_state(ssl);
+}
+
+early_data::~early_data()
+{
+	if(!released) give_back();
+}
+
+void early_data::async_handshake(callback cb)
+{
+	SSL_set_ex_data(ssl, index(), new std::weak_ptr<early_data>{shared_from_this()});
+	auto self = shared_from_this();
+	auto chunk = std::make_shared<std::vector<char>>(incoming.size());
+	step(boost::asio::buffer(*chunk), [self, chunk, cb](const boost::system::error_code& ec, std::size_t bytes)
+	{
+		if(!ec) self->head.assign(chunk->data(), bytes);
+		cb(ec);
+	}, true);
+}
+
+void early_data::async_read_some(boost::asio::mutable_buffer buffer, io_callback cb)
+{
+	if(!head.empty())
+	{
+		auto bytes = std::min(head.size(), boost::asio::buffer_size(buffer));
+		std::memcpy(boost::asio::buffer_cast<void*>(buffer), head.data(), bytes);
+		head.erase(0, bytes);
+		last_early = true;
+		return complete(std::move(cb), {}, bytes);
+	}
+	if(released) return complete(std::move(cb), {}, 0);
+	step(buffer, std::move(cb), false);
+}
+
+void early_data::async_write(boost::asio::const_buffer buffer, io_callback cb)
+{
+	if(released)
+		return boost::asio::async_write(*stream, boost::asio::const_buffers_1{buffer}, std::move(cb));
+	if(state == phase::handshake)
+	{
+		// the session can write again once the client has finished
+		auto self = shared_from_this();
+		deferred.emplace_back([self, buffer, cb]() { self->async_write(buffer, cb); });
+		return;
+	}
+
+	auto data = boost::asio::buffer_cast<const char*>(buffer);
+	auto size = boost::asio::buffer_size(buffer);
+	for(std::size_t done = 0; done < size;)
+	{
+		ERR_clear_error();
+		std::size_t written{0};
+		int result;
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+		if(state == phase::early)
+			result = SSL_write_early_data(ssl, data + done, size - done, &written);
+		else
+#endif
+		{
+			result = SSL_write(ssl, data + done, static_cast<int>(size - done));
+			if(result > 0) written = static_cast<std::size_t>(result);
+		}
+		if(result <= 0) return complete(std::move(cb), error_of(ssl, result), 0);
+		done += written;
+	}
+	auto self = shared_from_this();
+	flush([self, cb, size](const boost::system::error_code& ec) { self->complete(cb, ec, ec ? 0 : size); });
+}
+
+std::shared_ptr<early_data> early_data::of(SSL* ssl)
+{
+	auto found = static_cast<std::weak_ptr<early_data>*>(SSL_get_ex_data(ssl, index()));
+	return found ? found->lock() : nullptr;
+}
+
+void early_data::step(boost::asio::mutable_buffer buffer, io_callback cb, bool handshaking)
+{
+	auto data = boost::asio::buffer_cast<char*>(buffer);
+	auto size = boost::asio::buffer_size(buffer);
+	int result{0};
+	for(;;)
+	{
+		ERR_clear_error();
+		if(state == phase::early)
+		{
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+			std::size_t bytes{0};
+			result = SSL_read_early_data(ssl, data, size, &bytes);
+			if(result == SSL_READ_EARLY_DATA_ERROR) break;
+			if(result == SSL_READ_EARLY_DATA_SUCCESS)
+			{
+				if(!bytes) continue;
+				last_early = true;
+				// the flight of the server goes out meanwhile
+				flush(nullptr);
+				return complete(std::move(cb), {}, bytes);
+			}
+#endif
+			// no early data, or no more of it
+			state = phase::handshake;
+		}
+		else if(state == phase::handshake)
+		{
+			result = SSL_do_handshake(ssl);
+			if(result != 1) break;
+			state = phase::connected;
+			auto waiting = std::move(deferred);
+			deferred.clear();
+			for(auto& w : waiting) w();
+		}
+		else
+		{
+			// a record cut in half stays in the session: the stream reads the rest
+			if(!BIO_pending(in)) return release(std::move(cb));
+			if(handshaking)
+			{
+				// the client sent more along with its Finished: it is read through here
+				flush(nullptr);
+				return complete(std::move(cb), {}, 0);
+			}
+			result = SSL_read(ssl, data, static_cast<int>(size));
+			if(result > 0)
+			{
+				last_early = false;
+				flush(nullptr);
+				return complete(std::move(cb), {}, static_cast<std::size_t>(result));
+			}
+			if(SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ) break;
+		}
+	}
+
+	flush(nullptr);
+	if(SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ)
+		return complete(std::move(cb), error_of(ssl, result), 0);
+	auto self = shared_from_this();
+	receive([self, buffer, cb, handshaking](const boost::system::error_code& ec)
+	{
+		if(ec) return self->complete(cb, ec, 0);
+		self->step(buffer, cb, handshaking);
+	});
+}
+
+void early_data::receive(callback then)
+{
+	auto self = shared_from_this();
+	stream->next_layer().async_read_some(boost::asio::buffer(incoming),
+		[self, then](const boost::system::error_code& ec, std::size_t bytes)
+		{
+			if(!ec) BIO_write(self->in, self->incoming.data(), static_cast<int>(bytes));
+			then(ec);
+		});
+}
+
+void early_data::flush(callback then)
+{
+	if(then) flushed.push_back(std::move(then));
+	if(!sending) send();
+}
+
+void early_data::send()
+{
+	char* data{nullptr};
+	auto pending = BIO_get_mem_data(out, &data);
+	if(pending <= 0)
+	{
+		auto waiting = std::move(flushed);
+		flushed.clear();
+		for(auto& w : waiting) w({});
+		return;
+	}
+	outgoing.assign(data, static_cast<std::size_t>(pending));
+	BIO_reset(out);
+	sending = true;
+	auto waiting = std::make_shared<std::vector<callback>>(std::move(flushed));
+	flushed.clear();
+	auto self = shared_from_this();
+	boost::asio::async_write(stream->next_layer(), boost::asio::buffer(outgoing),
+		[self, waiting](const boost::system::error_code& ec, std::size_t)
+		{
+			self->sending = false;
+			for(auto& w : *waiting) w(ec);
+			// what was written meanwhile, unless the session was given back
+			if(!self->released && !self->sending && (BIO_pending(self->out) || !self->flushed.empty()))
+				self->send();
+		});
+}
+
+void early_data::release(io_callback cb)
+{
+	auto self = shared_from_this();
+	flush([self, cb](const boost::system::error_code& ec)
+	{
+		if(ec) return self->complete(cb, ec, 0);
+		// a write came in the meantime: it goes out first
+		if(self->sending || BIO_pending(self->out)) return self->release(cb);
+		self->give_back();
+		self->complete(cb, {}, 0);
+	});
+}
+
+void early_data::give_back() noexcept
+{
+	// the memory BIOs go with the session
+	SSL_set_bio(ssl, stream_bio, stream_bio);
+	in = out = nullptr;
+	released = true;
+	last_early = false;
+}
+
+void early_data::complete(io_callback cb, const boost::system::error_code& ec, std::size_t bytes)
+{
+	stream->get_io_service().post([cb, ec, bytes]() { cb(ec, bytes); });
+}
+
+}
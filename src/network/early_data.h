@@ -0,0 +1,106 @@
+#ifndef DOORMAT_NETWORK_EARLY_DATA_H
+#define DOORMAT_NETWORK_EARLY_DATA_H
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+
+namespace network
+{
+
+/** \brief the server side of a TLS 1.3 handshake reading early data (0-RTT) for a boost SSL stream, whose own
+ * handshake turns early data down.
+ *
+ * Until the handshake is over the session runs on memory BIOs of its own, pumped through the TCP socket: the first
+ * requests of a client resuming its session are read as soon as its first flight arrives, and can be answered
+ * (0.5-RTT data) before its Finished. Once the handshake is over and nothing is left in between, the session is
+ * given back to the stream, which reads and writes from then on.
+ *
+ * Early data can be replayed by whoever captured it: the context decides which handshakes read it (see
+ * ssl_utils::tls_settings), and early() tells the bytes read last which came with it. It runs on the thread of the
+ * io_service of the socket, one read and one write at a time, as the stream does.
+ * */
+class early_data : public std::enable_shared_from_this<early_data>
+{
+public:
+	using ssl_socket = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+	using callback = std::function<void(const boost::system::error_code&)>;
+	using io_callback = std::function<void(const boost::system::error_code&, std::size_t)>;
+
+	/** \brief takes the session of the stream over, before its handshake starts. */
+	explicit early_data(std::shared_ptr<ssl_socket> stream);
+	early_data(const early_data&) = delete;
+	early_data& operator=(const early_data&) = delete;
+	~early_data();
+
+	/** \brief handshakes until the first early data arrives, or until the handshake is over if none does. of()
+	 * finds this from then on. */
+	void async_handshake(callback cb);
+
+	/** \returns true while the session is not given back to the stream: reads and writes go through here */
+	bool active() const noexcept { return !released; }
+
+	/** \returns true if the bytes read last came as early data */
+	bool early() const noexcept { return last_early; }
+
+	/** \brief reads what the client sent, early data first. The callback gets 0 bytes, without error, once the
+	 * session is given back to the stream. */
+	void async_read_some(boost::asio::mutable_buffer buffer, io_callback cb);
+
+	/** \brief writes the whole buffer: 0.5-RTT data until the handshake is over. */
+	void async_write(boost::asio::const_buffer buffer, io_callback cb);
+
+	/** \returns the early data handshake the session is running, if any */
+	static std::shared_ptr<early_data> of(SSL* ssl);
+
+private:
+	enum class phase
+	{
+		/** Reading early data. */
+		early,
+		/** The early data is over: waiting for the Finished of the client. */
+		handshake,
+		connected
+	};
+
+	/** \brief advances the session until it has plaintext for the buffer or needs bytes from the client.
+	 * \param handshaking whether to stop, without reading, once connected
+	 * */
+	void step(boost::asio::mutable_buffer buffer, io_callback cb, bool handshaking);
+	/** \brief reads what the client sent into the memory BIO. */
+	void receive(callback then);
+	/** \brief writes what the session wrote to the memory BIO; then is called once it is on the socket. */
+	void flush(callback then);
+	void send();
+	/** \brief gives the session back to the stream once everything written is on the socket. */
+	void release(io_callback cb);
+	void give_back() noexcept;
+	void complete(io_callback cb, const boost::system::error_code& ec, std::size_t bytes);
+
+	std::shared_ptr<ssl_socket> stream;
+	SSL* ssl;
+	/** The BIO of the stream, given back with the session. */
+	BIO* stream_bio;
+	BIO* in;
+	BIO* out;
+	phase state{phase::early};
+	bool released{false};
+	bool last_early{false};
+	/** Early data read along with the handshake, not read yet. */
+	std::string head;
+	std::array<char, 16384> incoming;
+	std::string outgoing;
+	bool sending{false};
+	std::vector<callback> flushed;
+	/** Writes waiting for the Finished of the client. */
+	std::vector<std::function<void()>> deferred;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_EARLY_DATA_H
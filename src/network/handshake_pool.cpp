@@ -0,0 +1,76 @@
+#include "handshake_pool.h"
+#include "../utils/log_wrapper.h"
+
+#include <stdexcept>
+
+namespace network
+{
+
+handshake_pool::handshake_pool(std::size_t threads, std::size_t queue)
+	: limit{queue}
+{
+	if(threads == 0) throw std::invalid_argument{"a handshake pool needs one thread at least"};
+	if(queue == 0) throw std::invalid_argument{"a handshake pool needs room for one job at least"};
+	workers.reserve(threads);
+	for(std::size_t i = 0; i < threads; ++i)
+		workers.emplace_back([this]() { run(); });
+}
+
+handshake_pool::~handshake_pool()
+{
+	std::deque<job> dropped;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		stopping = true;
+		dropped.swap(jobs);
+	}
+	ready.notify_all();
+	for(auto& w : workers) w.join();
+}
+
+bool handshake_pool::submit(job j)
+{
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		if(stopping || jobs.size() >= limit)
+		{
+			++refused;
+			return false;
+		}
+		jobs.push_back(std::move(j));
+	}
+	ready.notify_one();
+	return true;
+}
+
+std::size_t handshake_pool::queued() const
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	return jobs.size();
+}
+
+void handshake_pool::run()
+{
+	for(;;)
+	{
+		job j;
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if(stopping) return;
+			j = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		try
+		{
+			j();
+		}
+		catch(const std::exception& e)
+		{
+			LOGERROR("handshake job failed: ", e.what());
+		}
+		++done;
+	}
+}
+
+}
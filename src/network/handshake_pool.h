@@ -0,0 +1,63 @@
+#ifndef DOORMAT_NETWORK_HANDSHAKE_POOL_H
+#define DOORMAT_NETWORK_HANDSHAKE_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace network
+{
+
+/** \brief threads of their own for the TLS handshakes, so that their private key operations do not delay the
+ * connections served by the io_services.
+ *
+ * Jobs wait in a bounded queue: when it is full they are refused, and the caller should turn the connection away
+ * rather than run the handshake itself. It can be shared by several servers (e.g. one per thread); the jobs post
+ * their results to the io_services, which must outlive the pool.
+ * */
+class handshake_pool
+{
+public:
+	using job = std::function<void()>;
+
+	/** \throws std::invalid_argument if threads or queue is 0 */
+	explicit handshake_pool(std::size_t threads, std::size_t queue = 1024);
+
+	handshake_pool(const handshake_pool&) = delete;
+	handshake_pool& operator=(const handshake_pool&) = delete;
+
+	/** \brief waits for the jobs running; the ones still queued are dropped without being run. */
+	~handshake_pool();
+
+	/** \returns false, the job being dropped, if the queue is full */
+	bool submit(job j);
+
+	std::size_t threads() const noexcept { return workers.size(); }
+	/** \returns the jobs waiting for a thread */
+	std::size_t queued() const;
+	/** \returns the jobs refused so far */
+	std::size_t rejected() const noexcept { return refused.load(); }
+	/** \returns the jobs run so far */
+	std::size_t completed() const noexcept { return done.load(); }
+
+private:
+	void run();
+
+	const std::size_t limit;
+	mutable std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<job> jobs;
+	bool stopping{false};
+	std::atomic<std::size_t> refused{0};
+	std::atomic<std::size_t> done{0};
+	std::vector<std::thread> workers;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_HANDSHAKE_POOL_H
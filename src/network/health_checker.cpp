@@ -0,0 +1,103 @@
+#include "health_checker.h"
+#include "../http_client.h"
+#include "../http/client/client_connection.h"
+#include "../http/client/request.h"
+#include "../http/client/response.h"
+#include "../utils/log_wrapper.h"
+
+namespace network
+{
+
+health_checker::health_checker(boost::asio::io_service& io, std::shared_ptr<upstream_group> group,
+	std::unique_ptr<connector_factory> factory, std::string path, std::chrono::milliseconds interval,
+	std::chrono::milliseconds timeout)
+	: io{io}
+	, group{std::move(group)}
+	, factory{std::move(factory)}
+	, path{std::move(path)}
+	, interval{interval}
+	, timeout{timeout}
+	, timer{io}
+{}
+
+void health_checker::start()
+{
+	stopped = false;
+	for(std::size_t i = 0; i < group->size(); ++i)
+		probe(i);
+	schedule();
+}
+
+void health_checker::stop()
+{
+	stopped = true;
+	timer.cancel();
+	factory->stop();
+}
+
+void health_checker::schedule()
+{
+	timer.expires_from_now(boost::posix_time::milliseconds(interval.count()));
+	std::weak_ptr<health_checker> self = this->shared_from_this();
+	timer.async_wait([self](const boost::system::error_code& ec)
+	{
+		auto checker = self.lock();
+		if(ec || !checker || checker->stopped) return;
+		for(std::size_t i = 0; i < checker->group->size(); ++i)
+			checker->probe(i);
+		checker->schedule();
+	});
+}
+
+void health_checker::probe(std::size_t i)
+{
+	const auto& ep = (*group)[i];
+	// the outcome is reported once, whatever comes first among answer, error and timeout
+	auto reported = std::make_shared<bool>(false);
+	std::weak_ptr<health_checker> self = this->shared_from_this();
+	auto report = [self, i, reported](bool success)
+	{
+		if(*reported) return;
+		*reported = true;
+		if(auto checker = self.lock())
+			checker->group->probed(i, success);
+	};
+
+	LOGTRACE("probing ", ep.key());
+	factory->get_connector(ep.address, ep.port, ep.tls, client::detail::handler_from_connector_factory(
+		[report, path = path, host = ep.address, timeout = timeout](std::shared_ptr<http::client_connection> conn)
+		{
+			conn->on_timeout(timeout, [report](auto conn)
+			{
+				report(false);
+				conn->close();
+			});
+			auto handlers = conn->create_transaction();
+			auto& req = handlers.first;
+			auto& res = handlers.second;
+			if(!req || !res)
+			{
+				report(false);
+				return conn->close();
+			}
+
+			res->on_headers([report](auto res)
+			{
+				report(res->preamble().status_code() < 500);
+				res->get_connection()->close();
+			});
+			res->on_error([report](auto, const http::connection_error&) { report(false); });
+			req->on_error([report]() { report(false); });
+
+			http::http_request preamble;
+			preamble.protocol(http::proto_version::HTTP11);
+			preamble.method(HTTP_GET);
+			preamble.path(path);
+			preamble.hostname(host);
+			preamble.keepalive(false);
+			req->headers(std::move(preamble));
+			req->end();
+		}), [report](int) { report(false); });
+}
+
+} // namespace network
@@ -0,0 +1,53 @@
+#ifndef DOORMAT_HEALTH_CHECKER_H
+#define DOORMAT_HEALTH_CHECKER_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "upstream_group.h"
+#include "communicator/communicator_factory.h"
+
+namespace network
+{
+
+/** \brief actively probes every endpoint of a group, on a fixed interval.
+ *
+ * Each probe is a GET of the configured path on a fresh connection: any answer below 500 received before the
+ * timeout re-admits an ejected endpoint, anything else counts as a failure. Passive tracking (the outcome of
+ * real requests) keeps working alongside the probes.
+ * The checker must run on the thread owning the group.
+ * */
+class health_checker : public std::enable_shared_from_this<health_checker>
+{
+public:
+	health_checker(boost::asio::io_service& io, std::shared_ptr<upstream_group> group,
+		std::unique_ptr<connector_factory> factory, std::string path = "/",
+		std::chrono::milliseconds interval = std::chrono::seconds{5},
+		std::chrono::milliseconds timeout = std::chrono::seconds{2});
+	health_checker(const health_checker&) = delete;
+	health_checker& operator=(const health_checker&) = delete;
+
+	/** \brief probes all the endpoints now, then every interval. */
+	void start();
+	void stop();
+
+private:
+	void schedule();
+	void probe(std::size_t i);
+
+	boost::asio::io_service& io;
+	std::shared_ptr<upstream_group> group;
+	std::unique_ptr<connector_factory> factory;
+	std::string path;
+	std::chrono::milliseconds interval;
+	std::chrono::milliseconds timeout;
+	boost::asio::deadline_timer timer;
+	bool stopped{false};
+};
+
+} // namespace network
+
+#endif //DOORMAT_HEALTH_CHECKER_H
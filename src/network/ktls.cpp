@@ -0,0 +1,169 @@
+#include "ktls.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <openssl/bio.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#if defined(__linux__) && defined(__has_include) && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#if __has_include(<linux/tls.h>)
+#define DOORMAT_KTLS 1
+#endif
+#endif
+
+#ifdef DOORMAT_KTLS
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+namespace network
+{
+namespace ktls
+{
+
+namespace
+{
+
+int offloaded_index()
+{
+	static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+#ifdef DOORMAT_KTLS
+
+/** \brief the PRF of TLS 1.2 (RFC 5246, section 5), for the key block. */
+bool prf(const EVP_MD* md, const unsigned char* secret, std::size_t secret_length, const std::string& seed,
+	unsigned char* out, std::size_t length)
+{
+	unsigned char a[EVP_MAX_MD_SIZE];
+	unsigned char next[EVP_MAX_MD_SIZE];
+	unsigned char block[EVP_MAX_MD_SIZE];
+	unsigned int a_length{0}, block_length{0};
+	auto s = reinterpret_cast<const unsigned char*>(seed.data());
+	if(!HMAC(md, secret, static_cast<int>(secret_length), s, seed.size(), a, &a_length)) return false;
+	for(std::size_t done = 0; done < length;)
+	{
+		std::string input{reinterpret_cast<const char*>(a), a_length};
+		input += seed;
+		if(!HMAC(md, secret, static_cast<int>(secret_length), reinterpret_cast<const unsigned char*>(input.data()),
+			input.size(), block, &block_length))
+			return false;
+		auto n = std::min<std::size_t>(block_length, length - done);
+		std::memcpy(out + done, block, n);
+		done += n;
+		if(!HMAC(md, secret, static_cast<int>(secret_length), a, a_length, next, &a_length)) return false;
+		std::memcpy(a, next, a_length);
+	}
+	OPENSSL_cleanse(block, sizeof(block));
+	return true;
+}
+
+template<typename info_type>
+bool install(int fd, info_type& info, unsigned short cipher, const unsigned char* key, const unsigned char* salt)
+{
+	info.info.version = TLS_1_2_VERSION;
+	info.info.cipher_type = cipher;
+	std::memcpy(info.key, key, sizeof(info.key));
+	std::memcpy(info.salt, salt, sizeof(info.salt));
+	// the server has written its Finished alone under these keys: the next record is the second one
+	unsigned char sequence[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+	std::memcpy(info.iv, sequence, sizeof(info.iv));
+	std::memcpy(info.rec_seq, sequence, sizeof(info.rec_seq));
+	auto done = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 &&
+		setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+	OPENSSL_cleanse(&info, sizeof(info));
+	return done;
+}
+
+#endif
+
+}
+
+bool supported() noexcept
+{
+#ifdef DOORMAT_KTLS
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool enable(SSL* ssl, int fd) noexcept
+{
+#ifdef DOORMAT_KTLS
+	auto cipher = SSL_get_current_cipher(ssl);
+	if(!cipher || SSL_version(ssl) != TLS1_2_VERSION || !SSL_is_init_finished(ssl)) return false;
+	auto nid = SSL_CIPHER_get_cipher_nid(cipher);
+	std::size_t key_length;
+	if(nid == NID_aes_128_gcm) key_length = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+#ifdef TLS_CIPHER_AES_GCM_256
+	else if(nid == NID_aes_256_gcm) key_length = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+#endif
+	else return false;
+
+	unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+	auto master_length = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+	std::string seed{"key expansion"};
+	unsigned char random[SSL3_RANDOM_SIZE];
+	seed.append(reinterpret_cast<const char*>(random), SSL_get_server_random(ssl, random, sizeof(random)));
+	seed.append(reinterpret_cast<const char*>(random), SSL_get_client_random(ssl, random, sizeof(random)));
+
+	// client and server write keys, then client and server implicit nonces; AEAD ciphers have no MAC keys
+	const std::size_t salt_length = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+	unsigned char block[2 * 32 + 2 * salt_length];
+	auto done = master_length &&
+		prf(SSL_CIPHER_get_handshake_digest(cipher), master, master_length, seed, block, 2 * key_length + 2 * salt_length);
+	if(done)
+	{
+		auto key = block + key_length;
+		auto salt = block + 2 * key_length + salt_length;
+		if(key_length == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+		{
+			tls12_crypto_info_aes_gcm_128 info{};
+			done = install(fd, info, TLS_CIPHER_AES_GCM_128, key, salt);
+		}
+#ifdef TLS_CIPHER_AES_GCM_256
+		else
+		{
+			tls12_crypto_info_aes_gcm_256 info{};
+			done = install(fd, info, TLS_CIPHER_AES_GCM_256, key, salt);
+		}
+#endif
+	}
+	OPENSSL_cleanse(master, sizeof(master));
+	OPENSSL_cleanse(block, sizeof(block));
+	if(done)
+	{
+		SSL_set_ex_data(ssl, offloaded_index(), ssl);
+		// OpenSSL keeps no sequence number in step with the kernel: renegotiations are refused, and what it would
+		// still write (alerts, a close_notify) is dropped instead of breaking the stream of records
+		SSL_set_options(ssl, SSL_OP_NO_RENEGOTIATION);
+		SSL_set0_wbio(ssl, BIO_new(BIO_s_null()));
+	}
+	return done;
+#else
+	(void) ssl;
+	(void) fd;
+	return false;
+#endif
+}
+
+bool offloaded(const SSL* ssl) noexcept
+{
+	return SSL_get_ex_data(const_cast<SSL*>(ssl), offloaded_index()) != nullptr;
+}
+
+}
+}
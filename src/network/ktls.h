@@ -0,0 +1,37 @@
+#ifndef DOORMAT_NETWORK_KTLS_H
+#define DOORMAT_NETWORK_KTLS_H
+
+#include <openssl/ssl.h>
+
+namespace network
+{
+
+/** \brief kernel TLS: once the handshake is over, the kernel makes the records of what is written on the socket, so
+ * that responses, files included (sendfile(2)), are written as they are on the TCP socket instead of going through
+ * OpenSSL. Only the sending half is handed over: reads go on through OpenSSL.
+ *
+ * It needs Linux with the tls module loaded and a TLS 1.2 session with AES-GCM; anywhere else enable() fails and
+ * the connection goes on in user space. Once enabled, OpenSSL must not write on the connection anymore: an alert or
+ * an answer to a renegotiation it sent would be out of sequence, and the peer would close the connection. Hence the
+ * session refuses renegotiations, and what OpenSSL writes is dropped.
+ * */
+namespace ktls
+{
+
+/** \returns false if this build can not hand a connection over to the kernel at all */
+bool supported() noexcept;
+
+/** \brief hands the sending half of the session, whose handshake is over and after which nothing has been written,
+ * over to the kernel, through the TCP socket it runs on. The write BIO of the session is replaced.
+ * \returns false if the kernel or the cipher do not allow it, in which case nothing changes
+ * */
+bool enable(SSL* ssl, int fd) noexcept;
+
+/** \returns true if the sending half of the session is in the kernel */
+bool offloaded(const SSL* ssl) noexcept;
+
+}
+
+}
+
+#endif //DOORMAT_NETWORK_KTLS_H
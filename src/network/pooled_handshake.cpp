@@ -0,0 +1,133 @@
+#include "pooled_handshake.h"
+#include "../utils/log_wrapper.h"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/err.h>
+
+namespace network
+{
+
+namespace
+{
+
+boost::system::error_code error_of(SSL* ssl, int result)
+{
+	if(SSL_get_error(ssl, result) == SSL_ERROR_ZERO_RETURN)
+		return boost::asio::error::eof;
+	auto e = ERR_get_error();
+	if(!e) return boost::asio::error::connection_reset;
+	return {static_cast<int>(e), boost::asio::error::get_ssl_category()};
+}
+
+}
+
+pooled_handshake::pooled_handshake(std::shared_ptr<ssl_socket> s, std::shared_ptr<handshake_pool> p)
+	: stream{std::move(s)}
+	, pool{std::move(p)}
+	, ssl{stream->native_handle()}
+	, stream_bio{SSL_get_rbio(ssl)}
+	, in{BIO_new(BIO_s_mem())}
+	, out{BIO_new(BIO_s_mem())}
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	BIO_up_ref(stream_bio);
+#else
+	CRYPTO_add(&stream_bio->references, 1, CRYPTO_LOCK_BIO);
+#endif
+	// an empty BIO asks for more bytes instead of telling the end of the stream
+	BIO_set_mem_eof_return(in, -1);
+	SSL_set_bio(ssl, in, out);
+	SSL_set_accept_state(ssl);
+}
+
+pooled_handshake::~pooled_handshake()
+{
+	if(!released) give_back();
+}
+
+void pooled_handshake::async_handshake(callback cb)
+{
+	done = std::move(cb);
+	receive();
+}
+
+void pooled_handshake::receive()
+{
+	// the client speaks first: no thread of the pool waits for its hello
+	auto self = shared_from_this();
+	// the io_service waits for the result of the pool, even with nothing else to do
+	auto work = std::make_shared<boost::asio::io_service::work>(stream->get_io_service());
+	stream->next_layer().async_receive(boost::asio::buffer(incoming), boost::asio::socket_base::message_peek,
+		[self, work](const boost::system::error_code& ec, std::size_t bytes)
+		{
+			if(ec) return self->finish(ec);
+			if(!bytes) return self->finish(boost::asio::error::eof);
+			self->peeked = bytes;
+			auto pool = self->pool.lock();
+			if(!pool) return self->finish(boost::asio::error::operation_aborted);
+			if(pool->submit([self, work]() { self->step(); })) return;
+			LOGDEBUG("handshake pool full: connection closed");
+			self->finish(boost::system::errc::make_error_code(boost::system::errc::connection_refused));
+		});
+}
+
+void pooled_handshake::step()
+{
+	// what the session took last time has been read off the socket: the peek starts after it
+	BIO_reset(in);
+	BIO_write(in, incoming.data(), static_cast<int>(peeked));
+	ERR_clear_error();
+	auto result = SSL_do_handshake(ssl);
+	auto consumed = peeked - static_cast<std::size_t>(BIO_pending(in));
+	boost::system::error_code ec;
+	if(result != 1 && SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ) ec = error_of(ssl, result);
+
+	char* data{nullptr};
+	auto pending = BIO_get_mem_data(out, &data);
+	outgoing.assign(data, pending > 0 ? static_cast<std::size_t>(pending) : 0);
+	BIO_reset(out);
+
+	auto self = shared_from_this();
+	stream->get_io_service().post([self, ec, over = result == 1, consumed]()
+	{
+		self->advance(ec, over, consumed);
+	});
+}
+
+void pooled_handshake::advance(const boost::system::error_code& ec, bool over, std::size_t consumed)
+{
+	boost::system::error_code read_error;
+	if(consumed) boost::asio::read(stream->next_layer(), boost::asio::buffer(incoming.data(), consumed), read_error);
+	if(read_error) return finish(read_error);
+
+	auto self = shared_from_this();
+	auto then = [self, ec, over](const boost::system::error_code& write_error, std::size_t)
+	{
+		// an alert goes out before the failure is told
+		if(write_error || ec) return self->finish(write_error ? write_error : ec);
+		if(!over) return self->receive();
+		self->give_back();
+		self->finish({});
+	};
+	if(outgoing.empty()) return then({}, 0);
+	boost::asio::async_write(stream->next_layer(), boost::asio::buffer(outgoing), then);
+}
+
+void pooled_handshake::finish(const boost::system::error_code& ec)
+{
+	auto cb = std::move(done);
+	done = nullptr;
+	if(cb) cb(ec);
+}
+
+void pooled_handshake::give_back() noexcept
+{
+	// the memory BIOs go with the session
+	SSL_set_bio(ssl, stream_bio, stream_bio);
+	in = out = nullptr;
+	released = true;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef DOORMAT_NETWORK_POOLED_HANDSHAKE_H
+#define DOORMAT_NETWORK_POOLED_HANDSHAKE_H
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include "handshake_pool.h"
+
+namespace network
+{
+
+/** \brief the server side of a TLS handshake for a boost SSL stream, whose computations (key exchange, private key
+ * operations) run on a handshake_pool while the io_service of the socket does the reads and the writes.
+ *
+ * Until the handshake is over the session runs on memory BIOs of its own, as with early_data: no thread of the pool
+ * ever waits for the network. What the client sent is peeked at, and only the bytes the session took are read off
+ * the socket, so that whatever follows the handshake (e.g. a request sent along with the Finished of TLS 1.3) is
+ * left there for the stream. Once the handshake is over, the session is given back to the stream.
+ * */
+class pooled_handshake : public std::enable_shared_from_this<pooled_handshake>
+{
+public:
+	using ssl_socket = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+	using callback = std::function<void(const boost::system::error_code&)>;
+
+	/** \brief takes the session of the stream over, before its handshake starts. */
+	pooled_handshake(std::shared_ptr<ssl_socket> stream, std::shared_ptr<handshake_pool> pool);
+	pooled_handshake(const pooled_handshake&) = delete;
+	pooled_handshake& operator=(const pooled_handshake&) = delete;
+	~pooled_handshake();
+
+	/** \brief handshakes; the callback is called on the thread of the io_service. A full pool fails the handshake
+	 * with connection_refused, a pool gone with operation_aborted. */
+	void async_handshake(callback cb);
+
+private:
+	/** \brief waits for the client, and peeks at what it sent. */
+	void receive();
+	/** \brief advances the session with the bytes peeked; it runs on the pool. */
+	void step();
+	/** \brief takes the bytes the session read off the socket, and writes what it wrote. */
+	void advance(const boost::system::error_code& ec, bool over, std::size_t consumed);
+	void finish(const boost::system::error_code& ec);
+	void give_back() noexcept;
+
+	std::shared_ptr<ssl_socket> stream;
+	/** Not owned: the last owner of the pool must not be one of its jobs */
+	std::weak_ptr<handshake_pool> pool;
+	SSL* ssl;
+	/** The BIO of the stream, given back with the session. */
+	BIO* stream_bio;
+	BIO* in;
+	BIO* out;
+	bool released{false};
+	std::array<char, 16384> incoming;
+	std::size_t peeked{0};
+	std::string outgoing;
+	callback done;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_POOLED_HANDSHAKE_H
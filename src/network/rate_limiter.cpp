@@ -0,0 +1,128 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace network
+{
+
+namespace
+{
+
+/** \brief the finalizer of MurmurHash3: every bit of the input flips half the bits of the output */
+uint64_t mix(uint64_t h) noexcept
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t nanoseconds(rate_limiter::clock::time_point t) noexcept
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+}
+
+}
+
+constexpr std::size_t rate_limiter::shard_bits;
+constexpr std::size_t rate_limiter::probes;
+
+rate_limiter::rate_limiter(double rate, uint32_t burst, std::size_t capacity)
+{
+	if(!(rate > 0) || burst == 0) throw std::invalid_argument{"rate and burst of a limiter must be positive"};
+	seed = (uint64_t{std::random_device{}()} << 32) | std::random_device{}();
+	step = std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(1e9 / rate)));
+	window = step * burst;
+
+	std::size_t size = probes;
+	while(size < capacity / shards.size()) size <<= 1;
+	mask = size - 1;
+	for(auto& s : shards)
+		s.slots = std::vector<slot>(size);
+}
+
+bool rate_limiter::acquire(const boost::asio::ip::address& a, clock::time_point now) noexcept
+{
+	// IPv4 addresses as IPv4-mapped ones, so that clients of dual-stack sockets share their bucket
+	auto bytes = a.is_v4() ? boost::asio::ip::address_v6::v4_mapped(a.to_v4()).to_bytes() : a.to_v6().to_bytes();
+	uint64_t high{0}, low{0};
+	for(std::size_t i = 0; i < 8; ++i)
+	{
+		high = (high << 8) | bytes[i];
+		low = (low << 8) | bytes[i + 8];
+	}
+	return acquire(mix(high ^ mix(low ^ seed)), now);
+}
+
+bool rate_limiter::acquire(boost::string_ref key, clock::time_point now) noexcept
+{
+	// FNV-1a, started from the seed
+	uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+	for(auto c : key)
+	{
+		h ^= static_cast<unsigned char>(c);
+		h *= 0x100000001b3ULL;
+	}
+	return acquire(mix(h), now);
+}
+
+bool rate_limiter::acquire(uint64_t hash, clock::time_point now) noexcept
+{
+	if(hash == 0) hash = 1;
+	auto t = nanoseconds(now);
+	auto& slots = shards[hash >> (64 - shard_bits)].slots;
+	// the key may sit past a slot freed since it took its own: look for it before claiming one. Keys are never
+	// cleared, hence nothing was placed past a slot never used
+	auto claimable = probes;
+	for(std::size_t i = 0; i < probes; ++i)
+	{
+		auto& s = slots[(hash + i) & mask];
+		auto k = s.key.load(std::memory_order_acquire);
+		if(k == hash) return take(s, t);
+		if(claimable == probes && (k == 0 || s.full_at.load(std::memory_order_relaxed) <= t)) claimable = i;
+		if(k == 0) break;
+	}
+	for(auto i = claimable; i < probes; ++i)
+	{
+		auto& s = slots[(hash + i) & mask];
+		auto k = s.key.load(std::memory_order_acquire);
+		// placed meanwhile by another thread
+		if(k == hash) return take(s, t);
+		// free, or holding a bucket full again: as good as a new one, which is what the key gets
+		if(k == 0 || s.full_at.load(std::memory_order_relaxed) <= t)
+		{
+			if(s.key.compare_exchange_strong(k, hash, std::memory_order_acq_rel) || k == hash)
+				return take(s, t);
+		}
+	}
+	overflowed.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool rate_limiter::take(slot& s, uint64_t now) noexcept
+{
+	auto full_at = s.full_at.load(std::memory_order_relaxed);
+	while(true)
+	{
+		auto next = std::max(full_at, now) + step;
+		if(next - now > window) return false;
+		if(s.full_at.compare_exchange_weak(full_at, next, std::memory_order_relaxed)) return true;
+	}
+}
+
+std::size_t rate_limiter::size(clock::time_point now) const noexcept
+{
+	auto t = nanoseconds(now);
+	std::size_t live{0};
+	for(const auto& s : shards)
+		for(const auto& e : s.slots)
+			live += e.key.load(std::memory_order_relaxed) != 0 && e.full_at.load(std::memory_order_relaxed) > t;
+	return live;
+}
+
+}
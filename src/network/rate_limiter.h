@@ -0,0 +1,83 @@
+#ifndef DOORMAT_NETWORK_RATE_LIMITER_H
+#define DOORMAT_NETWORK_RATE_LIMITER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <boost/asio/ip/address.hpp>
+#include <boost/utility/string_ref.hpp>
+
+namespace network
+{
+
+/** \brief token buckets, one per client, shared by all the threads serving them.
+ *
+ * Every key (an address, or e.g. the value of an API key header) has a bucket of burst tokens refilled at the given
+ * rate; taking a token fails when the bucket is empty. A bucket is kept as the single instant at which it would be
+ * full again (the "theoretical arrival time" of GCRA), hence taking a token is one compare-and-swap, and buckets
+ * that are full again are free slots: entries age out on their own, with no sweeping.
+ *
+ * Buckets live in an open-addressing table split into shards by the top bits of the hash of their keys; a key is
+ * looked for in a few slots only. When they are all taken by live buckets, the key is let through and counted as an
+ * overflow: a full table never keeps clients out. Keys are hashed with a seed of each limiter, so that clients can
+ * not pick colliding values on purpose. Under races a token may be charged to a key taking over the slot of an
+ * expired one: limits are approximate by a token or so, never by more.
+ * */
+class rate_limiter
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	/** \param rate tokens added to a bucket per second
+	 * \param burst tokens a bucket holds: requests a client can make at once
+	 * \param capacity keys with buckets that are not full which can be tracked at once
+	 * \throws std::invalid_argument if rate or burst are not positive
+	 * */
+	rate_limiter(double rate, uint32_t burst, std::size_t capacity = 65536);
+
+	/** \returns true if the key had a token, which has been taken */
+	bool acquire(const boost::asio::ip::address& a, clock::time_point now = clock::now()) noexcept;
+	bool acquire(boost::string_ref key, clock::time_point now = clock::now()) noexcept;
+
+	/** \returns the time it takes to add a token to a bucket */
+	std::chrono::nanoseconds interval() const noexcept { return std::chrono::nanoseconds{step}; }
+
+	/** \returns the number of keys whose bucket is not full; it scans the whole table */
+	std::size_t size(clock::time_point now = clock::now()) const noexcept;
+
+	/** \returns how many times a key found no free slot, and was let through */
+	uint64_t overflows() const noexcept { return overflowed.load(std::memory_order_relaxed); }
+
+private:
+	struct slot
+	{
+		/** Hash of the key; 0 for slots never used. */
+		std::atomic<uint64_t> key{0};
+		/** When the bucket is full again, in nanoseconds of the clock. */
+		std::atomic<uint64_t> full_at{0};
+	};
+
+	struct alignas(64) shard
+	{
+		std::vector<slot> slots;
+	};
+
+	static constexpr std::size_t shard_bits = 4;
+	static constexpr std::size_t probes = 8;
+
+	bool acquire(uint64_t hash, clock::time_point now) noexcept;
+	bool take(slot& s, uint64_t now) noexcept;
+
+	uint64_t seed;
+	uint64_t step;
+	uint64_t window;
+	std::size_t mask;
+	std::array<shard, 1 << shard_bits> shards;
+	std::atomic<uint64_t> overflowed{0};
+};
+
+}
+
+#endif //DOORMAT_NETWORK_RATE_LIMITER_H
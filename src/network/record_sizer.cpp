@@ -0,0 +1,29 @@
+#include "record_sizer.h"
+
+#include <stdexcept>
+
+namespace network
+{
+
+record_sizer::record_sizer(settings s)
+	: config{s}
+{
+	// the bounds of SSL_set_max_send_fragment
+	if(s.small < 512 || s.small > s.large || s.large > 16384)
+		throw std::invalid_argument{"record sizes must satisfy 512 <= small <= large <= 16384"};
+}
+
+std::size_t record_sizer::next(clock::time_point now) noexcept
+{
+	// the congestion window of an idle connection shrinks back
+	if(sent_bytes && now - last > config.idle) sent_bytes = 0;
+	return sent_bytes < config.ramp_up ? config.small : config.large;
+}
+
+void record_sizer::sent(std::size_t bytes, clock::time_point now) noexcept
+{
+	sent_bytes += bytes;
+	last = now;
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef DOORMAT_NETWORK_RECORD_SIZER_H
+#define DOORMAT_NETWORK_RECORD_SIZER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace network
+{
+
+/** \brief chooses the size of the TLS records of a connection, for a low time to first byte without giving up the
+ * throughput of long transfers.
+ *
+ * A record can be decrypted only once all of it has arrived: a 16KB one spans a dozen TCP segments, hence some
+ * round trips of a connection still in slow start. New connections, and connections back from an idle period (when
+ * the congestion window is reset), get records that fit a single segment; once enough bytes have gone, the window
+ * is open and records grow to the largest TLS allows, which cost less per byte.
+ * */
+class record_sizer
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct settings
+	{
+		/** Fits a segment of the usual 1460-byte MSS along with the record overhead. */
+		std::size_t small{1400};
+		std::size_t large{16384};
+		/** The bytes sent with small records. */
+		std::size_t ramp_up{1024 * 1024};
+		/** The pause after which records are small again. */
+		std::chrono::milliseconds idle{1000};
+	};
+
+	record_sizer() = default;
+	/** \throws std::invalid_argument if the sizes are not 512 <= small <= large <= 16384 */
+	explicit record_sizer(settings s);
+
+	/** \returns the size of the records of a write starting now */
+	std::size_t next(clock::time_point now = clock::now()) noexcept;
+
+	/** \brief tells the bytes of a write that has completed. */
+	void sent(std::size_t bytes, clock::time_point now = clock::now()) noexcept;
+
+	/** \returns the bytes sent since the connection started, or since it was idle the last time */
+	uint64_t streak() const noexcept { return sent_bytes; }
+
+private:
+	settings config;
+	uint64_t sent_bytes{0};
+	clock::time_point last;
+};
+
+}
+
+#endif //DOORMAT_NETWORK_RECORD_SIZER_H
@@ -0,0 +1,217 @@
+#include "upstream_group.h"
+#include "../utils/log_wrapper.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace network
+{
+
+namespace
+{
+
+/** Weight of the newest sample in the latency EWMA. */
+constexpr double ewma_weight = 0.3;
+
+/** FNV-1a followed by a 64 bit finalizer: cheap and, unlike std::hash, stable across platforms and runs.
+ * The finalizer spreads similar keys (e.g. differing only in the last character) all over the ring.
+ * */
+uint64_t ring_hash(const std::string& s) noexcept
+{
+	uint64_t h = 14695981039346656037ULL;
+	for(unsigned char c : s)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+}
+
+constexpr std::size_t upstream_group::virtual_nodes;
+
+upstream_group::upstream_group(std::vector<endpoint> endpoints, policy p, health_policy h, uint64_t seed)
+	: pol{p}
+	, health{h}
+	, rng{static_cast<std::minstd_rand::result_type>(seed)}
+{
+	assert(!endpoints.empty());
+	members.reserve(endpoints.size());
+	for(auto& ep : endpoints)
+	{
+		indexes.emplace(ep.key(), members.size());
+		members.push_back(member{std::move(ep)});
+	}
+
+	if(pol != policy::consistent_hashing) return;
+	ring.reserve(members.size() * virtual_nodes);
+	for(std::size_t i = 0; i < members.size(); ++i)
+	{
+		auto key = members[i].ep.key();
+		for(std::size_t n = 0; n < virtual_nodes; ++n)
+			ring.emplace_back(ring_hash(key + "#" + std::to_string(n)), i);
+	}
+	std::sort(ring.begin(), ring.end());
+}
+
+std::size_t upstream_group::select(const std::string& key, clock::time_point now)
+{
+	switch(pol)
+	{
+		case policy::least_outstanding:
+			return least_outstanding(now);
+		case policy::power_of_two_choices:
+			return power_of_two_choices(now);
+		case policy::consistent_hashing:
+			return key.empty() ? next_round_robin(now) : consistent_hashing(key, now);
+		case policy::round_robin:
+		default:
+			return next_round_robin(now);
+	}
+}
+
+std::size_t upstream_group::get_connector(connector_factory& factory, const std::string& key,
+	connector_factory::connector_callback_t ccb, connector_factory::error_callback_t ecb)
+{
+	auto i = select(key);
+	started(i);
+	auto begin = clock::now();
+	const auto& ep = members[i].ep;
+	factory.get_connector(ep.address, ep.port, ep.tls, std::move(ccb), [this, i, begin, ecb = std::move(ecb)](int error)
+	{
+		completed(i, clock::now() - begin, false);
+		ecb(error);
+	});
+	return i;
+}
+
+void upstream_group::started(std::size_t i) noexcept
+{
+	++members[i].outstanding;
+}
+
+void upstream_group::completed(std::size_t i, std::chrono::nanoseconds latency, bool success,
+	clock::time_point now) noexcept
+{
+	auto& m = members[i];
+	if(m.outstanding) --m.outstanding;
+	double sample = latency.count();
+	m.latency = m.latency == 0 ? sample : m.latency + ewma_weight * (sample - m.latency);
+	account(m, success, now);
+}
+
+void upstream_group::probed(std::size_t i, bool success, clock::time_point now) noexcept
+{
+	auto& m = members[i];
+	if(success && m.ejected_until > now)
+	{
+		LOGINFO(m.ep.key(), " passed the health check, back in the group");
+		m.ejected_until = now;
+	}
+	account(m, success, now);
+}
+
+void upstream_group::account(member& m, bool success, clock::time_point now) noexcept
+{
+	if(success)
+	{
+		m.failures = 0;
+		// an answer after the re-admission means the endpoint has recovered
+		if(m.ejected_until <= now) m.ejections = 0;
+		return;
+	}
+
+	// requests started before the ejection may still fail: they are not news
+	if(m.ejected_until > now || ++m.failures < health.max_fails) return;
+
+	auto backoff = health.fail_timeout * (std::size_t{1} << std::min<std::size_t>(m.ejections, 16));
+	m.ejected_until = now + std::min(std::chrono::duration_cast<std::chrono::milliseconds>(backoff), health.max_ejection);
+	m.failures = 0;
+	++m.ejections;
+	LOGWARN(m.ep.key(), " ejected after ", health.max_fails, " consecutive failures");
+}
+
+std::size_t upstream_group::index_of(const endpoint& ep) const
+{
+	auto it = indexes.find(ep.key());
+	return it == indexes.end() ? members.size() : it->second;
+}
+
+std::size_t upstream_group::next_round_robin(clock::time_point now) noexcept
+{
+	auto first = cursor;
+	for(std::size_t n = 0; n < members.size(); ++n)
+	{
+		auto i = cursor;
+		cursor = (cursor + 1) % members.size();
+		if(available(i, now)) return i;
+	}
+	cursor = (first + 1) % members.size();
+	return first;
+}
+
+std::size_t upstream_group::least_outstanding(clock::time_point now) noexcept
+{
+	// ties are broken from a rotating position, so that an idle group is still walked in round robin
+	std::size_t best = members.size();
+	for(std::size_t n = 0; n < members.size(); ++n)
+	{
+		auto i = (cursor + n) % members.size();
+		if(available(i, now) && (best == members.size() || members[i].outstanding < members[best].outstanding))
+			best = i;
+	}
+	if(best == members.size()) best = cursor;
+	cursor = (cursor + 1) % members.size();
+	return best;
+}
+
+std::size_t upstream_group::power_of_two_choices(clock::time_point now) noexcept
+{
+	if(members.size() == 1) return 0;
+	std::size_t a = rng() % members.size();
+	std::size_t b = rng() % (members.size() - 1);
+	if(b >= a) ++b;
+
+	bool a_available = available(a, now);
+	bool b_available = available(b, now);
+	if(a_available && b_available) return cost(b) < cost(a) ? b : a;
+	if(a_available) return a;
+	if(b_available) return b;
+	for(std::size_t n = 1; n < members.size(); ++n)
+	{
+		auto i = (a + n) % members.size();
+		if(available(i, now)) return i;
+	}
+	return a;
+}
+
+std::size_t upstream_group::consistent_hashing(const std::string& key, clock::time_point now) const noexcept
+{
+	auto h = ring_hash(key);
+	auto it = std::upper_bound(ring.begin(), ring.end(), h, [](uint64_t v, const std::pair<uint64_t, std::size_t>& p)
+	{
+		return v < p.first;
+	});
+	auto start = static_cast<std::size_t>(it - ring.begin()) % ring.size();
+	// keys of an ejected endpoint move to the following ones on the ring, the others stay where they are
+	for(std::size_t n = 0; n < ring.size(); ++n)
+	{
+		auto i = ring[(start + n) % ring.size()].second;
+		if(available(i, now)) return i;
+	}
+	return ring[start].second;
+}
+
+double upstream_group::cost(std::size_t i) const noexcept
+{
+	// an endpoint which never answered costs as the cheapest one, so that it gets probed
+	return (members[i].latency + 1) * (members[i].outstanding + 1);
+}
+
+} // namespace network
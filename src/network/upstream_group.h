@@ -0,0 +1,142 @@
+#ifndef DOORMAT_UPSTREAM_GROUP_H
+#define DOORMAT_UPSTREAM_GROUP_H
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "communicator/communicator_factory.h"
+
+namespace network
+{
+
+/** \brief coordinates of an upstream server. */
+struct endpoint
+{
+	std::string address;
+	uint16_t port{0};
+	bool tls{false};
+
+	/** \returns a string uniquely identifying the endpoint. */
+	std::string key() const { return address + ":" + std::to_string(port) + (tls ? "/tls" : "/clear"); }
+};
+
+/** \brief outlier ejection settings; they mirror the max_fails and fail_timeout of the route map. */
+struct health_policy
+{
+	std::size_t max_fails{1};
+	std::chrono::milliseconds fail_timeout{std::chrono::seconds{10}};
+	/** upper bound of the exponential back-off */
+	std::chrono::milliseconds max_ejection{std::chrono::minutes{5}};
+};
+
+/** \brief a set of equivalent upstream servers, among which requests are spread according to a policy.
+ *
+ * The group keeps, for each endpoint, the number of outstanding requests and an exponentially weighted moving
+ * average of their latency; callers report each request through started() and completed().
+ * Failures are tracked too: after max_fails consecutive ones an endpoint is ejected and no request is sent
+ * to it until fail_timeout has elapsed; each ejection following a failed re-admission lasts twice as long.
+ * When every endpoint is ejected the health state is ignored, as refusing all the requests would be worse.
+ * A group is meant to be owned by a single thread (one for each io_service): selection and accounting
+ * never lock nor use atomics.
+ * */
+class upstream_group
+{
+public:
+	enum class policy
+	{
+		round_robin,
+		least_outstanding,
+		/** two random endpoints are compared, the one with the lowest latency EWMA x outstanding wins */
+		power_of_two_choices,
+		/** the same key always goes to the same endpoint, as long as the group does not change */
+		consistent_hashing
+	};
+
+	using clock = std::chrono::steady_clock;
+
+	/** Points of each endpoint on the hash ring. */
+	static constexpr std::size_t virtual_nodes = 160;
+
+	upstream_group(std::vector<endpoint> endpoints, policy p, health_policy h = {},
+		uint64_t seed = std::random_device{}());
+
+	/** \brief chooses the endpoint for a request, among the ones which are not ejected.
+	 * \param key used by consistent_hashing only; an empty key falls back to round robin
+	 * \returns the index of the chosen endpoint
+	 * */
+	std::size_t select(const std::string& key = {}, clock::time_point now = clock::now());
+
+	/** \brief selects an endpoint and asks the factory to connect to it; the attempt counts as outstanding
+	 * until the caller reports it (connection failures are reported by the group itself).
+	 * The group must outlive the connection attempt.
+	 * \returns the index of the chosen endpoint
+	 * */
+	std::size_t get_connector(connector_factory& factory, const std::string& key,
+		connector_factory::connector_callback_t ccb, connector_factory::error_callback_t ecb);
+
+	/** \brief accounts a request sent to an endpoint. */
+	void started(std::size_t i) noexcept;
+
+	/** \brief accounts the end of a request.
+	 * \param latency time elapsed since the request was started
+	 * \param success false when the endpoint failed to answer properly
+	 * */
+	void completed(std::size_t i, std::chrono::nanoseconds latency, bool success = true,
+		clock::time_point now = clock::now()) noexcept;
+
+	/** \brief accounts the result of an active health check: a success re-admits an ejected endpoint
+	 * right away, a failure counts as a failed request.
+	 * */
+	void probed(std::size_t i, bool success, clock::time_point now = clock::now()) noexcept;
+
+	/** \returns false while the endpoint is ejected. */
+	bool available(std::size_t i, clock::time_point now = clock::now()) const noexcept
+	{
+		return members[i].ejected_until <= now;
+	}
+
+	const endpoint& operator[](std::size_t i) const noexcept { return members[i].ep; }
+	std::size_t size() const noexcept { return members.size(); }
+	/** \returns the index of the endpoint, or size() if it does not belong to the group. */
+	std::size_t index_of(const endpoint& ep) const;
+
+	std::size_t outstanding(std::size_t i) const noexcept { return members[i].outstanding; }
+	/** \returns the latency EWMA of the endpoint, in nanoseconds. */
+	double latency(std::size_t i) const noexcept { return members[i].latency; }
+
+private:
+	struct member
+	{
+		endpoint ep;
+		std::size_t outstanding{0};
+		double latency{0};
+		std::size_t failures{0};
+		/** consecutive ejections, drive the back-off */
+		std::size_t ejections{0};
+		clock::time_point ejected_until{};
+	};
+
+	std::size_t next_round_robin(clock::time_point now) noexcept;
+	std::size_t least_outstanding(clock::time_point now) noexcept;
+	std::size_t power_of_two_choices(clock::time_point now) noexcept;
+	std::size_t consistent_hashing(const std::string& key, clock::time_point now) const noexcept;
+	double cost(std::size_t i) const noexcept;
+	void account(member& m, bool success, clock::time_point now) noexcept;
+
+	std::vector<member> members;
+	std::unordered_map<std::string, std::size_t> indexes;
+	/** hash ring: sorted points, each one owned by an endpoint */
+	std::vector<std::pair<uint64_t, std::size_t>> ring;
+	policy pol;
+	health_policy health;
+	std::size_t cursor{0};
+	std::minstd_rand rng;
+};
+
+} // namespace network
+
+#endif //DOORMAT_UPSTREAM_GROUP_H
@@ -17,6 +17,7 @@ const static string alpn_protos_default[]
 	"\x8http/1.0"
 };
 
+#ifndef OPENSSL_NO_NEXTPROTONEG
 const static unsigned char npn_protos[]
 {
 	2,'h','2',
@@ -25,6 +26,7 @@ const static unsigned char npn_protos[]
 	8,'h','t','t','p','/','1','.','1',
 	8,'h','t','t','p','/','1','.','0'
 };
+#endif
 
 using alpn_cb = int (*)
 (ssl_st*, const unsigned char**, unsigned char*, const unsigned char*, unsigned int, void*);
@@ -39,6 +41,7 @@ const unsigned char* in, unsigned int inlen, void *data)
 	return SSL_TLSEXT_ERR_NOACK;
 };
 
+#ifndef OPENSSL_NO_NEXTPROTONEG
 using npn_cb = int (*) (SSL *ssl, const unsigned char** out, unsigned int* outlen, void *arg);
 npn_cb npn_adv_cb = [](ssl_st *ctx, const unsigned char** out, unsigned int* outlen, void *arg)
 {
@@ -46,10 +49,14 @@ npn_cb npn_adv_cb = [](ssl_st *ctx, const unsigned char** out, unsigned int* out
 	*outlen = sizeof(npn_protos);
 	return SSL_TLSEXT_ERR_OK;
 };
+#endif
 
 void handler_factory::register_protocol_selection_callbacks(SSL_CTX* ctx)
 {
+	// NPN is for TLS 1.2 clients predating ALPN; builds of OpenSSL may leave it out
+#ifndef OPENSSL_NO_NEXTPROTONEG
 	SSL_CTX_set_next_protos_advertised_cb(ctx, npn_adv_cb, nullptr);
+#endif
 	SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, nullptr);
 }
 
@@ -63,9 +70,11 @@ std::shared_ptr<http::server_connection> handler_factory::negotiate_handler(std:
 
 	//ALPN
 	SSL_get0_alpn_selected(ssl_handle, &proto, &len);
+#ifndef OPENSSL_NO_NEXTPROTONEG
 	if( !len )
 		//NPN
 		SSL_get0_next_proto_negotiated(ssl_handle, &proto, &len);
+#endif
 
 
 	handler_type type{handler_type::ht_h1};
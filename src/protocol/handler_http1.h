@@ -1,5 +1,6 @@
 #pragma once
 
+#include <deque>
 #include <memory>
 #include "../http/http_codec.h"
 #include "../http/http_structured_data.h"
@@ -107,6 +108,9 @@ public:
 	 * */
 	void decoding_failure()
 	{
+		// the answer is on its way: there is nobody else to tell
+		if(answered) return;
+		user_handlers();
 		//failure always gets called after start...
 		auto current_remote = get_current();
 		if(!current_remote) return;
@@ -121,6 +125,7 @@ public:
 	 * */
 	void decoding_end()
 	{
+		if(answered) return;
 		auto current_remote = get_current();
 		if(!current_remote) return;
 		current_remote->finished();
@@ -132,6 +137,7 @@ public:
 	 * */
 	void decoded_trailer(std::string&& k, std::string&& v)
 	{
+		if(answered) return;
 		auto current_remote = get_current();
 		if(!current_remote) return;
 		if(managing_continue) return;
@@ -144,6 +150,7 @@ public:
 	 * */
 	void decoded_body(data_t b, size_t size)
 	{
+		if(answered) return;
 		auto current_remote = get_current();
 		if(!current_remote) return;
 		current_remote->body(std::move(b), size);
@@ -175,9 +182,13 @@ public:
 	 * */
 	void decoded_headers()
 	{
+		update_persistent();
+		if(answer_statically()) return;
+		if(peer.is_unspecified()) peer = find_origin();
+		current_decoded_object.origin(peer);
+		user_handlers();
 		auto current_remote = get_current();
 		if(!current_remote) return;
-		update_persistent();
 		current_remote->headers(::std::move(current_decoded_object));
 		current_decoded_object = {};
 	}
@@ -188,6 +199,7 @@ public:
 	{
 		decoding_error = false;
 		managing_continue = false;
+		answered = false;
 		*data = &current_decoded_object;
 		decoder_begin();
 	}
@@ -225,10 +237,49 @@ public:
 				serialization = {};
 				return true;
 			}
+			if(!pending.empty() && !pending.front().block.data && !connector()->sends_files())
+				return read_file(data);
 		}
 		return false;
 	}
 
+	/** \brief the file region to be sent before anything else, if the connector can send it on its own.
+	 * */
+	http::file_segment* file_to_send() override
+	{
+		if(!serialization.empty() || pending.empty() || pending.front().block.data) return nullptr;
+		return &pending.front().segment;
+	}
+
+	/** \brief moves past the bytes of the current file region the connector has sent.
+	 * \param size the number of bytes sent
+	 * */
+	void file_sent(std::size_t size) override
+	{
+		auto &f = pending.front();
+		f.segment.offset += size;
+		f.segment.length -= size;
+		if(f.segment.length) return;
+		serialization = std::move(f.after);
+		pending.pop_front();
+	}
+
+	/** \brief the block of bytes to be sent before anything else, if it is its turn.
+	 * */
+	http::shared_block* block_to_send() override
+	{
+		if(!serialization.empty() || pending.empty() || !pending.front().block.data) return nullptr;
+		return &pending.front().block;
+	}
+
+	/** \brief moves past the block returned by block_to_send(), which has been written.
+	 * */
+	void block_sent() override
+	{
+		serialization = std::move(pending.front().after);
+		pending.pop_front();
+	}
+
 
 	/** \brief explicit user-requested close
 	 * */
@@ -249,6 +300,15 @@ private:
 	/** \brief event emitted when the decoder starts; default behaviour does nothing. See specializations.*/
 	void decoder_begin(){}
 
+	/** \brief creates the objects representing the message being decoded, if they are still missing;
+	 * default behaviour does nothing. See specializations.*/
+	void user_handlers(){}
+
+	/** \brief answers the message being decoded without involving the user, when possible;
+	 * default behaviour does nothing. See specializations.
+	 * \returns true if the message has been answered, in which case the rest of it is discarded */
+	bool answer_statically() { return false; }
+
 	/** \brief notifies an error to all currently managed objects.
 	 * \param err the error code. */
 	void notify_all(http::error_code err) {
@@ -264,6 +324,7 @@ private:
 		}
 		remote_objects.clear();
 		local_objects.clear();
+		queued_answers.clear();
 	}
 
 
@@ -332,6 +393,28 @@ private:
 		if(s) s->set_timeout(std::move(ms));
 	}
 
+	/** \brief propagates flow control requests to the connector.
+	 * \param enabled false to stop reading from the socket, true to restart.
+	 * */
+	void reading(bool enabled) override
+	{
+		auto s = connector();
+		if(!s) return;
+		if(enabled) s->resume_read();
+		else s->pause_read();
+	}
+
+	void draining() override
+	{
+		do_write();
+	}
+
+	/** \brief notifies drain listeners once the connector wrote everything it had */
+	void on_drained() override
+	{
+		connection_t::drained();
+	}
+
 	/** \brief retrieve new content from a remote object
 	 * \returns true if the remote object has finished and hence can be removed.
 	 * */
@@ -368,6 +451,8 @@ private:
 	/** \brief gets callbacks to be executed once the subsequent write has been completed successfully
 	 * \returns vector of pairs of <success, error> callback to be called when write has been successfully performed.*/
 	std::vector<std::pair<std::function<void()>, std::function<void()>>> write_feedbacks() override {
+		// responses are not written until their files and blocks are
+		if(!pending.empty()) return {};
 		auto d = std::move(pending_clear_callbacks);
 		pending_clear_callbacks = {};
 		return d;
@@ -380,14 +465,30 @@ private:
 		{
 			connection_t::persistent = loc.header(http::hf_connection) == http::hv_keepalive;
 		}
-		serialization.append(encoder.encode_header(loc));
+		output(encoder.encode_header(loc));
 		do_write();
 	}
 
 	/** \brief Local Object management method for body*/
 	void notify_local_body(std::string&& body)
 	{
-		serialization.append(encoder.encode_body(std::move(body)));
+		output(encoder.encode_body(std::move(body)));
+		do_write();
+	}
+
+	/** \brief Local Object management method for file regions and blocks
+	 * \param stored the region or the block, followed by the body received after it
+	 * */
+	void notify_local_file(http::response::stored_output&& stored)
+	{
+		auto length = stored.block.data ? stored.block.size : stored.segment.length;
+		if(length)
+		{
+			auto framing = encoder.encode_body_framing(length);
+			output(std::move(framing.first));
+			pending.push_back(pending_output{std::move(stored.segment), std::move(stored.block), std::move(framing.second)});
+		}
+		output(encoder.encode_body(std::move(stored.after)));
 		do_write();
 	}
 
@@ -395,17 +496,64 @@ private:
 	void notify_local_trailer(std::string&& k, std::string&& v)
 	{
 
-		serialization.append(encoder.encode_trailer(k, v));
+		output(encoder.encode_trailer(k, v));
 		do_write();
 	}
 	/** \brief Local Object management method for end*/
 	void notify_local_end()
 	{
 
-		serialization.append(encoder.encode_eom());
+		output(encoder.encode_eom());
+		do_write();
+	}
+
+	/** \brief queues serialized data after everything already waiting to be written, files included. */
+	void output(std::string&& data)
+	{
+		if(pending.empty()) serialization.append(data);
+		else pending.back().after.append(data);
+	}
+
+	/** \brief Local Object management method for prepared responses, which are written as they are.
+	 * \param prepared the message, and whether the connection persists after it
+	 * */
+	void notify_local_prepared(std::pair<http::shared_block, bool>&& prepared)
+	{
+		connection_t::persistent = prepared.second;
+		pending.push_back(pending_output{{}, std::move(prepared.first), {}});
 		do_write();
 	}
 
+	/** \brief reads the next chunk of the current file region, for connectors which can not send it on their own.
+	 * \returns false if the file can not be read, in which case the connection is closed
+	 * */
+	bool read_file(std::string& data)
+	{
+		static constexpr std::size_t chunk = 64 * 1024;
+		auto &f = pending.front();
+		data.resize(std::min(f.segment.length, chunk));
+		auto size = f.segment.read(&data[0], data.size());
+		if(!size)
+		{
+			// the body promised to the client can not be completed
+			LOGERROR(this, " cannot read the body from file");
+			data.clear();
+			pending.clear();
+			for(auto &cb : pending_clear_callbacks)
+				cb.second();
+			pending_clear_callbacks.clear();
+			close();
+			return false;
+		}
+		data.resize(size);
+		if(!f.segment.length)
+		{
+			serialization = std::move(f.after);
+			pending.pop_front();
+		}
+		return true;
+	}
+
 	/** local objects currently being managed by the handler*/
 	std::list<std::weak_ptr<local_t>> local_objects;
 
@@ -421,6 +569,17 @@ private:
 
 	/** Dstring used to serialize the information coming from the local object*/
 	std::string serialization;
+
+	/** A file region or a block of bytes waiting to be written, followed by what has been serialized after it */
+	struct pending_output
+	{
+		http::file_segment segment;
+		/** When set, it is sent instead of the segment */
+		http::shared_block block;
+		std::string after;
+	};
+	/** Output which comes after the serialization and is sent without copying whenever possible */
+	std::deque<pending_output> pending;
 	/** User close is set to true when an explicit connection close is required by the user, avoiding sending an error*/
 	bool user_close{false};
 	bool decoding_error{false};
@@ -428,6 +587,14 @@ private:
 	/** List of callbacks to be called when the next write is successful. */
 	std::vector<std::pair<std::function<void()>, std::function<void()>>> pending_clear_callbacks{};
 	bool managing_continue{false};
+	/** True when the message being decoded has been answered on the spot */
+	bool answered{false};
+	/** True until the objects representing the message being decoded are handed to the user */
+	bool handlers_pending{false};
+	/** The address of the peer, asked to the connector with the first message */
+	boost::asio::ip::address peer;
+	/** Answers waiting for the responses before them: nobody else holds them */
+	std::list<std::shared_ptr<local_t>> queued_answers;
 
 };
 
@@ -436,9 +603,61 @@ template<>
 inline
 void handler_http1<http::server_traits>::decoder_begin()
 {
+	// the user gets involved once the headers tell whether a static route answers the request
+	handlers_pending = true;
+}
+
+template<>
+inline
+void handler_http1<http::server_traits>::user_handlers()
+{
+	if(!handlers_pending) return;
+	handlers_pending = false;
 	auto f = get_user_handlers();
+	if(f.second)
+	{
+		// files are read as the socket takes what came before
+		std::weak_ptr<handler_http1> self = this->get_shared();
+		f.second->paced_by({[self](std::function<void()> cb) { if(auto s = self.lock()) s->when_drained(std::move(cb)); },
+			[self]() { if(auto s = self.lock()) s->close(); }});
+	}
 	user_feedback(std::move(f.first), std::move(f.second));
 }
+
+template<>
+inline
+bool handler_http1<http::server_traits>::answer_statically()
+{
+	auto conn = connector();
+	auto early = conn && conn->reading_early_data();
+	const auto& answer = static_answer(current_decoded_object, early);
+	if(!answer)
+	{
+		// the origin can tell the request may be a replay (RFC 8470)
+		if(early) current_decoded_object.header("early-data", "1");
+		return false;
+	}
+	answered = true;
+	handlers_pending = false;
+	if(local_objects.empty())
+	{
+		auto head = current_decoded_object.method_code() == HTTP_HEAD;
+		notify_local_prepared({http::h1_message(answer, current_decoded_object.protocol_version(),
+			connection_t::persistent, head), connection_t::persistent});
+	}
+	else if(conn)
+	{
+		// pipelined: it has to wait for the responses before it
+		auto loc = std::make_shared<local_t>([this, self = this->get_shared()](){
+			notify_local_content();
+		}, conn->io_service());
+		local_objects.push_back(loc);
+		queued_answers.push_back(loc);
+		loc->send(answer, current_decoded_object);
+	}
+	current_decoded_object = {};
+	return true;
+}
 template<>
 inline
 bool handler_http1<http::server_traits>::poll_local(std::shared_ptr<http::server_traits::local_t> loc)
@@ -453,6 +672,16 @@ bool handler_http1<http::server_traits>::poll_local(std::shared_ptr<http::server
 			case local_t::state::body_received:
 				notify_local_body(loc->get_body());
 				break;
+			case local_t::state::file_received:
+				notify_local_file(loc->get_file());
+				break;
+			case local_t::state::prepared_received:
+				// a whole message: there is nothing to encode
+				queued_answers.remove(loc);
+				pending_clear_callbacks.emplace_back([loc](){ loc->cleared(); }, [loc](){loc->error(http::error_code::missing_stream_element); });
+				notify_local_prepared(loc->get_prepared());
+				connection_t::cleared();
+				return true;
 			case local_t::state::trailer_received:
 			{
 				auto trailer = loc->get_trailer();
@@ -471,8 +700,8 @@ bool handler_http1<http::server_traits>::poll_local(std::shared_ptr<http::server
 				http::http_response r;
 				r.protocol(http::proto_version::HTTP11); //todo: make protocol parametric; fix everything.
 				r.status(100);
-				serialization.append(encoder.encode_header(r));
-				serialization.append(encoder.encode_eom());
+				output(encoder.encode_header(r));
+				output(encoder.encode_eom());
 				do_write();
 				return false;
 			}
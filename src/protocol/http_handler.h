@@ -6,6 +6,8 @@
 #include <iostream>
 #include <experimental/optional>
 #include "../http/http_commons.h"
+#include "../http/file_segment.h"
+#include "../http/shared_block.h"
 #include "../http/server/server_connection.h"
 
 /**
@@ -38,6 +40,18 @@ public:
 	virtual bool on_read(const char*, unsigned long) = 0;
 	virtual bool on_write(std::string& chunk) = 0;
 	virtual void trigger_timeout_event() =0;
+	/** Called by the connector when all the pending output has been written on the socket */
+	virtual void on_drained() {}
+	/** Called by plaintext connectors when on_write() had nothing to give: the file region to be sent next with
+	 * sendfile(2), if any. It stays valid until file_sent() is called. */
+	virtual http::file_segment* file_to_send() { return nullptr; }
+	/** Called once the first bytes of the region returned by file_to_send() have been written */
+	virtual void file_sent(std::size_t) {}
+	/** Called by connectors when on_write() had nothing to give: bytes owned by someone else, to be written as they
+	 * are, if any. It stays valid until block_sent() is called. */
+	virtual http::shared_block* block_to_send() { return nullptr; }
+	/** Called once the whole block returned by block_to_send() has been written */
+	virtual void block_sent() {}
 	virtual std::vector<std::pair<std::function<void()>, std::function<void()>>> write_feedbacks()=0;
 
 	virtual ~http_handler() = default;
@@ -0,0 +1,113 @@
+#include "coalescer.h"
+#include "../utils/log_wrapper.h"
+
+namespace proxy
+{
+
+void flight::headers(const http::http_response& res)
+{
+	if(done) return;
+	if(!shareable(res))
+	{
+		LOGDEBUG("response can not be shared, abandoning ", subscribers.size(), " followers");
+		return abandon();
+	}
+	for(auto& s : subscribers)
+		s.on_headers(res);
+}
+
+void flight::body(const shared_chunk& chunk)
+{
+	if(done) return;
+	// late followers would miss what has already been sent
+	close();
+	for(auto& s : subscribers)
+		s.on_body(chunk);
+}
+
+void flight::trailer(const std::string& k, const std::string& v)
+{
+	if(done) return;
+	for(auto& s : subscribers)
+		s.on_trailer(k, v);
+}
+
+void flight::finished()
+{
+	if(done) return;
+	close();
+	done = true;
+	auto subs = std::move(subscribers);
+	for(auto& s : subs)
+		s.on_finished();
+}
+
+void flight::abandon()
+{
+	if(done) return;
+	close();
+	done = true;
+	auto subs = std::move(subscribers);
+	for(auto& s : subs)
+		s.on_abandoned();
+}
+
+bool flight::shareable(const http::http_response& res)
+{
+	// the response may differ for the other requests, whose headers the key does not cover
+	if(res.has("set-cookie") || res.has("vary")) return false;
+	return !res.has("cache-control", [](const std::string& v)
+	{
+		return v.find("private") != std::string::npos || v.find("no-store") != std::string::npos;
+	});
+}
+
+void flight::close()
+{
+	if(!joinable) return;
+	joinable = false;
+	if(closed) closed();
+}
+
+constexpr std::size_t coalescer::default_follower_buffer;
+
+coalescer::coalescer(key_extractor_t key, std::size_t follower_buffer)
+	: extractor{std::move(key)}
+	, buffer_limit{follower_buffer}
+{}
+
+std::string coalescer::key(const http::http_request& req) const
+{
+	auto m = req.method_code();
+	if(m != HTTP_GET && m != HTTP_HEAD) return {};
+	if(req.chunked() || req.content_len() > 0) return {};
+	// credentials make the request personal, whatever the key says
+	if(req.has("authorization") || req.has("cookie")) return {};
+	return extractor(req);
+}
+
+std::shared_ptr<flight> coalescer::join(const std::string& key) const
+{
+	auto it = flights.find(key);
+	if(it == flights.end()) return nullptr;
+	auto f = it->second.lock();
+	return f && f->open() ? f : nullptr;
+}
+
+std::shared_ptr<flight> coalescer::lead(const std::string& key)
+{
+	std::weak_ptr<coalescer> self = this->shared_from_this();
+	auto f = std::make_shared<flight>([self, key]()
+	{
+		if(auto c = self.lock()) c->flights.erase(key);
+	});
+	flights[key] = f;
+	return f;
+}
+
+std::string coalescer::default_key(const http::http_request& req)
+{
+	return req.method() + " " + req.hostname() + req.path() + (req.query().empty() ? "" : "?" + req.query());
+}
+
+} // namespace proxy
@@ -0,0 +1,105 @@
+#ifndef DOORMAT_COALESCER_H
+#define DOORMAT_COALESCER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+
+namespace proxy
+{
+
+/** \brief a body chunk received from the upstream, shared by every request waiting for it. */
+using shared_chunk = std::shared_ptr<const std::string>;
+
+/** \brief an upstream exchange whose response is delivered to many identical requests.
+ *
+ * The leader publishes what it receives; followers subscribe while the flight is open, that is until the
+ * first body chunk has been published. A response which can not be shared (e.g. one setting a cookie or varying
+ * on request headers) and a failure of the leader both abandon the followers, which are then expected to go
+ * upstream on their own.
+ * */
+class flight
+{
+public:
+	struct subscriber
+	{
+		std::function<void(const http::http_response&)> on_headers;
+		std::function<void(const shared_chunk&)> on_body;
+		std::function<void(const std::string&, const std::string&)> on_trailer;
+		std::function<void()> on_finished;
+		std::function<void()> on_abandoned;
+	};
+
+	explicit flight(std::function<void()> closed) : closed{std::move(closed)} {}
+	flight(const flight&) = delete;
+	flight& operator=(const flight&) = delete;
+
+	bool open() const noexcept { return joinable; }
+	std::size_t followers() const noexcept { return subscribers.size(); }
+	void subscribe(subscriber s) { subscribers.push_back(std::move(s)); }
+
+	/** Leader side */
+	void headers(const http::http_response& res);
+	void body(const shared_chunk& chunk);
+	void trailer(const std::string& k, const std::string& v);
+	void finished();
+	void abandon();
+
+	/** \returns true when the same response can be delivered to requests coming from different clients. */
+	static bool shareable(const http::http_response& res);
+
+private:
+	void close();
+
+	std::vector<subscriber> subscribers;
+	std::function<void()> closed;
+	bool joinable{true};
+	bool done{false};
+};
+
+/** \brief collapses identical concurrent requests into a single upstream exchange.
+ * Only GET and HEAD requests without a body nor credentials are considered; the key decides which requests are
+ * identical.
+ * Like the connection pool, a coalescer belongs to a single thread.
+ * */
+class coalescer : public std::enable_shared_from_this<coalescer>
+{
+public:
+	using key_extractor_t = std::function<std::string(const http::http_request&)>;
+
+	/** Bytes each follower may keep queued when its client is slower than the upstream. */
+	static constexpr std::size_t default_follower_buffer = 1024 * 1024;
+
+	explicit coalescer(key_extractor_t key = default_key, std::size_t follower_buffer = default_follower_buffer);
+	coalescer(const coalescer&) = delete;
+	coalescer& operator=(const coalescer&) = delete;
+
+	/** \returns the coalescing key of the request, empty when the request must not be coalesced. */
+	std::string key(const http::http_request& req) const;
+
+	/** \returns the open flight for the key, if any. */
+	std::shared_ptr<flight> join(const std::string& key) const;
+
+	/** \brief opens a new flight for the key; the caller becomes its leader. */
+	std::shared_ptr<flight> lead(const std::string& key);
+
+	std::size_t follower_buffer() const noexcept { return buffer_limit; }
+	std::size_t in_flight() const noexcept { return flights.size(); }
+
+	/** \brief default key: method, host, path and query. */
+	static std::string default_key(const http::http_request& req);
+
+private:
+	key_extractor_t extractor;
+	std::size_t buffer_limit;
+	std::unordered_map<std::string, std::weak_ptr<flight>> flights;
+};
+
+} // namespace proxy
+
+#endif //DOORMAT_COALESCER_H
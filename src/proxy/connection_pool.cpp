@@ -0,0 +1,117 @@
+#include "connection_pool.h"
+#include "../http_client.h"
+#include "../http2/session_client.h"
+#include "../http/client/client_connection.h"
+#include "../utils/log_wrapper.h"
+
+#include <algorithm>
+
+namespace proxy
+{
+
+connection_pool::connection_pool(std::unique_ptr<network::connector_factory> factory, std::size_t max_idle)
+	: factory{std::move(factory)}
+	, max_idle{max_idle}
+{}
+
+bool connection_pool::multiplexed(const connection_t& c) noexcept
+{
+	return std::dynamic_pointer_cast<http2::session_client>(c) != nullptr;
+}
+
+void connection_pool::acquire(const upstream& u, acquire_callback_t acb, error_callback_t ecb)
+{
+	if(stopped) return ecb(1);
+
+	auto key = u.key();
+	auto session = shared_sessions.find(key);
+	if(session != shared_sessions.end())
+		return acb(session->second);
+
+	auto idle_list = idle_connections.find(key);
+	if(idle_list != idle_connections.end() && !idle_list->second.empty())
+	{
+		auto c = std::move(idle_list->second.front());
+		idle_list->second.pop_front();
+		return acb(std::move(c));
+	}
+
+	std::weak_ptr<connection_pool> self = this->shared_from_this();
+	factory->get_connector(u.address, u.port, u.tls, client::detail::handler_from_connector_factory(
+		[self, key, acb = std::move(acb)](connection_t c)
+		{
+			if(auto pool = self.lock())
+			{
+				pool->watch(key, c);
+				if(multiplexed(c))
+					pool->shared_sessions.emplace(key, c);
+			}
+			acb(std::move(c));
+		}), std::move(ecb));
+}
+
+void connection_pool::release(const upstream& u, connection_t c)
+{
+	if(multiplexed(c)) return;
+
+	auto& idle_list = idle_connections[u.key()];
+	if(stopped || idle_list.size() >= max_idle)
+	{
+		c->close();
+		return;
+	}
+	LOGTRACE("connection ", c.get(), " back to the pool of ", u.key());
+	idle_list.push_back(std::move(c));
+}
+
+void connection_pool::discard(const upstream& u, connection_t c)
+{
+	if(multiplexed(c)) return;
+	forget(u.key(), c.get());
+	c->close();
+}
+
+std::size_t connection_pool::idle(const upstream& u) const
+{
+	auto idle_list = idle_connections.find(u.key());
+	return idle_list == idle_connections.end() ? 0 : idle_list->second.size();
+}
+
+void connection_pool::stop()
+{
+	stopped = true;
+	factory->stop();
+	auto idle_lists = std::move(idle_connections);
+	idle_connections = {};
+	for(auto& idle_list : idle_lists)
+		for(auto& c : idle_list.second)
+			c->close();
+	auto sessions = std::move(shared_sessions);
+	shared_sessions = {};
+	for(auto& s : sessions)
+		s.second->close();
+}
+
+void connection_pool::watch(const std::string& key, const connection_t& c)
+{
+	// a dead connection must never be handed out again
+	std::weak_ptr<connection_pool> self = this->shared_from_this();
+	c->on_error([self, key](std::shared_ptr<http::connection> conn, const http::connection_error&)
+	{
+		if(auto pool = self.lock())
+			pool->forget(key, static_cast<http::client_connection*>(conn.get()));
+	});
+}
+
+void connection_pool::forget(const std::string& key, const http::client_connection* c)
+{
+	auto session = shared_sessions.find(key);
+	if(session != shared_sessions.end() && session->second.get() == c)
+		shared_sessions.erase(session);
+
+	auto idle_list = idle_connections.find(key);
+	if(idle_list == idle_connections.end()) return;
+	idle_list->second.remove_if([c](const connection_t& idle){ return idle.get() == c; });
+}
+
+} // namespace proxy
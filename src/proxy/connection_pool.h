@@ -0,0 +1,78 @@
+#ifndef DOORMAT_CONNECTION_POOL_H
+#define DOORMAT_CONNECTION_POOL_H
+
+#include <memory>
+#include <string>
+#include <list>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "../network/communicator/communicator_factory.h"
+#include "../network/upstream_group.h"
+
+namespace http
+{
+class client_connection;
+}
+
+namespace proxy
+{
+
+using upstream = network::endpoint;
+
+/** \brief keeps upstream connections alive between requests, so that a proxied request does not pay
+ * a connect (and a handshake) each time.
+ *
+ * HTTP/1.x connections are handed out exclusively and come back through release(); HTTP/2 sessions are
+ * shared by every request directed to the same upstream.
+ * The pool is not thread safe: there should be one for each thread running an io_service.
+ * */
+class connection_pool : public std::enable_shared_from_this<connection_pool>
+{
+public:
+	using connection_t = std::shared_ptr<http::client_connection>;
+	using acquire_callback_t = std::function<void(connection_t)>;
+	using error_callback_t = network::connector_factory::error_callback_t;
+
+	static constexpr std::size_t default_max_idle = 32;
+
+	explicit connection_pool(std::unique_ptr<network::connector_factory> factory, std::size_t max_idle = default_max_idle);
+	connection_pool(const connection_pool&) = delete;
+	connection_pool& operator=(const connection_pool&) = delete;
+
+	/** \brief provides a connection to the upstream, reusing an idle one when possible.
+	 * \param u the upstream to connect to
+	 * \param acb callback receiving the connection
+	 * \param ecb callback receiving the connector_factory error code when no connection can be established
+	 * */
+	void acquire(const upstream& u, acquire_callback_t acb, error_callback_t ecb);
+
+	/** \brief gives back a connection which is ready to carry another request. */
+	void release(const upstream& u, connection_t c);
+
+	/** \brief drops a connection which can not be reused (e.g. a message was truncated on it).
+	 * Shared HTTP/2 sessions are left untouched, as other requests may be flowing on them.
+	 * */
+	void discard(const upstream& u, connection_t c);
+
+	/** \returns the number of idle connections kept for the upstream. */
+	std::size_t idle(const upstream& u) const;
+
+	void stop();
+
+private:
+	void watch(const std::string& key, const connection_t& c);
+	void forget(const std::string& key, const http::client_connection* c);
+	static bool multiplexed(const connection_t& c) noexcept;
+
+	std::unique_ptr<network::connector_factory> factory;
+	std::size_t max_idle;
+	std::unordered_map<std::string, std::list<connection_t>> idle_connections;
+	std::unordered_map<std::string, connection_t> shared_sessions;
+	bool stopped{false};
+};
+
+} // namespace proxy
+
+#endif //DOORMAT_CONNECTION_POOL_H
@@ -0,0 +1,871 @@
+#include "reverse_proxy.h"
+#include "coalescer.h"
+#include "../cache/http_cache.h"
+#include "../errors/error_pages.h"
+#include "../http/server/request.h"
+#include "../http/server/response.h"
+#include "../http/server/server_connection.h"
+#include "../http/client/request.h"
+#include "../http/client/response.h"
+#include "../http/client/client_connection.h"
+#include "../utils/log_wrapper.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace proxy
+{
+
+namespace
+{
+
+/** Error code used by the connector factories when the connect timeout expires. */
+constexpr int connect_timeout_error = 4;
+
+bool hop_by_hop(const http::http_structured_data::header_t& h)
+{
+	// transfer-encoding is not here: the codec needs it to know how the body is framed
+	return utils::icompare(h.first, "connection") || utils::icompare(h.first, "keep-alive") ||
+		utils::icompare(h.first, "proxy-connection") || utils::icompare(h.first, "te") ||
+		utils::icompare(h.first, "trailer") || utils::icompare(h.first, "upgrade") ||
+		utils::icompare(h.first, "proxy-authenticate") || utils::icompare(h.first, "proxy-authorization");
+}
+
+/** \brief removes the hop-by-hop headers: the ones above, and those the Connection header of the message names
+ * (RFC 7230, 6.1). The headers the message is framed and routed with stay, whatever the Connection header says. */
+void strip_hop_by_hop(http::http_structured_data& msg)
+{
+	const auto& named = msg.connection_options();
+	msg.filter([&named](const http::http_structured_data::header_t& h)
+	{
+		if(hop_by_hop(h)) return true;
+		if(h.first == http::hf_content_len || h.first == http::hf_transfer_encoding || h.first == http::hf_host)
+			return false;
+		return std::find(named.begin(), named.end(), h.first) != named.end();
+	});
+}
+
+bool may_have_body(http_method m) noexcept
+{
+	return m == HTTP_POST || m == HTTP_PUT || m == HTTP_PATCH;
+}
+
+bool response_has_body(uint16_t status, http_method m) noexcept
+{
+	return m != HTTP_HEAD && status >= 200 && status != 204 && status != 304;
+}
+
+bool unsafe(http_method m) noexcept
+{
+	return m == HTTP_POST || m == HTTP_PUT || m == HTTP_DELETE || m == HTTP_PATCH;
+}
+
+/** Cached bodies are handed downstream in slices this big, so that flow control can kick in. */
+constexpr std::size_t cache_slice = 16 * 1024;
+
+using data_t = std::unique_ptr<const char[]>;
+
+/** \brief bookkeeping of the bytes flowing in one direction. */
+struct flow
+{
+	std::size_t inflight{0};
+	bool paused{false};
+	std::shared_ptr<http::connection> source{nullptr};
+};
+
+/** \brief a request body chunk or trailer received before the upstream was ready. */
+struct request_event
+{
+	data_t data;
+	std::size_t size;
+	std::string key;
+	std::string value;
+	bool trailer;
+};
+
+/** \brief refreshes a stale cache entry in the background, while clients keep being served the stale copy
+ * (RFC 5861, 3). A 304 freshens the entry, any other storable response replaces it.
+ * */
+class revalidation : public std::enable_shared_from_this<revalidation>
+{
+public:
+	revalidation(std::shared_ptr<const reverse_proxy::settings> config, std::string key, cache::entry_ptr stale,
+		const http::http_request& received)
+		: config{std::move(config)}
+		, key{std::move(key)}
+		, stale{std::move(stale)}
+		, request{received}
+	{
+		request.method(HTTP_GET);
+	}
+
+	void start()
+	{
+		myself = this->shared_from_this();
+		target = config->selector(request);
+		begin = std::chrono::steady_clock::now();
+		request_time = cache::clock::now();
+		outgoing = upstream_preamble(request, target);
+		outgoing.remove_header("if-none-match");
+		outgoing.remove_header("if-modified-since");
+		cache::add_validators(outgoing, stale->preamble());
+
+		std::weak_ptr<revalidation> self = myself;
+		config->pool->acquire(target, [self, pool = config->pool, u = target](auto c)
+		{
+			if(auto r = self.lock()) return r->upstream_ready(std::move(c));
+			pool->release(u, std::move(c));
+		}, [self](int error)
+		{
+			if(auto r = self.lock()) r->failed(error == connect_timeout_error ? 504 : 502);
+		});
+	}
+
+private:
+	void upstream_ready(std::shared_ptr<http::client_connection> c)
+	{
+		upstream_conn = std::move(c);
+		auto handlers = upstream_conn->create_transaction();
+		creq = std::move(handlers.first);
+		cres = std::move(handlers.second);
+		if(!creq || !cres) return failed(502);
+
+		std::weak_ptr<revalidation> self = this->shared_from_this();
+		cres->on_headers([self](auto) { if(auto r = self.lock()) r->response_time = cache::clock::now(); });
+		cres->on_body([self](auto, data_t d, size_t s) { if(auto r = self.lock()) r->body(std::move(d), s); });
+		cres->on_finished([self](auto) { if(auto r = self.lock()) r->finished(); });
+		cres->on_error([self](auto, const http::connection_error&) { if(auto r = self.lock()) r->failed(502); });
+		creq->on_error([self]() { if(auto r = self.lock()) r->failed(502); });
+		creq->headers(std::move(outgoing));
+		creq->end();
+	}
+
+	void body(data_t d, size_t s)
+	{
+		if(too_big || captured.size() + s > config->caching->max_object())
+		{
+			too_big = true;
+			captured = std::string{};
+			return;
+		}
+		captured.append(d.get(), s);
+	}
+
+	void finished()
+	{
+		if(over) return;
+		const auto& preamble = cres->preamble();
+		if(preamble.status_code() == 304)
+			config->caching->freshen(key, *stale, preamble, request_time, response_time);
+		else if(!too_big && cache::storable(request, preamble))
+			config->caching->store(key, preamble, std::move(captured), request_time, response_time);
+
+		if(preamble.keepalive()) config->pool->release(target, upstream_conn);
+		else config->pool->discard(target, upstream_conn);
+		done(preamble.status_code());
+	}
+
+	void failed(uint16_t status)
+	{
+		if(over) return;
+		LOGDEBUG("revalidation of ", key, " on ", target.key(), " failed");
+		if(upstream_conn) config->pool->discard(target, upstream_conn);
+		done(status);
+	}
+
+	void done(uint16_t status)
+	{
+		over = true;
+		config->caching->end_revalidation(key);
+		if(config->on_complete) config->on_complete(target, status, std::chrono::steady_clock::now() - begin);
+		myself = nullptr;
+	}
+
+	std::shared_ptr<const reverse_proxy::settings> config;
+	std::string key;
+	cache::entry_ptr stale;
+	http::http_request request;
+	http::http_request outgoing;
+
+	upstream target;
+	std::chrono::steady_clock::time_point begin;
+	cache::clock::time_point request_time;
+	cache::clock::time_point response_time;
+	std::string captured;
+	bool too_big{false};
+	bool over{false};
+
+	std::shared_ptr<http::client_connection> upstream_conn{nullptr};
+	std::shared_ptr<http::client_request> creq{nullptr};
+	std::shared_ptr<http::client_response> cres{nullptr};
+
+	std::shared_ptr<revalidation> myself{nullptr};
+};
+
+/** \brief a single proxied exchange.
+ * It keeps itself alive until both messages are done (or one side fails); all the callbacks registered on the
+ * two sides only hold weak references to it, so that dropping the self reference is enough to tear it down.
+ * */
+class transaction : public std::enable_shared_from_this<transaction>
+{
+public:
+	transaction(std::shared_ptr<const reverse_proxy::settings> config, std::shared_ptr<http::server_connection> conn,
+		std::shared_ptr<http::request> req, std::shared_ptr<http::response> res)
+		: config{std::move(config)}
+		, downstream{std::move(conn)}
+		, req{std::move(req)}
+		, res{std::move(res)}
+	{}
+
+	void start()
+	{
+		myself = this->shared_from_this();
+		std::weak_ptr<transaction> self = myself;
+		req->on_headers([self](auto) { if(auto t = self.lock()) t->request_headers(); });
+		req->on_body([self](auto, data_t d, size_t s) { if(auto t = self.lock()) t->request_body(std::move(d), s); });
+		req->on_trailer([self](auto, std::string k, std::string v)
+		{
+			if(auto t = self.lock()) t->request_trailer(std::move(k), std::move(v));
+		});
+		req->on_finished([self](auto) { if(auto t = self.lock()) t->request_finished(); });
+		req->on_error([self](auto, const http::connection_error&) { if(auto t = self.lock()) t->downstream_failed(); });
+		res->on_error([self]() { if(auto t = self.lock()) t->downstream_failed(); });
+	}
+
+private:
+	/** Downstream events */
+	void request_headers()
+	{
+		request = req->preamble();
+		if(config->compression) res->compress(config->compression, request);
+		// the upstream will never see the expectation; answer it right away
+		if(request.has("expect", "100-continue") && request.channel() != http::proto_version::HTTP20)
+			res->send_continue();
+
+		if(config->caching) return from_cache();
+		forward();
+	}
+
+	/** \brief sends the request upstream, unless an identical one is already on its way. */
+	void forward()
+	{
+		// a revalidation must not be shared: the others did not ask for a 304
+		if(config->coalescing && !stale)
+		{
+			auto key = config->coalescing->key(request);
+			if(!key.empty())
+			{
+				if(auto f = config->coalescing->join(key)) return follow(std::move(f));
+				leading = config->coalescing->lead(key);
+			}
+		}
+		connect_upstream();
+	}
+
+	void connect_upstream()
+	{
+		target = config->selector(request);
+		begin = std::chrono::steady_clock::now();
+		selected = true;
+		request_time = cache::clock::now();
+		outgoing = upstream_preamble(request, target);
+		if(stale)
+		{
+			// the conditions are ours: the client gets the whole response whatever the outcome
+			outgoing.remove_header("if-none-match");
+			outgoing.remove_header("if-modified-since");
+			cache::add_validators(outgoing, stale->preamble());
+		}
+
+		std::weak_ptr<transaction> self = this->shared_from_this();
+		config->pool->acquire(target, [self, pool = config->pool, u = target](auto c)
+		{
+			if(auto t = self.lock()) return t->upstream_ready(std::move(c));
+			pool->release(u, std::move(c));
+		}, [self](int error)
+		{
+			if(auto t = self.lock()) t->upstream_failed(error == connect_timeout_error ? 504 : 502);
+		});
+	}
+
+	void request_body(data_t d, size_t s)
+	{
+		if(finished) return;
+		if(!creq)
+		{
+			pending.push_back(request_event{std::move(d), s, {}, {}, false});
+			return throttle(upload, downstream, nullptr, s);
+		}
+		creq->body(std::move(d), s);
+		throttle(upload, downstream, upstream_conn, s);
+	}
+
+	void request_trailer(std::string&& k, std::string&& v)
+	{
+		if(finished) return;
+		if(!creq)
+			return pending.push_back(request_event{nullptr, 0, std::move(k), std::move(v), true});
+		creq->trailer(std::move(k), std::move(v));
+	}
+
+	void request_finished()
+	{
+		request_ended = true;
+		if(creq && !finished) creq->end();
+	}
+
+	void downstream_failed()
+	{
+		if(finished) return;
+		LOGDEBUG("downstream failed, canceling the request to ", target.key());
+		if(upstream_conn) config->pool->discard(target, upstream_conn);
+		complete(reverse_proxy::client_closed);
+	}
+
+	/** Upstream events */
+	void upstream_ready(std::shared_ptr<http::client_connection> c)
+	{
+		if(finished) return config->pool->release(target, std::move(c));
+
+		upstream_conn = std::move(c);
+		auto handlers = upstream_conn->create_transaction();
+		creq = std::move(handlers.first);
+		cres = std::move(handlers.second);
+		if(!creq || !cres) return upstream_failed(502);
+
+		std::weak_ptr<transaction> self = this->shared_from_this();
+		cres->on_headers([self](auto) { if(auto t = self.lock()) t->response_headers(); });
+		cres->on_body([self](auto, data_t d, size_t s) { if(auto t = self.lock()) t->response_body(std::move(d), s); });
+		cres->on_trailer([self](auto, std::string k, std::string v)
+		{
+			if(auto t = self.lock()) t->response_trailer(std::move(k), std::move(v));
+		});
+		cres->on_finished([self](auto) { if(auto t = self.lock()) t->response_finished(); });
+		cres->on_error([self](auto, const http::connection_error&) { if(auto t = self.lock()) t->upstream_failed(502); });
+		creq->on_error([self]() { if(auto t = self.lock()) t->upstream_failed(502); });
+
+		creq->headers(std::move(outgoing));
+		std::size_t flushed{0};
+		while(!pending.empty())
+		{
+			auto& e = pending.front();
+			if(e.trailer) creq->trailer(std::move(e.key), std::move(e.value));
+			else
+			{
+				flushed += e.size;
+				creq->body(std::move(e.data), e.size);
+			}
+			pending.pop_front();
+		}
+		// what was held so far now belongs to the upstream connection
+		resume(upload);
+		throttle(upload, downstream, upstream_conn, flushed);
+		if(request_ended) creq->end();
+	}
+
+	void response_headers()
+	{
+		if(finished) return;
+		response_time = cache::clock::now();
+		const auto& preamble = cres->preamble();
+		if(stale && preamble.status_code() == 304)
+		{
+			revalidated = config->caching->freshen(cache_key, *stale, preamble, request_time, response_time);
+			return;
+		}
+		if(!cache_key.empty() && cache::storable(request, preamble)
+			&& (preamble.chunked() || preamble.content_len() <= config->caching->max_object()))
+		{
+			capturing = true;
+			captured.reserve(preamble.content_len());
+		}
+
+		response_started = true;
+		res->headers(downstream_preamble(cres->preamble(), request));
+		if(leading) leading->headers(cres->preamble());
+	}
+
+	void response_body(data_t d, size_t s)
+	{
+		if(finished || revalidated) return;
+		if(capturing)
+		{
+			if(captured.size() + s > config->caching->max_object())
+			{
+				capturing = false;
+				captured = std::string{};
+			}
+			else captured.append(d.get(), s);
+		}
+		if(leading)
+			leading->body(leading->followers() ? std::make_shared<const std::string>(d.get(), s) : nullptr);
+		res->body(std::move(d), s);
+		throttle(download, upstream_conn, downstream, s);
+	}
+
+	void response_trailer(std::string&& k, std::string&& v)
+	{
+		if(finished) return;
+		// there is no room for trailers in a cache entry
+		capturing = false;
+		if(leading) leading->trailer(k, v);
+		res->trailer(std::move(k), std::move(v));
+	}
+
+	void response_finished()
+	{
+		if(finished) return;
+		if(!revalidated) res->end();
+		if(leading) leading->finished();
+		// an upstream which answered before reading the whole request can not be reused safely
+		if(request_ended && cres->preamble().keepalive())
+			config->pool->release(target, upstream_conn);
+		else
+			config->pool->discard(target, upstream_conn);
+		upstream_conn = nullptr;
+
+		auto status = cres->preamble().status_code();
+		if(capturing)
+			config->caching->store(cache_key, cres->preamble(), std::move(captured), request_time, response_time);
+		// a successful unsafe request makes what we hold for the same resource obsolete (RFC 7234, 4.4)
+		if(!invalidated_key.empty() && status < 400)
+			config->caching->erase(invalidated_key);
+
+		if(!revalidated) return complete(status);
+		report(status);
+		serve(cache_key, revalidated, cache::clock::now());
+	}
+
+	void upstream_failed(uint16_t status)
+	{
+		if(finished) return;
+		LOGDEBUG("upstream ", target.key(), " failed");
+		if(upstream_conn) config->pool->discard(target, upstream_conn);
+		if(!response_started) respond(status);
+		else
+		{
+			// the response is already on its way; a truncated body must not look like a complete one
+			downstream->close();
+		}
+		complete(status);
+	}
+
+	/** \brief sends a response generated on our own: its error page, or nothing but the status. */
+	void respond(uint16_t status)
+	{
+		if(config->errors && config->errors->send(*res, status, request)) return;
+		http::http_response r;
+		r.protocol(request.protocol_version());
+		r.status(status);
+		r.content_len(0);
+		if(request.channel() != http::proto_version::HTTP20)
+			r.keepalive(request.keepalive());
+		res->headers(std::move(r));
+		res->end();
+	}
+
+	/** Cache: the response may come from a stored entry */
+
+	/** \brief answers from the cache when it can, forwards the request otherwise. */
+	void from_cache()
+	{
+		auto& c = *config->caching;
+		auto method = request.method_code();
+		if(unsafe(method))
+		{
+			invalidated_key = c.key(request);
+			return forward();
+		}
+		if(method != HTTP_GET && method != HTTP_HEAD) return forward();
+
+		auto key = c.key(request);
+		// no-cache asks for a response from the origin, which can still be stored
+		if(cache::request_cache_control(request).no_cache) return cached(std::move(key), nullptr);
+		std::weak_ptr<transaction> self = this->shared_from_this();
+		c.lookup(key, req->io_service(), [self, key](cache::entry_ptr e)
+		{
+			if(auto t = self.lock()) t->cached(key, std::move(e));
+		});
+	}
+
+	/** \brief goes on with the entry found for the request, if any. */
+	void cached(std::string key, cache::entry_ptr e)
+	{
+		if(finished) return;
+		auto& c = *config->caching;
+		auto now = cache::clock::now();
+		auto asked = cache::request_cache_control(request);
+		if(e && e->acceptable(now, asked)) return serve(key, e, now);
+		// a client with freshness requirements of its own gets a response which meets them
+		bool demanding = asked.max_age || asked.min_fresh || asked.max_stale;
+		if(e && !demanding && e->stale_while_revalidate(now))
+		{
+			if(c.begin_revalidation(key))
+				std::make_shared<revalidation>(config, key, e, request)->start();
+			return serve(key, e, now);
+		}
+		if(asked.only_if_cached)
+		{
+			respond(504);
+			return complete(504);
+		}
+
+		if(request.method_code() != HTTP_GET) return forward();
+		cache_key = std::move(key);
+		if(e && e->has_validators()) stale = std::move(e);
+		forward();
+	}
+
+	/** \brief answers with a stored entry; its body is sent straight from where the entry keeps it, or from its
+	 * compressed variant.
+	 * */
+	void serve(const std::string& key, const cache::entry_ptr& e, cache::clock::time_point now)
+	{
+		response_started = true;
+		auto preamble = downstream_preamble(e->preamble(), request);
+		preamble.remove_header("age");
+		preamble.header("age", std::to_string(std::chrono::duration_cast<std::chrono::seconds>(e->age(now)).count()));
+		backlog_status = preamble.status_code();
+		bool body = response_has_body(backlog_status, request.method_code());
+		if(cache::not_modified(request, e->preamble()))
+		{
+			preamble.status(304);
+			preamble.content_len(0);
+			backlog_status = 304;
+			body = false;
+		}
+		auto b = e->body();
+		auto coding = body && config->compression ? http::negotiate_encoding(request.header(http::hf_accept_encoding))
+			: http::tranfer_encoding::identity;
+		if(coding != http::tranfer_encoding::identity && config->compression->compressible(e->preamble()))
+		{
+			// the variant must follow the body: the validator tells whether it changed
+			auto version = e->preamble().has("etag") ? e->preamble().header("etag")
+				: std::to_string(e->response_time().time_since_epoch().count());
+			auto variant = config->variants->get(key + '\n' + version, coding, config->compression->level, b.data, b.size);
+			b = cache::body_view{variant, variant->data(), variant->size()};
+			http::mark_encoded(preamble, coding);
+			preamble.content_len(b.size);
+		}
+		res->headers(std::move(preamble));
+
+		if(body)
+		{
+			for(std::size_t offset = 0; offset < b.size; offset += cache_slice)
+			{
+				backlog.push_back(cache::body_view{b.owner, b.data + offset, std::min(cache_slice, b.size - offset)});
+				backlog_bytes += backlog.back().size;
+			}
+		}
+		backlog_ended = true;
+		flush_backlog();
+	}
+
+	/** Coalesced requests: the response comes from the flight, not from an upstream connection */
+	void follow(std::shared_ptr<flight> f)
+	{
+		following = std::move(f);
+		std::weak_ptr<transaction> self = this->shared_from_this();
+		following->subscribe(flight::subscriber{
+			[self](const http::http_response& r) { if(auto t = self.lock()) t->shared_headers(r); },
+			[self](const shared_chunk& c) { if(auto t = self.lock()) t->shared_body(c); },
+			[self](const std::string& k, const std::string& v) { if(auto t = self.lock()) t->shared_trailer(k, v); },
+			[self]() { if(auto t = self.lock()) t->shared_finished(); },
+			[self]() { if(auto t = self.lock()) t->shared_abandoned(); }
+		});
+	}
+
+	void shared_headers(const http::http_response& r)
+	{
+		if(finished) return;
+		response_started = true;
+		backlog_status = r.status_code();
+		res->headers(downstream_preamble(r, request));
+	}
+
+	void shared_body(const shared_chunk& c)
+	{
+		if(finished) return;
+		backlog_bytes += c->size();
+		backlog.push_back(cache::body_view{c, c->data(), c->size()});
+		if(backlog_bytes > config->coalescing->follower_buffer())
+		{
+			// the client can not keep up with the others: it is not going to stall them
+			LOGDEBUG("coalesced request too slow, dropping it");
+			downstream->close();
+			return complete(reverse_proxy::client_closed);
+		}
+		flush_backlog();
+	}
+
+	void shared_trailer(const std::string& k, const std::string& v)
+	{
+		if(finished) return;
+		shared_trailers.emplace_back(k, v);
+		flush_backlog();
+	}
+
+	void shared_finished()
+	{
+		if(finished) return;
+		backlog_ended = true;
+		flush_backlog();
+	}
+
+	void shared_abandoned()
+	{
+		if(finished) return;
+		following = nullptr;
+		if(!response_started) return connect_upstream();
+		downstream->close();
+		complete(502);
+	}
+
+	/** \brief hands the queued slices to the client, as long as its connection keeps draining. */
+	void flush_backlog()
+	{
+		while(!backlog.empty() && download.inflight < config->high_watermark)
+		{
+			auto& b = backlog.front();
+			// written from where the entry or the shared response keeps it, which stays alive meanwhile
+			res->block(http::shared_block{b.owner, b.data, b.size});
+			download.inflight += b.size;
+			backlog_bytes -= b.size;
+			backlog.pop_front();
+		}
+
+		if(!backlog.empty())
+		{
+			if(draining) return;
+			draining = true;
+			std::weak_ptr<transaction> self = this->shared_from_this();
+			downstream->when_drained([self]()
+			{
+				if(auto t = self.lock())
+				{
+					t->draining = false;
+					t->download.inflight = 0;
+					t->flush_backlog();
+				}
+			});
+			return;
+		}
+
+		for(auto& t : shared_trailers)
+			res->trailer(std::move(t.first), std::move(t.second));
+		shared_trailers.clear();
+		if(!backlog_ended) return;
+		res->end();
+		complete(backlog_status);
+	}
+
+	/** Flow control */
+
+	/** \brief accounts bytes handed to the sink; past the high watermark the source stops being read
+	 * until the sink has written everything it had.
+	 * */
+	void throttle(flow& f, std::shared_ptr<http::connection> source, std::shared_ptr<http::connection> sink, std::size_t bytes)
+	{
+		f.inflight += bytes;
+		if(f.paused || f.inflight < config->high_watermark) return;
+		f.paused = true;
+		f.source = std::move(source);
+		f.source->pause_reading();
+		if(!sink) return; // upstream_ready() will take care of it
+
+		std::weak_ptr<transaction> self = this->shared_from_this();
+		flow transaction::* which = (&f == &upload) ? &transaction::upload : &transaction::download;
+		sink->when_drained([self, which]() { if(auto t = self.lock()) t->resume(t.get()->*which); });
+	}
+
+	void resume(flow& f)
+	{
+		f.inflight = 0;
+		if(!f.paused) return;
+		f.paused = false;
+		f.source->resume_reading();
+		f.source = nullptr;
+	}
+
+	/** \brief tells how the upstream exchange went, once. */
+	void report(uint16_t status)
+	{
+		if(!selected) return;
+		selected = false;
+		if(config->on_complete)
+			config->on_complete(target, status, std::chrono::steady_clock::now() - begin);
+	}
+
+	void complete(uint16_t status)
+	{
+		finished = true;
+		if(leading) leading->abandon();
+		report(status);
+		resume(upload);
+		resume(download);
+		pending.clear();
+		myself = nullptr;
+	}
+
+	std::shared_ptr<const reverse_proxy::settings> config;
+	std::shared_ptr<http::server_connection> downstream;
+	std::shared_ptr<http::request> req;
+	std::shared_ptr<http::response> res;
+
+	upstream target;
+	std::chrono::steady_clock::time_point begin;
+	http::http_request request;
+	http::http_request outgoing;
+	std::deque<request_event> pending;
+
+	std::shared_ptr<flight> leading{nullptr};
+	std::shared_ptr<flight> following{nullptr};
+	std::vector<std::pair<std::string, std::string>> shared_trailers;
+
+	/** What is sent downstream from the cache or from a flight */
+	std::deque<cache::body_view> backlog;
+	std::size_t backlog_bytes{0};
+	uint16_t backlog_status{200};
+	bool backlog_ended{false};
+	bool draining{false};
+
+	std::string cache_key;
+	std::string invalidated_key;
+	/** the entry being revalidated, and the outcome when the upstream confirmed it */
+	cache::entry_ptr stale{nullptr};
+	cache::entry_ptr revalidated{nullptr};
+	cache::clock::time_point request_time;
+	cache::clock::time_point response_time;
+	std::string captured;
+	bool capturing{false};
+
+	std::shared_ptr<http::client_connection> upstream_conn{nullptr};
+	std::shared_ptr<http::client_request> creq{nullptr};
+	std::shared_ptr<http::client_response> cres{nullptr};
+
+	flow upload;
+	flow download;
+	bool selected{false};
+	bool request_ended{false};
+	bool response_started{false};
+	bool finished{false};
+
+	std::shared_ptr<transaction> myself{nullptr};
+};
+
+} // unnamed namespace
+
+reverse_proxy::reverse_proxy(std::shared_ptr<connection_pool> pool, upstream_selector_t selector,
+	completion_callback_t on_complete, std::size_t high_watermark)
+	: config{std::make_shared<settings>(settings{std::move(pool), std::move(selector), std::move(on_complete), high_watermark})}
+{}
+
+reverse_proxy::reverse_proxy(std::shared_ptr<connection_pool> pool, std::shared_ptr<network::upstream_group> group,
+	key_extractor_t key, std::size_t high_watermark)
+	: reverse_proxy{std::move(pool), [group, key = std::move(key)](const http::http_request& req)
+		{
+			auto i = group->select(key ? key(req) : std::string{});
+			group->started(i);
+			return (*group)[i];
+		}, [group](const upstream& u, uint16_t status, std::chrono::steady_clock::duration elapsed)
+		{
+			auto i = group->index_of(u);
+			if(i < group->size())
+				group->completed(i, elapsed, status < 500);
+		}, high_watermark}
+{}
+
+void reverse_proxy::operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+	std::shared_ptr<http::response> res) const
+{
+	std::make_shared<transaction>(config, std::move(conn), std::move(req), std::move(res))->start();
+}
+
+void reverse_proxy::coalesce(std::shared_ptr<coalescer> c)
+{
+	auto s = std::make_shared<settings>(*config);
+	s->coalescing = std::move(c);
+	config = std::move(s);
+}
+
+void reverse_proxy::use_cache(std::shared_ptr<cache::http_cache> c)
+{
+	auto s = std::make_shared<settings>(*config);
+	s->caching = std::move(c);
+	config = std::move(s);
+}
+
+void reverse_proxy::compress(std::shared_ptr<const http::compression_policy> policy,
+	std::shared_ptr<http::compressed_variants> variants)
+{
+	auto s = std::make_shared<settings>(*config);
+	s->compression = std::move(policy);
+	s->variants = std::move(variants);
+	config = std::move(s);
+}
+
+void reverse_proxy::use_error_pages(std::shared_ptr<const errors::error_pages> pages)
+{
+	auto s = std::make_shared<settings>(*config);
+	s->errors = std::move(pages);
+	config = std::move(s);
+}
+
+void reverse_proxy::attach(const std::shared_ptr<http::server_connection>& conn) const
+{
+	conn->on_request(*this);
+}
+
+http::http_request upstream_preamble(const http::http_request& received, const upstream& u)
+{
+	http::http_request out{received};
+	strip_hop_by_hop(out);
+	out.remove_header("expect");
+	out.protocol(http::proto_version::HTTP11);
+	out.keepalive(true);
+	if(out.schema().empty())
+		out.schema(u.tls ? "https" : "http");
+	if(out.hostname().empty())
+		out.hostname(u.address);
+
+	if(!received.origin().is_unspecified())
+	{
+		static const std::string forwarded_for = "x-forwarded-for";
+		auto chain = received.header(forwarded_for);
+		chain = chain.empty() ? received.origin().to_string() : chain + http::comma_space + received.origin().to_string();
+		out.remove_header(forwarded_for);
+		out.header(forwarded_for, chain);
+	}
+
+	// HTTP/2 does not need a length to delimit the body; HTTP/1.1 does
+	if(received.channel() == http::proto_version::HTTP20 && !out.chunked() && out.content_len() == 0
+		&& may_have_body(out.method_code()))
+		out.chunked(true);
+	return out;
+}
+
+http::http_response downstream_preamble(const http::http_response& received, const http::http_request& request)
+{
+	http::http_response out{received};
+	strip_hop_by_hop(out);
+	out.protocol(request.protocol_version());
+	// connection management headers are meaningless on an HTTP/2 stream
+	if(request.channel() == http::proto_version::HTTP20)
+		return out;
+
+	bool keepalive = request.keepalive();
+	if(received.channel() == http::proto_version::HTTP20 && !out.chunked() && out.content_len() == 0
+		&& response_has_body(out.status_code(), request.method_code()))
+		out.chunked(true);
+
+	if(out.chunked() && request.protocol_version() == http::proto_version::HTTP10)
+	{
+		// HTTP/1.0 has no chunked encoding: the body ends when the connection is closed
+		out.chunked(false);
+		keepalive = false;
+	}
+	out.keepalive(keepalive);
+	return out;
+}
+
+} // namespace proxy
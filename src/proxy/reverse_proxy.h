@@ -0,0 +1,120 @@
+#ifndef DOORMAT_REVERSE_PROXY_H
+#define DOORMAT_REVERSE_PROXY_H
+
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include "connection_pool.h"
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+#include "../http/compression.h"
+
+namespace http
+{
+class request;
+class response;
+class server_connection;
+}
+
+namespace cache
+{
+class http_cache;
+}
+
+namespace errors
+{
+class error_pages;
+}
+
+namespace proxy
+{
+
+class coalescer;
+
+/** \brief forwards the requests received by the server to an upstream, streaming the messages in both directions.
+ *
+ * Preamble, body chunks and trailers are handed to the other side as soon as they are decoded, without ever
+ * buffering a whole body. When the receiving side can not keep up, the sending connection stops being read
+ * until the pending output has been written (see high_watermark). Any combination of HTTP/1.x and HTTP/2 is
+ * supported on the two sides; a failure on either side cancels the other one.
+ * */
+class reverse_proxy
+{
+public:
+	using upstream_selector_t = std::function<upstream(const http::http_request&)>;
+	/** Receives the upstream status (or the one sent on its behalf) and the time spent on each request. */
+	using completion_callback_t = std::function<void(const upstream&, uint16_t, std::chrono::steady_clock::duration)>;
+	using key_extractor_t = std::function<std::string(const http::http_request&)>;
+
+	/** Bytes that can be handed to one side before the other one is paused. */
+	static constexpr std::size_t default_high_watermark = 64 * 1024;
+	/** Status reported on completion when the client went away before the exchange was over. */
+	static constexpr uint16_t client_closed = 499;
+
+	reverse_proxy(std::shared_ptr<connection_pool> pool, upstream_selector_t selector,
+		completion_callback_t on_complete = nullptr, std::size_t high_watermark = default_high_watermark);
+
+	/** \brief spreads the requests among the members of the group, reporting to it how each one went.
+	 * \param key extracts the consistent hashing key from a request; when missing, no key is used
+	 * */
+	reverse_proxy(std::shared_ptr<connection_pool> pool, std::shared_ptr<network::upstream_group> group,
+		key_extractor_t key = nullptr, std::size_t high_watermark = default_high_watermark);
+
+	/** \brief proxies a single request; it can be used directly as http::server_connection request callback. */
+	void operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+		std::shared_ptr<http::response> res) const;
+
+	/** \brief collapses identical concurrent requests into one upstream exchange from now on. */
+	void coalesce(std::shared_ptr<coalescer> c);
+
+	/** \brief answers from the cache whenever RFC 7234 allows it, and stores what can be stored, from now on.
+	 * Stale entries are revalidated with a conditional request; those allowing stale-while-revalidate are served
+	 * right away and refreshed in the background.
+	 * */
+	void use_cache(std::shared_ptr<cache::http_cache> c);
+
+	/** \brief compresses the responses allowed by the policy for the clients accepting it, from now on.
+	 * Bodies served from the cache are compressed once and the result is kept in variants.
+	 * */
+	void compress(std::shared_ptr<const http::compression_policy> policy,
+		std::shared_ptr<http::compressed_variants> variants = std::make_shared<http::compressed_variants>());
+
+	/** \brief sends the pages along with the errors generated on our own, from now on. */
+	void use_error_pages(std::shared_ptr<const errors::error_pages> pages);
+
+	/** \brief proxies every request received on the connection. */
+	void attach(const std::shared_ptr<http::server_connection>& conn) const;
+
+	struct settings
+	{
+		std::shared_ptr<connection_pool> pool;
+		upstream_selector_t selector;
+		completion_callback_t on_complete;
+		std::size_t high_watermark;
+		std::shared_ptr<coalescer> coalescing;
+		std::shared_ptr<cache::http_cache> caching;
+		std::shared_ptr<const http::compression_policy> compression;
+		std::shared_ptr<http::compressed_variants> variants;
+		std::shared_ptr<const errors::error_pages> errors;
+	};
+private:
+	std::shared_ptr<const settings> config;
+};
+
+/** \brief builds the preamble sent to the upstream from the one received by the server.
+ * Hop-by-hop headers are dropped, the ones its Connection header names included, and the message is always sent as
+ * a persistent HTTP/1.1 one; HTTP/2 streams
+ * with a body but without a length become chunked.
+ * */
+http::http_request upstream_preamble(const http::http_request& received, const upstream& u);
+
+/** \brief builds the preamble sent downstream from the one received by the upstream.
+ * \param received the upstream response
+ * \param request the preamble of the request which is being answered
+ * */
+http::http_response downstream_preamble(const http::http_response& received, const http::http_request& request);
+
+} // namespace proxy
+
+#endif //DOORMAT_REVERSE_PROXY_H
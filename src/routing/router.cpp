@@ -0,0 +1,409 @@
+#include "router.h"
+#include "../http/http_commons.h"
+#include "../http/http_request.h"
+#include "../http/http_response.h"
+#include "../http/server/request.h"
+#include "../http/server/response.h"
+#include "../http/server/server_connection.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace routing
+{
+
+namespace
+{
+
+constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+
+/** \brief a piece of a pattern: static text, a parameter or a wildcard. */
+struct token
+{
+	enum class kind { text, param, wildcard };
+
+	kind type;
+	std::string value;
+};
+
+std::vector<token> parse(const std::string& pattern)
+{
+	if(pattern.empty() || pattern[0] != '/')
+		throw std::invalid_argument{"route patterns must start with a slash: " + pattern};
+
+	std::vector<token> tokens;
+	std::string text{"/"};
+	auto capture = [&tokens, &text, &pattern](token::kind type, std::string name)
+	{
+		for(const auto& t : tokens)
+			if(t.type != token::kind::text && t.value == name)
+				throw std::invalid_argument{"duplicate capture \"" + name + "\" in route pattern " + pattern};
+		if(!text.empty()) tokens.push_back(token{token::kind::text, std::move(text)});
+		text.clear();
+		tokens.push_back(token{type, std::move(name)});
+	};
+
+	std::size_t captures = 0;
+	std::size_t begin = 1;
+	while(true)
+	{
+		auto end = std::min(pattern.find('/', begin), pattern.size());
+		auto segment = pattern.substr(begin, end - begin);
+		if(!segment.empty() && segment.front() == '{')
+		{
+			if(segment.size() < 3 || segment.back() != '}' || segment.find_first_of("{}", 1) != segment.size() - 1)
+				throw std::invalid_argument{"malformed parameter in route pattern " + pattern};
+			capture(token::kind::param, segment.substr(1, segment.size() - 2));
+			++captures;
+		}
+		else if(!segment.empty() && segment.front() == '*')
+		{
+			if(end != pattern.size())
+				throw std::invalid_argument{"wildcards must be the last segment of route pattern " + pattern};
+			capture(token::kind::wildcard, segment.substr(1));
+			++captures;
+		}
+		else
+		{
+			if(segment.find_first_of("{}") != std::string::npos)
+				throw std::invalid_argument{"parameters must be whole segments in route pattern " + pattern};
+			text += segment;
+		}
+		if(end == pattern.size()) break;
+		text += '/';
+		begin = end + 1;
+	}
+	if(!text.empty()) tokens.push_back(token{token::kind::text, std::move(text)});
+
+	if(captures > match::max_captures)
+		throw std::invalid_argument{"too many parameters in route pattern " + pattern};
+	return tokens;
+}
+
+/** \brief orders the lower case host names against a host name of any case. */
+bool iless(boost::string_ref lower, boost::string_ref other) noexcept
+{
+	auto size = std::min(lower.size(), other.size());
+	for(std::size_t i = 0; i < size; ++i)
+	{
+		auto c = static_cast<char>(std::tolower(static_cast<unsigned char>(other[i])));
+		if(lower[i] != c) return lower[i] < c;
+	}
+	return lower.size() < other.size();
+}
+
+bool iequal(boost::string_ref lower, boost::string_ref other) noexcept
+{
+	return lower.size() == other.size() && std::equal(lower.begin(), lower.end(), other.begin(),
+		[](char l, char o) { return l == static_cast<char>(std::tolower(static_cast<unsigned char>(o))); });
+}
+
+/** \returns the host without the port, if any */
+boost::string_ref without_port(boost::string_ref host) noexcept
+{
+	auto colon = host.rfind(':');
+	auto bracket = host.rfind(']');
+	if(colon != boost::string_ref::npos && (bracket == boost::string_ref::npos || colon > bracket))
+		return host.substr(0, colon);
+	return host;
+}
+
+std::string allow_header(method_mask methods)
+{
+	// GET handlers answer HEAD requests too
+	if(methods & method_bit(HTTP_GET)) methods |= method_bit(HTTP_HEAD);
+	std::string allow;
+	for(int m = HTTP_DELETE; m <= HTTP_UNLINK; ++m)
+	{
+		if(!(methods & method_bit(static_cast<http_method>(m)))) continue;
+		if(!allow.empty()) allow += ", ";
+		allow += http_method_str(static_cast<http_method>(m));
+	}
+	return allow;
+}
+
+void refuse(const http::http_request& req, http::response& res, method_mask allowed)
+{
+	http::http_response r;
+	r.protocol(req.protocol_version());
+	r.status(allowed ? 405 : 404);
+	if(req.channel() != http::proto_version::HTTP20)
+		r.keepalive(req.keepalive());
+	if(allowed) r.header(http::hf_allow, allow_header(allowed));
+	r.content_len(0);
+	res.headers(std::move(r));
+	res.end();
+}
+
+}
+
+/** \brief a node of the radix tree, reached once its prefix has been matched. */
+struct router::node
+{
+	/** Static text leading to the node from its parent; empty for parameters and wildcards. */
+	std::string prefix;
+	/** First byte of the prefix of each static child, to pick the only one that can match. */
+	std::string first_bytes;
+	std::vector<std::unique_ptr<node>> children;
+	/** Name of the parameter or wildcard the node stands for. */
+	std::string name;
+	std::unique_ptr<node> param;
+	std::unique_ptr<node> wildcard;
+	/** Methods routed at the node, and their handlers. */
+	std::vector<std::pair<method_mask, std::size_t>> endpoints;
+
+	/** \returns the node reached from this one through the text, splitting the edges as needed */
+	node* walk(boost::string_ref text)
+	{
+		node* current = this;
+		while(!text.empty())
+		{
+			auto i = current->first_bytes.find(text[0]);
+			if(i == std::string::npos)
+			{
+				current->first_bytes.push_back(text[0]);
+				current->children.push_back(std::make_unique<node>());
+				current->children.back()->prefix = text.to_string();
+				return current->children.back().get();
+			}
+
+			auto& slot = current->children[i];
+			std::size_t common = 0;
+			while(common < slot->prefix.size() && common < text.size() && slot->prefix[common] == text[common])
+				++common;
+			if(common < slot->prefix.size())
+			{
+				auto split = std::make_unique<node>();
+				split->prefix = slot->prefix.substr(0, common);
+				slot->prefix.erase(0, common);
+				split->first_bytes.push_back(slot->prefix[0]);
+				split->children.push_back(std::move(slot));
+				slot = std::move(split);
+			}
+			current = slot.get();
+			text = text.substr(common);
+		}
+		return current;
+	}
+
+	/** \returns the parameter or wildcard node in the slot, which must have the given name if it exists */
+	static node* capture(std::unique_ptr<node>& slot, const std::string& name, const std::string& pattern)
+	{
+		if(!slot)
+		{
+			slot = std::make_unique<node>();
+			slot->name = name;
+		}
+		else if(slot->name != name)
+			throw std::invalid_argument{"capture \"" + name + "\" of route pattern " + pattern
+				+ " is named \"" + slot->name + "\" by another pattern"};
+		return slot.get();
+	}
+};
+
+struct router::shared_state
+{
+	/** Routes of the requests for any host without routes of its own. */
+	node any_host;
+	/** Sorted by host name, in lower case. */
+	std::vector<std::pair<std::string, std::unique_ptr<node>>> hosts;
+	std::vector<handler_t> handlers;
+	handler_t fallback;
+};
+
+boost::string_ref match::operator[](boost::string_ref name) const noexcept
+{
+	for(std::size_t i = 0; i < count; ++i)
+		if(captures[i].first == name) return captures[i].second;
+	return {};
+}
+
+router::router()
+	: state{std::make_shared<shared_state>()}
+{}
+
+void router::add(method_mask methods, const std::string& pattern, handler_t handler)
+{
+	add({}, methods, pattern, std::move(handler));
+}
+
+void router::add(const std::string& host, method_mask methods, const std::string& pattern, handler_t handler)
+{
+	if(!methods) throw std::invalid_argument{"no methods routed to pattern " + pattern};
+	auto tokens = parse(pattern);
+
+	node* current = &state->any_host;
+	if(!host.empty())
+	{
+		std::string lower{host};
+		std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+		auto& hosts = state->hosts;
+		auto it = std::lower_bound(hosts.begin(), hosts.end(), lower,
+			[](const std::pair<std::string, std::unique_ptr<node>>& h, const std::string& name)
+			{
+				return h.first < name;
+			});
+		if(it == hosts.end() || it->first != lower)
+			it = hosts.emplace(it, std::move(lower), std::make_unique<node>());
+		current = it->second.get();
+	}
+
+	for(const auto& t : tokens)
+	{
+		switch(t.type)
+		{
+			case token::kind::text:
+				current = current->walk(t.value);
+				break;
+			case token::kind::param:
+				current = node::capture(current->param, t.value, pattern);
+				break;
+			case token::kind::wildcard:
+				current = node::capture(current->wildcard, t.value, pattern);
+				break;
+		}
+	}
+
+	for(const auto& e : current->endpoints)
+		if(e.first & methods)
+			throw std::invalid_argument{"route pattern " + pattern + " overlaps another one with the same methods"};
+	current->endpoints.emplace_back(methods, state->handlers.size());
+	state->handlers.push_back(std::move(handler));
+}
+
+void router::otherwise(handler_t handler)
+{
+	state->fallback = std::move(handler);
+}
+
+std::size_t router::size() const noexcept
+{
+	return state->handlers.size();
+}
+
+namespace
+{
+
+/** \returns the handler routed for the method among the endpoints, adding the methods they route to allowed */
+template<typename endpoints_t>
+std::size_t pick(const endpoints_t& endpoints, http_method method, method_mask& allowed) noexcept
+{
+	std::size_t get = none;
+	for(const auto& e : endpoints)
+	{
+		if(e.first & method_bit(method)) return e.second;
+		if(e.first & method_bit(HTTP_GET)) get = e.second;
+		allowed |= e.first;
+	}
+	return method == HTTP_HEAD ? get : none;
+}
+
+}
+
+std::size_t router::lookup(const node& n, boost::string_ref path, std::size_t pos, http_method method,
+	match& m) noexcept
+{
+	if(pos == path.size())
+	{
+		auto found = pick(n.endpoints, method, m.methods);
+		if(found != none) return found;
+	}
+	else
+	{
+		auto i = n.first_bytes.find(path[pos]);
+		if(i != std::string::npos)
+		{
+			const auto& child = *n.children[i];
+			if(path.size() - pos >= child.prefix.size()
+				&& std::memcmp(path.data() + pos, child.prefix.data(), child.prefix.size()) == 0)
+			{
+				auto found = lookup(child, path, pos + child.prefix.size(), method, m);
+				if(found != none) return found;
+			}
+		}
+
+		if(n.param && path[pos] != '/')
+		{
+			auto end = std::find(path.begin() + pos, path.end(), '/') - path.begin();
+			m.captures[m.count++] = {n.param->name, path.substr(pos, end - pos)};
+			auto found = lookup(*n.param, path, end, method, m);
+			if(found != none) return found;
+			--m.count;
+		}
+	}
+
+	if(n.wildcard)
+	{
+		m.captures[m.count++] = {n.wildcard->name, path.substr(pos)};
+		auto found = pick(n.wildcard->endpoints, method, m.methods);
+		if(found != none) return found;
+		--m.count;
+	}
+	return none;
+}
+
+const router::handler_t* router::find(boost::string_ref host, http_method method, boost::string_ref path,
+	match& m) const noexcept
+{
+	m.count = 0;
+	m.methods = 0;
+	if(path.empty()) return nullptr;
+
+	const node* root = &state->any_host;
+	if(!state->hosts.empty())
+	{
+		host = without_port(host);
+		const auto& hosts = state->hosts;
+		auto it = std::lower_bound(hosts.begin(), hosts.end(), host,
+			[](const std::pair<std::string, std::unique_ptr<node>>& h, boost::string_ref name)
+			{
+				return iless(h.first, name);
+			});
+		if(it != hosts.end() && iequal(it->first, host))
+			root = it->second.get();
+	}
+
+	auto found = lookup(*root, path, 0, method, m);
+	return found == none ? nullptr : &state->handlers[found];
+}
+
+const router::handler_t* router::find(const http::http_request& req, match& m) const noexcept
+{
+	const auto& host = req.hostname().empty() ? req.urihost() : req.hostname();
+	return find(host, req.method_code(), req.path(), m);
+}
+
+void router::route(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+	std::shared_ptr<http::response> res) const
+{
+	// the captures refer to the preamble, which the request keeps until the handler returns
+	match m;
+	if(auto handler = find(req->preamble(), m))
+		return (*handler)(std::move(conn), std::move(req), std::move(res), m);
+	if(state->fallback)
+		return state->fallback(std::move(conn), std::move(req), std::move(res), m);
+	refuse(req->preamble(), *res, m.allowed());
+}
+
+void router::operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+	std::shared_ptr<http::response> res) const
+{
+	std::weak_ptr<http::server_connection> connection = conn;
+	req->on_headers([self = *this, connection, res](std::shared_ptr<http::request> req)
+	{
+		if(auto conn = connection.lock())
+			self.route(std::move(conn), std::move(req), res);
+	});
+}
+
+void router::attach(const std::shared_ptr<http::server_connection>& conn) const
+{
+	conn->on_request(*this);
+}
+
+}
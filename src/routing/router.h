@@ -0,0 +1,133 @@
+#ifndef DOORMAT_ROUTING_ROUTER_H
+#define DOORMAT_ROUTING_ROUTER_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <boost/utility/string_ref.hpp>
+
+#include "../http_parser/http_parser.h"
+
+namespace http
+{
+class http_request;
+class request;
+class response;
+class server_connection;
+}
+
+namespace routing
+{
+
+/** \brief a set of methods, one bit per http_method. */
+using method_mask = std::uint64_t;
+
+constexpr method_mask any_method = ~method_mask{0};
+
+constexpr method_mask method_bit(http_method method) noexcept
+{
+	return method_mask{1} << method;
+}
+
+/** \brief the outcome of a lookup: the values of the parameters and wildcard of the matching pattern.
+ *
+ * Names are views into the router and values views into the path that has been looked up, which both have to
+ * outlive the match; values are taken as they are in the path, without decoding them.
+ * */
+class match
+{
+public:
+	/** Parameters and wildcards a pattern can have at most. */
+	static constexpr std::size_t max_captures = 8;
+
+	std::size_t size() const noexcept { return count; }
+	boost::string_ref name(std::size_t i) const noexcept { return captures[i].first; }
+	boost::string_ref value(std::size_t i) const noexcept { return captures[i].second; }
+
+	/** \returns the value of the named parameter or wildcard, empty if the pattern has none */
+	boost::string_ref operator[](boost::string_ref name) const noexcept;
+
+	/** \returns the methods the path could be requested with, when a lookup failed because of the method */
+	method_mask allowed() const noexcept { return methods; }
+
+private:
+	friend class router;
+
+	std::array<std::pair<boost::string_ref, boost::string_ref>, max_captures> captures;
+	std::size_t count{0};
+	method_mask methods{0};
+};
+
+/** \brief dispatches requests to handlers by host, method and path, as http::server_connection request callback.
+ *
+ * Patterns are paths whose segments can be parameters, written "{name}", each matching a whole non-empty
+ * segment; the last segment can be a wildcard, written "*name" or "*", matching the rest of the path, slashes
+ * included. Static segments win over parameters, which win over wildcards, regardless of the order in which
+ * the routes are added.
+ *
+ * Routes live in a radix tree whose edges are the static parts of the patterns, so that a lookup walks the path
+ * once, going back only when a static branch turns out to be a dead end and a parameter has to be tried instead;
+ * it allocates nothing.
+ *
+ * Routes added with a host only serve the requests for that host (compared case-insensitively, port excluded);
+ * the others serve the requests for any host without routes of its own. HEAD requests go to the GET handler when
+ * they have none of their own.
+ *
+ * Routes must all be added before the router is used; copies share them.
+ * */
+class router
+{
+public:
+	/** Handlers are called once the headers have been received: the preamble is there and the other events of
+	 * the request can be subscribed; the match lasts as long as the call. */
+	using handler_t = std::function<void(std::shared_ptr<http::server_connection>, std::shared_ptr<http::request>,
+		std::shared_ptr<http::response>, const match&)>;
+
+	router();
+
+	/** \brief routes the methods and pattern to the handler.
+	 * \throws std::invalid_argument if the pattern is malformed or overlaps another one with the same methods
+	 * */
+	void add(method_mask methods, const std::string& pattern, handler_t handler);
+	void add(const std::string& host, method_mask methods, const std::string& pattern, handler_t handler);
+
+	/** \brief sets the handler of the requests no route matches, which by default get a 404, or a 405 when the
+	 * path is routed for other methods.
+	 * */
+	void otherwise(handler_t handler);
+
+	/** \returns the handler of the request, or nullptr if none matches */
+	const handler_t* find(boost::string_ref host, http_method method, boost::string_ref path, match& m) const noexcept;
+	const handler_t* find(const http::http_request& req, match& m) const noexcept;
+
+	/** \brief hands the request to its handler, or to the one set by otherwise(); to be called once its headers
+	 * have been received (e.g. behind a filters::chain).
+	 * */
+	void route(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+		std::shared_ptr<http::response> res) const;
+
+	void operator()(std::shared_ptr<http::server_connection> conn, std::shared_ptr<http::request> req,
+		std::shared_ptr<http::response> res) const;
+
+	/** \brief routes every request received on the connection. */
+	void attach(const std::shared_ptr<http::server_connection>& conn) const;
+
+	/** \returns the number of routes */
+	std::size_t size() const noexcept;
+
+private:
+	struct node;
+	struct shared_state;
+
+	/** \returns the index of the handler routed at path[pos...] under n, given that n has been reached */
+	static std::size_t lookup(const node& n, boost::string_ref path, std::size_t pos, http_method method,
+		match& m) noexcept;
+
+	std::shared_ptr<shared_state> state;
+};
+
+}
+
+#endif //DOORMAT_ROUTING_ROUTER_H
@@ -0,0 +1,386 @@
+#include "ocsp.h"
+#include "log_wrapper.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <openssl/ocsp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+namespace ssl_utils
+{
+
+namespace ocsp
+{
+
+namespace
+{
+
+using stamp = std::tuple<time_t, long, off_t, ino_t>;
+
+stamp stamp_of(const std::string& file)
+{
+	// responses of the same size may be written within a second, and a rename may reuse the inode just freed
+	struct stat st{};
+	::stat(file.c_str(), &st);
+	return stamp{st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size, st.st_ino};
+}
+
+std::string read_file(const std::string& file)
+{
+	std::ifstream in{file, std::ios::binary};
+	return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+clock::time_point time_of(const ASN1_GENERALIZEDTIME* t)
+{
+	int days{0}, seconds{0};
+	ASN1_TIME_diff(&days, &seconds, nullptr, t);
+	return clock::now() + std::chrono::hours{24 * days} + std::chrono::seconds{seconds};
+}
+
+/** \brief verifies the response is signed by the issuer, or by a responder it delegated to, whose certificate comes
+ * with the response */
+bool verify(OCSP_BASICRESP* basic, X509* issuer)
+{
+	std::unique_ptr<X509_STORE, decltype(&X509_STORE_free)> store{X509_STORE_new(), X509_STORE_free};
+	X509_STORE_add_cert(store.get(), issuer);
+	// the issuer may be an intermediate, whose own issuer is not known here
+	X509_STORE_set_flags(store.get(), X509_V_FLAG_PARTIAL_CHAIN);
+	std::unique_ptr<STACK_OF(X509), void(*)(STACK_OF(X509)*)> certificates{sk_X509_new_null(),
+		[](STACK_OF(X509)* s) { sk_X509_free(s); }};
+	sk_X509_push(certificates.get(), issuer);
+	return OCSP_basic_verify(basic, certificates.get(), store.get(), 0) == 1;
+}
+
+/** What a response tells. */
+struct validity
+{
+	bool good{false};
+	clock::time_point this_update;
+	/** Never, if the response has no nextUpdate. */
+	clock::time_point next_update{clock::time_point::max()};
+};
+
+/** \brief checks the encoded response is a successful one, current, telling the certificate of the id (any if null)
+ * is good, and signed for the issuer if it is given. */
+validity check(const std::string& der, OCSP_CERTID* id, X509* issuer = nullptr)
+{
+	validity v;
+	auto p = reinterpret_cast<const unsigned char*>(der.data());
+	std::unique_ptr<OCSP_RESPONSE, decltype(&OCSP_RESPONSE_free)> response{
+		d2i_OCSP_RESPONSE(nullptr, &p, static_cast<long>(der.size())), OCSP_RESPONSE_free};
+	if(!response || OCSP_response_status(response.get()) != OCSP_RESPONSE_STATUS_SUCCESSFUL) return v;
+	std::unique_ptr<OCSP_BASICRESP, decltype(&OCSP_BASICRESP_free)> basic{OCSP_response_get1_basic(response.get()),
+		OCSP_BASICRESP_free};
+	if(!basic || (issuer && !verify(basic.get(), issuer))) return v;
+	auto index = id ? OCSP_resp_find(basic.get(), id, -1) : 0;
+	auto single = index >= 0 ? OCSP_resp_get0(basic.get(), index) : nullptr;
+	ASN1_GENERALIZEDTIME* this_update{nullptr};
+	ASN1_GENERALIZEDTIME* next_update{nullptr};
+	if(!single || OCSP_single_get0_status(single, nullptr, nullptr, &this_update, &next_update) != V_OCSP_CERTSTATUS_GOOD)
+		return v;
+	// a few minutes of clock skew between us and the responder
+	if(!OCSP_check_validity(this_update, next_update, 300, -1)) return v;
+	v.good = true;
+	v.this_update = time_of(this_update);
+	if(next_update) v.next_update = time_of(next_update);
+	return v;
+}
+
+/** \brief posts the body to the responder over HTTP/1.0, within the timeout.
+ * \returns the body of the answer, empty if it is not a 200 or it did not come in time
+ * */
+std::string post(const std::string& host, const std::string& port, const std::string& path, const std::string& body,
+	std::chrono::seconds timeout)
+{
+	addrinfo hints{};
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found{nullptr};
+	if(getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0 || !found) return {};
+	std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addresses{found, freeaddrinfo};
+
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	auto wait = [&deadline](int fd, short events)
+	{
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+		pollfd p{fd, events, 0};
+		return left.count() > 0 && ::poll(&p, 1, static_cast<int>(left.count())) == 1;
+	};
+	struct descriptor
+	{
+		int fd;
+		~descriptor() { if(fd >= 0) ::close(fd); }
+	} s{::socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+	if(s.fd < 0) return {};
+	if(::connect(s.fd, found->ai_addr, found->ai_addrlen) != 0 && (errno != EINPROGRESS || !wait(s.fd, POLLOUT)))
+		return {};
+	int error{0};
+	socklen_t length = sizeof(error);
+	if(getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error) return {};
+
+	auto message = "POST " + path + " HTTP/1.0\r\nhost: " + (port == "80" ? host : host + ":" + port) +
+		"\r\ncontent-type: application/ocsp-request\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n" +
+		body;
+	for(std::size_t sent = 0; sent < message.size();)
+	{
+		auto n = ::send(s.fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+		if(n > 0) sent += static_cast<std::size_t>(n);
+		else if(n < 0 && (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && wait(s.fd, POLLOUT))))
+			continue;
+		else return {};
+	}
+
+	// HTTP/1.0: the answer ends with the connection
+	std::string answer;
+	char buffer[4096];
+	for(;;)
+	{
+		auto n = ::recv(s.fd, buffer, sizeof(buffer), 0);
+		if(n > 0) answer.append(buffer, static_cast<std::size_t>(n));
+		else if(!n) break;
+		else if(errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && wait(s.fd, POLLIN))) continue;
+		else return {};
+		// no response is this big
+		if(answer.size() > 1024 * 1024) return {};
+	}
+	auto status = answer.find(' ');
+	auto head = answer.find("\r\n\r\n");
+	if(answer.compare(0, 5, "HTTP/") || status == std::string::npos || answer.compare(status + 1, 3, "200") ||
+		head == std::string::npos)
+		return {};
+	return answer.substr(head + 4);
+}
+
+struct response
+{
+	std::string der;
+	clock::time_point next_update;
+};
+
+/** What stapling keeps along with a context. */
+struct state
+{
+	std::string file;
+	/** The certificate of the context, null if its issuer is not in its chain: the first response is read then */
+	std::unique_ptr<OCSP_CERTID, decltype(&OCSP_CERTID_free)> id{nullptr, OCSP_CERTID_free};
+	/** Refreshes run one at a time. */
+	std::mutex reading;
+	stamp last{};
+	std::shared_ptr<const response> current;
+};
+
+void forget(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+{
+	delete static_cast<state*>(ptr);
+}
+
+int index()
+{
+	static const int i = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, forget);
+	return i;
+}
+
+state* state_of(SSL_CTX* ctx)
+{
+	return static_cast<state*>(SSL_CTX_get_ex_data(ctx, index()));
+}
+
+int status_callback(SSL* ssl, void*)
+{
+	// the context the SNI callback chose, that is the one of the certificate sent
+	auto s = state_of(SSL_get_SSL_CTX(ssl));
+	auto r = s ? std::atomic_load(&s->current) : nullptr;
+	if(!r || r->next_update <= clock::now()) return SSL_TLSEXT_ERR_NOACK;
+	// OpenSSL takes the buffer over, and frees it along with the connection
+	auto copy = static_cast<unsigned char*>(OPENSSL_malloc(r->der.size()));
+	if(!copy) return SSL_TLSEXT_ERR_NOACK;
+	std::memcpy(copy, r->der.data(), r->der.size());
+	SSL_set_tlsext_status_ocsp_resp(ssl, copy, static_cast<long>(r->der.size()));
+	return SSL_TLSEXT_ERR_OK;
+}
+
+}
+
+std::string response_file(const std::string& certificate_file)
+{
+	return certificate_file + ".ocsp";
+}
+
+void staple(SSL_CTX* ctx, std::string file)
+{
+	auto s = state_of(ctx);
+	if(!s)
+	{
+		s = new state;
+		SSL_CTX_set_ex_data(ctx, index(), s);
+	}
+	{
+		std::lock_guard<std::mutex> lock{s->reading};
+		s->file = std::move(file);
+		s->last = stamp{};
+		s->id.reset();
+		if(auto certificate = SSL_CTX_get0_certificate(ctx))
+		{
+			// the chain of the certificate, if it has no extra one
+			STACK_OF(X509)* chain{nullptr};
+			SSL_CTX_get_extra_chain_certs(ctx, &chain);
+			for(int i = 0; chain && i < sk_X509_num(chain) && !s->id; ++i)
+			{
+				auto candidate = sk_X509_value(chain, i);
+				if(X509_check_issued(candidate, certificate) == X509_V_OK)
+					s->id.reset(OCSP_cert_to_id(nullptr, certificate, candidate));
+			}
+		}
+		std::atomic_store(&s->current, std::shared_ptr<const response>{});
+	}
+	SSL_CTX_set_tlsext_status_cb(ctx, status_callback);
+	refresh(ctx);
+}
+
+bool refresh(SSL_CTX* ctx)
+{
+	auto s = state_of(ctx);
+	if(!s) return false;
+	std::lock_guard<std::mutex> lock{s->reading};
+	auto now = stamp_of(s->file);
+	if(now != s->last)
+	{
+		s->last = now;
+		auto der = read_file(s->file);
+		auto v = der.empty() ? validity{} : check(der, s->id.get());
+		if(v.good)
+			std::atomic_store(&s->current,
+				std::shared_ptr<const response>{std::make_shared<response>(response{std::move(der), v.next_update})});
+		else if(der.empty())
+			std::atomic_store(&s->current, std::shared_ptr<const response>{});
+		else
+			// e.g. a file being written: the response read before goes on until it expires
+			LOGWARN("the OCSP response ", s->file, " is not a current good one for its certificate, it is not read");
+	}
+	auto r = std::atomic_load(&s->current);
+	if(r && r->next_update <= clock::now())
+	{
+		LOGWARN("the OCSP response ", s->file, " has expired, it is not stapled any more");
+		std::atomic_store(&s->current, std::shared_ptr<const response>{});
+		return false;
+	}
+	return bool(r);
+}
+
+std::string stapled(SSL_CTX* ctx)
+{
+	auto s = state_of(ctx);
+	auto r = s ? std::atomic_load(&s->current) : nullptr;
+	return r ? r->der : std::string{};
+}
+
+fetcher::fetcher(std::string responder, std::chrono::seconds timeout)
+	: responder{std::move(responder)}, timeout{timeout}
+{}
+
+bool fetcher::due(const std::string& certificate_file)
+{
+	auto file = response_file(certificate_file);
+	auto now = stamp_of(file);
+	std::lock_guard<std::mutex> lock{mutex};
+	auto found = next.find(file);
+	if(found != next.end() && found->second.first == now) return found->second.second <= clock::now();
+
+	auto v = check(read_file(file), nullptr);
+	// halfway through its validity, as most servers do; an hour after it was issued if it never expires
+	auto when = !v.good ? clock::time_point{} : v.next_update == clock::time_point::max() ?
+		v.this_update + std::chrono::hours{1} : v.this_update + (v.next_update - v.this_update) / 2;
+	next[file] = {now, when};
+	return when <= clock::now();
+}
+
+bool fetcher::fetch(const std::string& certificate_file)
+{
+	auto file = response_file(certificate_file);
+	auto fail = [this, &certificate_file, &file](const char* why)
+	{
+		LOGWARN("could not fetch the OCSP response of ", certificate_file, ": ", why);
+		++failed_count;
+		// the responder is not asked again at once
+		std::lock_guard<std::mutex> lock{mutex};
+		next[file] = {stamp_of(file), clock::now() + std::chrono::minutes{1}};
+		return false;
+	};
+
+	using x509_ptr = std::unique_ptr<X509, decltype(&X509_free)>;
+	std::vector<x509_ptr> chain;
+	if(auto bio = BIO_new_file(certificate_file.c_str(), "r"))
+	{
+		while(auto x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) chain.emplace_back(x, X509_free);
+		BIO_free(bio);
+		// the end of the file
+		ERR_clear_error();
+	}
+	if(chain.empty()) return fail("the certificate can not be read");
+	auto certificate = chain.front().get();
+	X509* issuer{nullptr};
+	for(auto& c : chain)
+		if(c.get() != certificate && X509_check_issued(c.get(), certificate) == X509_V_OK) issuer = c.get();
+	if(!issuer) return fail("its issuer is not in its chain");
+
+	auto url = responder;
+	if(url.empty())
+	{
+		auto urls = X509_get1_ocsp(certificate);
+		if(urls && sk_OPENSSL_STRING_num(urls)) url = sk_OPENSSL_STRING_value(urls, 0);
+		X509_email_free(urls);
+	}
+	if(url.empty()) return fail("it tells no responder");
+	char* host{nullptr};
+	char* port{nullptr};
+	char* path{nullptr};
+	int tls{0};
+	if(!OCSP_parse_url(url.c_str(), &host, &port, &path, &tls)) return fail("the URL of the responder is not valid");
+	std::string h{host}, p{port}, resource{path};
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+	if(tls) return fail("HTTPS responders are not asked");
+
+	std::unique_ptr<OCSP_CERTID, decltype(&OCSP_CERTID_free)> id{OCSP_cert_to_id(nullptr, certificate, issuer),
+		OCSP_CERTID_free};
+	std::unique_ptr<OCSP_REQUEST, decltype(&OCSP_REQUEST_free)> request{OCSP_REQUEST_new(), OCSP_REQUEST_free};
+	if(!id || !request || !OCSP_request_add0_id(request.get(), OCSP_CERTID_dup(id.get())))
+		return fail("the request can not be built");
+	auto size = i2d_OCSP_REQUEST(request.get(), nullptr);
+	std::string body(static_cast<std::size_t>(size > 0 ? size : 0), '\0');
+	auto out = reinterpret_cast<unsigned char*>(&body[0]);
+	i2d_OCSP_REQUEST(request.get(), &out);
+
+	auto der = post(h, p, resource, body, timeout);
+	if(der.empty()) return fail("the responder did not answer");
+	auto v = check(der, id.get(), issuer);
+	if(!v.good) return fail("the response is not a current good one signed for the issuer");
+
+	// replaced at once, for the stapling not to read it half written
+	auto written = file + ".tmp";
+	{
+		std::ofstream f{written, std::ios::binary | std::ios::trunc};
+		f.write(der.data(), static_cast<std::streamsize>(der.size()));
+		if(!f) return fail("the response can not be written");
+	}
+	if(std::rename(written.c_str(), file.c_str())) return fail("the response can not be written");
+	++fetched_count;
+	return true;
+}
+
+}
+
+}
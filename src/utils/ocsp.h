@@ -0,0 +1,89 @@
+#ifndef DOORMAT_OCSP_H
+#define DOORMAT_OCSP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+namespace ssl_utils
+{
+
+/** \brief OCSP stapling (RFC 6066 status_request): the handshakes carry the response of the responder of the CA
+ * telling the certificate is good, so that clients need not ask it themselves before trusting the certificate.
+ *
+ * The response of a certificate is read from a file next to it (see response_file()), which an external fetcher or
+ * the fetcher below keeps fresh. It is kept encoded along with the context and replaced as a whole (RCU-style) when
+ * the file changes: the status callback takes no lock and encodes nothing. A response for another certificate, or
+ * telling anything but good, is not read; one past its nextUpdate is not stapled any more, clients taking it as a
+ * failure.
+ * */
+namespace ocsp
+{
+
+using clock = std::chrono::system_clock;
+
+/** \returns the file of the OCSP response of a certificate: the file of the certificate with ".ocsp" appended,
+ * DER-encoded as `openssl ocsp -respout` writes it */
+std::string response_file(const std::string& certificate_file);
+
+/** \brief staples the response of the file, if any, to the handshakes of the context from now on; the certificate,
+ * and its issuer if the chain has it, must be in the context already. */
+void staple(SSL_CTX* ctx, std::string file);
+
+/** \brief reads the file of the context again if it changed since it was last read, and stops stapling an expired
+ * response.
+ * \returns true if the context has a response to staple
+ * */
+bool refresh(SSL_CTX* ctx);
+
+/** \returns the response stapled to the handshakes of the context, empty if none */
+std::string stapled(SSL_CTX* ctx);
+
+/** \brief asks the OCSP responders for the responses of certificates, and writes the good ones to the files the
+ * stapling reads, replacing them at once. It blocks: it is meant for a thread of its own, e.g. the one watching the
+ * certificates (see sni_solver::watch).
+ * */
+class fetcher
+{
+public:
+	/** \param responder the URL of the responder asked for every certificate, e.g. a stand-in one; empty asks the
+	 * one the certificate tells (authority information access). Only plain HTTP responders are asked.
+	 * \param timeout of connecting to the responder and of every read and write
+	 * */
+	explicit fetcher(std::string responder = {}, std::chrono::seconds timeout = std::chrono::seconds{5});
+
+	/** \returns true if the response of the certificate is missing, not good, or past the middle of its validity:
+	 * time to fetch a new one */
+	bool due(const std::string& certificate_file);
+
+	/** \brief fetches the response of the certificate, whose issuer follows it in its chain file, and writes it.
+	 * \returns false if the responder could not be asked, or its response is not a good one signed for the issuer
+	 * */
+	bool fetch(const std::string& certificate_file);
+
+	uint64_t fetched() const noexcept { return fetched_count.load(); }
+	uint64_t failed() const noexcept { return failed_count.load(); }
+
+private:
+	using stamp = std::tuple<time_t, long, off_t, ino_t>;
+
+	std::string responder;
+	std::chrono::seconds timeout;
+	std::mutex mutex;
+	/** When the response of each file is due, as of the file it was read from. */
+	std::unordered_map<std::string, std::pair<stamp, clock::time_point>> next;
+	std::atomic<uint64_t> fetched_count{0};
+	std::atomic<uint64_t> failed_count{0};
+};
+
+}
+
+}
+
+#endif //DOORMAT_OCSP_H
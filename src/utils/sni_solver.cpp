@@ -1,8 +1,15 @@
 #include "sni_solver.h"
-#include "utils.h"
+#include "tls_sessions.h"
+#include "ocsp.h"
 #include "log_wrapper.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <thread>
+#include <sys/stat.h>
+#include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
@@ -12,7 +19,7 @@
 namespace ssl_utils
 {
 
-const char *const DEFAULT_CIPHER_LIST =
+extern const char *const DEFAULT_CIPHER_LIST =
 	"ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:ECDHE-ECDSA-"
 	"AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-"
 	"SHA384:ECDHE-RSA-AES256-GCM-SHA384:DHE-RSA-AES128-GCM-SHA256:DHE-RSA-"
@@ -24,74 +31,312 @@ const char *const DEFAULT_CIPHER_LIST =
 	"SHA256:AES256-GCM-SHA384:AES128-SHA256:AES256-SHA256:AES128-SHA:AES256-"
 	"SHA:DES-CBC3-SHA:!DSS";
 
-void configure_tls_context_easy(SSL_CTX *ctx)
+namespace
+{
+
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+/** Early data can be replayed: it is taken only under a session resumed once, and for HTTP/1, whose handler
+ * answers the requests that are not safe with 425 (RFC 8470). */
+int allow_early_data(SSL* ssl, void*)
+{
+	const unsigned char* protocol{nullptr};
+	unsigned int length{0};
+	SSL_get0_alpn_selected(ssl, &protocol, &length);
+	auto http1 = !length || (length >= 6 && !std::memcmp(protocol, "http/1", 6));
+	return http1 && session_cache::resumed_once(ssl);
+}
+#endif
+
+}
+
+bool configure_tls_context(SSL_CTX *ctx, const tls_settings& settings)
 {
 	auto ssl_opts = (SSL_OP_ALL & ~SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS) |
 		SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION |
 		SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION |	SSL_OP_SINGLE_ECDH_USE |
 		SSL_OP_NO_TICKET |	SSL_OP_CIPHER_SERVER_PREFERENCE;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	ssl_opts |= SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1;
+#endif
 	SSL_CTX_set_options(ctx, ssl_opts);
 	SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
 	SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
-	SSL_CTX_set_cipher_list(ctx, DEFAULT_CIPHER_LIST);
+	auto valid = SSL_CTX_set_cipher_list(ctx, settings.ciphers.c_str()) == 1;
 
-#ifndef OPENSSL_NO_EC
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef TLS1_3_VERSION
+	SSL_CTX_set_max_proto_version(ctx, settings.tls13 ? TLS1_3_VERSION : TLS1_2_VERSION);
+	valid = SSL_CTX_set_ciphersuites(ctx, settings.ciphersuites.c_str()) == 1 && valid;
+#else
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+#endif
+	valid = SSL_CTX_set1_groups_list(ctx, settings.groups.c_str()) == 1 && valid;
+#elif !defined(OPENSSL_NO_EC)
+	// no X25519 before 1.1.0: P-256 only
 	auto ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
 	if (ecdh) {
 	SSL_CTX_set_tmp_ecdh(ctx, ecdh);
 	EC_KEY_free(ecdh);
 	}
-#endif /* OPENSSL_NO_EC */
+#endif
 
-/*
-	SSL_CTX_set_next_protos_advertised_cb( ctx,
-	  [](SSL *s, const unsigned char **data, unsigned int *len, void *arg) {
-		auto &token = get_alpn_token();
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+	if (settings.max_early_data)
+	{
+		SSL_CTX_set_max_early_data(ctx, settings.max_early_data);
+		SSL_CTX_set_recv_max_early_data(ctx, settings.max_early_data);
+		// OpenSSL's own protection works with its internal cache only: allow_early_data takes its place
+		SSL_CTX_set_options(ctx, SSL_OP_NO_ANTI_REPLAY);
+		SSL_CTX_set_allow_early_data_cb(ctx, allow_early_data, nullptr);
+	}
+#endif
+	return valid;
+}
 
-		*data = token.data();
-		*len = token.size();
 
-		return SSL_TLSEXT_ERR_OK;
-	  },
-	  nullptr);
+namespace
+{
 
-#if OPENSSL_VERSION_NUMBER >= 0x10002000L
-	// ALPN selection callback
-	SSL_CTX_set_alpn_select_cb(ctx, alpn_select_proto_cb, nullptr);
-#endif // OPENSSL_VERSION_NUMBER >= 0x10002000L
-*/
+std::string lowercase( const char* name, std::size_t length )
+{
+	std::string lower{ name, length };
+	for ( auto& c : lower )
+		if ( c >= 'A' && c <= 'Z' ) c += 'a' - 'A';
+	// a fully qualified name may end with a dot
+	if ( !lower.empty() && lower.back() == '.' ) lower.pop_back();
+	return lower;
 }
 
+/** What loading tells of a certificate, without its key. */
+struct metadata
+{
+	bool valid{false};
+	std::string common_name;
+	/** The CN and the DNS SANs, in lower case. */
+	std::vector<std::string> names;
+	std::chrono::system_clock::time_point not_after;
+};
+
+metadata read_metadata( const std::string& certificate_file )
+{
+	metadata m;
+	auto bio = BIO_new_file( certificate_file.c_str(), "r" );
+	if ( !bio ) return m;
+	// the first certificate of the chain is the one of the server
+	auto x509 = PEM_read_bio_X509( bio, nullptr, nullptr, nullptr );
+	BIO_free( bio );
+	if ( !x509 ) return m;
+
+	char cn[256];
+	auto length = X509_NAME_get_text_by_NID( X509_get_subject_name( x509 ), NID_commonName, cn, sizeof(cn) );
+	if ( length > 0 )
+	{
+		m.common_name.assign( cn, static_cast<std::size_t>( length ) );
+		m.names.push_back( lowercase( cn, static_cast<std::size_t>( length ) ) );
+	}
+
+	if ( auto names = static_cast<GENERAL_NAMES*>( X509_get_ext_d2i( x509, NID_subject_alt_name, nullptr, nullptr ) ) )
+	{
+		for ( int i = 0; i < sk_GENERAL_NAME_num( names ); ++i )
+		{
+			auto name = sk_GENERAL_NAME_value( names, i );
+			if ( name->type != GEN_DNS ) continue;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+			auto data = ASN1_STRING_get0_data( name->d.dNSName );
+#else
+			auto data = ASN1_STRING_data( name->d.dNSName );
+#endif
+			m.names.push_back( lowercase( reinterpret_cast<const char*>( data ), ASN1_STRING_length( name->d.dNSName ) ) );
+		}
+		GENERAL_NAMES_free( names );
+	}
+
+	int days{0}, seconds{0};
+	if ( ASN1_TIME_diff( &days, &seconds, nullptr, X509_get_notAfter( x509 ) ) )
+		m.not_after = std::chrono::system_clock::now() + std::chrono::hours{ 24 * days } + std::chrono::seconds{ seconds };
+	X509_free( x509 );
+	m.valid = true;
+	return m;
+}
+
+}
 
 bool sni_solver::load_certificates()
 {
-	/** This will load all certificates; however it cannot work, since we don't have enough info! */
+	auto loaded = read( raw_certificates );
+	if ( !loaded ) return false;
+	std::atomic_store( &current, std::move( loaded ) );
+	return true;
+}
 
-	for(auto &t: raw_certificates)
+bool sni_solver::reload( std::vector<files> certificates )
+{
+	std::lock_guard<std::mutex> lock{ reloading };
+	auto loaded = read( certificates );
+	if ( !loaded )
 	{
-		if(!prepare_certificate(std::get<0>(t), std::get<1>(t), std::get<2>(t))) return false;
+		LOGWARN( "could not reload the certificates, the ones in use are kept" );
+		return false;
 	}
+	// the handshakes and connections holding the contexts of the previous generation keep them
+	std::atomic_store( &current, std::move( loaded ) );
+	++replaced;
+	return true;
+}
+
+std::shared_ptr<sni_solver::generation> sni_solver::read( const std::vector<files>& sources )
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<metadata> read( sources.size() );
+	std::atomic<std::size_t> next{ 0 };
+	auto reader = [&sources, &read, &next]()
+	{
+		for ( std::size_t i; ( i = next++ ) < sources.size(); )
+			read[i] = read_metadata( std::get<0>( sources[i] ) );
+	};
+	std::size_t threads = std::min<std::size_t>( std::max( 1U, std::thread::hardware_concurrency() ), sources.size() );
+	std::vector<std::thread> readers;
+	for ( std::size_t i = 1; i < threads; ++i ) readers.emplace_back( reader );
+	reader();
+	for ( auto& t : readers ) t.join();
 
+	auto g = std::make_shared<generation>();
+	g->sources = sources;
+	for ( std::size_t i = 0; i < sources.size(); ++i )
+	{
+		auto& t = sources[i];
+		if ( !read[i].valid )
+		{
+			LOGWARN( "could not read the certificate ", std::get<0>( t ) );
+			return nullptr;
+		}
+		if ( read[i].not_after < std::chrono::system_clock::now() )
+			LOGWARN( "the certificate ", std::get<0>( t ), " has expired" );
+		g->certificates.push_back( certificate{ std::get<0>( t ), std::get<1>( t ), std::get<2>( t ),
+			read[i].common_name, read[i].not_after } );
+		index( *g, read[i].names, i );
+	}
 
-	if(certificates_list.empty())
+	if(g->certificates.empty())
 	{
 		LOGWARN("could not load any certificate. HTTPS will not started.");
-		return false;
+		return nullptr;
 	}
 
-	return true;
+	g->slots.resize( g->certificates.size() );
+	// the default context is needed before any handshake
+	if ( !( g->slots.front().context = prepare_certificate( g->certificates.front() ) ) ) return nullptr;
+
+	auto took = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start );
+	loading = took.count();
+	LOGINFO( "loaded ", g->certificates.size(), " certificates in ", took.count(), " ms on ", threads, " threads" );
+	return g;
+}
+
+namespace
+{
+
+using stamp = std::tuple<time_t, off_t, ino_t>;
+
+std::vector<stamp> stamps( const std::vector<sni_solver::files>& sources )
+{
+	// a file replaced by a rename has a new inode, one written in place a new time or size
+	std::vector<stamp> s;
+	for ( auto& f : sources )
+		for ( auto& name : { std::get<0>( f ), std::get<1>( f ), std::get<2>( f ) } )
+		{
+			struct stat st{};
+			::stat( name.c_str(), &st );
+			s.emplace_back( st.st_mtime, st.st_size, st.st_ino );
+		}
+	return s;
+}
+
+}
+
+void sni_solver::watch( std::chrono::milliseconds interval )
+{
+	unwatch();
+	{
+		std::lock_guard<std::mutex> lock{ watch_mutex };
+		watching = true;
+	}
+	auto g = snapshot();
+	// the files as they are now, not as they are when the thread starts
+	auto last = stamps( g ? g->sources : raw_certificates );
+	watcher = std::thread{ [this, interval, last]() mutable
+	{
+		std::unique_lock<std::mutex> lock{ watch_mutex };
+		while ( !watch_stopped.wait_for( lock, interval, [this]() { return !watching; } ) )
+		{
+			lock.unlock();
+			if ( auto g = snapshot() )
+			{
+				auto now = stamps( g->sources );
+				if ( now != last )
+				{
+					last = std::move( now );
+					LOGINFO( "the certificates have changed, reloading them" );
+					reload( g->sources );
+				}
+			}
+			refresh_staples();
+			lock.lock();
+		}
+	} };
+}
+
+void sni_solver::unwatch()
+{
+	{
+		std::lock_guard<std::mutex> lock{ watch_mutex };
+		watching = false;
+	}
+	watch_stopped.notify_all();
+	if ( watcher.joinable() ) watcher.join();
 }
 
-bool sni_solver::prepare_certificate(std::string certificate_file, std::string key_file, std::string key_password)
+void sni_solver::set_tls( tls_settings s )
 {
-	certificates_list.emplace_back("", boost::asio::ssl::context::tlsv12);
-	auto& certificate = certificates_list.back();
-	auto& context = certificate.context;
-	configure_tls_context_easy( context.native_handle() );
+	boost::asio::ssl::context probe{ boost::asio::ssl::context::sslv23_server };
+	if ( !configure_tls_context( probe.native_handle(), s ) )
+		throw std::invalid_argument{ "the TLS settings hold a cipher or a group OpenSSL does not know" };
+	settings = std::move( s );
+}
+
+void sni_solver::refresh_staples()
+{
+	auto g = snapshot();
+	if ( !g ) return;
+	if ( ocsp_fetcher )
+		for ( auto& c : g->certificates )
+			if ( ocsp_fetcher->due( c.certificate_file ) ) ocsp_fetcher->fetch( c.certificate_file );
+
+	std::vector<context_ptr> built;
+	{
+		std::lock_guard<std::mutex> lock{ g->cache };
+		for ( auto& s : g->slots )
+			if ( s.context ) built.push_back( s.context );
+	}
+	// the others read their response when they are built
+	for ( auto& c : built ) ocsp::refresh( c->native_handle() );
+}
+
+sni_solver::~sni_solver()
+{
+	unwatch();
+}
+
+sni_solver::context_ptr sni_solver::prepare_certificate( const certificate& c )
+{
+	auto built = std::make_shared<boost::asio::ssl::context>( boost::asio::ssl::context::sslv23_server );
+	auto& context = *built;
+	configure_tls_context( context.native_handle(), settings );
 	std::ifstream password_file;
 	try
 	{
-		std::string decrypt_key_password = key_password;
+		std::string decrypt_key_password = c.key_password;
 		password_file.open( decrypt_key_password );
 		std::string password;
 		std::getline( password_file, password );
@@ -101,56 +346,124 @@ bool sni_solver::prepare_certificate(std::string certificate_file, std::string k
 			{
 				return password;
 			} );
-		context.use_private_key_file(key_file, boost::asio::ssl::context::pem);
-		context.use_certificate_chain_file(certificate_file);
+		context.use_private_key_file(c.key_file, boost::asio::ssl::context::pem);
+		context.use_certificate_chain_file(c.certificate_file);
 	}
 	catch ( const boost::system::error_code& ec )
 	{
 		LOGWARN("error while setting the password callback");
-		certificates_list.pop_back();
-		return false;
+		return nullptr;
 	}
 	catch ( const std::ifstream::failure& open_error )
 	{
-		certificates_list.pop_back();
 		LOGWARN("could not open the password file, hence we cannot decrypt the certificate file");
-		return false;
+		return nullptr;
 	} catch(...)
 	{
-		certificates_list.pop_back();
-		return false;
+		LOGWARN("could not load the certificate ", c.certificate_file, " or its key");
+		return nullptr;
+	}
+
+	auto ssl_ctx = context.native_handle();
+	// a certificate renewed while its old key is still there must not be served without a key
+	if ( SSL_CTX_check_private_key( ssl_ctx ) != 1 )
+	{
+		LOGWARN("the key ", c.key_file, " does not match the certificate ", c.certificate_file);
+		return nullptr;
+	}
+	ocsp::staple( ssl_ctx, ocsp::response_file( c.certificate_file ) );
+	SSL_CTX_set_tlsext_servername_arg( ssl_ctx, this );
+	SSL_CTX_set_tlsext_servername_callback( ssl_ctx, sni_callback );
+	if ( configure_context ) configure_context( ssl_ctx );
+	return built;
+}
+
+void sni_solver::index( generation& g, const std::vector<std::string>& names, std::size_t certificate )
+{
+	for ( auto& name : names )
+	{
+		if ( name.empty() ) continue;
+		if ( name.size() > 2 && name[0] == '*' && name[1] == '.' )
+			g.wildcard_names.emplace( name.substr( 2 ), certificate );
+		else if ( name.find( '*' ) == std::string::npos )
+			g.exact_names.emplace( name, certificate );
 	}
+}
 
+sni_solver::context_ptr sni_solver::find( const std::string& server_name )
+{
+	auto g = snapshot();
+	if ( !g ) return nullptr;
+	auto name = lowercase( server_name.data(), server_name.size() );
+	auto exact = g->exact_names.find( name );
+	if ( exact != g->exact_names.end() ) return context_of( *g, exact->second );
 
+	// a wildcard stands in for the first label only
+	auto dot = name.find( '.' );
+	if ( dot == std::string::npos || dot == 0 ) return nullptr;
+	auto wildcard = g->wildcard_names.find( name.substr( dot + 1 ) );
+	return wildcard != g->wildcard_names.end() ? context_of( *g, wildcard->second ) : nullptr;
+}
 
-	//get server name from certificate
-	SSL* ssl = SSL_new( context.native_handle());
-	SSL_set_connect_state( ssl );
-	X509* x509 = SSL_get_certificate( ssl );
-	CRYPTO_add( &x509->references, 1, CRYPTO_LOCK_X509 );
-	SSL_free( ssl );
-	X509_NAME* subject = X509_get_subject_name( x509 );
-	if ( !subject )
+sni_solver::context_ptr sni_solver::context_of( generation& g, std::size_t certificate )
+{
 	{
-		LOGWARN("could not get server name from certificate.");
-		return false;
+		std::lock_guard<std::mutex> lock{ g.cache };
+		auto& s = g.slots[certificate];
+		if ( s.failed ) return nullptr;
+		if ( s.context )
+		{
+			if ( s.cached ) g.recency.splice( g.recency.begin(), g.recency, s.position );
+			return s.context;
+		}
 	}
 
-	char cn[65];
-	std::memset(cn, 0, 65);
-	//int res = X509_NAME_get_text_by_NID( subject, NID_commonName, cn, 64 );
-	cn[64] = '\0';
-	auto ssl_ctx = context.native_handle();
-	ssl_ctx->tlsext_servername_arg = this;
-	certificate.server_name = std::string{ cn };
-	certificate.x509 = x509;
-	SSL_CTX_set_tlsext_servername_callback( ssl_ctx, sni_callback );
-	return true;
+	// decrypting the key is slow: handshakes for other names go on meanwhile
+	auto built = prepare_certificate( g.certificates[certificate] );
+
+	std::lock_guard<std::mutex> lock{ g.cache };
+	auto& s = g.slots[certificate];
+	if ( !built )
+	{
+		s.failed = true;
+		return nullptr;
+	}
+	// another handshake built it first
+	if ( s.context ) return s.context;
+	s.context = built;
+	g.recency.push_front( certificate );
+	s.position = g.recency.begin();
+	s.cached = true;
+	while ( cache_capacity && g.recency.size() > cache_capacity )
+	{
+		// handshakes and connections using it hold a reference of their own
+		auto& evicted = g.slots[g.recency.back()];
+		evicted.context.reset();
+		evicted.cached = false;
+		g.recency.pop_back();
+	}
+	return built;
+}
+
+sni_solver::context_ptr sni_solver::default_context() const
+{
+	auto g = snapshot();
+	// never evicted nor replaced within a generation
+	return g ? g->slots.front().context : nullptr;
+}
+
+std::size_t sni_solver::contexts() const
+{
+	auto g = snapshot();
+	if ( !g ) return 0;
+	std::lock_guard<std::mutex> lock{ g->cache };
+	return g->recency.size() + 1;
 }
 
-static std::string clean_wildcard_name( const std::string& name )
+std::vector<sni_solver::certificate> sni_solver::certificates() const
 {
-	return name.substr( 2 ); // Clean up the first *.
+	auto g = snapshot();
+	return g ? g->certificates : std::vector<certificate>{};
 }
 
 int sni_callback( SSL* ssl, int* ad, void* arg )
@@ -165,54 +478,13 @@ int sni_callback( SSL* ssl, int* ad, void* arg )
 		return SSL_TLSEXT_ERR_NOACK;
 	auto server_name = SSL_get_servername( ssl, TLSEXT_NAMETYPE_host_name );
 	if(server_name == nullptr) return SSL_TLSEXT_ERR_NOACK;
-	const std::string required_server_name = std::string{server_name};
-	/** The presence of these three loops is due to the fact that we want a priority
-	 * between different matches:
-	 * - in the first we check against the common name;
-	 * - if no match, against wildcards
-	 * - finally using subject alternative names extensions
-	 * */
-	for ( auto& certificate: instance->certificates_list )
-	{
-		if ( certificate.server_name == required_server_name )
-		{
-			//ok, found. SNI resolved.
-			SSL_set_SSL_CTX( ssl, certificate.context.native_handle());
-
-			//SSL_CTX_set_alpn_select_cb(certificate.context.native_handle(), );
-
-			LOGINFO( "Found certificate: " + certificate.server_name );
-			return SSL_TLSEXT_ERR_OK;
-		}
-	}
-
-	// Wildcard certificates have only an * in the first position
-	for ( auto& certificate: instance->certificates_list )
-	{
-		if ( ! ( certificate.server_name[0] == '*' &&  certificate.server_name[1] == '.' ) )
-			continue;
-
-		std::string server_name = clean_wildcard_name( certificate.server_name );
-		if ( utils::ends_with ( required_server_name, server_name ) )
-		{
-			LOGINFO( "Found wildcard certificate: " + certificate.server_name );
-
-			//ok, found. SNI resolved.
-			SSL_set_SSL_CTX( ssl, certificate.context.native_handle());
-			return SSL_TLSEXT_ERR_OK;
-		}
-	}
-
-	for(auto &certificate: instance->certificates_list)
+	if ( auto context = instance->find( server_name ) )
 	{
-		if(X509_check_host(certificate.x509, required_server_name.c_str(), required_server_name.length(), 0, NULL) == 1)
-		{
-			LOGINFO(" Found matching certificate by using x509v3 SAN extension ", required_server_name);
-			SSL_set_SSL_CTX( ssl, certificate.context.native_handle());
-			return SSL_TLSEXT_ERR_OK;
-		}
+		//ok, found. SNI resolved.
+		SSL_set_SSL_CTX( ssl, context->native_handle() );
+		return SSL_TLSEXT_ERR_OK;
 	}
-	LOGINFO("Could not find the indicated server name ", server_name ," cannot finish SNI.");
+	LOGDEBUG("Could not find the indicated server name ", server_name ," cannot finish SNI.");
 	return TLS1_AD_UNRECOGNIZED_NAME;
 }
 
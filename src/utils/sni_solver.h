@@ -4,8 +4,22 @@
 
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/ssl/context.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "ocsp.h"
 
 
 namespace configuration
@@ -18,21 +32,58 @@ namespace ssl_utils
 
 int sni_callback(SSL *ssl, int *ad, void *arg);
 
+/** The cipher suites of TLS 1.2, the ones with forward secrecy and AEAD first. */
+extern const char* const DEFAULT_CIPHER_LIST;
+
+/** \brief what the TLS contexts of the server negotiate. */
+struct tls_settings
+{
+	/** TLS 1.3 besides 1.2, if OpenSSL has it (1.1.1 and later): one round trip less for a full handshake. */
+	bool tls13{true};
+	/** The cipher suites of TLS 1.2, as an OpenSSL cipher list. */
+	std::string ciphers{DEFAULT_CIPHER_LIST};
+	/** The cipher suites of TLS 1.3, the preferred first. */
+	std::string ciphersuites{"TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256:TLS_AES_256_GCM_SHA384"};
+	/** The groups of the key exchange, the preferred first. */
+	std::string groups{"X25519:P-256:P-384"};
+	/** The most bytes of early data (TLS 1.3 0-RTT) read from an HTTP/1 client resuming a session taken from a
+	 * session_cache, which resumes each of them once; 0, the default, turns early data down. Session tickets and the
+	 * handshake pool of the server turn it down as well. */
+	uint32_t max_early_data{0};
+};
+
+/** \brief applies the settings, and the options every context of the server has, to a context.
+ * \returns false if OpenSSL rejects a list of the settings
+ * */
+bool configure_tls_context(SSL_CTX* ctx, const tls_settings& settings);
+
 /** \class sni_solver resolves SNI in TLS (https://en.wikipedia.org/wiki/Server_Name_Indication)
+ *
+ * Loading the certificates only reads their names and expiry, on as many threads as there are cores; the context
+ * of a certificate, whose key has to be decrypted, is built on the first handshake for one of its names and kept in
+ * a cache, the least recently used contexts going first when it is bounded. The context of the first certificate is
+ * built at once, being the default one, and never leaves the cache.
+ *
+ * The certificates, their index and their contexts make a generation, which a reload replaces as a whole (RCU-style):
+ * the handshakes look for their context in the generation current when they start, and the connections keep the
+ * contexts they got.
  */
 class sni_solver
 {
 	//friend int sni_solver::sni_callback(SSL *ssl, int *ad, void *arg);
 public:
+	using context_ptr = std::shared_ptr<boost::asio::ssl::context>;
+	/** The file of the certificate chain, the one of the key and the one of the password of the key. */
+	using files = std::tuple<std::string, std::string, std::string>;
 
 	struct certificate
 	{
-		certificate(std::string server_name, boost::asio::ssl::context::method method) : server_name{server_name},
-			context{method} { }
-
+		std::string certificate_file;
+		std::string key_file;
+		std::string key_password;
+		/** The common name. */
 		std::string server_name;
-		boost::asio::ssl::context context;
-		X509* x509;
+		std::chrono::system_clock::time_point not_after;
 	};
 
 	sni_solver() = default;
@@ -48,26 +99,125 @@ public:
 	*/
 	bool load_certificates();
 
+	/** \brief replaces the certificates with the ones of the files. They are read, and the default context is
+	 * built, on the calling thread, which should not be one running handshakes; the next handshake gets the new ones.
+	 * \returns false, the certificates in use being kept, if a certificate can not be read or the default context
+	 * can not be built
+	 * */
+	bool reload(std::vector<files> certificates);
+
+	/** \brief checks the files of the certificates in use every interval, on a thread of its own, and reloads all
+	 * of them when one has changed; a reload failing, e.g. because a file is being written, is tried again on the
+	 * next change. */
+	void watch(std::chrono::milliseconds interval);
+	void unwatch();
+
 	void add_certificate(std::string certificate_file, std::string key_file, std::string key_password)
 	{
 		raw_certificates.emplace_back(certificate_file, key_file, key_password);
 	}
 
-	std::vector<certificate>::iterator begin() { return certificates_list.begin(); }
-	std::vector<certificate>::iterator end() { return certificates_list.end(); }
-	~sni_solver() = default;
+	/** \brief sets what the contexts built from now on negotiate.
+	 * \throws std::invalid_argument if OpenSSL rejects a list of the settings
+	 * */
+	void set_tls(tls_settings settings);
+	const tls_settings& tls() const noexcept { return settings; }
+
+	/** \brief fetches the OCSP responses of the certificates when they are due, on every check of watch(); without
+	 * a fetcher, the responses are the ones other programs write (see ocsp::response_file). */
+	void set_ocsp_fetcher(std::shared_ptr<ocsp::fetcher> fetcher) { ocsp_fetcher = std::move(fetcher); }
+	bool fetches_ocsp() const noexcept { return bool(ocsp_fetcher); }
+
+	/** \brief fetches the OCSP responses due, if there is a fetcher, and reads again the changed or expired ones of
+	 * the contexts built; watch() does it on every check. */
+	void refresh_staples();
+
+	/** \brief bounds the contexts kept besides the default one; 0, the default, keeps all of them. */
+	void set_context_cache(std::size_t capacity) { cache_capacity = capacity; }
+
+	/** \brief sets what is done to every context once built, e.g. registering the protocol selection callbacks;
+	 * contexts are built on any of the threads running handshakes. */
+	void on_context(std::function<void(SSL_CTX*)> configure) { configure_context = std::move(configure); }
+
+	/** \brief finds the context of the certificate for a server name: one with the name as CN or SAN first, then
+	 * one with a wildcard covering it (*.example.com covers a.example.com, not a.b.example.com). The cost does not
+	 * depend on the number of certificates; the context is built if it is not in the cache.
+	 * \returns null if no certificate is for the name, or its context could not be built
+	 * */
+	context_ptr find(const std::string& server_name);
+
+	/** \returns the context of the first certificate, null before the certificates are loaded */
+	context_ptr default_context() const;
+
+	/** \returns the number of contexts in the cache, the default one included */
+	std::size_t contexts() const;
+
+	/** \returns the certificates in use */
+	std::vector<certificate> certificates() const;
+
+	/** \returns how long loading the certificates took, the last time */
+	std::chrono::milliseconds load_time() const noexcept { return std::chrono::milliseconds{loading.load()}; }
+
+	/** \returns how many times the certificates have been replaced since they were loaded */
+	std::size_t reloads() const noexcept { return replaced.load(); }
+
+	~sni_solver();
 
 private:
-	using raw_certificate = std::tuple<std::string, std::string, std::string>;
-	bool prepare_certificate(std::string certificate_file, std::string key_file, std::string key_password);
+	struct slot
+	{
+		context_ptr context;
+		/** Where the certificate is in the recency list, if its context is cached. */
+		std::list<std::size_t>::iterator position;
+		bool cached{false};
+		bool failed{false};
+	};
+
+	struct generation
+	{
+		std::vector<files> sources;
+		std::vector<certificate> certificates;
+		/** Certificates by lower-case name. */
+		std::unordered_map<std::string, std::size_t> exact_names;
+		/** Wildcard certificates by the lower-case domain the wildcard stands in, e.g. example.com for *.example.com */
+		std::unordered_map<std::string, std::size_t> wildcard_names;
+
+		std::mutex cache;
+		std::vector<slot> slots;
+		/** Certificates whose context is cached, the most recently used first; the default one is not there. */
+		std::list<std::size_t> recency;
+	};
 
-	std::vector<certificate> certificates_list;
-	std::vector<raw_certificate> raw_certificates;
+	/** \returns the generation of the certificates of the files, null if one could not be read or the default
+	 * context could not be built */
+	std::shared_ptr<generation> read(const std::vector<files>& sources);
+	/** \brief builds the context of a certificate, decrypting its key.
+	 * \returns null if the certificate or the key could not be used */
+	context_ptr prepare_certificate(const certificate& c);
+	context_ptr context_of(generation& g, std::size_t certificate);
+	/** \brief indexes the certificate by its names; the first certificate loaded for a name keeps it */
+	static void index(generation& g, const std::vector<std::string>& names, std::size_t certificate);
+	std::shared_ptr<generation> snapshot() const { return std::atomic_load(&current); }
+
+	std::vector<files> raw_certificates;
+	std::function<void(SSL_CTX*)> configure_context;
+	std::shared_ptr<ocsp::fetcher> ocsp_fetcher;
+	tls_settings settings;
+	std::size_t cache_capacity{0};
+	std::atomic<std::chrono::milliseconds::rep> loading{0};
+	std::atomic<std::size_t> replaced{0};
+	std::shared_ptr<generation> current;
+	/** Reloads run one at a time. */
+	std::mutex reloading;
+
+	std::thread watcher;
+	std::mutex watch_mutex;
+	std::condition_variable watch_stopped;
+	bool watching{false};
 
 	friend int sni_callback(SSL *ssl, int *ad, void *arg);
 };
 
-
 }
 
 #endif //DOOR_MAT_SNI_SOLVER_H
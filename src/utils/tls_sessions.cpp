@@ -0,0 +1,331 @@
+#include "tls_sessions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+namespace ssl_utils
+{
+
+namespace
+{
+
+/** Sessions are resumed by any context attached, whatever certificate it serves. */
+const unsigned char session_context[] = "doormat";
+
+template<typename T>
+int ex_index()
+{
+	static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+template<typename T>
+T* instance(const SSL* ssl)
+{
+	return static_cast<T*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ex_index<T>()));
+}
+
+void share_sessions(SSL_CTX* ctx)
+{
+	SSL_CTX_set_session_id_context(ctx, session_context, sizeof(session_context) - 1);
+}
+
+int resumed_once_index()
+{
+	static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+bool init_mac(EVP_MAC_CTX* mac, const ticket_keys::key& k)
+{
+	char digest[] = "SHA256";
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(k.hmac.data()), k.hmac.size()),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+		OSSL_PARAM_construct_end()};
+	return EVP_MAC_CTX_set_params(mac, params) == 1;
+}
+#else
+bool init_mac(HMAC_CTX* mac, const ticket_keys::key& k)
+{
+	return HMAC_Init_ex(mac, k.hmac.data(), static_cast<int>(k.hmac.size()), EVP_sha256(), nullptr) == 1;
+}
+#endif
+
+static_assert(sizeof(ticket_keys::key) == 80, "ticket keys are read from files as 80-byte records");
+
+ticket_keys::key random_key()
+{
+	ticket_keys::key k;
+	if(RAND_bytes(k.name.data(), k.name.size()) != 1 || RAND_bytes(k.hmac.data(), k.hmac.size()) != 1 ||
+		RAND_bytes(k.aes.data(), k.aes.size()) != 1)
+		throw std::runtime_error{"could not generate a session ticket key"};
+	return k;
+}
+
+std::chrono::steady_clock::rep ticks(std::chrono::steady_clock::time_point t)
+{
+	return t.time_since_epoch().count();
+}
+
+}
+
+ticket_keys::ticket_keys(std::chrono::seconds rotation, std::size_t kept)
+	: keys{std::make_shared<const std::vector<key>>(1, random_key())}, rotation{rotation}, kept{kept}
+{
+	if(rotation.count()) next_rotation = ticks(std::chrono::steady_clock::now() + rotation);
+}
+
+void ticket_keys::load(const std::string& file)
+{
+	std::ifstream in{file, std::ios::binary};
+	if(!in) throw std::runtime_error{"could not open the session ticket keys file " + file};
+	std::string content{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+	if(content.empty() || content.size() % sizeof(key))
+		throw std::runtime_error{"the session ticket keys file " + file + " must hold one or more 80-byte keys"};
+
+	std::vector<key> loaded(content.size() / sizeof(key));
+	std::memcpy(loaded.data(), content.data(), content.size());
+	std::lock_guard<std::mutex> lock{rotating};
+	next_rotation = 0;
+	publish(std::make_shared<const std::vector<key>>(std::move(loaded)));
+}
+
+void ticket_keys::rotate()
+{
+	auto k = random_key();
+	std::lock_guard<std::mutex> lock{rotating};
+	auto current = std::atomic_load(&keys);
+	std::vector<key> next;
+	next.reserve(std::min(current->size() + 1, kept + 1));
+	next.push_back(k);
+	for(auto it = current->begin(); it != current->end() && next.size() <= kept; ++it) next.push_back(*it);
+	publish(std::make_shared<const std::vector<key>>(std::move(next)));
+}
+
+void ticket_keys::attach(SSL_CTX* ctx)
+{
+	SSL_CTX_set_ex_data(ctx, ex_index<ticket_keys>(), this);
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+	share_sessions(ctx);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, callback);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, callback);
+#endif
+}
+
+std::size_t ticket_keys::size() const noexcept
+{
+	return std::atomic_load(&keys)->size();
+}
+
+void ticket_keys::publish(keys_t k)
+{
+	// handshakes still holding the old keys finish with them
+	std::atomic_store(&keys, std::move(k));
+}
+
+void ticket_keys::rotate_if_due()
+{
+	auto due = next_rotation.load();
+	auto now = std::chrono::steady_clock::now();
+	if(!due || ticks(now) < due) return;
+	// the first thread to see the key expired rotates it; the others go on with it meanwhile
+	if(!next_rotation.compare_exchange_strong(due, ticks(now + rotation))) return;
+	try
+	{
+		rotate();
+	}
+	catch(const std::runtime_error&) {}
+}
+
+int ticket_keys::callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+	mac_context* mac, int encrypt)
+{
+	auto self = instance<ticket_keys>(ssl);
+	if(!self) return encrypt ? -1 : 0;
+
+	if(encrypt)
+	{
+		self->rotate_if_due();
+		auto current = std::atomic_load(&self->keys);
+		auto& k = current->front();
+		if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) return -1;
+		std::memcpy(name, k.name.data(), k.name.size());
+		if(EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, k.aes.data(), iv) != 1 || !init_mac(mac, k))
+			return -1;
+		++self->issued_count;
+		return 1;
+	}
+
+	auto current = std::atomic_load(&self->keys);
+	auto k = std::find_if(current->begin(), current->end(), [name](const key& k)
+	{
+		return !std::memcmp(k.name.data(), name, k.name.size());
+	});
+	if(k == current->end())
+	{
+		++self->rejected_count;
+		return 0;
+	}
+	if(!init_mac(mac, *k) || EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, k->aes.data(), iv) != 1)
+		return -1;
+	if(k == current->begin())
+	{
+		++self->resumed_count;
+		return 1;
+	}
+	// an older key: the client gets a ticket under the current one
+	++self->renewed_count;
+	return 2;
+}
+
+session_cache::session_cache(std::size_t capacity, std::chrono::seconds lifetime)
+	: capacity{capacity}, lifetime{lifetime}
+{
+	if(capacity == 0) throw std::invalid_argument{"a session cache must hold one session at least"};
+}
+
+void session_cache::attach(SSL_CTX* ctx)
+{
+	SSL_CTX_set_ex_data(ctx, ex_index<session_cache>(), this);
+	share_sessions(ctx);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+	SSL_CTX_set_timeout(ctx, static_cast<long>(lifetime.count()));
+	SSL_CTX_sess_set_new_cb(ctx, on_new);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_CTX_sess_set_get_cb(ctx, [](SSL* ssl, unsigned char* id, int length, int* copy)
+	{
+		return on_get(ssl, id, length, copy);
+	});
+#else
+	SSL_CTX_sess_set_get_cb(ctx, on_get);
+#endif
+	SSL_CTX_sess_set_remove_cb(ctx, on_remove);
+}
+
+std::size_t session_cache::size() const
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	return sessions.size();
+}
+
+int session_cache::on_new(SSL* ssl, SSL_SESSION* session)
+{
+	auto self = instance<session_cache>(ssl);
+	unsigned int length{0};
+	auto id = SSL_SESSION_get_id(session, &length);
+	auto size = i2d_SSL_SESSION(session, nullptr);
+	if(!self || !length || size <= 0) return 0;
+
+	std::string serialized(static_cast<std::size_t>(size), '\0');
+	auto out = reinterpret_cast<unsigned char*>(&serialized[0]);
+	i2d_SSL_SESSION(session, &out);
+	self->store(std::string{reinterpret_cast<const char*>(id), length}, std::move(serialized));
+	// the session itself is not kept
+	return 0;
+}
+
+SSL_SESSION* session_cache::on_get(SSL* ssl, const unsigned char* id, int length, int* copy)
+{
+	*copy = 0;
+	auto self = instance<session_cache>(ssl);
+	if(!self) return nullptr;
+	bool once{false};
+#ifdef TLS1_3_VERSION
+	once = SSL_version(ssl) == TLS1_3_VERSION;
+#endif
+	auto session = self->find(std::string{reinterpret_cast<const char*>(id), static_cast<std::size_t>(length)}, once);
+	session ? ++self->hit_count : ++self->miss_count;
+	if(session && once) SSL_set_ex_data(ssl, resumed_once_index(), ssl);
+	return session;
+}
+
+bool session_cache::resumed_once(const SSL* ssl) noexcept
+{
+	return SSL_get_ex_data(const_cast<SSL*>(ssl), resumed_once_index()) != nullptr;
+}
+
+void session_cache::on_remove(SSL_CTX* ctx, SSL_SESSION* session)
+{
+	auto self = static_cast<session_cache*>(SSL_CTX_get_ex_data(ctx, ex_index<session_cache>()));
+	unsigned int length{0};
+	auto id = SSL_SESSION_get_id(session, &length);
+	if(self && length) self->remove(std::string{reinterpret_cast<const char*>(id), length});
+}
+
+void session_cache::store(const std::string& id, std::string session)
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	auto it = sessions.find(id);
+	if(it != sessions.end()) erase(it);
+	while(sessions.size() >= capacity) erase(sessions.find(recency.back()));
+	recency.push_front(id);
+	sessions.emplace(id, entry{std::move(session), clock::now() + lifetime, recency.begin()});
+}
+
+SSL_SESSION* session_cache::find(const std::string& id, bool take)
+{
+	std::string serialized;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		auto it = sessions.find(id);
+		if(it == sessions.end()) return nullptr;
+		if(it->second.expiry <= clock::now())
+		{
+			erase(it);
+			return nullptr;
+		}
+		if(take)
+		{
+			serialized = std::move(it->second.session);
+			erase(it);
+		}
+		else
+		{
+			recency.splice(recency.begin(), recency, it->second.position);
+			serialized = it->second.session;
+		}
+	}
+	auto in = reinterpret_cast<const unsigned char*>(serialized.data());
+	return d2i_SSL_SESSION(nullptr, &in, static_cast<long>(serialized.size()));
+}
+
+void session_cache::remove(const std::string& id)
+{
+	std::lock_guard<std::mutex> lock{mutex};
+	auto it = sessions.find(id);
+	if(it != sessions.end()) erase(it);
+}
+
+void session_cache::erase(std::unordered_map<std::string, entry>::iterator it)
+{
+	recency.erase(it->second.position);
+	sessions.erase(it);
+}
+
+void resumption_counters::count(SSL* ssl) noexcept
+{
+	++completed;
+	if(SSL_session_reused(ssl)) ++resumptions;
+}
+
+double resumption_counters::hit_rate() const noexcept
+{
+	auto total = completed.load();
+	return total ? static_cast<double>(resumptions.load()) / total : 0;
+}
+
+}
@@ -0,0 +1,161 @@
+#ifndef DOORMAT_TLS_SESSIONS_H
+#define DOORMAT_TLS_SESSIONS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <openssl/ssl.h>
+
+namespace ssl_utils
+{
+
+/** \brief the keys of stateless session tickets (RFC 5077): returning clients resume their session with an
+ * abbreviated handshake, the state of which they hold encrypted.
+ *
+ * The newest key encrypts the tickets; the older ones still decrypt theirs, which get a new ticket under the newest
+ * key. Keys are replaced as a whole (RCU-style), hence the callback reading them takes no lock and one set of keys is
+ * shared by all the contexts (SNI ones included) and all the threads. Random keys rotate on their own every period;
+ * keys loaded from a file, for several processes to resume the sessions of each other, are not rotated.
+ * */
+class ticket_keys
+{
+public:
+	/** \brief a key, laid out as in the 80-byte key files of other servers (e.g. nginx's ssl_session_ticket_key). */
+	struct key
+	{
+		std::array<unsigned char, 16> name;
+		std::array<unsigned char, 32> hmac;
+		std::array<unsigned char, 32> aes;
+	};
+
+	/** \param rotation how long a random key encrypts tickets; 0 never rotates
+	 * \param kept how many rotations a key keeps decrypting tickets after it stops encrypting them
+	 * */
+	explicit ticket_keys(std::chrono::seconds rotation = std::chrono::hours{1}, std::size_t kept = 2);
+
+	/** \brief replaces the keys with the ones of a file holding one or more 80-byte keys, the first of which
+	 * encrypts; rotation stops.
+	 * \throws std::runtime_error if the file can not be read or its size is not a multiple of 80
+	 * */
+	void load(const std::string& file);
+
+	/** \brief starts encrypting with a new random key. */
+	void rotate();
+
+	/** \brief makes the context issue tickets and resume sessions with these keys. */
+	void attach(SSL_CTX* ctx);
+
+	std::size_t size() const noexcept;
+
+	/** Full handshakes that got a ticket. */
+	uint64_t issued() const noexcept { return issued_count.load(); }
+	/** Sessions resumed with the current key. */
+	uint64_t resumed() const noexcept { return resumed_count.load(); }
+	/** Sessions resumed with an older key, whose tickets are renewed. */
+	uint64_t renewed() const noexcept { return renewed_count.load(); }
+	/** Tickets of no key known any longer: a full handshake follows. */
+	uint64_t rejected() const noexcept { return rejected_count.load(); }
+
+private:
+	using keys_t = std::shared_ptr<const std::vector<key>>;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	using mac_context = EVP_MAC_CTX;
+#else
+	using mac_context = HMAC_CTX;
+#endif
+
+	static int callback(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, mac_context* mac,
+		int encrypt);
+	void rotate_if_due();
+	void publish(keys_t k);
+
+	keys_t keys;
+	const std::chrono::seconds rotation;
+	const std::size_t kept;
+	/** When random keys rotate next, in ticks of the steady clock; 0 if they do not. */
+	std::atomic<std::chrono::steady_clock::rep> next_rotation{0};
+	std::mutex rotating;
+	std::atomic<uint64_t> issued_count{0};
+	std::atomic<uint64_t> resumed_count{0};
+	std::atomic<uint64_t> renewed_count{0};
+	std::atomic<uint64_t> rejected_count{0};
+};
+
+/** \brief a cache of sessions by ID shared by all the contexts attached to it, and by all the threads, for the
+ * clients not supporting tickets. Sessions are kept serialized, up to a capacity, the least recently used ones
+ * going first; they expire after their lifetime.
+ *
+ * TLS 1.3 sessions, whose tickets are the IDs of the sessions kept here unless ticket keys are attached, are
+ * resumed once (RFC 8446, section 8.1): the early data of a resumption can not be replayed.
+ * */
+class session_cache
+{
+public:
+	explicit session_cache(std::size_t capacity = 20480, std::chrono::seconds lifetime = std::chrono::minutes{10});
+
+	/** \brief makes the context store its sessions here, and look for them here only. */
+	void attach(SSL_CTX* ctx);
+
+	std::size_t size() const;
+	uint64_t hits() const noexcept { return hit_count.load(); }
+
+	/** \returns true if the handshake resumed a TLS 1.3 session taken from a cache, hence only once */
+	static bool resumed_once(const SSL* ssl) noexcept;
+	uint64_t misses() const noexcept { return miss_count.load(); }
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct entry
+	{
+		std::string session;
+		clock::time_point expiry;
+		std::list<std::string>::iterator position;
+	};
+
+	static int on_new(SSL* ssl, SSL_SESSION* session);
+	static SSL_SESSION* on_get(SSL* ssl, const unsigned char* id, int length, int* copy);
+	static void on_remove(SSL_CTX* ctx, SSL_SESSION* session);
+
+	void store(const std::string& id, std::string session);
+	/** \param take whether the session leaves the cache */
+	SSL_SESSION* find(const std::string& id, bool take);
+	void remove(const std::string& id);
+	void erase(std::unordered_map<std::string, entry>::iterator it);
+
+	const std::size_t capacity;
+	const std::chrono::seconds lifetime;
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, entry> sessions;
+	/** IDs, the most recently used first. */
+	std::list<std::string> recency;
+	std::atomic<uint64_t> hit_count{0};
+	std::atomic<uint64_t> miss_count{0};
+};
+
+/** \brief counts the TLS handshakes completed, and how many of them resumed a session. */
+class resumption_counters
+{
+public:
+	void count(SSL* ssl) noexcept;
+
+	uint64_t handshakes() const noexcept { return completed.load(); }
+	uint64_t resumed() const noexcept { return resumptions.load(); }
+	/** \returns the share of handshakes resuming a session, 0 before the first */
+	double hit_rate() const noexcept;
+
+private:
+	std::atomic<uint64_t> completed{0};
+	std::atomic<uint64_t> resumptions{0};
+};
+
+}
+
+#endif //DOORMAT_TLS_SESSIONS_H
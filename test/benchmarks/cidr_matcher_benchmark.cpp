@@ -0,0 +1,85 @@
+/**
+ * Lookup time of network::cidr_matcher holding 100000 random blocks, half IPv4 and half IPv6, for addresses
+ * inside and outside of them.
+ */
+#include "../../src/network/cidr_matcher.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+constexpr std::size_t blocks = 100000;
+constexpr std::size_t lookups = 5000000;
+
+using address = boost::asio::ip::address;
+
+address random_v4(std::mt19937_64& rng)
+{
+	return boost::asio::ip::address_v4{static_cast<uint32_t>(rng())};
+}
+
+address random_v6(std::mt19937_64& rng)
+{
+	boost::asio::ip::address_v6::bytes_type bytes;
+	auto high = rng(), low = rng();
+	// a provider's space, as for real tables
+	bytes[0] = 0x2a;
+	bytes[1] = 0x01;
+	for(std::size_t i = 2; i < 8; ++i) bytes[i] = static_cast<uint8_t>(high >> (8 * i));
+	for(std::size_t i = 8; i < 16; ++i) bytes[i] = static_cast<uint8_t>(low >> (8 * (i - 8)));
+	return boost::asio::ip::address_v6{bytes};
+}
+
+void run(const char* name, const network::cidr_matcher& m, const std::vector<address>& addresses)
+{
+	std::size_t allowed{0};
+	auto start = std::chrono::steady_clock::now();
+	for(std::size_t i = 0; i < lookups; ++i)
+		allowed += m.allowed(addresses[i % addresses.size()]);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::printf("%-16s %12.1f %12zu\n", name, static_cast<double>(ns) / lookups, allowed);
+}
+
+}
+
+int main()
+{
+	std::mt19937_64 rng{7};
+	std::uniform_int_distribution<unsigned> v4_length{8, 32}, v6_length{24, 128};
+	std::vector<network::cidr_matcher::rule> rules;
+	std::vector<address> v4_inside, v6_inside;
+	for(std::size_t i = 0; i < blocks / 2; ++i)
+	{
+		auto a = random_v4(rng);
+		rules.push_back(network::cidr_matcher::rule{a, static_cast<uint8_t>(v4_length(rng)), true});
+		v4_inside.push_back(a);
+		auto b = random_v6(rng);
+		rules.push_back(network::cidr_matcher::rule{b, static_cast<uint8_t>(v6_length(rng)), true});
+		v6_inside.push_back(b);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	network::cidr_matcher m{rules, false};
+	auto built = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	std::printf("%zu blocks, %zu nodes, built in %lld ms; time per lookup in ns\n", rules.size(), m.size(),
+		static_cast<long long>(built.count()));
+
+	std::vector<address> v4_random, v6_random;
+	for(std::size_t i = 0; i < blocks / 2; ++i)
+	{
+		v4_random.push_back(random_v4(rng));
+		v6_random.push_back(random_v6(rng));
+	}
+
+	std::printf("%-16s %12s %12s\n", "addresses", "ns", "allowed");
+	run("ipv4 inside", m, v4_inside);
+	run("ipv4 random", m, v4_random);
+	run("ipv6 inside", m, v6_inside);
+	run("ipv6 random", m, v6_random);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * Cost of running requests and responses through ten filters: a filters::chain composed at compile time,
+ * a filters::dynamic_chain, and nodes forwarding the events to the next one through virtual calls, as the
+ * former chain of responsibility did.
+ *
+ * Filters do next to nothing, so that the numbers are the overhead of the chains.
+ */
+#include "../../src/filters/filter_chain.h"
+
+#include <boost/asio/io_service.hpp>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+namespace
+{
+
+constexpr std::size_t events = 5000000;
+
+std::size_t work{0};
+
+template<int n>
+struct counter : filters::filter
+{
+	filters::verdict on_request(http::http_request& req, http::response&)
+	{
+		work += n + req.path().size();
+		return filters::verdict::proceed;
+	}
+
+	void on_response(const http::http_request&, http::http_response& res)
+	{
+		work += n + res.status_code();
+	}
+};
+
+/** \brief the former design: every node holds the next and forwards to it. */
+struct node
+{
+	virtual ~node() = default;
+
+	virtual void on_request(http::http_request& req, http::response& res)
+	{
+		if(next) next->on_request(req, res);
+	}
+
+	virtual void on_response(const http::http_request& req, http::http_response& res)
+	{
+		if(next) next->on_response(req, res);
+	}
+
+	std::unique_ptr<node> next;
+};
+
+template<int n>
+struct counter_node : node
+{
+	void on_request(http::http_request& req, http::response& res) override
+	{
+		work += n + req.path().size();
+		node::on_request(req, res);
+	}
+
+	void on_response(const http::http_request& req, http::http_response& res) override
+	{
+		work += n + res.status_code();
+		node::on_response(req, res);
+	}
+};
+
+template<typename chain_t>
+void run(const char* name, chain_t& chain, http::http_request& req, http::response& res, http::http_response& r)
+{
+	auto start = std::chrono::steady_clock::now();
+	for(std::size_t i = 0; i < events; ++i)
+	{
+		chain.on_request(req, res);
+		chain.on_response(req, r);
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::printf("%-16s %12.2f\n", name, static_cast<double>(ns) / events);
+}
+
+template<int n>
+void append(node& last)
+{
+	last.next = std::make_unique<counter_node<n>>();
+}
+
+}
+
+int main()
+{
+	boost::asio::io_service io;
+	http::http_request req;
+	req.path("/items/42");
+	http::http_response r;
+	r.status(200);
+	http::response res{[](http::http_response&&) {}, [](http::response::data_t, size_t) {},
+		[](std::string&&, std::string&&) {}, []() {}, io};
+
+	filters::chain<counter<0>, counter<1>, counter<2>, counter<3>, counter<4>, counter<5>, counter<6>, counter<7>,
+		counter<8>, counter<9>> static_chain;
+
+	filters::dynamic_chain dynamic_chain;
+	dynamic_chain.add(counter<0>{});
+	dynamic_chain.add(counter<1>{});
+	dynamic_chain.add(counter<2>{});
+	dynamic_chain.add(counter<3>{});
+	dynamic_chain.add(counter<4>{});
+	dynamic_chain.add(counter<5>{});
+	dynamic_chain.add(counter<6>{});
+	dynamic_chain.add(counter<7>{});
+	dynamic_chain.add(counter<8>{});
+	dynamic_chain.add(counter<9>{});
+
+	node nodes;
+	node* last = &nodes;
+	append<0>(*last); last = last->next.get();
+	append<1>(*last); last = last->next.get();
+	append<2>(*last); last = last->next.get();
+	append<3>(*last); last = last->next.get();
+	append<4>(*last); last = last->next.get();
+	append<5>(*last); last = last->next.get();
+	append<6>(*last); last = last->next.get();
+	append<7>(*last); last = last->next.get();
+	append<8>(*last); last = last->next.get();
+	append<9>(*last);
+
+	std::printf("10 filters; ns per request and response\n");
+	run("static", static_chain, req, res, r);
+	run("dynamic", dynamic_chain, req, res, r);
+	run("virtual nodes", nodes, req, res, r);
+	std::printf("(%zu)\n", work);
+	return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * Lookup time of routing::router with 10000 routes: static paths, paths with parameters and wildcards, and misses.
+ *
+ * The exact match of an unordered_map holding the static paths is given as a reference point. Allocations are
+ * counted while looking up, to check that routing allocates nothing.
+ */
+#include "../../src/routing/router.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+std::size_t allocations{0};
+
+constexpr std::size_t sections = 100;
+constexpr std::size_t routes_per_kind = 10000 / 4;
+constexpr std::size_t lookups = 2000000;
+
+template<typename lookup_t>
+void run(const char* name, const std::vector<std::string>& paths, lookup_t lookup)
+{
+	std::mt19937_64 rng{7};
+	std::uniform_int_distribution<std::size_t> pick{0, paths.size() - 1};
+	std::vector<std::size_t> order(lookups);
+	for(auto& o : order) o = pick(rng);
+
+	std::size_t found{0};
+	auto before = allocations;
+	auto start = std::chrono::steady_clock::now();
+	for(auto o : order)
+		found += lookup(paths[o]);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::printf("%-20s %12.1f %12zu %12zu\n", name, static_cast<double>(ns) / lookups, found, allocations - before);
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+	++allocations;
+	if(auto p = std::malloc(size)) return p;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+int main()
+{
+	routing::router r;
+	std::unordered_map<std::string, int> exact;
+	auto handler = [](std::shared_ptr<http::server_connection>, std::shared_ptr<http::request>,
+		std::shared_ptr<http::response>, const routing::match&) {};
+	auto get = routing::method_bit(HTTP_GET);
+
+	std::vector<std::string> statics, params, wildcards, misses;
+	for(std::size_t i = 0; i < routes_per_kind; ++i)
+	{
+		auto section = std::to_string(i % sections), id = std::to_string(i);
+		auto path = "/static/section" + section + "/page" + id + ".html";
+		r.add(get, path, handler);
+		exact.emplace(path, 0);
+		statics.push_back(path);
+
+		r.add(get, "/api/v1/resource" + id + "/{id}", handler);
+		r.add(get, "/api/v1/resource" + id + "/{id}/items/{item}", handler);
+		params.push_back("/api/v1/resource" + id + "/12345/items/678");
+
+		r.add(get, "/files/bucket" + id + "/*path", handler);
+		wildcards.push_back("/files/bucket" + id + "/a/b/c/object.bin");
+
+		misses.push_back("/static/section" + section + "/page" + id + ".htm");
+	}
+	std::printf("%zu routes; time per lookup in ns\n", r.size());
+	std::printf("%-20s %12s %12s %12s\n", "paths", "ns", "found", "allocations");
+
+	routing::match m;
+	auto route = [&r, &m](const std::string& path) { return r.find("example.com", HTTP_GET, path, m) ? 1 : 0; };
+	run("static", statics, route);
+	run("parameters", params, route);
+	run("wildcard", wildcards, route);
+	run("miss", misses, route);
+	run("unordered_map", statics, [&exact](const std::string& path) { return exact.count(path); });
+	return 0;
+}
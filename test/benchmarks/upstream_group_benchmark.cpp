@@ -0,0 +1,124 @@
+/**
+ * Tail latency of the balancing policies when one backend of the group is much slower than the others.
+ *
+ * Backends and clients are simulated (discrete events on a virtual clock), so that the numbers only depend
+ * on the choices made by network::upstream_group and are reproducible on any machine.
+ */
+#include "../../src/network/upstream_group.h"
+
+#include <queue>
+#include <deque>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <algorithm>
+
+namespace
+{
+
+constexpr std::size_t backends = 16;
+constexpr std::size_t workers = 4; // requests served in parallel by each backend
+constexpr double service_ms = 1.0;
+constexpr double slow_service_ms = 20.0;
+constexpr double arrivals_per_ms = 30.0; // about half the capacity of the group
+constexpr std::size_t requests = 200000;
+constexpr std::size_t keys = 10000;
+
+struct event
+{
+	double time;
+	bool completion;
+	std::size_t backend;
+	double arrival;
+
+	bool operator>(const event& other) const noexcept { return time > other.time; }
+};
+
+struct backend_state
+{
+	std::size_t busy{0};
+	std::deque<double> queue;
+};
+
+std::chrono::nanoseconds to_ns(double ms)
+{
+	return std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(ms * 1e6)};
+}
+
+void run(const char* name, network::upstream_group::policy policy)
+{
+	std::vector<network::endpoint> endpoints;
+	for(std::size_t i = 0; i < backends; ++i)
+		endpoints.push_back(network::endpoint{"10.0.0." + std::to_string(i + 1), 80, false});
+	network::upstream_group group{std::move(endpoints), policy, {}, 1};
+
+	std::mt19937_64 rng{7};
+	std::exponential_distribution<double> interarrival{arrivals_per_ms};
+	std::uniform_int_distribution<std::size_t> key{0, keys - 1};
+	auto service = [&rng](std::size_t backend)
+	{
+		std::exponential_distribution<double> d{1.0 / (backend == 0 ? slow_service_ms : service_ms)};
+		return d(rng);
+	};
+
+	std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+	std::vector<backend_state> state(backends);
+	std::vector<double> latencies;
+	latencies.reserve(requests);
+
+	double now{0};
+	for(std::size_t i = 0; i < requests; ++i)
+	{
+		now += interarrival(rng);
+		events.push(event{now, false, 0, now});
+	}
+
+	while(!events.empty())
+	{
+		auto e = events.top();
+		events.pop();
+		now = e.time;
+		if(!e.completion)
+		{
+			auto b = group.select("/object/" + std::to_string(key(rng)));
+			group.started(b);
+			auto& s = state[b];
+			if(s.busy < workers)
+			{
+				++s.busy;
+				events.push(event{now + service(b), true, b, e.arrival});
+			}
+			else s.queue.push_back(e.arrival);
+			continue;
+		}
+
+		auto latency = now - e.arrival;
+		latencies.push_back(latency);
+		group.completed(e.backend, to_ns(latency));
+		auto& s = state[e.backend];
+		if(s.queue.empty()) --s.busy;
+		else
+		{
+			events.push(event{now + service(e.backend), true, e.backend, s.queue.front()});
+			s.queue.pop_front();
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) { return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))]; };
+	std::printf("%-24s %10.2f %10.2f %10.2f %10.2f\n", name, percentile(0.5), percentile(0.99), percentile(0.999),
+		latencies.back());
+}
+
+}
+
+int main()
+{
+	std::printf("%zu backends, backend 0 is %.0fx slower; latencies in ms\n", backends, slow_service_ms / service_ms);
+	std::printf("%-24s %10s %10s %10s %10s\n", "policy", "p50", "p99", "p99.9", "max");
+	run("round_robin", network::upstream_group::policy::round_robin);
+	run("least_outstanding", network::upstream_group::policy::least_outstanding);
+	run("power_of_two_choices", network::upstream_group::policy::power_of_two_choices);
+	run("consistent_hashing", network::upstream_group::policy::consistent_hashing);
+	return 0;
+}
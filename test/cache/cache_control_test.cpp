@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+#include "src/cache/cache_control.h"
+
+namespace
+{
+
+http::http_request get(const std::string& path = "/")
+{
+	http::http_request req;
+	req.protocol(http::proto_version::HTTP11);
+	req.method(HTTP_GET);
+	req.hostname("localhost");
+	req.path(path);
+	return req;
+}
+
+http::http_response ok(const std::string& cache_control = {})
+{
+	http::http_response res;
+	res.protocol(http::proto_version::HTTP11);
+	res.status(200);
+	if(!cache_control.empty()) res.header("cache-control", cache_control);
+	return res;
+}
+
+}
+
+TEST(cache_control, parses_directives)
+{
+	auto d = cache::parse_cache_control(ok("public, max-age=60, S-MaxAge=\"120\", stale-while-revalidate=30, no-cache"));
+	EXPECT_TRUE(d.is_public);
+	EXPECT_TRUE(d.no_cache);
+	EXPECT_FALSE(d.no_store);
+	ASSERT_TRUE(d.max_age);
+	EXPECT_EQ(*d.max_age, std::chrono::seconds{60});
+	ASSERT_TRUE(d.s_maxage);
+	EXPECT_EQ(*d.s_maxage, std::chrono::seconds{120});
+	ASSERT_TRUE(d.stale_while_revalidate);
+	EXPECT_EQ(*d.stale_while_revalidate, std::chrono::seconds{30});
+
+	auto bad = cache::parse_cache_control(ok("max-age=soon"));
+	EXPECT_FALSE(bad.max_age);
+}
+
+TEST(cache_control, request_directives)
+{
+	auto req = get();
+	req.header("cache-control", "max-age=0, max-stale, min-fresh=20");
+	auto d = cache::request_cache_control(req);
+	ASSERT_TRUE(d.max_age);
+	EXPECT_EQ(*d.max_age, std::chrono::seconds{0});
+	ASSERT_TRUE(d.max_stale);
+	EXPECT_EQ(*d.max_stale, std::chrono::seconds{2147483648LL});
+	ASSERT_TRUE(d.min_fresh);
+	EXPECT_EQ(*d.min_fresh, std::chrono::seconds{20});
+	EXPECT_FALSE(d.no_cache);
+
+	auto pragma = get();
+	pragma.header("pragma", "No-Cache");
+	EXPECT_TRUE(cache::request_cache_control(pragma).no_cache);
+	// Cache-Control takes over Pragma
+	pragma.header("cache-control", "max-stale=30");
+	d = cache::request_cache_control(pragma);
+	EXPECT_FALSE(d.no_cache);
+	ASSERT_TRUE(d.max_stale);
+	EXPECT_EQ(*d.max_stale, std::chrono::seconds{30});
+}
+
+TEST(cache_control, http_dates_round_trip)
+{
+	cache::clock::time_point date;
+	ASSERT_TRUE(cache::parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", date));
+	EXPECT_EQ(cache::clock::to_time_t(date), 784111777);
+	EXPECT_EQ(cache::format_http_date(date), "Sun, 06 Nov 1994 08:49:37 GMT");
+
+	cache::clock::time_point other;
+	ASSERT_TRUE(cache::parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT", other));
+	EXPECT_EQ(date, other);
+	ASSERT_TRUE(cache::parse_http_date("Sun Nov  6 08:49:37 1994", other));
+	EXPECT_EQ(date, other);
+	EXPECT_FALSE(cache::parse_http_date("yesterday", other));
+}
+
+TEST(cache_control, storable)
+{
+	EXPECT_TRUE(cache::storable(get(), ok("max-age=10")));
+	EXPECT_TRUE(cache::storable(get(), ok()));
+	EXPECT_FALSE(cache::storable(get(), ok("no-store")));
+	EXPECT_FALSE(cache::storable(get(), ok("private, max-age=10")));
+
+	auto post = get();
+	post.method(HTTP_POST);
+	EXPECT_FALSE(cache::storable(post, ok("max-age=10")));
+
+	auto authorized = get();
+	authorized.header("authorization", "Basic Zm9vOmJhcg==");
+	EXPECT_FALSE(cache::storable(authorized, ok("max-age=10")));
+	EXPECT_TRUE(cache::storable(authorized, ok("public, max-age=10")));
+
+	auto cookie = ok("max-age=10");
+	cookie.header("set-cookie", "a=b");
+	EXPECT_FALSE(cache::storable(get(), cookie));
+
+	auto teapot = ok();
+	teapot.status(418);
+	EXPECT_FALSE(cache::storable(get(), teapot));
+}
+
+TEST(cache_control, freshness_lifetime)
+{
+	EXPECT_EQ(cache::freshness_lifetime(ok("max-age=10, s-maxage=20")), std::chrono::seconds{20});
+	EXPECT_EQ(cache::freshness_lifetime(ok("max-age=10")), std::chrono::seconds{10});
+
+	auto expires = ok();
+	expires.date("Sun, 06 Nov 1994 08:49:37 GMT");
+	expires.header("expires", "Sun, 06 Nov 1994 08:50:37 GMT");
+	EXPECT_EQ(cache::freshness_lifetime(expires), std::chrono::seconds{60});
+	expires.remove_header("expires");
+	expires.header("expires", "0");
+	EXPECT_EQ(cache::freshness_lifetime(expires), cache::clock::duration::zero());
+
+	auto heuristic = ok();
+	heuristic.date("Sun, 06 Nov 1994 08:49:37 GMT");
+	heuristic.header("last-modified", "Sun, 06 Nov 1994 08:33:57 GMT");
+	EXPECT_EQ(cache::freshness_lifetime(heuristic), std::chrono::seconds{94});
+}
+
+TEST(cache_control, initial_age)
+{
+	auto res = ok();
+	res.header("age", "30");
+	auto t = cache::clock::now();
+	EXPECT_EQ(cache::initial_age(res, t - std::chrono::seconds{2}, t), std::chrono::seconds{32});
+}
+
+TEST(cache_control, conditional_requests)
+{
+	auto res = ok("max-age=10");
+	res.header("etag", "\"v1\"");
+	res.header("last-modified", "Sun, 06 Nov 1994 08:49:37 GMT");
+
+	auto req = get();
+	EXPECT_FALSE(cache::not_modified(req, res));
+	req.header("if-none-match", "\"v0\", W/\"v1\"");
+	EXPECT_TRUE(cache::not_modified(req, res));
+
+	auto stale_tag = get();
+	stale_tag.header("if-none-match", "\"v0\"");
+	// If-Modified-Since does not count when If-None-Match is there
+	stale_tag.header("if-modified-since", "Sun, 06 Nov 1994 08:49:37 GMT");
+	EXPECT_FALSE(cache::not_modified(stale_tag, res));
+
+	auto since = get();
+	since.header("if-modified-since", "Mon, 07 Nov 1994 08:49:37 GMT");
+	EXPECT_TRUE(cache::not_modified(since, res));
+
+	auto revalidation = get();
+	cache::add_validators(revalidation, res);
+	EXPECT_EQ(revalidation.header("if-none-match"), "\"v1\"");
+	EXPECT_EQ(revalidation.header("if-modified-since"), "Sun, 06 Nov 1994 08:49:37 GMT");
+}
@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+#include "src/cache/http_cache.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+
+http::http_request get(const std::string& host, const std::string& path, const std::string& user_agent = {})
+{
+	http::http_request req;
+	req.protocol(http::proto_version::HTTP11);
+	req.method(HTTP_GET);
+	req.hostname(host);
+	req.path(path);
+	if(!user_agent.empty()) req.header("user-agent", user_agent);
+	return req;
+}
+
+http::http_response ok(const std::string& cache_control = "max-age=60")
+{
+	http::http_response res;
+	res.protocol(http::proto_version::HTTP11);
+	res.status(200, "OK");
+	res.header("cache-control", cache_control);
+	res.header("etag", "\"v1\"");
+	res.header("content-type", "text/plain");
+	return res;
+}
+
+cache::entry_ptr make_entry(std::size_t body_size, const std::string& cache_control = "max-age=60")
+{
+	return std::make_shared<const cache::entry>(ok(cache_control),
+		cache::body_view::from_string(std::string(body_size, 'x')), cache::clock::now(), cache::clock::duration::zero());
+}
+
+std::string as_string(const cache::body_view& b)
+{
+	return std::string(b.data, b.size);
+}
+
+class temp_dir
+{
+public:
+	temp_dir()
+	{
+		char tmpl[] = "/tmp/doormat_cache_XXXXXX";
+		path = mkdtemp(tmpl);
+	}
+
+	~temp_dir()
+	{
+		std::system(("rm -rf " + path).c_str());
+	}
+
+	std::string path;
+};
+
+/** \returns what the cache finds under each key, once it has read the disk */
+std::vector<cache::entry_ptr> lookup_all(cache::http_cache& c, const std::vector<std::string>& keys)
+{
+	boost::asio::io_service io;
+	auto work = std::make_unique<boost::asio::io_service::work>(io);
+	std::vector<cache::entry_ptr> found(keys.size());
+	std::size_t pending = keys.size();
+	for(std::size_t i = 0; i < keys.size(); ++i)
+		c.lookup(keys[i], io, [&, i](cache::entry_ptr e)
+		{
+			found[i] = std::move(e);
+			if(--pending == 0) work.reset();
+		});
+	io.run();
+	return found;
+}
+
+}
+
+TEST(key_builder, default_key_ignores_port_and_case)
+{
+	cache::key_builder keys;
+	auto req = get("Example.COM:8080", "/a");
+	req.query("x=1");
+	EXPECT_EQ(keys(req), "example.com/a?x=1");
+}
+
+TEST(key_builder, first_matching_rule_wins)
+{
+	cache::key_builder keys{{
+		{"^www\\.example\\.com$", "^/favicon.ico$", "", "$<default>$"},
+		{"^www\\.example\\.com$", "", "(twitterbot|facebookexternalhit)", "$<default>$<header:User-Agent>$"},
+		{"^www\\.example\\.com$", "", "", "$www.example.com$/index.html$$"}
+	}};
+
+	EXPECT_EQ(keys(get("www.example.com", "/favicon.ico", "Twitterbot")), "www.example.com/favicon.ico");
+	EXPECT_EQ(keys(get("www.example.com", "/post/1", "Twitterbot/1.0")), "www.example.com/post/1Twitterbot/1.0");
+	EXPECT_EQ(keys(get("www.example.com", "/post/1", "Mozilla/5.0")), "www.example.com/index.html");
+	EXPECT_EQ(keys(get("api.example.com", "/post/1")), "api.example.com/post/1");
+}
+
+TEST(key_builder, loads_the_normalization_file)
+{
+	temp_dir dir;
+	auto file = dir.path + "/normalization.config";
+	std::ofstream{file} << R"json({"cache_normalization" : [
+		{"vhost" : "^ww(.{1}).morphcast.video$", "cache_key": "$www.morphcast.video$/index.html$$", "user_agent" : "(.*)", "path" : "(.*)"}
+	]})json";
+
+	auto keys = cache::key_builder::from_file(file);
+	EXPECT_EQ(keys(get("ww2.morphcast.video", "/whatever")), "www.morphcast.video/index.html");
+	EXPECT_THROW(cache::key_builder::from_file(dir.path + "/missing.config"), std::runtime_error);
+}
+
+TEST(memory_tier, evicts_least_recently_used)
+{
+	auto size = make_entry(1000)->cost();
+	cache::memory_tier tier{3 * size, 1};
+	tier.put("a", make_entry(1000));
+	tier.put("b", make_entry(1000));
+	tier.put("c", make_entry(1000));
+	ASSERT_NE(tier.get("a"), nullptr);
+
+	auto evicted = tier.put("d", make_entry(1000));
+	ASSERT_EQ(evicted.size(), 1U);
+	EXPECT_EQ(evicted[0].first, "b");
+	EXPECT_EQ(tier.get("b"), nullptr);
+	EXPECT_NE(tier.get("a"), nullptr);
+	EXPECT_EQ(tier.used(), 3 * size);
+
+	auto too_big = tier.put("e", make_entry(10 * size));
+	ASSERT_EQ(too_big.size(), 1U);
+	EXPECT_EQ(too_big[0].first, "e");
+	EXPECT_EQ(tier.get("e"), nullptr);
+}
+
+TEST(disk_tier, stores_and_maps_entries)
+{
+	temp_dir dir;
+	{
+		cache::disk_tier tier{dir.path, 1 << 20};
+		auto e = make_entry(5000);
+		ASSERT_TRUE(tier.put("example.com/a", *e));
+		EXPECT_TRUE(tier.contains("example.com/a"));
+		EXPECT_GT(tier.used(), 5000U);
+	}
+
+	// a new tier finds what the previous one stored
+	cache::disk_tier tier{dir.path, 1 << 20};
+	auto hit = tier.get("example.com/a");
+	ASSERT_NE(hit, nullptr);
+	EXPECT_EQ(as_string(hit->body()), std::string(5000, 'x'));
+	EXPECT_EQ(hit->preamble().status_code(), 200);
+	EXPECT_EQ(hit->preamble().header("etag"), "\"v1\"");
+	EXPECT_EQ(hit->preamble().header("cache-control"), "max-age=60");
+	EXPECT_TRUE(hit->fresh(cache::clock::now()));
+
+	tier.erase("example.com/a");
+	EXPECT_EQ(tier.get("example.com/a"), nullptr);
+	EXPECT_EQ(tier.used(), 0U);
+}
+
+TEST(disk_tier, evicts_by_size)
+{
+	temp_dir dir;
+	cache::disk_tier tier{dir.path, 25000};
+	ASSERT_TRUE(tier.put("a", *make_entry(10000)));
+	ASSERT_TRUE(tier.put("b", *make_entry(10000)));
+	auto mapped = tier.get("a");
+	ASSERT_NE(mapped, nullptr);
+	ASSERT_TRUE(tier.put("c", *make_entry(10000)));
+
+	EXPECT_EQ(tier.get("b"), nullptr);
+	EXPECT_NE(tier.get("c"), nullptr);
+	EXPECT_LE(tier.used(), 25000U);
+	// an evicted file stays readable through an existing mapping
+	EXPECT_EQ(as_string(mapped->body()), std::string(10000, 'x'));
+}
+
+TEST(http_cache, demotes_to_disk_and_promotes_back)
+{
+	temp_dir dir;
+	cache::http_cache::settings s;
+	s.path = dir.path;
+	s.memory_capacity = 16 * 20000;
+	cache::http_cache c{s};
+
+	auto now = cache::clock::now();
+	std::vector<std::string> keys;
+	for(int i = 0; i < 64; ++i)
+	{
+		keys.push_back("k" + std::to_string(i));
+		ASSERT_NE(c.store(keys.back(), ok(), std::string(10000, 'a' + i % 26), now, now), nullptr);
+	}
+	EXPECT_LE(c.memory().used(), s.memory_capacity);
+	ASSERT_NE(c.disk(), nullptr);
+
+	auto found = lookup_all(c, keys);
+	// the demotions were written before the lookups read the disk
+	EXPECT_GT(c.disk()->used(), 0U);
+	for(int i = 0; i < 64; ++i)
+	{
+		auto& e = found[i];
+		ASSERT_NE(e, nullptr);
+		EXPECT_EQ(as_string(e->body()), std::string(10000, 'a' + i % 26));
+		EXPECT_EQ(e->preamble().content_len(), 10000U);
+	}
+
+	c.erase("k0");
+	EXPECT_EQ(lookup_all(c, {"k0"}).front(), nullptr);
+	EXPECT_EQ(c.store("huge", ok(), std::string(s.max_object + 1, 'x'), now, now), nullptr);
+}
+
+TEST(http_cache, freshens_on_not_modified)
+{
+	cache::http_cache c{cache::http_cache::settings{}};
+	auto then = cache::clock::now() - std::chrono::seconds{120};
+	auto stale = c.store("k", ok(), "body", then, then);
+	ASSERT_NE(stale, nullptr);
+	EXPECT_FALSE(stale->fresh(cache::clock::now()));
+
+	http::http_response not_modified;
+	not_modified.status(304);
+	not_modified.header("cache-control", "max-age=600");
+	not_modified.header("etag", "\"v1\"");
+	auto now = cache::clock::now();
+	auto fresh = c.freshen("k", *stale, not_modified, now, now);
+	EXPECT_TRUE(fresh->fresh(now));
+	EXPECT_EQ(fresh->preamble().status_code(), 200);
+	EXPECT_EQ(fresh->preamble().header("cache-control"), "max-age=600");
+	EXPECT_EQ(fresh->preamble().content_len(), 4U);
+	EXPECT_EQ(as_string(fresh->body()), "body");
+	EXPECT_EQ(c.find("k"), fresh);
+}
+
+TEST(entry, stale_while_revalidate)
+{
+	auto then = cache::clock::now() - std::chrono::seconds{90};
+	cache::entry e{ok("max-age=60, stale-while-revalidate=60"), cache::body_view::from_string("x"), then,
+		cache::clock::duration::zero()};
+	auto now = cache::clock::now();
+	EXPECT_FALSE(e.fresh(now));
+	EXPECT_TRUE(e.stale_while_revalidate(now));
+	EXPECT_FALSE(e.stale_while_revalidate(now + std::chrono::seconds{60}));
+
+	cache::entry strict{ok("max-age=60, stale-while-revalidate=60, must-revalidate"), cache::body_view::from_string("x"),
+		then, cache::clock::duration::zero()};
+	EXPECT_FALSE(strict.stale_while_revalidate(now));
+}
+
+TEST(entry, acceptable_to_the_request)
+{
+	auto now = cache::clock::now();
+	// 30 seconds old, fresh for 60
+	cache::entry e{ok("max-age=60"), cache::body_view::from_string("x"), now - std::chrono::seconds{30},
+		cache::clock::duration::zero()};
+	cache::directives none;
+	EXPECT_TRUE(e.acceptable(now, none));
+
+	cache::directives no_cache;
+	no_cache.no_cache = true;
+	EXPECT_FALSE(e.acceptable(now, no_cache));
+
+	cache::directives max_age;
+	max_age.max_age = std::chrono::seconds{0};
+	EXPECT_FALSE(e.acceptable(now, max_age));
+	max_age.max_age = std::chrono::seconds{40};
+	EXPECT_TRUE(e.acceptable(now, max_age));
+
+	cache::directives min_fresh;
+	min_fresh.min_fresh = std::chrono::seconds{40};
+	EXPECT_FALSE(e.acceptable(now, min_fresh));
+	min_fresh.min_fresh = std::chrono::seconds{20};
+	EXPECT_TRUE(e.acceptable(now, min_fresh));
+
+	// 90 seconds old: stale by 30
+	auto later = now + std::chrono::seconds{60};
+	EXPECT_FALSE(e.acceptable(later, none));
+	cache::directives max_stale;
+	max_stale.max_stale = std::chrono::seconds{10};
+	EXPECT_FALSE(e.acceptable(later, max_stale));
+	max_stale.max_stale = std::chrono::seconds{60};
+	EXPECT_TRUE(e.acceptable(later, max_stale));
+
+	cache::entry strict{ok("max-age=60, must-revalidate"), cache::body_view::from_string("x"),
+		now - std::chrono::seconds{30}, cache::clock::duration::zero()};
+	EXPECT_FALSE(strict.acceptable(later, max_stale));
+}
@@ -577,4 +577,26 @@ TEST( codec, too_long_uri )
 	EXPECT_TRUE(fcb_called);
 }
 
+TEST( codec, external_body_framing )
+{
+	http_response message;
+	message.protocol(proto_version::HTTP11);
+	message.status(200);
+	message.chunked(true);
+
+	http_codec encoder;
+	encoder.encode_header(message);
+	auto framing = encoder.encode_body_framing(26);
+	EXPECT_EQ(framing.first, "1a\r\n");
+	EXPECT_EQ(framing.second, "\r\n");
+	EXPECT_EQ(encoder.encode_eom(), "0\r\n\r\n");
+
+	message.chunked(false);
+	message.content_len(26);
+	encoder.encode_header(message);
+	framing = encoder.encode_body_framing(26);
+	EXPECT_TRUE(framing.first.empty());
+	EXPECT_TRUE(framing.second.empty());
+}
+
 }//namespace
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "src/errors/error_pages.h"
+#include "src/http/server/response.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+
+class error_pages_test : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		char tmpl[] = "/tmp/doormat_pages_XXXXXX";
+		dir = mkdtemp(tmpl);
+		std::ofstream{dir + "/404.html"} << "<html>not found</html>";
+		std::ofstream{dir + "/503.html"} << "<html>unavailable</html>";
+	}
+
+	void TearDown() override
+	{
+		std::system(("rm -rf " + dir).c_str());
+	}
+
+	std::string config(const std::string& content)
+	{
+		auto path = dir + "/error_files.config";
+		std::ofstream{path} << content;
+		return path;
+	}
+
+	http::http_request get(http::proto_version protocol, bool keepalive)
+	{
+		http::http_request req;
+		req.protocol(protocol);
+		req.method(HTTP_GET);
+		req.keepalive(keepalive);
+		req.path("/");
+		return req;
+	}
+
+	std::string dir;
+};
+
+}
+
+TEST(prepared_response, serializes_every_variant)
+{
+	http::http_response preamble;
+	preamble.status(404);
+	preamble.header(http::hf_content_type, http::hv_text_html);
+	preamble.header("transfer-encoding", "chunked");
+	preamble.keepalive(true);
+	auto p = std::make_shared<const http::prepared_response>(std::move(preamble), "<html></html>");
+
+	EXPECT_EQ(p->status(), 404);
+	EXPECT_FALSE(p->preamble().chunked());
+	EXPECT_EQ(p->preamble().content_len(), 13U);
+
+	const auto& close11 = p->h1(http::proto_version::HTTP11, false);
+	EXPECT_EQ(close11.substr(0, 22), "HTTP/1.1 404 Not Found");
+	EXPECT_NE(close11.find("connection: close\r\n"), std::string::npos);
+	EXPECT_NE(close11.find("content-length: 13\r\n"), std::string::npos);
+	EXPECT_EQ(close11.find("transfer-encoding"), std::string::npos);
+	EXPECT_EQ(close11.substr(close11.size() - 17), "\r\n\r\n<html></html>");
+	EXPECT_EQ(p->h1_head_size(http::proto_version::HTTP11, false), close11.size() - 13);
+
+	const auto& keep10 = p->h1(http::proto_version::HTTP10, true);
+	EXPECT_EQ(keep10.substr(0, 8), "HTTP/1.0");
+	EXPECT_NE(keep10.find("connection: keep-alive\r\n"), std::string::npos);
+
+	// a HEAD request gets the head only, owned by the prepared response
+	auto head = http::h1_message(p, http::proto_version::HTTP11, true, true);
+	EXPECT_EQ(head.owner, p);
+	EXPECT_EQ(std::string(head.data, head.size), p->h1(http::proto_version::HTTP11, true).substr(0, head.size));
+	EXPECT_EQ(head.size, p->h1_head_size(http::proto_version::HTTP11, true));
+
+	ASSERT_GT(p->h2_headers_count(), 0U);
+	auto nv = p->h2_headers();
+	EXPECT_EQ(std::string((const char*) nv[0].name, nv[0].namelen), ":status");
+	EXPECT_EQ(std::string((const char*) nv[0].value, nv[0].valuelen), "404");
+	for(std::size_t i = 0; i < p->h2_headers_count(); ++i)
+		EXPECT_NE(std::string((const char*) nv[i].name, nv[i].namelen), "connection");
+}
+
+TEST_F(error_pages_test, loads_the_configuration)
+{
+	auto pages = errors::error_pages::from_file(config(
+		"{\"error_files\" : [{\"404\" : \"" + dir + "/404.html\"}, {\"503\" : \"" + dir + "/503.html\"}]}"));
+	EXPECT_EQ(pages.size(), 2U);
+	ASSERT_TRUE(pages.get(404));
+	EXPECT_EQ(pages.get(404)->body(), "<html>not found</html>");
+	EXPECT_EQ(pages.get(404)->preamble().header(http::hf_content_type), http::hv_text_html);
+	EXPECT_EQ(pages.get(503)->status(), 503);
+	EXPECT_FALSE(pages.get(500));
+	EXPECT_FALSE(pages.get(200));
+	EXPECT_FALSE(pages.get(1000));
+
+	EXPECT_THROW(pages.add(302, "moved"), std::out_of_range);
+	EXPECT_THROW(errors::error_pages::from_file(dir + "/missing.config"), std::runtime_error);
+	EXPECT_THROW(errors::error_pages::from_file(config("{\"error_files\" : [{\"404\" : \"" + dir + "/none.html\"}]}")),
+		std::runtime_error);
+	EXPECT_THROW(errors::error_pages::from_file(config("{\"error_files\" : [{\"4o4\" : \"" + dir + "/404.html\"}]}")),
+		std::runtime_error);
+	EXPECT_THROW(errors::error_pages::from_file(config("{\"pages\" : []}")), std::runtime_error);
+}
+
+TEST_F(error_pages_test, sends_the_shared_message)
+{
+	errors::error_pages pages;
+	pages.add(404, "<html>not found</html>");
+	boost::asio::io_service io;
+
+	std::shared_ptr<http::response> res;
+	bool notified{false};
+	res = std::make_shared<http::response>([&notified]() { notified = true; }, io);
+	EXPECT_FALSE(pages.send(*res, 500, get(http::proto_version::HTTP11, true)));
+	ASSERT_TRUE(pages.send(*res, 404, get(http::proto_version::HTTP11, true)));
+	io.run();
+	EXPECT_TRUE(notified);
+	ASSERT_EQ(res->get_state(), http::response::state::prepared_received);
+}
+
+TEST_F(error_pages_test, falls_back_on_the_preamble_and_body)
+{
+	errors::error_pages pages;
+	pages.add(404, "<html>not found</html>");
+	boost::asio::io_service io;
+
+	http::http_response sent;
+	std::string body;
+	bool ended{false};
+	auto res = std::make_shared<http::response>([&sent](http::http_response&& r) { sent = std::move(r); },
+		[&body](http::response::data_t d, size_t s) { body.append(d.get(), s); },
+		[](std::string&&, std::string&&) {}, [&ended]() { ended = true; }, io);
+	ASSERT_TRUE(pages.send(*res, 404, get(http::proto_version::HTTP10, false)));
+	io.run();
+	EXPECT_TRUE(ended);
+	EXPECT_EQ(sent.status_code(), 404);
+	EXPECT_EQ(sent.protocol_version(), http::proto_version::HTTP10);
+	EXPECT_FALSE(sent.keepalive());
+	EXPECT_EQ(sent.content_len(), body.size());
+	EXPECT_EQ(body, "<html>not found</html>");
+}
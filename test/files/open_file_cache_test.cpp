@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "src/files/open_file_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+
+class temp_dir
+{
+public:
+	temp_dir()
+	{
+		char tmpl[] = "/tmp/doormat_files_XXXXXX";
+		path = mkdtemp(tmpl);
+	}
+
+	~temp_dir()
+	{
+		std::system(("rm -rf " + path).c_str());
+	}
+
+	std::string file(const std::string& name, const std::string& content) const
+	{
+		auto p = path + "/" + name;
+		std::ofstream{p} << content;
+		return p;
+	}
+
+	std::string path;
+};
+
+/** \brief runs the io_service until the condition holds, or a second has gone by. */
+template<typename condition_t>
+bool wait_for(boost::asio::io_service& io, condition_t condition)
+{
+	bool expired{false};
+	boost::asio::deadline_timer timer{io, boost::posix_time::seconds(1)};
+	timer.async_wait([&expired](const boost::system::error_code& ec) { if(!ec) expired = true; });
+	while(!condition() && !expired)
+		io.run_one();
+	timer.cancel();
+	io.poll();
+	io.reset();
+	return condition();
+}
+
+}
+
+TEST(open_file_cache, keeps_files_open)
+{
+	boost::asio::io_service io;
+	temp_dir dir;
+	auto path = dir.file("a.txt", "hello");
+	files::open_file_cache cache{io};
+	ASSERT_TRUE(cache.watching());
+
+	int error;
+	auto first = cache.open(path, error);
+	ASSERT_TRUE(first);
+	EXPECT_EQ(error, 0);
+	EXPECT_EQ(first->size(), 5U);
+	EXPECT_EQ(cache.open(path, error), first);
+	EXPECT_EQ(cache.size(), 1U);
+
+	auto s = files::segment(first, 1, 3);
+	char out[3];
+	EXPECT_EQ(s.read(out, sizeof(out)), 3U);
+	EXPECT_EQ(std::string(out, 3), "ell");
+	EXPECT_EQ(s.length, 0U);
+}
+
+TEST(open_file_cache, remembers_missing_files)
+{
+	boost::asio::io_service io;
+	temp_dir dir;
+	files::open_file_cache cache{io};
+
+	int error;
+	EXPECT_FALSE(cache.open(dir.path + "/missing", error));
+	EXPECT_EQ(error, ENOENT);
+	EXPECT_FALSE(cache.open(dir.path + "/missing", error));
+	EXPECT_EQ(error, ENOENT);
+	EXPECT_EQ(cache.size(), 1U);
+
+	EXPECT_FALSE(cache.open(dir.path, error));
+	EXPECT_EQ(error, EISDIR);
+
+	// a directory which does not exist can not be watched
+	EXPECT_FALSE(cache.open(dir.path + "/nowhere/missing", error));
+	EXPECT_EQ(error, ENOENT);
+	EXPECT_EQ(cache.size(), 2U);
+
+	// created afterwards: the entry is dropped
+	auto path = dir.file("missing", "now here");
+	ASSERT_TRUE(wait_for(io, [&cache]() { return cache.size() == 1; }));
+	auto file = cache.open(path, error);
+	ASSERT_TRUE(file);
+	EXPECT_EQ(file->size(), 8U);
+}
+
+TEST(open_file_cache, changes_invalidate_entries)
+{
+	boost::asio::io_service io;
+	temp_dir dir;
+	auto path = dir.file("a.txt", "hello");
+	auto other = dir.file("b.txt", "untouched");
+	files::open_file_cache cache{io};
+
+	int error;
+	auto first = cache.open(path, error);
+	auto untouched = cache.open(other, error);
+	ASSERT_TRUE(first);
+
+	// replaced by a rename, as deployments do
+	auto replacement = dir.file(".a.txt.new", "hello, world");
+	ASSERT_EQ(std::rename(replacement.c_str(), path.c_str()), 0);
+	ASSERT_TRUE(wait_for(io, [&cache]() { return cache.size() == 1; }));
+	auto second = cache.open(path, error);
+	ASSERT_TRUE(second);
+	EXPECT_NE(second, first);
+	EXPECT_EQ(second->size(), 12U);
+	EXPECT_EQ(cache.open(other, error), untouched);
+
+	// modified in place
+	std::ofstream{path, std::ios::app} << "!";
+	ASSERT_TRUE(wait_for(io, [&cache]() { return cache.size() == 1; }));
+	EXPECT_EQ(cache.open(path, error)->size(), 13U);
+
+	// removed
+	ASSERT_EQ(unlink(path.c_str()), 0);
+	ASSERT_TRUE(wait_for(io, [&cache]() { return cache.size() == 1; }));
+	EXPECT_FALSE(cache.open(path, error));
+	EXPECT_EQ(error, ENOENT);
+}
+
+TEST(open_file_cache, evicts_least_recently_used)
+{
+	boost::asio::io_service io;
+	temp_dir dir;
+	auto a = dir.file("a", "a"), b = dir.file("b", "b"), c = dir.file("c", "c");
+	files::open_file_cache cache{io, 2};
+
+	int error;
+	auto first = cache.open(a, error);
+	cache.open(b, error);
+	EXPECT_EQ(cache.open(a, error), first);
+	cache.open(c, error);
+	EXPECT_EQ(cache.size(), 2U);
+	// b was the least recently used
+	EXPECT_EQ(cache.open(a, error), first);
+}
@@ -0,0 +1,275 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "src/files/static_files.h"
+#include "src/errors/error_pages.h"
+#include "src/http/server/response.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+
+class static_files_test : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		char tmpl[] = "/tmp/doormat_static_XXXXXX";
+		root = mkdtemp(tmpl);
+		write("/index.html", "<html></html>");
+		write("/alphabet.txt", "abcdefghijklmnopqrstuvwxyz");
+		mkdir((root + "/css").c_str(), 0755);
+		write("/css/style.css", "body{}");
+	}
+
+	void TearDown() override
+	{
+		std::system(("rm -rf " + root).c_str());
+	}
+
+	void write(const std::string& path, const std::string& content)
+	{
+		std::ofstream{root + path} << content;
+	}
+
+	http::http_request get(const std::string& path)
+	{
+		http::http_request req;
+		req.protocol(http::proto_version::HTTP11);
+		req.method(HTTP_GET);
+		req.path(path);
+		return req;
+	}
+
+	/** \brief serves the request, collecting the response. */
+	void serve(const http::http_request& req, files::static_files::settings s = {})
+	{
+		if(s.root.empty()) s.root = root;
+		sent = {};
+		body.clear();
+		ended = false;
+		auto res = std::make_shared<http::response>([this](http::http_response&& r) { sent = std::move(r); },
+			[this](http::response::data_t d, size_t s) { body.append(d.get(), s); },
+			[](std::string&&, std::string&&) {}, [this]() { ended = true; }, io);
+		{
+			files::static_files handler{io, s};
+			ASSERT_TRUE(handler.serve(req, *res));
+		}
+		io.run();
+		io.reset();
+		EXPECT_TRUE(ended);
+	}
+
+	boost::asio::io_service io;
+	std::string root;
+	http::http_response sent;
+	std::string body;
+	bool ended{false};
+};
+
+}
+
+TEST(byte_ranges, parsing)
+{
+	std::vector<files::byte_range> r;
+	EXPECT_EQ(files::parse_range("bytes=0-499", 1000, r), files::range_status::satisfiable);
+	ASSERT_EQ(r.size(), 1U);
+	EXPECT_EQ(r[0].first, 0U);
+	EXPECT_EQ(r[0].last, 499U);
+
+	EXPECT_EQ(files::parse_range("bytes=-200", 1000, r), files::range_status::satisfiable);
+	EXPECT_EQ(r[0].first, 800U);
+	EXPECT_EQ(r[0].last, 999U);
+
+	EXPECT_EQ(files::parse_range("bytes=900-", 1000, r), files::range_status::satisfiable);
+	EXPECT_EQ(r[0].first, 900U);
+	EXPECT_EQ(r[0].last, 999U);
+
+	EXPECT_EQ(files::parse_range("Bytes=990-2000, -5000", 1000, r), files::range_status::satisfiable);
+	ASSERT_EQ(r.size(), 1U);
+	EXPECT_EQ(r[0].first, 0U);
+	EXPECT_EQ(r[0].last, 999U);
+
+	// overlapping and adjacent ranges are coalesced, and sorted
+	EXPECT_EQ(files::parse_range("bytes=500-599, 0-9, 5-20, 21-30,, 700-", 1000, r), files::range_status::satisfiable);
+	ASSERT_EQ(r.size(), 3U);
+	EXPECT_EQ(r[0].first, 0U);
+	EXPECT_EQ(r[0].last, 30U);
+	EXPECT_EQ(r[1].first, 500U);
+	EXPECT_EQ(r[2].first, 700U);
+
+	EXPECT_EQ(files::parse_range("bytes=1000-", 1000, r), files::range_status::unsatisfiable);
+	EXPECT_EQ(files::parse_range("bytes=-0", 1000, r), files::range_status::unsatisfiable);
+	EXPECT_EQ(files::parse_range("bytes=0-", 0, r), files::range_status::unsatisfiable);
+
+	EXPECT_EQ(files::parse_range("items=0-10", 1000, r), files::range_status::ignored);
+	EXPECT_EQ(files::parse_range("bytes=10-5", 1000, r), files::range_status::ignored);
+	EXPECT_EQ(files::parse_range("bytes=a-b", 1000, r), files::range_status::ignored);
+	EXPECT_EQ(files::parse_range("bytes=", 1000, r), files::range_status::ignored);
+	EXPECT_EQ(files::parse_range("bytes=0-99999999999999999999999", 1000, r), files::range_status::satisfiable);
+	EXPECT_EQ(r[0].last, 999U);
+
+	// too many of them
+	EXPECT_EQ(files::parse_range("bytes=0-0,2-2,4-4", 1000, r, 2), files::range_status::ignored);
+	EXPECT_TRUE(r.empty());
+}
+
+TEST_F(static_files_test, serves_files_with_validators)
+{
+	serve(get("/alphabet.txt"));
+	EXPECT_EQ(sent.status_code(), 200);
+	EXPECT_EQ(sent.content_len(), 26U);
+	EXPECT_EQ(body, "abcdefghijklmnopqrstuvwxyz");
+	EXPECT_EQ(sent.header("accept-ranges"), "bytes");
+	EXPECT_FALSE(sent.header("last-modified").empty());
+	auto etag = sent.header("etag");
+	ASSERT_FALSE(etag.empty());
+	EXPECT_EQ(etag.front(), '"');
+
+	serve(get("/css/style.css"));
+	EXPECT_EQ(sent.header(http::hf_content_type), http::hv_text_css);
+	EXPECT_EQ(body, "body{}");
+
+	serve(get("/"));
+	EXPECT_EQ(sent.header(http::hf_content_type), http::hv_text_html);
+	EXPECT_EQ(body, "<html></html>");
+
+	auto head = get("/alphabet.txt");
+	head.method(HTTP_HEAD);
+	serve(head);
+	EXPECT_EQ(sent.content_len(), 26U);
+	EXPECT_TRUE(body.empty());
+}
+
+TEST_F(static_files_test, conditional_requests)
+{
+	serve(get("/alphabet.txt"));
+	auto etag = sent.header("etag");
+	auto last_modified = sent.header("last-modified");
+
+	auto req = get("/alphabet.txt");
+	req.header("if-none-match", "\"other\", " + etag);
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 304);
+	EXPECT_EQ(sent.header("etag"), etag);
+	EXPECT_TRUE(body.empty());
+
+	req = get("/alphabet.txt");
+	req.header("if-modified-since", last_modified);
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 304);
+
+	// If-None-Match wins over If-Modified-Since
+	req = get("/alphabet.txt");
+	req.header("if-none-match", "\"other\"");
+	req.header("if-modified-since", last_modified);
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 200);
+
+	// a changed file has another tag
+	usleep(20000);
+	write("/alphabet.txt", "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	req = get("/alphabet.txt");
+	req.header("if-none-match", etag);
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 200);
+	EXPECT_NE(sent.header("etag"), etag);
+	EXPECT_EQ(body, "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+}
+
+TEST_F(static_files_test, byte_ranges)
+{
+	auto req = get("/alphabet.txt");
+	req.header("range", "bytes=2-4");
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 206);
+	EXPECT_EQ(sent.header("content-range"), "bytes 2-4/26");
+	EXPECT_EQ(sent.content_len(), 3U);
+	EXPECT_EQ(body, "cde");
+
+	req = get("/alphabet.txt");
+	req.header("range", "bytes=0-1,-2");
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 206);
+	auto type = sent.header(http::hf_content_type);
+	auto boundary = type.substr(type.find("boundary=") + 9);
+	EXPECT_EQ(type.substr(0, 21), "multipart/byteranges;");
+	EXPECT_EQ(body, "\r\n--" + boundary + "\r\ncontent-type: text/plain\r\ncontent-range: bytes 0-1/26\r\n\r\nab"
+		"\r\n--" + boundary + "\r\ncontent-type: text/plain\r\ncontent-range: bytes 24-25/26\r\n\r\nyz"
+		"\r\n--" + boundary + "--\r\n");
+	EXPECT_EQ(sent.content_len(), body.size());
+
+	req = get("/alphabet.txt");
+	req.header("range", "bytes=30-");
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 416);
+	EXPECT_EQ(sent.header("content-range"), "bytes */26");
+
+	// the ranges refer to another version of the file
+	req = get("/alphabet.txt");
+	req.header("range", "bytes=2-4");
+	req.header("if-range", "\"old\"");
+	serve(req);
+	EXPECT_EQ(sent.status_code(), 200);
+	EXPECT_EQ(body.size(), 26U);
+}
+
+TEST_F(static_files_test, precompressed_siblings)
+{
+	write("/alphabet.txt.gz", "not really gzip");
+	auto req = get("/alphabet.txt");
+	req.header(http::hf_accept_encoding, "gzip, deflate");
+	serve(req);
+	EXPECT_EQ(sent.header(http::hf_content_encoding), "gzip");
+	EXPECT_EQ(sent.header("vary"), "Accept-Encoding");
+	EXPECT_EQ(sent.header(http::hf_content_type), http::hv_text_plain);
+	EXPECT_EQ(body, "not really gzip");
+	auto gzip_etag = sent.header("etag");
+
+	serve(get("/alphabet.txt"));
+	EXPECT_FALSE(sent.has(http::hf_content_encoding));
+	EXPECT_EQ(sent.header("vary"), "Accept-Encoding");
+	EXPECT_EQ(body.size(), 26U);
+	EXPECT_NE(sent.header("etag"), gzip_etag);
+
+	files::static_files::settings s;
+	s.gzip_siblings = false;
+	serve(req, s);
+	EXPECT_FALSE(sent.has(http::hf_content_encoding));
+	EXPECT_FALSE(sent.has("vary"));
+}
+
+TEST_F(static_files_test, errors)
+{
+	serve(get("/missing.txt"));
+	EXPECT_EQ(sent.status_code(), 404);
+
+	serve(get("/css/../../etc/passwd"));
+	EXPECT_EQ(sent.status_code(), 400);
+
+	serve(get("/css/%2e%2e/alphabet.txt"));
+	EXPECT_EQ(sent.status_code(), 200);
+	EXPECT_EQ(body.size(), 26U);
+
+	serve(get("/css"));
+	EXPECT_EQ(sent.status_code(), 301);
+	EXPECT_EQ(sent.header("location"), "/css/");
+
+	auto post = get("/alphabet.txt");
+	post.method(HTTP_POST);
+	serve(post);
+	EXPECT_EQ(sent.status_code(), 405);
+	EXPECT_EQ(sent.header(http::hf_allow), "GET, HEAD");
+
+	// pages are sent along with the errors, when configured
+	auto pages = std::make_shared<errors::error_pages>();
+	pages->add(404, "<html>not found</html>");
+	files::static_files::settings s;
+	s.error_pages = pages;
+	serve(get("/missing.txt"), s);
+	EXPECT_EQ(sent.status_code(), 404);
+	EXPECT_EQ(sent.header(http::hf_content_type), http::hv_text_html);
+	EXPECT_EQ(body, "<html>not found</html>");
+}
@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "src/filters/filter_chain.h"
+
+#include <string>
+
+namespace
+{
+
+std::string trace;
+
+/** \brief records its passage, both ways. */
+template<char name>
+struct tracer : filters::filter
+{
+	filters::verdict on_request(http::http_request&, http::response&)
+	{
+		trace.push_back(name);
+		return filters::verdict::proceed;
+	}
+
+	void on_response(const http::http_request&, http::http_response& res)
+	{
+		trace.push_back(name);
+		res.remove_header("x-trace");
+		res.header("x-trace", trace);
+	}
+};
+
+/** \brief turns away the requests without credentials. */
+struct auth : filters::filter
+{
+	filters::verdict on_request(http::http_request& req, http::response& res)
+	{
+		if(req.has("authorization")) return filters::verdict::proceed;
+		http::http_response r;
+		r.status(401);
+		r.content_len(0);
+		res.headers(std::move(r));
+		res.end();
+		return filters::verdict::answered;
+	}
+};
+
+/** \brief hooks only the requests, rewriting them. */
+struct rewrite : filters::filter
+{
+	filters::verdict on_request(http::http_request& req, http::response&)
+	{
+		req.path("/v2" + req.path());
+		return filters::verdict::proceed;
+	}
+};
+
+class filter_chain_test : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		trace.clear();
+		req.protocol(http::proto_version::HTTP11);
+		req.method(HTTP_GET);
+		req.path("/items");
+		res = std::make_shared<http::response>([this](http::http_response&& r) { sent = std::move(r); },
+			[](http::response::data_t, size_t) {}, [](std::string&&, std::string&&) {}, []() {}, io);
+	}
+
+	/** \brief runs the request through the chain, answering it with a 200 when it goes through. */
+	template<typename chain_t>
+	filters::verdict run(chain_t& chain)
+	{
+		auto v = chain.on_request(req, *res);
+		if(v == filters::verdict::answered) return v;
+		res->filter_headers([this, &chain](http::http_response& r) { chain.on_response(req, r); });
+		http::http_response r;
+		r.status(200);
+		res->headers(std::move(r));
+		return v;
+	}
+
+	boost::asio::io_service io;
+	http::http_request req;
+	std::shared_ptr<http::response> res;
+	http::http_response sent;
+};
+
+}
+
+TEST_F(filter_chain_test, static_chain)
+{
+	filters::chain<tracer<'a'>, rewrite, tracer<'b'>, tracer<'c'>> chain;
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+	EXPECT_EQ(req.path(), "/v2/items");
+	// requests go forward, responses backwards
+	EXPECT_EQ(trace, "abccba");
+	EXPECT_EQ(sent.status_code(), 200);
+	EXPECT_EQ(sent.header("x-trace"), "abccba");
+}
+
+TEST_F(filter_chain_test, short_circuit)
+{
+	auto chain = filters::make_chain(tracer<'a'>{}, auth{}, tracer<'b'>{});
+	EXPECT_EQ(run(chain), filters::verdict::answered);
+	EXPECT_EQ(trace, "a");
+	EXPECT_EQ(sent.status_code(), 401);
+
+	SetUp();
+	req.header("authorization", "Basic Zm9vOmJhcg==");
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+	EXPECT_EQ(trace, "abba");
+	EXPECT_EQ(sent.status_code(), 200);
+}
+
+TEST_F(filter_chain_test, dynamic_chain)
+{
+	filters::response_headers headers;
+	headers.add("x-frame-options", "DENY");
+	headers.add("x-trace", "never");
+
+	filters::dynamic_chain chain;
+	chain.add(headers);
+	chain.add(tracer<'a'>{});
+	// static chains are a single filter of the dynamic ones
+	chain.add(filters::chain<tracer<'b'>, tracer<'c'>>{});
+	chain.add(auth{});
+	EXPECT_EQ(chain.size(), 4U);
+
+	EXPECT_EQ(run(chain), filters::verdict::answered);
+	EXPECT_EQ(trace, "abc");
+	EXPECT_FALSE(sent.has("x-frame-options"));
+
+	SetUp();
+	req.header("authorization", "Basic Zm9vOmJhcg==");
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+	EXPECT_EQ(trace, "abccba");
+	EXPECT_EQ(sent.header("x-frame-options"), "DENY");
+	// headers set by the response are kept
+	EXPECT_EQ(sent.header("x-trace"), "abccba");
+}
+
+TEST_F(filter_chain_test, headers_filter_is_dropped_once_used)
+{
+	int calls{0};
+	res->filter_headers([&calls](http::http_response& r) { ++calls; r.header("x-filtered", "1"); });
+	res->headers(http::http_response{});
+	EXPECT_EQ(calls, 1);
+	EXPECT_EQ(sent.header("x-filtered"), "1");
+	res->headers(http::http_response{});
+	EXPECT_EQ(calls, 1);
+}
+
+TEST_F(filter_chain_test, rate_limit)
+{
+	// two requests at once, then one a minute
+	auto limiter = std::make_shared<network::rate_limiter>(1.0 / 60, 2);
+	auto chain = filters::make_chain(filters::rate_limit{limiter, "x-api-key"}, tracer<'a'>{});
+	req.origin(boost::asio::ip::address::from_string("192.0.2.1"));
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+	SetUp();
+	req.origin(boost::asio::ip::address::from_string("192.0.2.1"));
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+
+	SetUp();
+	req.origin(boost::asio::ip::address::from_string("192.0.2.1"));
+	EXPECT_EQ(run(chain), filters::verdict::answered);
+	EXPECT_EQ(trace, "");
+	EXPECT_EQ(sent.status_code(), 429);
+	EXPECT_EQ(sent.header("retry-after"), "60");
+
+	// other clients have buckets of their own, be they told by address or by key
+	SetUp();
+	req.origin(boost::asio::ip::address::from_string("192.0.2.2"));
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+	SetUp();
+	req.origin(boost::asio::ip::address::from_string("192.0.2.1"));
+	req.header("x-api-key", "secret");
+	EXPECT_EQ(run(chain), filters::verdict::proceed);
+}
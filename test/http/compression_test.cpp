@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <zlib.h>
+
+#include "src/http/compression.h"
+#include "src/http/server/response.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+namespace
+{
+
+/** \brief decodes gzip or zlib data, telling them apart from the header. */
+std::string inflate_all(const std::string& in)
+{
+	z_stream s{};
+	inflateInit2(&s, 32 + MAX_WBITS);
+	s.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+	s.avail_in = in.size();
+	std::string out;
+	char buf[4096];
+	int r;
+	do
+	{
+		s.next_out = reinterpret_cast<Bytef*>(buf);
+		s.avail_out = sizeof(buf);
+		r = inflate(&s, Z_NO_FLUSH);
+		out.append(buf, sizeof(buf) - s.avail_out);
+	} while(r == Z_OK && (s.avail_in > 0 || s.avail_out == 0));
+	inflateEnd(&s);
+	return out;
+}
+
+http::http_response json_response(std::size_t length)
+{
+	http::http_response res;
+	res.protocol(http::proto_version::HTTP11);
+	res.status(200);
+	res.header(http::hf_content_type, "application/json; charset=utf-8");
+	res.content_len(length);
+	return res;
+}
+
+http::http_request request(const std::string& accept_encoding, http::proto_version p = http::proto_version::HTTP11)
+{
+	http::http_request req;
+	req.protocol(p);
+	req.method(HTTP_GET);
+	req.path("/");
+	if(!accept_encoding.empty()) req.header(http::hf_accept_encoding, accept_encoding);
+	return req;
+}
+
+}
+
+TEST(compression, negotiates_the_coding)
+{
+	EXPECT_EQ(http::negotiate_encoding("gzip, deflate, br"), http::tranfer_encoding::gzip);
+	EXPECT_EQ(http::negotiate_encoding("deflate"), http::tranfer_encoding::deflate);
+	EXPECT_EQ(http::negotiate_encoding("gzip;q=0.5, deflate"), http::tranfer_encoding::deflate);
+	EXPECT_EQ(http::negotiate_encoding("GZIP;q=0"), http::tranfer_encoding::identity);
+	EXPECT_EQ(http::negotiate_encoding("*"), http::tranfer_encoding::gzip);
+	EXPECT_EQ(http::negotiate_encoding("*;q=0, identity"), http::tranfer_encoding::identity);
+	EXPECT_EQ(http::negotiate_encoding("br"), http::tranfer_encoding::identity);
+	EXPECT_EQ(http::negotiate_encoding(""), http::tranfer_encoding::identity);
+}
+
+TEST(compression, policy_selects_responses)
+{
+	http::compression_policy p;
+	p.min_size = 100;
+	p.mime_types = {"application/json", "text/*"};
+
+	EXPECT_TRUE(p.compressible(json_response(1000)));
+	EXPECT_FALSE(p.compressible(json_response(10)));
+
+	auto html = json_response(1000);
+	html.remove_header(http::hf_content_type);
+	html.header(http::hf_content_type, "TEXT/HTML");
+	EXPECT_TRUE(p.compressible(html));
+
+	auto png = json_response(1000);
+	png.remove_header(http::hf_content_type);
+	png.header(http::hf_content_type, http::hv_image_png);
+	EXPECT_FALSE(p.compressible(png));
+
+	auto encoded = json_response(1000);
+	encoded.header(http::hf_content_encoding, "br");
+	EXPECT_FALSE(p.compressible(encoded));
+
+	auto no_transform = json_response(1000);
+	no_transform.header("cache-control", "public, no-transform");
+	EXPECT_FALSE(p.compressible(no_transform));
+
+	auto not_modified = json_response(1000);
+	not_modified.status(304);
+	EXPECT_FALSE(p.compressible(not_modified));
+}
+
+TEST(compression, policy_from_configuration)
+{
+	char name[] = "/tmp/doormat_gzip_XXXXXX";
+	int fd = mkstemp(name);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	std::ofstream{name} << "{\"port\": 443}\n"
+		"{\"gzip\" : {\"compression_level\" : 9, \"compression_min_size\" : 10, \"compression_mime_types\" : [\"application/json\"]}}\n";
+
+	auto p = http::compression_policy::from_file(name);
+	std::remove(name);
+	EXPECT_EQ(p.level, 9);
+	EXPECT_EQ(p.min_size, 10U);
+	ASSERT_EQ(p.mime_types.size(), 1U);
+	EXPECT_EQ(p.mime_types[0], "application/json");
+}
+
+TEST(compression, streaming_round_trip)
+{
+	std::string body;
+	for(int i = 0; i < 2000; ++i) body += "{\"id\": " + std::to_string(i) + ", \"name\": \"doormat\"},";
+
+	for(auto coding : {http::tranfer_encoding::gzip, http::tranfer_encoding::deflate})
+	{
+		std::string out;
+		{
+			http::deflater d{coding, 6};
+			for(std::size_t i = 0; i < body.size(); i += 1000)
+				out += d.compress(body.data() + i, std::min<std::size_t>(1000, body.size() - i));
+			EXPECT_TRUE(d.pending());
+			auto flushed = d.flush();
+			EXPECT_FALSE(flushed.empty());
+			EXPECT_FALSE(d.pending());
+			// everything so far can be decoded without the end of the stream
+			EXPECT_EQ(inflate_all(out + flushed), body);
+			out += flushed;
+			out += d.finish();
+		}
+		EXPECT_LT(out.size(), body.size() / 4);
+		EXPECT_EQ(inflate_all(out), body);
+	}
+
+	// streams are reused once released
+	EXPECT_EQ(inflate_all(http::deflater::compress_all(http::tranfer_encoding::gzip, 6, body.data(), body.size())), body);
+}
+
+TEST(compression, variants_are_compressed_once)
+{
+	http::compressed_variants variants{1024 * 1024};
+	std::string body(10000, 'a');
+	auto first = variants.get("k\"v1\"", http::tranfer_encoding::gzip, 6, body.data(), body.size());
+	auto second = variants.get("k\"v1\"", http::tranfer_encoding::gzip, 6, body.data(), body.size());
+	EXPECT_EQ(first, second);
+	EXPECT_EQ(inflate_all(*first), body);
+
+	auto deflated = variants.get("k\"v1\"", http::tranfer_encoding::deflate, 6, body.data(), body.size());
+	EXPECT_NE(first, deflated);
+	EXPECT_EQ(variants.used(), first->size() + deflated->size());
+}
+
+TEST(compression, response_compresses_on_the_fly)
+{
+	boost::asio::io_service io;
+	http::http_response sent;
+	std::string received;
+	bool ended{false};
+	auto res = std::make_shared<http::response>([&](http::http_response&& r) { sent = std::move(r); },
+		[&](http::response::data_t d, size_t s) { received.append(d.get(), s); },
+		[](std::string&&, std::string&&) {}, [&]() { ended = true; }, io);
+
+	res->compress(std::make_shared<http::compression_policy>(), request("gzip"));
+	auto preamble = json_response(12);
+	preamble.header("etag", "\"v1\"");
+	res->headers(std::move(preamble));
+	EXPECT_EQ(sent.header(http::hf_content_encoding), "gzip");
+	EXPECT_EQ(sent.header("vary"), "Accept-Encoding");
+	EXPECT_EQ(sent.header("etag"), "W/\"v1\"");
+	EXPECT_TRUE(sent.chunked());
+	EXPECT_FALSE(sent.has(http::hf_content_len));
+
+	auto chunk = [](const std::string& s)
+	{
+		auto d = std::make_unique<char[]>(s.size());
+		std::copy(s.begin(), s.end(), d.get());
+		return http::response::data_t{std::move(d)};
+	};
+	res->body(chunk("{\"a\":"), 5);
+	res->body(chunk("\"hello\"}"), 8);
+	// the flush happens once the current turn is over
+	io.run();
+	io.reset();
+	EXPECT_EQ(inflate_all(received), "{\"a\":\"hello\"}");
+
+	res->end();
+	io.run();
+	EXPECT_TRUE(ended);
+	EXPECT_EQ(inflate_all(received), "{\"a\":\"hello\"}");
+}
+
+TEST(compression, head_gets_the_headers_of_the_compressed_get)
+{
+	boost::asio::io_service io;
+	http::http_response sent;
+	std::size_t body_bytes{0};
+	auto res = std::make_shared<http::response>([&](http::http_response&& r) { sent = std::move(r); },
+		[&](http::response::data_t, size_t s) { body_bytes += s; }, [](std::string&&, std::string&&) {}, []() {}, io);
+
+	auto head = request("gzip");
+	head.method(HTTP_HEAD);
+	res->compress(std::make_shared<http::compression_policy>(), head);
+	auto preamble = json_response(12);
+	preamble.header("etag", "\"v1\"");
+	res->headers(std::move(preamble));
+	EXPECT_EQ(sent.header(http::hf_content_encoding), "gzip");
+	EXPECT_EQ(sent.header("vary"), "Accept-Encoding");
+	EXPECT_EQ(sent.header("etag"), "W/\"v1\"");
+	EXPECT_FALSE(sent.has(http::hf_content_len));
+	EXPECT_FALSE(sent.chunked());
+
+	res->end();
+	io.run();
+	// no encoder: not even the empty gzip stream is sent
+	EXPECT_EQ(body_bytes, 0U);
+}
+
+TEST(compression, files_are_read_as_the_body_is_taken)
+{
+	char name[] = "/tmp/doormat_compression_XXXXXX";
+	int fd = mkstemp(name);
+	ASSERT_GE(fd, 0);
+	std::string content;
+	for(int i = 0; content.size() < 200 * 1024; ++i) content += "{\"n\":" + std::to_string(i) + "},";
+	ASSERT_EQ(write(fd, content.data(), content.size()), static_cast<ssize_t>(content.size()));
+
+	boost::asio::io_service io;
+	std::string received;
+	bool ended{false};
+	auto res = std::make_shared<http::response>([](http::http_response&&) {},
+		[&](http::response::data_t d, size_t s) { received.append(d.get(), s); },
+		[](std::string&&, std::string&&) {}, [&]() { ended = true; }, io);
+	std::vector<std::function<void()>> drained;
+	res->paced_by({[&](std::function<void()> cb) { drained.push_back(std::move(cb)); }, {}});
+
+	res->compress(std::make_shared<http::compression_policy>(), request("gzip"));
+	res->headers(json_response(content.size() + 1));
+	http::file_segment f;
+	f.fd = fd;
+	f.length = content.size();
+	ASSERT_TRUE(res->file(std::move(f)));
+	auto tail = std::make_unique<char[]>(1);
+	tail[0] = ']';
+	res->body(std::move(tail), 1);
+	res->end();
+
+	// one chunk of 64 KiB at a time, each once the previous one has been taken
+	std::size_t chunks{1};
+	while(!drained.empty())
+	{
+		ASSERT_FALSE(ended);
+		auto next = std::move(drained.front());
+		drained.clear();
+		next();
+		io.run();
+		io.reset();
+		++chunks;
+	}
+	io.run();
+	EXPECT_EQ(chunks, (content.size() + 65535) / 65536);
+	EXPECT_TRUE(ended);
+	EXPECT_EQ(inflate_all(received), content + "]");
+	close(fd);
+	unlink(name);
+}
+
+TEST(compression, response_left_alone_when_not_accepted)
+{
+	boost::asio::io_service io;
+	http::http_response sent;
+	auto res = std::make_shared<http::response>([&](http::http_response&& r) { sent = std::move(r); },
+		[](http::response::data_t, size_t) {}, [](std::string&&, std::string&&) {}, []() {}, io);
+
+	res->compress(std::make_shared<http::compression_policy>(), request(""));
+	res->headers(json_response(12));
+	EXPECT_FALSE(sent.has(http::hf_content_encoding));
+	EXPECT_EQ(sent.content_len(), 12U);
+}
+
+TEST(compression, http10_body_ends_with_the_connection)
+{
+	auto res = json_response(100);
+	http::compressed_preamble(res, http::tranfer_encoding::gzip, http::proto_version::HTTP10, http::proto_version::HTTP10);
+	EXPECT_FALSE(res.chunked());
+	EXPECT_FALSE(res.keepalive());
+	EXPECT_FALSE(res.has(http::hf_content_len));
+}
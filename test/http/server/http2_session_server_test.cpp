@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include "../../../src/http/server/request.h"
 #include "../../../src/http/server/response.h"
+#include "../../../src/http/server/static_routes.h"
 #include "../../mocks/mock_connector/mock_connector.h"
 #include "../src/http2/session.h"
 #include "../src/http2/stream.h"
@@ -1048,3 +1049,66 @@ TEST_F(http2_server_test, randomdata)
 	bool error = _handler->on_read(raw_request, len);
 	ASSERT_FALSE( error );
 }
+
+TEST_F(http2_server_test, static_route)
+{
+	static const std::string body{"OK"};
+	std::unique_ptr<Connection>  c = start_client();
+	Connection* cnx =  c.get();
+	cnx->test = this;
+
+	auto routes = std::make_shared<http::static_routes>();
+	http::http_response status;
+	status.status(200);
+	status.header("content-type", "text/plain");
+	routes->add(HTTP_GET, "/status", std::move(status), body);
+	_handler->use_static_routes(routes);
+	bool user_called{false};
+	_handler->on_request([&user_called](auto conn, auto req, auto res) { user_called = true; });
+
+	auto keep_alive = std::make_unique<boost::asio::io_service::work>(mock_connector->io_service());
+	bool terminated{false};
+	std::function<void()> io_poll;
+	io_poll = [&io_poll, &keep_alive, cnx, &terminated, this]
+	{
+		if (nghttp2_session_want_read(cnx->session) ||
+			nghttp2_session_want_write(cnx->session))
+		{
+			exec_io( cnx );
+			mock_connector->read( request_raw );
+			request_raw = "";
+			mock_connector->io_service().post(io_poll);
+		}
+		else
+		{
+			terminated = true;
+			keep_alive.reset();
+		}
+	};
+	mock_connector->io_service().post([this, &terminated, cnx, &io_poll]()
+	{
+		Request req;
+		Request* greq = &req;
+		greq->path = "/status?probe=1";
+		greq->stream_id = -1;
+		greq->hostport = "80";
+
+		submit_settings(cnx);
+
+		submit_request(cnx, greq);
+
+		io_poll();
+	});
+	mock_connector->io_service().run();
+	nghttp2_session_del( cnx->session );
+
+	ASSERT_TRUE( terminated );
+	EXPECT_FALSE( user_called );
+	EXPECT_EQ( http2_server_test::stream_terminated, 1 );
+	EXPECT_EQ( http2_server_test::closing_error_code, NGHTTP2_NO_ERROR );
+	EXPECT_EQ( http2_server_test::data_recv_v[1], body );
+	EXPECT_EQ( http2_server_test::header_recv_v[1].find(":status")->second, std::string{"200"} );
+	EXPECT_EQ( http2_server_test::header_recv_v[1].find("content-length")->second, std::to_string(body.size()) );
+	EXPECT_EQ( http2_server_test::header_recv_v[1].find("content-type")->second, "text/plain" );
+	EXPECT_EQ( http2_server_test::header_recv_v[1].count("connection"), 0U );
+}
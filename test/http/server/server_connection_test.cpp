@@ -1,6 +1,10 @@
 #include "../src/http/server/server_connection.h"
 #include "../src/protocol/handler_http1.h"
 #include "../src/http/server/server_traits.h"
+#include "../src/http/server/static_routes.h"
+#include "../src/filters/filter_chain.h"
+#include "../src/routing/router.h"
+#include "../src/network/concurrency_limiter.h"
 #include "mocks/mock_connector/mock_connector.h"
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -592,3 +596,267 @@ TEST_F(server_connection_test, http10_pipelining)
 	ASSERT_TRUE(terminated);
 	ASSERT_TRUE(response.find("connection: close\r\n") != std::string::npos);
 }
+
+
+TEST_F(server_connection_test, static_routes)
+{
+	auto routes = std::make_shared<http::static_routes>();
+	http::http_response status;
+	status.status(200);
+	status.header("content-type", "text/plain");
+	routes->add(HTTP_GET, "/status", std::move(status), "OK");
+	_handler->use_static_routes(routes);
+	_handler->set_persistent(true);
+
+	size_t requests{0};
+	_handler->on_request([&requests](auto conn, auto req, auto res) {
+		++requests;
+		req->on_finished([res](auto req) {
+			http::http_response r;
+			r.protocol(http::proto_version::HTTP11);
+			r.status(404);
+			r.keepalive(true);
+			r.content_len(0);
+			res->headers(std::move(r));
+			res->end();
+		});
+	});
+
+	std::string ok = "HTTP/1.1 200 OK\r\n"
+			"connection: keep-alive\r\n"
+			"content-length: 2\r\n"
+			"content-type: text/plain\r\n"
+			"\r\n";
+	std::string not_found = "HTTP/1.1 404 Not Found\r\n"
+			"connection: keep-alive\r\n"
+			"content-length: 0\r\n"
+			"\r\n";
+	std::string expected_response = ok + "OK" + not_found + ok + not_found +
+			"HTTP/1.1 200 OK\r\n"
+			"connection: close\r\n"
+			"content-length: 2\r\n"
+			"content-type: text/plain\r\n"
+			"\r\n"
+			"OK";
+
+	_write_cb = [this](std::string chunk) {
+		response.append(chunk);
+	};
+
+	mock_connector->io_service().post([this]()
+	{
+		// the body of the first one is discarded; the ones after the user's wait for their turn
+		mock_connector->read("GET /status HTTP/1.1\r\n"
+				"content-length: 4\r\n"
+				"\r\n"
+				"ping"
+				"POST /status HTTP/1.1\r\n"
+				"content-length: 0\r\n"
+				"\r\n"
+				"HEAD /status?probe=1 HTTP/1.1\r\n"
+				"\r\n"
+				"GET /other HTTP/1.1\r\n"
+				"\r\n"
+				"GET /status HTTP/1.1\r\n"
+				"connection: close\r\n"
+				"\r\n");
+	});
+
+	mock_connector->io_service().run();
+	ASSERT_EQ(requests, 2U);
+	ASSERT_EQ(response, expected_response);
+	ASSERT_TRUE(_handler->should_stop());
+}
+
+
+TEST_F(server_connection_test, filtered_routes)
+{
+	routing::router router;
+	router.add(routing::method_bit(HTTP_GET), "/items/{id}", [](auto conn, auto req, auto res, const routing::match& m) {
+		auto id = m["id"].to_string();
+		http::http_response r;
+		r.protocol(http::proto_version::HTTP11);
+		r.status(200);
+		r.keepalive(true);
+		r.content_len(id.size());
+		res->headers(std::move(r));
+		res->body(make_data_ptr(id), id.size());
+		res->end();
+	});
+
+	filters::response_headers headers;
+	headers.add("x-frame-options", "DENY");
+	auto chain = std::make_shared<filters::chain<filters::response_headers>>(std::move(headers));
+	_handler->on_request(filters::filtered(chain, [router](auto conn, auto req, auto res) {
+		router.route(std::move(conn), std::move(req), std::move(res));
+	}));
+	_handler->set_persistent(true);
+
+	std::string expected_response = "HTTP/1.1 200 OK\r\n"
+			"connection: keep-alive\r\n"
+			"content-length: 2\r\n"
+			"x-frame-options: DENY\r\n"
+			"\r\n"
+			"42"
+			"HTTP/1.1 404 Not Found\r\n"
+			"connection: close\r\n"
+			"content-length: 0\r\n"
+			"x-frame-options: DENY\r\n"
+			"\r\n";
+
+	_write_cb = [this](std::string chunk) {
+		response.append(chunk);
+	};
+
+	mock_connector->io_service().post([this]()
+	{
+		mock_connector->read("GET /items/42 HTTP/1.1\r\n"
+				"\r\n"
+				"GET /nowhere HTTP/1.1\r\n"
+				"connection: close\r\n"
+				"\r\n");
+	});
+
+	mock_connector->io_service().run();
+	ASSERT_EQ(response, expected_response);
+}
+
+
+TEST_F(server_connection_test, filtered_prepared_responses)
+{
+	http::http_response busy;
+	busy.status(503);
+	auto prepared = std::make_shared<const http::prepared_response>(std::move(busy), "busy");
+
+	filters::response_headers headers;
+	headers.add("x-frame-options", "DENY");
+	auto chain = std::make_shared<filters::chain<filters::response_headers>>(std::move(headers));
+	_handler->on_request(filters::filtered(chain, [prepared](auto conn, auto req, auto res) {
+		res->send(prepared, req->preamble());
+	}));
+	_handler->set_persistent(true);
+
+	std::string expected_response = "HTTP/1.1 503 Service Unavailable\r\n"
+			"connection: keep-alive\r\n"
+			"content-length: 4\r\n"
+			"x-frame-options: DENY\r\n"
+			"\r\n"
+			"busy"
+			"HTTP/1.1 503 Service Unavailable\r\n"
+			"connection: close\r\n"
+			"content-length: 4\r\n"
+			"x-frame-options: DENY\r\n"
+			"\r\n"
+			"busy";
+
+	_write_cb = [this](std::string chunk) {
+		response.append(chunk);
+	};
+
+	mock_connector->io_service().post([this]()
+	{
+		mock_connector->read("GET /items/42 HTTP/1.1\r\n"
+				"\r\n"
+				"GET /items/43 HTTP/1.1\r\n"
+				"connection: close\r\n"
+				"\r\n");
+	});
+
+	mock_connector->io_service().run();
+	ASSERT_EQ(response, expected_response);
+}
+
+
+TEST_F(server_connection_test, blocks_are_written_as_they_are)
+{
+	auto shared = std::make_shared<const std::string>("client, ");
+	std::weak_ptr<const std::string> weak = shared;
+	_handler->on_request([weak](auto conn, auto req, auto res) {
+		req->on_finished([res, weak](auto req) {
+			auto shared = weak.lock();
+			http::http_response r;
+			r.protocol(http::proto_version::HTTP11);
+			r.status(200);
+			r.keepalive(false);
+			r.chunked(true);
+			res->headers(std::move(r));
+			res->body(make_data_ptr("Ave "), 4);
+			res->block(http::shared_block{shared, shared->data(), shared->size()});
+			res->body(make_data_ptr("hello"), 5);
+			res->end();
+		});
+	});
+
+	_write_cb = [this](std::string chunk) {
+		response.append(chunk);
+	};
+
+	mock_connector->io_service().post([this]() {
+		mock_connector->read("GET / HTTP/1.1\r\n"
+				"connection: close\r\n"
+				"\r\n");
+	});
+	mock_connector->io_service().run();
+
+	// framed as the rest of the body
+	auto body = response.find("\r\n\r\n");
+	ASSERT_NE(body, std::string::npos);
+	ASSERT_EQ(response.substr(body + 4), "4\r\nAve \r\n8\r\nclient, \r\n5\r\nhello\r\n0\r\n\r\n");
+	// nobody but us keeps the bytes once written
+	ASSERT_EQ(shared.use_count(), 1);
+}
+
+
+TEST_F(server_connection_test, overload_shedding)
+{
+	network::concurrency_limiter::settings settings;
+	settings.initial_limit = settings.min_limit = settings.max_limit = 1;
+	auto limiter = std::make_shared<network::concurrency_limiter>(settings);
+	http::http_response unavailable;
+	unavailable.status(503);
+	_handler->use_concurrency_limiter(limiter, std::make_shared<const http::prepared_response>(std::move(unavailable), ""));
+	_handler->set_persistent(true);
+
+	size_t requests{0};
+	_handler->on_request([&requests](auto conn, auto req, auto res) {
+		++requests;
+		req->on_finished([res](auto req) {
+			http::http_response r;
+			r.protocol(http::proto_version::HTTP11);
+			r.status(200);
+			r.keepalive(true);
+			r.content_len(0);
+			res->headers(std::move(r));
+			res->end();
+		});
+	});
+
+	// the second comes while the first is being served
+	std::string expected_response = "HTTP/1.1 200 OK\r\n"
+			"connection: keep-alive\r\n"
+			"content-length: 0\r\n"
+			"\r\n"
+			"HTTP/1.1 503 Service Unavailable\r\n"
+			"connection: close\r\n"
+			"content-length: 0\r\n"
+			"\r\n";
+
+	_write_cb = [this](std::string chunk) {
+		response.append(chunk);
+	};
+
+	mock_connector->io_service().post([this]()
+	{
+		mock_connector->read("GET /a HTTP/1.1\r\n"
+				"\r\n"
+				"GET /b HTTP/1.1\r\n"
+				"connection: close\r\n"
+				"\r\n");
+	});
+
+	mock_connector->io_service().run();
+	ASSERT_EQ(requests, 1U);
+	ASSERT_EQ(response, expected_response);
+	ASSERT_EQ(limiter->in_flight(), 0U);
+	ASSERT_EQ(limiter->shed(), 1U);
+}
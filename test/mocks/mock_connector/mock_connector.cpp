@@ -15,6 +15,14 @@ void MockConnector::do_write()
 {
 	std::string chunk;
 	_handler->on_write(chunk);
+	// blocks are written as they are, along with what comes after them
+	while(auto b = _handler->block_to_send())
+	{
+		chunk.append(b->data, b->size);
+		_handler->block_sent();
+		std::string after;
+		if(_handler->on_write(after)) chunk.append(after);
+	}
 	write_cb(chunk);
 	auto all_cbs = _handler->write_feedbacks();
 	for(auto &cb : all_cbs)
@@ -50,6 +58,16 @@ boost::asio::io_service& MockConnector::io_service()
 void MockConnector::start(bool)
 {}
 
+void MockConnector::pause_read()
+{
+	paused = true;
+}
+
+void MockConnector::resume_read()
+{
+	paused = false;
+}
+
 void MockConnector::read(std::string request)
 {
 	_handler->on_read(request.data(), request.size());
@@ -20,6 +20,8 @@ struct MockConnector : server::connector_interface, std::enable_shared_from_this
 	void set_timeout(std::chrono::milliseconds) override;
 	void handler(std::shared_ptr<server::http_handler>) override;
 	void start(bool) override;
+	void pause_read() override;
+	void resume_read() override;
 	void read(std::string request);
 
 	boost::asio::io_service &io;
@@ -27,4 +29,5 @@ struct MockConnector : server::connector_interface, std::enable_shared_from_this
 	std::shared_ptr<server::http_handler> _handler;
 	
 	bool die{false};
+	bool paused{false};
 };
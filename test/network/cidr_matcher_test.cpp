@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+#include "src/network/cidr_matcher.h"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+
+bool allowed(const network::cidr_matcher& m, const std::string& address)
+{
+	return m.allowed(boost::asio::ip::address::from_string(address));
+}
+
+using rule = network::cidr_matcher::rule;
+
+}
+
+TEST(cidr_matcher, parses_blocks)
+{
+	auto r = network::cidr_matcher::parse("10.1.2.3/8");
+	EXPECT_EQ(r.network.to_string(), "10.1.2.3");
+	EXPECT_EQ(r.length, 8U);
+	EXPECT_TRUE(r.allow);
+	EXPECT_EQ(network::cidr_matcher::parse("2001:db8::1", false).length, 128U);
+	EXPECT_EQ(network::cidr_matcher::parse("192.168.0.1").length, 32U);
+
+	EXPECT_THROW(network::cidr_matcher::parse("10.0.0.0/33"), std::invalid_argument);
+	EXPECT_THROW(network::cidr_matcher::parse("2001:db8::/129"), std::invalid_argument);
+	EXPECT_THROW(network::cidr_matcher::parse("10.0.0.0/"), std::invalid_argument);
+	EXPECT_THROW(network::cidr_matcher::parse("10.0.0.0/-1"), std::invalid_argument);
+	EXPECT_THROW(network::cidr_matcher::parse("10.0.0/8"), std::invalid_argument);
+	EXPECT_THROW(network::cidr_matcher::parse("localhost"), std::invalid_argument);
+}
+
+TEST(cidr_matcher, longest_prefix_wins)
+{
+	network::cidr_matcher m{{
+		network::cidr_matcher::parse("10.0.0.0/8"),
+		network::cidr_matcher::parse("10.1.0.0/16", false),
+		network::cidr_matcher::parse("10.1.2.0/24"),
+		network::cidr_matcher::parse("10.1.2.3/32", false),
+		network::cidr_matcher::parse("2001:db8::/32"),
+		network::cidr_matcher::parse("2001:db8:dead::/48", false),
+	}, false};
+
+	EXPECT_TRUE(allowed(m, "10.200.0.1"));
+	EXPECT_FALSE(allowed(m, "10.1.200.1"));
+	EXPECT_TRUE(allowed(m, "10.1.2.4"));
+	EXPECT_FALSE(allowed(m, "10.1.2.3"));
+	EXPECT_FALSE(allowed(m, "11.0.0.1"));
+	EXPECT_FALSE(allowed(m, "9.255.255.255"));
+
+	EXPECT_TRUE(allowed(m, "2001:db8:beef::1"));
+	EXPECT_FALSE(allowed(m, "2001:db8:dead::1"));
+	EXPECT_FALSE(allowed(m, "2001:db9::1"));
+	// IPv4 addresses of dual-stack sockets
+	EXPECT_TRUE(allowed(m, "::ffff:10.0.0.1"));
+	EXPECT_FALSE(allowed(m, "::ffff:10.1.2.3"));
+}
+
+TEST(cidr_matcher, defaults_and_whole_spaces)
+{
+	network::cidr_matcher deny_some{{network::cidr_matcher::parse("192.168.0.0/16", false)}, true};
+	EXPECT_TRUE(allowed(deny_some, "8.8.8.8"));
+	EXPECT_TRUE(allowed(deny_some, "::1"));
+	EXPECT_FALSE(allowed(deny_some, "192.168.1.1"));
+
+	network::cidr_matcher v4_only{{network::cidr_matcher::parse("0.0.0.0/0"),
+		network::cidr_matcher::parse("::/0", false)}, true};
+	EXPECT_TRUE(allowed(v4_only, "1.2.3.4"));
+	EXPECT_FALSE(allowed(v4_only, "2001:db8::1"));
+
+	// the later rule for a block wins
+	network::cidr_matcher repeated{{network::cidr_matcher::parse("1.0.0.0/8"),
+		network::cidr_matcher::parse("1.2.3.4/8", false)}, true};
+	EXPECT_FALSE(allowed(repeated, "1.9.9.9"));
+}
+
+TEST(cidr_matcher, agrees_with_a_linear_scan)
+{
+	std::mt19937 rng{11};
+	std::vector<rule> rules;
+	for(int i = 0; i < 2000; ++i)
+	{
+		// a narrow space, so that blocks nest and overlap
+		boost::asio::ip::address_v4 a{static_cast<uint32_t>((10u << 24) | (rng() & 0xffff))};
+		rules.push_back(rule{a, static_cast<uint8_t>(16 + rng() % 17), rng() % 2 == 0});
+	}
+	network::cidr_matcher m{rules, false};
+
+	for(int i = 0; i < 5000; ++i)
+	{
+		boost::asio::ip::address_v4 a{static_cast<uint32_t>((10u << 24) | (rng() & 0xffff))};
+		int best = -1;
+		bool expected = false;
+		for(const auto& r : rules)
+		{
+			uint32_t mask = r.length ? ~uint32_t{0} << (32 - r.length) : 0;
+			if((r.network.to_v4().to_ulong() & mask) == (a.to_ulong() & mask) && r.length >= best)
+			{
+				best = r.length;
+				expected = r.allow;
+			}
+		}
+		ASSERT_EQ(m.allowed(a), expected) << a.to_string();
+	}
+}
+
+TEST(cidr_matcher, agrees_with_a_linear_scan_on_ipv6)
+{
+	auto address = [](uint32_t bits)
+	{
+		// 2001:db8:XXXX:YY00::, so that the blocks share their first 32 bits
+		boost::asio::ip::address_v6::bytes_type bytes{{0x20, 0x01, 0x0d, 0xb8,
+			static_cast<uint8_t>(bits >> 16), static_cast<uint8_t>(bits >> 8), static_cast<uint8_t>(bits)}};
+		return boost::asio::ip::address_v6{bytes};
+	};
+	auto prefix = [](const boost::asio::ip::address_v6& a)
+	{
+		auto b = a.to_bytes();
+		return (uint64_t{b[0]} << 56) | (uint64_t{b[1]} << 48) | (uint64_t{b[2]} << 40) | (uint64_t{b[3]} << 32) |
+			(uint64_t{b[4]} << 24) | (uint64_t{b[5]} << 16) | (uint64_t{b[6]} << 8) | b[7];
+	};
+
+	std::mt19937 rng{13};
+	std::vector<rule> rules;
+	for(int i = 0; i < 2000; ++i)
+		rules.push_back(rule{address(rng() & 0xffffff), static_cast<uint8_t>(32 + rng() % 25), rng() % 2 == 0});
+	network::cidr_matcher m{rules, true};
+
+	for(int i = 0; i < 5000; ++i)
+	{
+		auto a = address(rng() & 0xffffff);
+		int best = -1;
+		bool expected = true;
+		for(const auto& r : rules)
+		{
+			uint64_t mask = ~uint64_t{0} << (64 - r.length);
+			if((prefix(r.network.to_v6()) & mask) == (prefix(a) & mask) && r.length >= best)
+			{
+				best = r.length;
+				expected = r.allow;
+			}
+		}
+		ASSERT_EQ(m.allowed(a), expected) << a.to_string();
+	}
+}
+
+TEST(cidr_matcher, loads_rule_files)
+{
+	auto file = std::string{"/tmp/doormat_cidr_test"};
+	std::ofstream{file} << "# privileged\n"
+		"allow 127.0.0.1/24\n"
+		"\n"
+		"allow 2001:db8::/32\n"
+		"deny 127.0.0.13\n";
+	auto m = network::cidr_matcher::from_file(file);
+	EXPECT_TRUE(allowed(m, "127.0.0.200"));
+	EXPECT_FALSE(allowed(m, "127.0.0.13"));
+	EXPECT_TRUE(allowed(m, "2001:db8::1"));
+	// rules allowing some: the others are kept out
+	EXPECT_FALSE(allowed(m, "127.0.1.1"));
+
+	std::ofstream{file} << "deny 10.0.0.0/8\n";
+	auto d = network::cidr_matcher::from_file(file);
+	EXPECT_FALSE(allowed(d, "10.0.0.1"));
+	EXPECT_TRUE(allowed(d, "11.0.0.1"));
+
+	std::ofstream{file} << "allow 10.0.0.0/8 extra\n";
+	EXPECT_THROW(network::cidr_matcher::from_file(file), std::runtime_error);
+	std::ofstream{file} << "permit 10.0.0.0/8\n";
+	EXPECT_THROW(network::cidr_matcher::from_file(file), std::runtime_error);
+	std::ofstream{file} << "allow 2a01:84a0:1001:a001:0:0:1:1/1024\n";
+	EXPECT_THROW(network::cidr_matcher::from_file(file), std::runtime_error);
+	std::remove(file.c_str());
+	EXPECT_THROW(network::cidr_matcher::from_file(file), std::runtime_error);
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include "src/network/concurrency_limiter.h"
+
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+network::concurrency_limiter::settings small()
+{
+	network::concurrency_limiter::settings s;
+	s.initial_limit = 4;
+	s.min_limit = 2;
+	s.max_limit = 8;
+	s.latency_target = std::chrono::nanoseconds{0};
+	s.backoff = 0.5;
+	return s;
+}
+
+}
+
+TEST(concurrency_limiter, requests_beyond_the_limit_are_shed)
+{
+	auto limiter = std::make_shared<network::concurrency_limiter>(small());
+	std::vector<network::concurrency_limiter::permit> permits;
+	for(int i = 0; i < 4; ++i)
+	{
+		permits.push_back(limiter->acquire());
+		ASSERT_TRUE(permits.back());
+	}
+	EXPECT_FALSE(limiter->acquire());
+	EXPECT_EQ(limiter->in_flight(), 4U);
+	EXPECT_EQ(limiter->shed(), 1U);
+
+	permits.pop_back();
+	EXPECT_EQ(limiter->in_flight(), 3U);
+	EXPECT_TRUE(limiter->acquire());
+
+	auto s = small();
+	s.min_limit = 0;
+	EXPECT_THROW(network::concurrency_limiter{s}, std::invalid_argument);
+	s = small();
+	s.backoff = 1;
+	EXPECT_THROW(network::concurrency_limiter{s}, std::invalid_argument);
+}
+
+TEST(concurrency_limiter, limit_grows_while_used_and_in_time)
+{
+	auto limiter = std::make_shared<network::concurrency_limiter>(small());
+	// a limit nobody comes close to stays
+	for(int i = 0; i < 100; ++i) limiter->on_latency(std::chrono::milliseconds{1}, 1);
+	EXPECT_EQ(limiter->limit(), 4U);
+
+	// one more every limit requests
+	for(int i = 0; i < 4; ++i) limiter->on_latency(std::chrono::milliseconds{1}, 4);
+	EXPECT_EQ(limiter->limit(), 4U);
+	limiter->on_latency(std::chrono::milliseconds{1}, 4);
+	EXPECT_EQ(limiter->limit(), 5U);
+
+	for(int i = 0; i < 1000; ++i) limiter->on_latency(std::chrono::milliseconds{1}, 8);
+	EXPECT_EQ(limiter->limit(), 8U);
+}
+
+TEST(concurrency_limiter, limit_shrinks_when_late)
+{
+	auto s = small();
+	s.initial_limit = 8;
+	s.latency_target = std::chrono::milliseconds{100};
+	auto limiter = std::make_shared<network::concurrency_limiter>(s);
+	auto now = network::concurrency_limiter::clock::now();
+
+	limiter->on_lag(std::chrono::milliseconds{1}, now);
+	EXPECT_EQ(limiter->limit(), 8U);
+	limiter->on_lag(std::chrono::milliseconds{50}, now);
+	EXPECT_EQ(limiter->limit(), 4U);
+	// a stall makes many late samples, which count once
+	limiter->on_latency(std::chrono::seconds{1}, 4, now + std::chrono::milliseconds{10});
+	limiter->on_lag(std::chrono::milliseconds{50}, now + std::chrono::milliseconds{20});
+	EXPECT_EQ(limiter->limit(), 4U);
+
+	limiter->on_latency(std::chrono::seconds{1}, 4, now + std::chrono::milliseconds{200});
+	EXPECT_EQ(limiter->limit(), 2U);
+	limiter->on_lag(std::chrono::milliseconds{50}, now + std::chrono::milliseconds{400});
+	EXPECT_EQ(limiter->limit(), 2U);
+}
+
+TEST(concurrency_limiter, lag_probe_measures_the_io_service)
+{
+	boost::asio::io_service io;
+	auto s = small();
+	s.lag_target = std::chrono::milliseconds{1};
+	auto limiter = std::make_shared<network::concurrency_limiter>(s);
+	auto probe = std::make_shared<network::lag_probe>(io, limiter, std::chrono::milliseconds{1});
+	probe->start();
+
+	// handlers hogging the io_service, one after the other, delay the probe's
+	std::function<void(int)> hog = [&io, &hog, probe](int left)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds{5});
+		if(left) io.post([&hog, left]() { hog(left - 1); });
+		else probe->stop();
+	};
+	io.post([&hog]() { hog(10); });
+	io.run();
+
+	EXPECT_GE(probe->last(), std::chrono::milliseconds{1});
+	EXPECT_EQ(limiter->limit(), 2U);
+}
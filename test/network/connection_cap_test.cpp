@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include "src/network/connection_cap.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST(connection_cap, slots_are_given_back_with_their_last_copy)
+{
+	auto cap = std::make_shared<network::connection_cap>(2);
+	auto a = cap->acquire();
+	auto b = cap->acquire();
+	ASSERT_TRUE(a);
+	ASSERT_TRUE(b);
+	EXPECT_FALSE(cap->acquire());
+	EXPECT_EQ(cap->size(), 2U);
+
+	auto copy = a;
+	a.reset();
+	EXPECT_EQ(cap->size(), 2U);
+	copy.reset();
+	EXPECT_EQ(cap->size(), 1U);
+	EXPECT_TRUE(cap->acquire());
+	EXPECT_EQ(cap->size(), 1U);
+
+	EXPECT_THROW(network::connection_cap{0}, std::invalid_argument);
+}
+
+TEST(connection_cap, waiters_resume_once_a_slot_is_back)
+{
+	auto cap = std::make_shared<network::connection_cap>(1);
+	auto held = cap->acquire();
+	int resumed{0};
+	EXPECT_FALSE(cap->acquire([&resumed]() { ++resumed; }));
+	EXPECT_FALSE(cap->acquire([&resumed]() { ++resumed; }));
+	EXPECT_EQ(resumed, 0);
+
+	held.reset();
+	EXPECT_EQ(resumed, 2);
+	// once
+	auto again = cap->acquire();
+	again.reset();
+	EXPECT_EQ(resumed, 2);
+}
+
+TEST(connection_cap, threads_never_go_beyond_the_cap)
+{
+	auto cap = std::make_shared<network::connection_cap>(3);
+	std::atomic<std::size_t> most{0};
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t)
+		threads.emplace_back([cap, &most]()
+		{
+			for(int i = 0; i < 10000; ++i)
+				if(auto s = cap->acquire([]() {}))
+				{
+					auto now = cap->size();
+					auto seen = most.load();
+					while(now > seen && !most.compare_exchange_weak(seen, now));
+				}
+		});
+	for(auto& t : threads) t.join();
+	EXPECT_LE(most.load(), 3U);
+	EXPECT_EQ(cap->size(), 0U);
+}
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+#include "src/network/early_data.h"
+#include "src/utils/sni_solver.h"
+#include "src/utils/tls_sessions.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+#ifdef SSL_READ_EARLY_DATA_SUCCESS
+
+namespace
+{
+
+using session_ptr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+const std::string request{"GET / HTTP/1.1\r\nhost: localhost\r\n\r\n"};
+const std::string answer{"HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok"};
+
+/** A server answering one request per connection, reading early data if the client sends it. */
+struct server
+{
+	boost::asio::io_service io;
+	ssl_utils::session_cache cache;
+	boost::asio::ssl::context ctx{boost::asio::ssl::context::sslv23_server};
+	boost::asio::ip::tcp::acceptor acceptor{io, {boost::asio::ip::address_v4::loopback(), 0}};
+
+	std::shared_ptr<network::early_data::ssl_socket> socket;
+	std::shared_ptr<network::early_data> reading;
+	std::array<char, 4096> chunk;
+	std::string received;
+	/** Set if the request came as early data */
+	bool early{false};
+
+	server()
+	{
+		static const std::string password = []()
+		{
+			std::ifstream in{"etc/doormat/certificates/npn1/keypass"};
+			std::string p;
+			std::getline(in, p);
+			return p;
+		}();
+		ssl_utils::tls_settings settings;
+		settings.max_early_data = 16384;
+		auto c = ctx.native_handle();
+		EXPECT_TRUE(ssl_utils::configure_tls_context(c, settings));
+		// the test certificate is signed with SHA-1
+		SSL_CTX_set_security_level(c, 0);
+		ctx.set_password_callback([](std::size_t, boost::asio::ssl::context::password_purpose) { return password; });
+		EXPECT_EQ(SSL_CTX_use_certificate_chain_file(c, "etc/doormat/certificates/npn1/newcert.pem"), 1);
+		EXPECT_EQ(SSL_CTX_use_PrivateKey_file(c, "etc/doormat/certificates/npn1/newkey.pem", SSL_FILETYPE_PEM), 1);
+		cache.attach(c);
+	}
+
+	uint16_t port() const { return acceptor.local_endpoint().port(); }
+
+	/** \brief accepts a connection, answers its request and waits for the client to leave. */
+	void serve()
+	{
+		socket = std::make_shared<network::early_data::ssl_socket>(io, ctx);
+		received.clear();
+		early = false;
+		acceptor.async_accept(socket->lowest_layer(), [this](const boost::system::error_code& ec)
+		{
+			ASSERT_FALSE(ec);
+			reading = std::make_shared<network::early_data>(socket);
+			reading->async_handshake([this](const boost::system::error_code& ec)
+			{
+				ASSERT_FALSE(ec);
+				read([this]()
+				{
+					write([this]() { read([]() {}); });
+				});
+			});
+		});
+		io.run();
+		io.reset();
+		reading.reset();
+		socket.reset();
+	}
+
+	/** \brief reads as the connector does: through the handshake while it goes on, from the stream afterwards. */
+	void read(std::function<void()> then)
+	{
+		auto on_read = [this, then](const boost::system::error_code& ec, std::size_t bytes)
+		{
+			if(ec)
+			{
+				// as the connector stops: the session stays in the cache
+				SSL_set_quiet_shutdown(socket->native_handle(), 1);
+				SSL_shutdown(socket->native_handle());
+				return;
+			}
+			if(!bytes) return read(then);
+			if(reading->early()) early = true;
+			received.append(chunk.data(), bytes);
+			if(received.find("\r\n\r\n") == std::string::npos) return read(then);
+			then();
+		};
+		if(reading->active())
+			reading->async_read_some(boost::asio::buffer(chunk), on_read);
+		else
+			socket->async_read_some(boost::asio::buffer(chunk), on_read);
+	}
+
+	void write(std::function<void()> then)
+	{
+		auto on_write = [then](const boost::system::error_code& ec, std::size_t) { if(!ec) then(); };
+		if(reading->active())
+			reading->async_write(boost::asio::buffer(answer), on_write);
+		else
+			boost::asio::async_write(*socket, boost::asio::buffer(answer), on_write);
+	}
+};
+
+/** \brief fetches the answer, with early data if the session allows it.
+ * \returns the session the client ends up with
+ * */
+session_ptr fetch(uint16_t port, SSL_SESSION* session, int& status, std::string& got)
+{
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+	SSL_CTX_set_security_level(ctx, 0);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+	SSL* ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	if(session)
+	{
+		SSL_set_session(ssl, session);
+		std::size_t written{0};
+		if(SSL_SESSION_get_max_early_data(session))
+		{
+			EXPECT_EQ(SSL_write_early_data(ssl, request.data(), request.size(), &written), 1);
+		}
+	}
+	EXPECT_EQ(SSL_connect(ssl), 1);
+	status = SSL_get_early_data_status(ssl);
+	// the request is sent again, after the handshake, if the server turned its early data down
+	if(status != SSL_EARLY_DATA_ACCEPTED)
+	{
+		EXPECT_EQ(SSL_write(ssl, request.data(), static_cast<int>(request.size())), static_cast<int>(request.size()));
+	}
+	char buffer[4096];
+	while(got.size() < answer.size())
+	{
+		auto n = SSL_read(ssl, buffer, sizeof(buffer));
+		if(n <= 0) break;
+		got.append(buffer, static_cast<std::size_t>(n));
+	}
+	session_ptr resumable{SSL_get1_session(ssl), SSL_SESSION_free};
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	close(fd);
+	SSL_CTX_free(ctx);
+	return resumable;
+}
+
+/** \brief runs a connection of the client against the server. */
+session_ptr connection(server& s, SSL_SESSION* session, int& status)
+{
+	session_ptr got{nullptr, SSL_SESSION_free};
+	std::string response;
+	std::thread client{[&]() { got = fetch(s.port(), session, status, response); }};
+	s.serve();
+	client.join();
+	EXPECT_EQ(response, answer);
+	EXPECT_EQ(s.received, request);
+	return got;
+}
+
+}
+
+TEST(early_data, read_once_and_answered_before_the_handshake_is_over)
+{
+	server s;
+	int status{0};
+	auto first = connection(s, nullptr, status);
+	ASSERT_FALSE(s.early);
+	ASSERT_TRUE(first);
+	ASSERT_EQ(SSL_SESSION_get_max_early_data(first.get()), 16384U);
+
+	// the request comes with the first flight of the client, the answer before its Finished
+	connection(s, first.get(), status);
+	ASSERT_EQ(status, SSL_EARLY_DATA_ACCEPTED);
+	ASSERT_TRUE(s.early);
+
+	// the session was taken once: early data sent with it again, as a replay would, is not read
+	connection(s, first.get(), status);
+	ASSERT_EQ(status, SSL_EARLY_DATA_REJECTED);
+	ASSERT_FALSE(s.early);
+}
+
+TEST(early_data, off_by_default)
+{
+	ssl_utils::tls_settings settings;
+	ASSERT_EQ(settings.max_early_data, 0U);
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+	ASSERT_TRUE(ssl_utils::configure_tls_context(ctx, settings));
+	ASSERT_EQ(SSL_CTX_get_max_early_data(ctx), 0U);
+	SSL_CTX_free(ctx);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "src/network/handshake_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+TEST(handshake_pool, jobs_run_on_the_threads_of_the_pool)
+{
+	network::handshake_pool pool{2};
+	EXPECT_EQ(pool.threads(), 2U);
+	std::mutex mutex;
+	std::condition_variable over;
+	int runs{0};
+	bool elsewhere{true};
+	const auto caller = std::this_thread::get_id();
+	for(int i = 0; i < 10; ++i)
+		ASSERT_TRUE(pool.submit([&]()
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			elsewhere = elsewhere && std::this_thread::get_id() != caller;
+			++runs;
+			over.notify_one();
+		}));
+	std::unique_lock<std::mutex> lock{mutex};
+	ASSERT_TRUE(over.wait_for(lock, std::chrono::seconds{5}, [&]() { return runs == 10; }));
+	EXPECT_TRUE(elsewhere);
+	EXPECT_EQ(pool.rejected(), 0U);
+}
+
+TEST(handshake_pool, a_full_queue_refuses_jobs)
+{
+	std::atomic<bool> release{false};
+	std::atomic<int> runs{0};
+	{
+		network::handshake_pool pool{1, 2};
+		auto blocking = [&]()
+		{
+			while(!release.load()) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+			++runs;
+		};
+		ASSERT_TRUE(pool.submit(blocking));
+		// the first job leaves the queue once the thread takes it
+		while(pool.queued()) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		ASSERT_TRUE(pool.submit(blocking));
+		ASSERT_TRUE(pool.submit(blocking));
+		ASSERT_FALSE(pool.submit(blocking));
+		EXPECT_EQ(pool.queued(), 2U);
+		EXPECT_EQ(pool.rejected(), 1U);
+		release = true;
+		while(pool.completed() < 3) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+	}
+	EXPECT_EQ(runs.load(), 3);
+}
+
+TEST(handshake_pool, queued_jobs_are_dropped_on_destruction)
+{
+	std::atomic<bool> release{false};
+	std::atomic<int> runs{0};
+	auto dropped = std::make_shared<int>(0);
+	std::thread releaser;
+	{
+		network::handshake_pool pool{1};
+		ASSERT_TRUE(pool.submit([&]()
+		{
+			while(!release.load()) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+			++runs;
+		}));
+		while(pool.queued()) std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		ASSERT_TRUE(pool.submit([&runs, dropped]() { ++runs; }));
+		EXPECT_EQ(dropped.use_count(), 2);
+		releaser = std::thread{[&]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds{20});
+			release = true;
+		}};
+	}
+	releaser.join();
+	// the running job was waited for, the queued one let go
+	EXPECT_EQ(runs.load(), 1);
+	EXPECT_EQ(dropped.use_count(), 1);
+}
+
+TEST(handshake_pool, invalid)
+{
+	EXPECT_THROW(network::handshake_pool{0}, std::invalid_argument);
+	EXPECT_THROW((network::handshake_pool{1, 0}), std::invalid_argument);
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include "../../src/network/upstream_group.h"
+#include "../../src/network/health_checker.h"
+#include "../../src/network/communicator/dns_communicator_factory.h"
+#include "../mocks/mock_server/mock_server.h"
+
+namespace
+{
+
+using group_clock = network::upstream_group::clock;
+const auto port = 8454U;
+const auto timeout = std::chrono::milliseconds{100};
+
+std::vector<network::endpoint> make_endpoints(std::size_t n)
+{
+	std::vector<network::endpoint> endpoints;
+	for(std::size_t i = 0; i < n; ++i)
+		endpoints.push_back(network::endpoint{"127.0.0.1", static_cast<uint16_t>(port + i), false});
+	return endpoints;
+}
+
+network::health_policy make_policy(std::size_t max_fails)
+{
+	network::health_policy h;
+	h.max_fails = max_fails;
+	h.fail_timeout = std::chrono::seconds{10};
+	h.max_ejection = std::chrono::seconds{30};
+	return h;
+}
+
+void fail(network::upstream_group& group, std::size_t i, group_clock::time_point now)
+{
+	group.started(i);
+	group.completed(i, std::chrono::milliseconds{1}, false, now);
+}
+
+/** runs the io_service until the checker has had the time to probe once */
+void run_probes(boost::asio::io_service& io, std::shared_ptr<network::health_checker> checker)
+{
+	boost::asio::deadline_timer deadline{io};
+	deadline.expires_from_now(boost::posix_time::milliseconds(300));
+	deadline.async_wait([checker](auto) { checker->stop(); });
+	checker->start();
+	io.run();
+}
+
+}
+
+TEST(health, ejected_after_consecutive_failures)
+{
+	network::upstream_group group{make_endpoints(2), network::upstream_group::policy::round_robin, make_policy(3)};
+	auto now = group_clock::now();
+	fail(group, 0, now);
+	fail(group, 0, now);
+	ASSERT_TRUE(group.available(0, now));
+	fail(group, 0, now);
+	ASSERT_FALSE(group.available(0, now));
+	for(int i = 0; i < 4; ++i)
+		ASSERT_EQ(group.select({}, now), 1U);
+	// back after fail_timeout
+	ASSERT_TRUE(group.available(0, now + std::chrono::seconds{10}));
+}
+
+TEST(health, success_resets_failures)
+{
+	network::upstream_group group{make_endpoints(2), network::upstream_group::policy::round_robin, make_policy(2)};
+	auto now = group_clock::now();
+	fail(group, 0, now);
+	group.started(0);
+	group.completed(0, std::chrono::milliseconds{1}, true, now);
+	fail(group, 0, now);
+	ASSERT_TRUE(group.available(0, now));
+}
+
+TEST(health, exponential_backoff)
+{
+	network::upstream_group group{make_endpoints(2), network::upstream_group::policy::round_robin, make_policy(1)};
+	auto now = group_clock::now();
+	fail(group, 0, now);
+	now += std::chrono::seconds{10};
+	ASSERT_TRUE(group.available(0, now));
+	// failing right after the re-admission doubles the ejection
+	fail(group, 0, now);
+	ASSERT_FALSE(group.available(0, now + std::chrono::seconds{19}));
+	now += std::chrono::seconds{20};
+	ASSERT_TRUE(group.available(0, now));
+	// capped by max_ejection
+	fail(group, 0, now);
+	ASSERT_TRUE(group.available(0, now + std::chrono::seconds{30}));
+}
+
+TEST(health, every_endpoint_ejected)
+{
+	network::upstream_group group{make_endpoints(2), network::upstream_group::policy::least_outstanding, make_policy(1)};
+	auto now = group_clock::now();
+	fail(group, 0, now);
+	fail(group, 1, now);
+	// better trying than refusing everything
+	auto chosen = group.select({}, now);
+	ASSERT_LT(chosen, group.size());
+}
+
+TEST(health, ejection_moves_only_the_keys_of_the_endpoint)
+{
+	network::upstream_group group{make_endpoints(4), network::upstream_group::policy::consistent_hashing, make_policy(1)};
+	auto now = group_clock::now();
+	std::vector<std::size_t> before;
+	for(int i = 0; i < 200; ++i)
+		before.push_back(group.select("/k/" + std::to_string(i), now));
+	fail(group, 2, now);
+	for(int i = 0; i < 200; ++i)
+	{
+		auto chosen = group.select("/k/" + std::to_string(i), now);
+		ASSERT_NE(chosen, 2U);
+		if(before[i] != 2)
+		{
+			ASSERT_EQ(chosen, before[i]);
+		}
+	}
+}
+
+TEST(health, policies_skip_ejected_endpoints)
+{
+	for(auto p : {network::upstream_group::policy::round_robin, network::upstream_group::policy::least_outstanding,
+		network::upstream_group::policy::power_of_two_choices})
+	{
+		network::upstream_group group{make_endpoints(3), p, make_policy(1)};
+		auto now = group_clock::now();
+		fail(group, 1, now);
+		for(int i = 0; i < 20; ++i)
+			ASSERT_NE(group.select({}, now), 1U);
+	}
+}
+
+TEST(health, probe_ejects_failing_backend)
+{
+	boost::asio::io_service io;
+	mock_server<> server{io};
+	server.start([&server]
+	{
+		server.write("HTTP/1.1 503 Service Unavailable\r\ncontent-length: 0\r\n\r\n");
+	}, true);
+
+	auto group = std::make_shared<network::upstream_group>(make_endpoints(1),
+		network::upstream_group::policy::round_robin, make_policy(1));
+	auto checker = std::make_shared<network::health_checker>(io, group,
+		std::make_unique<network::dns_connector_factory>(io, timeout), "/health", std::chrono::seconds{10}, timeout);
+	run_probes(io, checker);
+	server.stop();
+
+	ASSERT_FALSE(group->available(0));
+}
+
+TEST(health, probe_ejects_unreachable_backend)
+{
+	boost::asio::io_service io;
+	// nobody listens there
+	auto group = std::make_shared<network::upstream_group>(make_endpoints(2),
+		network::upstream_group::policy::round_robin, make_policy(1));
+	auto checker = std::make_shared<network::health_checker>(io, group,
+		std::make_unique<network::dns_connector_factory>(io, timeout), "/health", std::chrono::seconds{10}, timeout);
+	run_probes(io, checker);
+
+	ASSERT_FALSE(group->available(1));
+}
+
+TEST(health, probe_readmits_recovered_backend)
+{
+	boost::asio::io_service io;
+	mock_server<> server{io};
+	server.start([&server]
+	{
+		server.write("HTTP/1.1 200 OK\r\ncontent-length: 0\r\n\r\n");
+	}, true);
+
+	auto group = std::make_shared<network::upstream_group>(make_endpoints(1),
+		network::upstream_group::policy::round_robin, make_policy(1));
+	fail(*group, 0, group_clock::now());
+	ASSERT_FALSE(group->available(0));
+
+	auto checker = std::make_shared<network::health_checker>(io, group,
+		std::make_unique<network::dns_connector_factory>(io, timeout), "/health", std::chrono::seconds{10}, timeout);
+	run_probes(io, checker);
+	server.stop();
+
+	ASSERT_TRUE(group->available(0));
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include "src/network/ktls.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+
+/** A TLS 1.2 connection on loopback TCP, handshaken with the cipher. */
+struct tls_connection
+{
+	SSL_CTX* server_ctx;
+	SSL_CTX* client_ctx;
+	SSL* server{nullptr};
+	SSL* client{nullptr};
+	int server_fd{-1};
+	int client_fd{-1};
+
+	explicit tls_connection(const char* cipher)
+	{
+		static const std::string password = []()
+		{
+			std::ifstream in{"etc/doormat/certificates/npn1/keypass"};
+			std::string p;
+			std::getline(in, p);
+			return p;
+		}();
+		server_ctx = SSL_CTX_new(SSLv23_server_method());
+		client_ctx = SSL_CTX_new(SSLv23_client_method());
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		// the test certificate is signed with SHA-1
+		SSL_CTX_set_security_level(server_ctx, 0);
+		SSL_CTX_set_security_level(client_ctx, 0);
+		SSL_CTX_set_max_proto_version(client_ctx, TLS1_2_VERSION);
+#endif
+		SSL_CTX_set_cipher_list(client_ctx, cipher);
+		SSL_CTX_set_default_passwd_cb_userdata(server_ctx, const_cast<char*>(password.c_str()));
+		EXPECT_EQ(SSL_CTX_use_certificate_chain_file(server_ctx, "etc/doormat/certificates/npn1/newcert.pem"), 1);
+		EXPECT_EQ(SSL_CTX_use_PrivateKey_file(server_ctx, "etc/doormat/certificates/npn1/newkey.pem", SSL_FILETYPE_PEM), 1);
+
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		EXPECT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&address), length), 0);
+		EXPECT_EQ(listen(listener, 1), 0);
+		getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+		client_fd = socket(AF_INET, SOCK_STREAM, 0);
+		EXPECT_EQ(connect(client_fd, reinterpret_cast<sockaddr*>(&address), length), 0);
+		server_fd = accept(listener, nullptr, nullptr);
+		close(listener);
+
+		server = SSL_new(server_ctx);
+		client = SSL_new(client_ctx);
+		SSL_set_fd(server, server_fd);
+		SSL_set_fd(client, client_fd);
+		std::thread peer{[this]() { EXPECT_EQ(SSL_connect(client), 1); }};
+		EXPECT_EQ(SSL_accept(server), 1);
+		peer.join();
+	}
+
+	~tls_connection()
+	{
+		SSL_free(client);
+		SSL_free(server);
+		close(client_fd);
+		close(server_fd);
+		SSL_CTX_free(client_ctx);
+		SSL_CTX_free(server_ctx);
+	}
+
+	/** \returns what the client reads, decrypted, until it has the bytes */
+	std::string receive(std::size_t bytes)
+	{
+		std::string got;
+		char buffer[4096];
+		while(got.size() < bytes)
+		{
+			auto n = SSL_read(client, buffer, sizeof(buffer));
+			if(n <= 0) break;
+			got.append(buffer, static_cast<std::size_t>(n));
+		}
+		return got;
+	}
+};
+
+}
+
+TEST(ktls, plain_writes_and_sendfile)
+{
+	if(!network::ktls::supported()) return;
+	for(auto cipher : {"ECDHE-RSA-AES128-GCM-SHA256", "ECDHE-RSA-AES256-GCM-SHA384"})
+	{
+		tls_connection c{cipher};
+		if(!network::ktls::enable(c.server, c.server_fd))
+		{
+			// the kernel has no tls module: nothing to test here
+			std::cerr << "kernel TLS is not available" << std::endl;
+			ASSERT_FALSE(network::ktls::offloaded(c.server));
+			return;
+		}
+		ASSERT_TRUE(network::ktls::offloaded(c.server));
+
+		// the kernel makes the records of what is written as it is
+		std::string head{"HTTP/1.1 200 OK\r\n\r\n"};
+		ASSERT_EQ(write(c.server_fd, head.data(), head.size()), static_cast<ssize_t>(head.size()));
+		const std::string name{"ktls_test.body"};
+		std::string body(100 * 1024, 'b');
+		std::ofstream{name} << body;
+		auto fd = open(name.c_str(), O_RDONLY);
+		off_t offset{0};
+		std::size_t sent{0};
+		while(sent < body.size())
+		{
+			auto n = sendfile(c.server_fd, fd, &offset, body.size() - sent);
+			ASSERT_GT(n, 0);
+			sent += static_cast<std::size_t>(n);
+		}
+		close(fd);
+		std::remove(name.c_str());
+		ASSERT_EQ(c.receive(head.size() + body.size()), head + body) << cipher;
+	}
+}
+
+TEST(ktls, openssl_writes_nothing_once_offloaded)
+{
+	if(!network::ktls::supported()) return;
+	tls_connection c{"ECDHE-RSA-AES128-GCM-SHA256"};
+	if(!network::ktls::enable(c.server, c.server_fd))
+	{
+		std::cerr << "kernel TLS is not available" << std::endl;
+		return;
+	}
+	EXPECT_TRUE(SSL_get_options(c.server) & SSL_OP_NO_RENEGOTIATION);
+
+	// a close_notify from OpenSSL would be a record out of sequence, and the one after it would not decrypt
+	SSL_shutdown(c.server);
+	std::string tail{"tail"};
+	ASSERT_EQ(write(c.server_fd, tail.data(), tail.size()), static_cast<ssize_t>(tail.size()));
+	ASSERT_EQ(c.receive(tail.size()), tail);
+}
+
+TEST(ktls, other_ciphers_stay_in_user_space)
+{
+	tls_connection c{"ECDHE-RSA-CHACHA20-POLY1305"};
+	ASSERT_FALSE(network::ktls::enable(c.server, c.server_fd));
+	ASSERT_FALSE(network::ktls::offloaded(c.server));
+	std::string hello{"hello"};
+	ASSERT_EQ(SSL_write(c.server, hello.data(), static_cast<int>(hello.size())), 5);
+	ASSERT_EQ(c.receive(hello.size()), hello);
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include "src/network/communicator/local_communicator_factory.h"
+#include "src/network/communicator/dns_communicator_factory.h"
+#include "src/connector.h"
+#include "mocks/mock_handler/mock_handler.h"
+
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+
+using local_acceptor = boost::asio::local::stream_protocol::acceptor;
+
+/** \brief connects to a socket listening at the address, writes a chunk through the connector and reads it on the
+ * other end. */
+void exchange(const std::string& address)
+{
+	boost::asio::io_service io;
+	local_acceptor acceptor{io, network::local_connector_factory::endpoint(address)};
+	server::local_socket accepted{io};
+	std::array<char, 13> received;
+	bool read{false};
+	std::shared_ptr<server::connector_interface> connector;
+	acceptor.async_accept(accepted, [&](const boost::system::error_code& ec)
+	{
+		ASSERT_FALSE(ec);
+		boost::asio::async_read(accepted, boost::asio::buffer(received),
+			[&](const boost::system::error_code& ec, std::size_t)
+			{
+				ASSERT_FALSE(ec);
+				read = true;
+				connector->close();
+			});
+	});
+
+	network::local_connector_factory f{io, std::chrono::milliseconds{1000}};
+	auto handler = std::make_shared<mock_handler>();
+	f.get_connector(address, 0, false, [&](std::shared_ptr<server::connector_interface> c, http::proto_version v)
+	{
+		ASSERT_TRUE(bool(c));
+		ASSERT_EQ(v, http::proto_version::HTTP11);
+		ASSERT_FALSE(c->is_ssl());
+		// the peer has no address
+		ASSERT_TRUE(c->origin().is_unspecified());
+		connector = c;
+		c->handler(handler);
+		c->start(true);
+		c->do_write();
+	}, [](int error) { FAIL() << "Failed with error code " << error; });
+	io.run();
+	ASSERT_TRUE(read);
+	ASSERT_EQ(std::string(received.data(), received.size()), "filling chunk");
+}
+
+}
+
+TEST(local_factory, connects_to_abstract_sockets)
+{
+	exchange("unix:@doormat-local-factory-test-" + std::to_string(getpid()));
+}
+
+TEST(local_factory, connects_to_sockets_with_a_path)
+{
+	std::string path{"local_factory_test.sock"};
+	std::remove(path.c_str());
+	exchange("unix:" + path);
+	std::remove(path.c_str());
+}
+
+TEST(local_factory, endpoints)
+{
+	ASSERT_TRUE(network::local_connector_factory::is_local("unix:/run/app.sock"));
+	ASSERT_FALSE(network::local_connector_factory::is_local("localhost"));
+	ASSERT_EQ(network::local_connector_factory::endpoint("unix:/run/app.sock").path(), "/run/app.sock");
+	ASSERT_EQ(network::local_connector_factory::endpoint("unix:@app").path(), std::string("\0app", 4));
+	ASSERT_THROW(network::local_connector_factory::endpoint("unix:"), std::invalid_argument);
+}
+
+TEST(local_factory, fails)
+{
+	boost::asio::io_service io;
+	network::local_connector_factory f{io, std::chrono::milliseconds{1000}};
+	std::vector<int> errors;
+	auto connected = [](std::shared_ptr<server::connector_interface>, http::proto_version) { FAIL() << "Connected"; };
+	auto failed = [&errors](int error) { errors.push_back(error); };
+	f.get_connector("unix:local_factory_test.missing", 0, false, connected, failed);
+	// TLS is not spoken over Unix sockets
+	f.get_connector("unix:@doormat", 0, true, connected, failed);
+	f.get_connector("unix:", 0, false, connected, failed);
+	// the DNS factory leaves the Unix sockets to the local one
+	network::dns_connector_factory dns{io, std::chrono::milliseconds{1000}};
+	dns.get_connector("unix:local_factory_test.missing", 0, false, connected, failed);
+	io.run();
+	ASSERT_EQ(errors, (std::vector<int>{3, 3, 3, 3}));
+
+	f.stop();
+	f.get_connector("unix:@doormat", 0, false, connected, failed);
+	ASSERT_EQ(errors.back(), 1);
+}
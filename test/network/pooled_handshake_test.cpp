@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+#include "src/network/pooled_handshake.h"
+
+#include <array>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+namespace
+{
+
+const std::string request{"GET / HTTP/1.1\r\nhost: localhost\r\n\r\n"};
+const std::string answer{"HTTP/1.1 200 OK\r\ncontent-length: 2\r\n\r\nok"};
+
+std::mutex mutex;
+/** Threads on which the session went through the handshake */
+std::set<std::thread::id> handshaking;
+
+void trace(const SSL*, int where, int)
+{
+	if(!(where & SSL_CB_LOOP)) return;
+	std::lock_guard<std::mutex> lock{mutex};
+	handshaking.insert(std::this_thread::get_id());
+}
+
+/** A server handshaking on a pool, and answering one request per connection. */
+struct server
+{
+	boost::asio::io_service io;
+	boost::asio::ssl::context ctx{boost::asio::ssl::context::sslv23_server};
+	boost::asio::ip::tcp::acceptor acceptor{io, {boost::asio::ip::address_v4::loopback(), 0}};
+	std::shared_ptr<network::handshake_pool> pool = std::make_shared<network::handshake_pool>(1);
+
+	std::shared_ptr<network::pooled_handshake::ssl_socket> socket;
+	std::array<char, 4096> chunk;
+	std::string received;
+
+	server()
+	{
+		static const std::string password = []()
+		{
+			std::ifstream in{"etc/doormat/certificates/npn1/keypass"};
+			std::string p;
+			std::getline(in, p);
+			return p;
+		}();
+		auto c = ctx.native_handle();
+		// the test certificate is signed with SHA-1
+		SSL_CTX_set_security_level(c, 0);
+		SSL_CTX_set_info_callback(c, trace);
+		ctx.set_password_callback([](std::size_t, boost::asio::ssl::context::password_purpose) { return password; });
+		EXPECT_EQ(SSL_CTX_use_certificate_chain_file(c, "etc/doormat/certificates/npn1/newcert.pem"), 1);
+		EXPECT_EQ(SSL_CTX_use_PrivateKey_file(c, "etc/doormat/certificates/npn1/newkey.pem", SSL_FILETYPE_PEM), 1);
+	}
+
+	uint16_t port() const { return acceptor.local_endpoint().port(); }
+
+	/** \brief accepts a connection, handshakes and answers its request through the stream. */
+	void serve()
+	{
+		socket = std::make_shared<network::pooled_handshake::ssl_socket>(io, ctx);
+		received.clear();
+		acceptor.async_accept(socket->lowest_layer(), [this](const boost::system::error_code& ec)
+		{
+			ASSERT_FALSE(ec);
+			auto handshake = std::make_shared<network::pooled_handshake>(socket, pool);
+			handshake->async_handshake([this](const boost::system::error_code& ec)
+			{
+				ASSERT_FALSE(ec);
+				read();
+			});
+		});
+		io.run();
+		io.reset();
+		socket.reset();
+	}
+
+	void read()
+	{
+		socket->async_read_some(boost::asio::buffer(chunk), [this](const boost::system::error_code& ec, std::size_t bytes)
+		{
+			ASSERT_FALSE(ec);
+			received.append(chunk.data(), bytes);
+			if(received.find("\r\n\r\n") == std::string::npos) return read();
+			boost::asio::async_write(*socket, boost::asio::buffer(answer), [](const boost::system::error_code&, std::size_t) {});
+		});
+	}
+};
+
+/** \brief writes what the session wrote. */
+void flush(int fd, BIO* out)
+{
+	char* data{nullptr};
+	auto pending = BIO_get_mem_data(out, &data);
+	for(long done = 0; done < pending;)
+	{
+		auto n = write(fd, data + done, static_cast<std::size_t>(pending - done));
+		if(n <= 0) break;
+		done += n;
+	}
+	BIO_reset(out);
+}
+
+/** \brief reads what the server sent into the session. */
+bool receive(int fd, BIO* in)
+{
+	char buffer[4096];
+	auto n = read(fd, buffer, sizeof(buffer));
+	if(n <= 0) return false;
+	BIO_write(in, buffer, static_cast<int>(n));
+	return true;
+}
+
+/** \brief sends the request in the same write as the last flight of the handshake, and reads the answer. */
+std::string fetch(uint16_t port, int version)
+{
+	SSL_CTX* ctx = SSL_CTX_new(SSLv23_client_method());
+	SSL_CTX_set_security_level(ctx, 0);
+	SSL_CTX_set_max_proto_version(ctx, version);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+	SSL* ssl = SSL_new(ctx);
+	BIO* in = BIO_new(BIO_s_mem());
+	BIO* out = BIO_new(BIO_s_mem());
+	BIO_set_mem_eof_return(in, -1);
+	SSL_set_bio(ssl, in, out);
+	SSL_set_connect_state(ssl);
+	while(SSL_do_handshake(ssl) != 1)
+	{
+		flush(fd, out);
+		if(!receive(fd, in)) break;
+	}
+	// with TLS 1.3 the Finished of the client is still there: the request follows it in the same segment
+	EXPECT_EQ(SSL_write(ssl, request.data(), static_cast<int>(request.size())), static_cast<int>(request.size()));
+	flush(fd, out);
+	std::string got;
+	char buffer[4096];
+	while(got.size() < answer.size())
+	{
+		auto n = SSL_read(ssl, buffer, sizeof(buffer));
+		if(n > 0) got.append(buffer, static_cast<std::size_t>(n));
+		else if(SSL_get_error(ssl, n) != SSL_ERROR_WANT_READ || !receive(fd, in)) break;
+	}
+	SSL_free(ssl);
+	close(fd);
+	SSL_CTX_free(ctx);
+	return got;
+}
+
+}
+
+TEST(pooled_handshake, computes_on_the_pool_and_leaves_the_rest_to_the_stream)
+{
+	server s;
+	for(auto version : {TLS1_2_VERSION, TLS1_3_VERSION})
+	{
+		handshaking.clear();
+		std::string got;
+		std::thread client{[&]() { got = fetch(s.port(), version); }};
+		s.serve();
+		client.join();
+		EXPECT_EQ(got, answer) << version;
+		EXPECT_EQ(s.received, request) << version;
+
+		// neither the io_service nor the client: the thread of the pool, and only it, ran the server side
+		std::lock_guard<std::mutex> lock{mutex};
+		EXPECT_GT(s.pool->completed(), 0U);
+		EXPECT_EQ(handshaking.count(std::this_thread::get_id()), 0U) << version;
+	}
+}
+
+TEST(pooled_handshake, a_full_pool_refuses_the_connection)
+{
+	std::mutex busy;
+	server s;
+	// the thread of the pool is busy, and its queue has room for nothing else
+	s.pool = std::make_shared<network::handshake_pool>(1, 1);
+	busy.lock();
+	ASSERT_TRUE(s.pool->submit([&busy]() { std::lock_guard<std::mutex> lock{busy}; }));
+	while(s.pool->queued()) std::this_thread::yield();
+	ASSERT_TRUE(s.pool->submit([]() {}));
+
+	boost::system::error_code failure;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	std::thread client{[&]()
+	{
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(s.port());
+		EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+		const char hello[] = "\x16\x03\x01";
+		EXPECT_EQ(write(fd, hello, 3), 3);
+	}};
+	auto socket = std::make_shared<network::pooled_handshake::ssl_socket>(s.io, s.ctx);
+	s.acceptor.async_accept(socket->lowest_layer(), [&](const boost::system::error_code& ec)
+	{
+		ASSERT_FALSE(ec);
+		auto handshake = std::make_shared<network::pooled_handshake>(socket, s.pool);
+		handshake->async_handshake([&failure](const boost::system::error_code& ec) { failure = ec; });
+	});
+	s.io.run();
+	client.join();
+	busy.unlock();
+	close(fd);
+	EXPECT_EQ(failure, boost::system::errc::connection_refused);
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include "src/network/rate_limiter.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using steady = network::rate_limiter::clock;
+
+boost::asio::ip::address address(const std::string& a)
+{
+	return boost::asio::ip::address::from_string(a);
+}
+
+}
+
+TEST(rate_limiter, buckets_refill_at_the_rate)
+{
+	// ten tokens a second, three at once
+	network::rate_limiter limiter{10, 3};
+	auto now = steady::now();
+	auto a = address("192.0.2.1");
+	EXPECT_TRUE(limiter.acquire(a, now));
+	EXPECT_TRUE(limiter.acquire(a, now));
+	EXPECT_TRUE(limiter.acquire(a, now));
+	EXPECT_FALSE(limiter.acquire(a, now));
+	EXPECT_FALSE(limiter.acquire(a, now + std::chrono::milliseconds{50}));
+	EXPECT_TRUE(limiter.acquire(a, now + std::chrono::milliseconds{100}));
+	EXPECT_FALSE(limiter.acquire(a, now + std::chrono::milliseconds{100}));
+
+	// no more than the burst, however long the wait
+	now += std::chrono::hours{1};
+	for(int i = 0; i < 3; ++i) EXPECT_TRUE(limiter.acquire(a, now));
+	EXPECT_FALSE(limiter.acquire(a, now));
+	EXPECT_EQ(limiter.interval(), std::chrono::milliseconds{100});
+
+	EXPECT_THROW((network::rate_limiter{0, 1}), std::invalid_argument);
+	EXPECT_THROW((network::rate_limiter{1, 0}), std::invalid_argument);
+}
+
+TEST(rate_limiter, keys_have_buckets_of_their_own)
+{
+	network::rate_limiter limiter{1, 1};
+	auto now = steady::now();
+	EXPECT_TRUE(limiter.acquire(address("192.0.2.1"), now));
+	EXPECT_FALSE(limiter.acquire(address("192.0.2.1"), now));
+	// clients of dual-stack sockets are the same
+	EXPECT_FALSE(limiter.acquire(address("::ffff:192.0.2.1"), now));
+	EXPECT_TRUE(limiter.acquire(address("192.0.2.2"), now));
+	EXPECT_TRUE(limiter.acquire(address("2001:db8::1"), now));
+	EXPECT_TRUE(limiter.acquire(boost::string_ref{"api-key-1"}, now));
+	EXPECT_FALSE(limiter.acquire(boost::string_ref{"api-key-1"}, now));
+	EXPECT_TRUE(limiter.acquire(boost::string_ref{"api-key-2"}, now));
+	EXPECT_EQ(limiter.size(now), 5U);
+}
+
+TEST(rate_limiter, entries_age_out)
+{
+	network::rate_limiter limiter{100, 1, 16};
+	auto now = steady::now();
+	// far more keys than slots: the last ones find no room, and are let through
+	for(int i = 0; i < 1000; ++i)
+		EXPECT_TRUE(limiter.acquire(std::to_string(i), now));
+	EXPECT_GT(limiter.overflows(), 0U);
+	EXPECT_LT(limiter.size(now), 1000U);
+
+	// full buckets free their slots
+	now += std::chrono::milliseconds{10};
+	EXPECT_EQ(limiter.size(now), 0U);
+	auto overflows = limiter.overflows();
+	EXPECT_TRUE(limiter.acquire(std::string{"new"}, now));
+	EXPECT_FALSE(limiter.acquire(std::string{"new"}, now));
+	EXPECT_EQ(limiter.overflows(), overflows);
+}
+
+TEST(rate_limiter, keys_keep_their_bucket_when_an_earlier_slot_frees)
+{
+	// one token a second, in a table crowded enough for keys to be placed past their first slot
+	network::rate_limiter limiter{1, 1, 256};
+	auto now = steady::now();
+	for(int i = 0; i < 200; ++i)
+		limiter.acquire("early-" + std::to_string(i), now);
+
+	std::vector<std::string> placed;
+	for(int i = 0; i < 100; ++i)
+	{
+		auto key = "late-" + std::to_string(i);
+		auto overflows = limiter.overflows();
+		limiter.acquire(key, now + std::chrono::milliseconds{500});
+		if(limiter.overflows() == overflows) placed.push_back(key);
+	}
+	ASSERT_FALSE(placed.empty());
+
+	// the early buckets are full again, the late ones are not
+	for(const auto& key : placed)
+		EXPECT_FALSE(limiter.acquire(key, now + std::chrono::milliseconds{1200})) << key;
+}
+
+TEST(rate_limiter, threads_share_the_buckets)
+{
+	network::rate_limiter limiter{1, 1000};
+	auto now = steady::now();
+	std::atomic<int> taken{0};
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t)
+		threads.emplace_back([&limiter, &taken, now]()
+		{
+			for(int i = 0; i < 1000; ++i)
+				if(limiter.acquire(address("192.0.2.1"), now)) ++taken;
+		});
+	for(auto& t : threads) t.join();
+	EXPECT_EQ(taken.load(), 1000);
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "src/network/record_sizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <openssl/ssl.h>
+
+using network::record_sizer;
+
+namespace
+{
+
+/** A TLS server and client talking through memory: whatever the server writes waits in its queue, and reaches the
+ * client only as the link carries it. */
+struct slow_link
+{
+	SSL_CTX* server_ctx;
+	SSL_CTX* client_ctx;
+	SSL* server;
+	SSL* client;
+
+	slow_link()
+	{
+		static const std::string password = []()
+		{
+			std::ifstream in{"etc/doormat/certificates/npn1/keypass"};
+			std::string p;
+			std::getline(in, p);
+			return p;
+		}();
+		server_ctx = SSL_CTX_new(SSLv23_server_method());
+		client_ctx = SSL_CTX_new(SSLv23_client_method());
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		// the test certificate is signed with SHA-1
+		SSL_CTX_set_security_level(server_ctx, 0);
+		SSL_CTX_set_security_level(client_ctx, 0);
+#endif
+		SSL_CTX_set_default_passwd_cb_userdata(server_ctx, const_cast<char*>(password.c_str()));
+		EXPECT_EQ(SSL_CTX_use_certificate_chain_file(server_ctx, "etc/doormat/certificates/npn1/newcert.pem"), 1);
+		EXPECT_EQ(SSL_CTX_use_PrivateKey_file(server_ctx, "etc/doormat/certificates/npn1/newkey.pem", SSL_FILETYPE_PEM), 1);
+		server = SSL_new(server_ctx);
+		client = SSL_new(client_ctx);
+		SSL_set_bio(server, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+		SSL_set_bio(client, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+		SSL_set_accept_state(server);
+		SSL_set_connect_state(client);
+		for(int i = 0; i < 16 && !(SSL_is_init_finished(server) && SSL_is_init_finished(client)); ++i)
+		{
+			SSL_do_handshake(client);
+			carry(client, server, SIZE_MAX);
+			SSL_do_handshake(server);
+			carry(server, client, SIZE_MAX);
+		}
+		EXPECT_TRUE(SSL_is_init_finished(server) && SSL_is_init_finished(client));
+	}
+
+	~slow_link()
+	{
+		SSL_free(client);
+		SSL_free(server);
+		SSL_CTX_free(client_ctx);
+		SSL_CTX_free(server_ctx);
+	}
+
+	/** \returns the bytes moved, at most max */
+	static std::size_t carry(SSL* from, SSL* to, std::size_t max)
+	{
+		std::vector<char> buffer(std::min<std::size_t>(max, 64 * 1024));
+		std::size_t moved{0};
+		while(moved < max)
+		{
+			auto n = BIO_read(SSL_get_wbio(from), buffer.data(), static_cast<int>(std::min(buffer.size(), max - moved)));
+			if(n <= 0) break;
+			BIO_write(SSL_get_rbio(to), buffer.data(), n);
+			moved += static_cast<std::size_t>(n);
+		}
+		return moved;
+	}
+
+	/** \returns how many segments the client receives before it can read the first byte of the response */
+	int segments_to_first_byte(std::size_t record, std::size_t response)
+	{
+		SSL_set_max_send_fragment(server, record);
+		std::string body(response, 'x');
+		EXPECT_EQ(SSL_write(server, body.data(), static_cast<int>(body.size())), static_cast<int>(body.size()));
+		char first;
+		for(int segments = 1; segments < 1000; ++segments)
+		{
+			// a slow link: one MSS a round trip
+			if(!carry(server, client, 1460)) break;
+			if(SSL_read(client, &first, 1) == 1) return segments;
+		}
+		return -1;
+	}
+};
+
+}
+
+TEST(record_sizer, small_records_first)
+{
+	record_sizer sizer;
+	auto now = record_sizer::clock::now();
+	ASSERT_EQ(sizer.next(now), 1400U);
+	sizer.sent(512 * 1024, now);
+	ASSERT_EQ(sizer.next(now), 1400U);
+	sizer.sent(512 * 1024, now);
+	ASSERT_EQ(sizer.next(now + std::chrono::milliseconds{10}), 16384U);
+	ASSERT_EQ(sizer.streak(), 1024U * 1024);
+}
+
+TEST(record_sizer, small_records_again_after_idle)
+{
+	record_sizer sizer{record_sizer::settings{1400, 16384, 4096, std::chrono::milliseconds{100}}};
+	auto now = record_sizer::clock::now();
+	sizer.sent(8192, now);
+	ASSERT_EQ(sizer.next(now + std::chrono::milliseconds{100}), 16384U);
+	ASSERT_EQ(sizer.next(now + std::chrono::milliseconds{101}), 1400U);
+	ASSERT_EQ(sizer.streak(), 0U);
+}
+
+TEST(record_sizer, invalid)
+{
+	ASSERT_THROW(record_sizer{record_sizer::settings{256}}, std::invalid_argument);
+	ASSERT_THROW((record_sizer{record_sizer::settings{4096, 2048}}), std::invalid_argument);
+	ASSERT_THROW((record_sizer{record_sizer::settings{1400, 32768}}), std::invalid_argument);
+}
+
+TEST(record_sizer, first_byte_on_a_slow_link)
+{
+	record_sizer sizer;
+	slow_link small;
+	slow_link large;
+	auto dynamic = small.segments_to_first_byte(sizer.next(), 64 * 1024);
+	auto fixed = large.segments_to_first_byte(16384, 64 * 1024);
+	// a small record is decrypted as soon as its segment arrives; a full one waits for a dozen of them
+	ASSERT_EQ(dynamic, 1);
+	ASSERT_GE(fixed, 11);
+}
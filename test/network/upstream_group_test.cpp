@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include "../../src/network/upstream_group.h"
+
+#include <map>
+
+namespace
+{
+
+std::vector<network::endpoint> make_endpoints(std::size_t n)
+{
+	std::vector<network::endpoint> endpoints;
+	for(std::size_t i = 0; i < n; ++i)
+		endpoints.push_back(network::endpoint{"127.0.0.1", static_cast<uint16_t>(8454 + i), false});
+	return endpoints;
+}
+
+}
+
+TEST(upstream_group, round_robin_walks_all_endpoints)
+{
+	network::upstream_group group{make_endpoints(3), network::upstream_group::policy::round_robin};
+	ASSERT_EQ(group.select(), 0U);
+	ASSERT_EQ(group.select(), 1U);
+	ASSERT_EQ(group.select(), 2U);
+	ASSERT_EQ(group.select(), 0U);
+}
+
+TEST(upstream_group, least_outstanding_avoids_busy_endpoints)
+{
+	network::upstream_group group{make_endpoints(3), network::upstream_group::policy::least_outstanding};
+	group.started(0);
+	group.started(0);
+	group.started(1);
+	ASSERT_EQ(group.select(), 2U);
+	group.started(2);
+	group.started(2);
+	ASSERT_EQ(group.select(), 1U);
+	group.completed(0, std::chrono::milliseconds{1});
+	group.completed(0, std::chrono::milliseconds{1});
+	ASSERT_EQ(group.select(), 0U);
+}
+
+TEST(upstream_group, power_of_two_choices_prefers_fast_endpoints)
+{
+	network::upstream_group group{make_endpoints(2), network::upstream_group::policy::power_of_two_choices, {}, 42};
+	group.started(0);
+	group.completed(0, std::chrono::milliseconds{100});
+	group.started(1);
+	group.completed(1, std::chrono::milliseconds{1});
+	for(int i = 0; i < 10; ++i)
+		ASSERT_EQ(group.select(), 1U);
+}
+
+TEST(upstream_group, latency_is_averaged)
+{
+	network::upstream_group group{make_endpoints(1), network::upstream_group::policy::round_robin};
+	group.started(0);
+	group.completed(0, std::chrono::nanoseconds{1000});
+	ASSERT_DOUBLE_EQ(group.latency(0), 1000);
+	group.started(0);
+	group.completed(0, std::chrono::nanoseconds{2000});
+	ASSERT_GT(group.latency(0), 1000);
+	ASSERT_LT(group.latency(0), 2000);
+	ASSERT_EQ(group.outstanding(0), 0U);
+}
+
+TEST(upstream_group, consistent_hashing_is_stable)
+{
+	network::upstream_group group{make_endpoints(8), network::upstream_group::policy::consistent_hashing};
+	network::upstream_group same{make_endpoints(8), network::upstream_group::policy::consistent_hashing};
+	std::map<std::size_t, std::size_t> hits;
+	for(int i = 0; i < 1000; ++i)
+	{
+		auto key = "/resource/" + std::to_string(i);
+		auto chosen = group.select(key);
+		ASSERT_EQ(chosen, group.select(key));
+		ASSERT_EQ(chosen, same.select(key));
+		++hits[chosen];
+	}
+	// every endpoint gets its share
+	ASSERT_EQ(hits.size(), 8U);
+}
+
+TEST(upstream_group, consistent_hashing_moves_few_keys)
+{
+	network::upstream_group before{make_endpoints(8), network::upstream_group::policy::consistent_hashing};
+	network::upstream_group after{make_endpoints(9), network::upstream_group::policy::consistent_hashing};
+	std::size_t moved{0};
+	for(int i = 0; i < 1000; ++i)
+	{
+		auto key = "/resource/" + std::to_string(i);
+		if(before[before.select(key)].port != after[after.select(key)].port) ++moved;
+	}
+	// ideally 1/9 of the keys; a modulo would move most of them
+	ASSERT_LT(moved, 250U);
+}
+
+TEST(upstream_group, index_of)
+{
+	network::upstream_group group{make_endpoints(3), network::upstream_group::policy::round_robin};
+	ASSERT_EQ(group.index_of(network::endpoint{"127.0.0.1", 8455, false}), 1U);
+	ASSERT_EQ(group.index_of(network::endpoint{"127.0.0.1", 8455, true}), group.size());
+}
@@ -0,0 +1,303 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/ocsp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "../src/utils/ocsp.h"
+#include "../src/utils/sni_solver.h"
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+using namespace ssl_utils;
+
+namespace
+{
+
+using key_ptr = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+using x509_ptr = std::unique_ptr<X509, decltype(&X509_free)>;
+
+key_ptr make_key()
+{
+	EVP_PKEY* key{nullptr};
+	auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	EVP_PKEY_keygen_init(ctx);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(ctx, &key);
+	EVP_PKEY_CTX_free(ctx);
+	return key_ptr{key, EVP_PKEY_free};
+}
+
+/** \brief makes a certificate for the name, signed by the issuer, or by itself if there is none. */
+x509_ptr make_certificate(const char* name, EVP_PKEY* key, X509* issuer, EVP_PKEY* issuer_key, long serial,
+	const char* responder = nullptr)
+{
+	x509_ptr x{X509_new(), X509_free};
+	X509_set_version(x.get(), 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x.get()), serial);
+	X509_gmtime_adj(X509_get_notBefore(x.get()), -3600);
+	X509_gmtime_adj(X509_get_notAfter(x.get()), 24 * 3600);
+	X509_set_pubkey(x.get(), key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(x.get()), "CN", MBSTRING_ASC,
+		reinterpret_cast<const unsigned char*>(name), -1, -1, 0);
+	X509_set_issuer_name(x.get(), X509_get_subject_name(issuer ? issuer : x.get()));
+	X509V3_CTX v3;
+	X509V3_set_ctx(&v3, issuer ? issuer : x.get(), x.get(), nullptr, nullptr, 0);
+	auto add = [&](int nid, const std::string& value)
+	{
+		auto e = X509V3_EXT_conf_nid(nullptr, &v3, nid, const_cast<char*>(value.c_str()));
+		X509_add_ext(x.get(), e, -1);
+		X509_EXTENSION_free(e);
+	};
+	add(NID_basic_constraints, issuer ? "CA:FALSE" : "critical,CA:TRUE");
+	if(responder) add(NID_info_access, std::string{"OCSP;URI:"} + responder);
+	X509_sign(x.get(), issuer_key ? issuer_key : key, EVP_sha256());
+	return x;
+}
+
+/** \returns the response of the issuer telling the certificate of the id is good, for the seconds from now */
+std::string respond(OCSP_CERTID* id, X509* issuer, EVP_PKEY* issuer_key, long validity)
+{
+	auto basic = OCSP_BASICRESP_new();
+	auto this_update = X509_gmtime_adj(nullptr, validity > 0 ? -60 : validity - 60);
+	auto next_update = X509_gmtime_adj(nullptr, validity);
+	OCSP_basic_add1_status(basic, id, V_OCSP_CERTSTATUS_GOOD, 0, nullptr, this_update, next_update);
+	OCSP_basic_sign(basic, issuer, issuer_key, EVP_sha256(), nullptr, 0);
+	auto response = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+	auto size = i2d_OCSP_RESPONSE(response, nullptr);
+	std::string der(static_cast<std::size_t>(size), '\0');
+	auto out = reinterpret_cast<unsigned char*>(&der[0]);
+	i2d_OCSP_RESPONSE(response, &out);
+	OCSP_RESPONSE_free(response);
+	ASN1_TIME_free(next_update);
+	ASN1_TIME_free(this_update);
+	OCSP_BASICRESP_free(basic);
+	return der;
+}
+
+void write(const std::string& file, const std::string& content)
+{
+	// replaced at once, as a fetcher does
+	{
+		std::ofstream out{file + ".tmp", std::ios::binary};
+		out << content;
+	}
+	std::rename((file + ".tmp").c_str(), file.c_str());
+}
+
+/** A CA and a certificate it issued, in files as sni_solver reads them. */
+struct pki
+{
+	key_ptr ca_key{make_key()};
+	x509_ptr ca{make_certificate("ocsp test CA", ca_key.get(), nullptr, nullptr, 1)};
+	key_ptr key{make_key()};
+	x509_ptr certificate;
+	const std::string certificate_file{"ocsp_test.pem"};
+	const std::string key_file{"ocsp_test.key"};
+	const std::string password_file{"ocsp_test.pass"};
+
+	/** \param responder the one the certificate tells */
+	explicit pki(const char* responder = "http://127.0.0.1:1/")
+		: certificate{make_certificate("localhost", key.get(), ca.get(), ca_key.get(), 2, responder)}
+	{
+		auto f = std::fopen(certificate_file.c_str(), "w");
+		PEM_write_X509(f, certificate.get());
+		PEM_write_X509(f, ca.get());
+		std::fclose(f);
+		f = std::fopen(key_file.c_str(), "w");
+		PEM_write_PrivateKey(f, key.get(), nullptr, nullptr, 0, nullptr, nullptr);
+		std::fclose(f);
+		std::ofstream{password_file} << "unused";
+	}
+
+	~pki()
+	{
+		for(auto& f : {certificate_file, key_file, password_file, ocsp::response_file(certificate_file)})
+			std::remove(f.c_str());
+	}
+
+	/** \returns a response for the certificate, good for the seconds from now */
+	std::string response(long validity, X509* of = nullptr)
+	{
+		auto id = OCSP_cert_to_id(nullptr, of ? of : certificate.get(), ca.get());
+		auto der = respond(id, ca.get(), ca_key.get(), validity);
+		OCSP_CERTID_free(id);
+		return der;
+	}
+};
+
+/** \returns the response stapled to a handshake with the context, empty if none */
+std::string handshake(SSL_CTX* server_ctx)
+{
+	SSL_CTX* client_ctx = SSL_CTX_new(SSLv23_client_method());
+	SSL* s = SSL_new(server_ctx);
+	SSL* c = SSL_new(client_ctx);
+	BIO* server_end;
+	BIO* client_end;
+	BIO_new_bio_pair(&server_end, 0, &client_end, 0);
+	SSL_set_bio(s, server_end, server_end);
+	SSL_set_bio(c, client_end, client_end);
+	SSL_set_accept_state(s);
+	SSL_set_connect_state(c);
+	SSL_set_tlsext_status_type(c, TLSEXT_STATUSTYPE_ocsp);
+	bool server_done = false, client_done = false;
+	for(int i = 0; i < 16 && !(server_done && client_done); ++i)
+	{
+		client_done = client_done || SSL_do_handshake(c) == 1;
+		server_done = server_done || SSL_do_handshake(s) == 1;
+	}
+	EXPECT_TRUE(server_done && client_done);
+	const unsigned char* response{nullptr};
+	auto length = SSL_get_tlsext_status_ocsp_resp(c, &response);
+	std::string stapled = length > 0 ? std::string(reinterpret_cast<const char*>(response), length) : std::string{};
+	SSL_free(c);
+	SSL_free(s);
+	SSL_CTX_free(client_ctx);
+	return stapled;
+}
+
+/** A stand-in responder: it answers the requests with good responses of the CA, over HTTP/1.0. */
+struct responder
+{
+	pki& issuer;
+	int listener{socket(AF_INET, SOCK_STREAM, 0)};
+	uint16_t port{0};
+	std::thread server;
+	std::size_t answered{0};
+
+	explicit responder(pki& p, std::size_t requests) : issuer(p)
+	{
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		EXPECT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&address), length), 0);
+		EXPECT_EQ(listen(listener, 4), 0);
+		getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+		port = ntohs(address.sin_port);
+		server = std::thread{[this, requests]() { for(std::size_t i = 0; i < requests; ++i) answer(); }};
+	}
+
+	~responder()
+	{
+		server.join();
+		close(listener);
+	}
+
+	std::string url() const { return "http://127.0.0.1:" + std::to_string(port) + "/ocsp"; }
+
+	void answer()
+	{
+		int fd = accept(listener, nullptr, nullptr);
+		std::string request;
+		char buffer[4096];
+		std::size_t head{std::string::npos}, length{0};
+		while(head == std::string::npos || request.size() < head + 4 + length)
+		{
+			auto n = recv(fd, buffer, sizeof(buffer), 0);
+			if(n <= 0) break;
+			request.append(buffer, static_cast<std::size_t>(n));
+			if(head == std::string::npos && (head = request.find("\r\n\r\n")) != std::string::npos)
+				length = std::stoul(request.substr(request.find("content-length: ") + 16));
+		}
+		auto p = reinterpret_cast<const unsigned char*>(request.data() + head + 4);
+		auto ocsp_request = d2i_OCSP_REQUEST(nullptr, &p, static_cast<long>(length));
+		auto id = OCSP_onereq_get0_id(OCSP_request_onereq_get0(ocsp_request, 0));
+		auto body = respond(id, issuer.ca.get(), issuer.ca_key.get(), 3600);
+		OCSP_REQUEST_free(ocsp_request);
+		auto reply = "HTTP/1.0 200 OK\r\ncontent-type: application/ocsp-response\r\ncontent-length: " +
+			std::to_string(body.size()) + "\r\n\r\n" + body;
+		send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+		close(fd);
+		++answered;
+	}
+};
+
+}
+
+TEST(ocsp, staples_the_response_of_the_file)
+{
+	pki p;
+	auto file = ocsp::response_file(p.certificate_file);
+	ASSERT_EQ(file, "ocsp_test.pem.ocsp");
+	// an expired response is not read
+	write(file, p.response(-60));
+	sni_solver sni;
+	sni.add_certificate(p.certificate_file, p.key_file, p.password_file);
+	ASSERT_TRUE(sni.load_certificates());
+	auto ctx = sni.default_context()->native_handle();
+	ASSERT_TRUE(ocsp::stapled(ctx).empty());
+	ASSERT_TRUE(handshake(ctx).empty());
+
+	auto good = p.response(3600);
+	write(file, good);
+	sni.refresh_staples();
+	ASSERT_EQ(ocsp::stapled(ctx), good);
+	ASSERT_EQ(handshake(ctx), good);
+
+	// the response goes with its file
+	std::remove(file.c_str());
+	ASSERT_FALSE(ocsp::refresh(ctx));
+	ASSERT_TRUE(handshake(ctx).empty());
+}
+
+TEST(ocsp, responses_of_other_certificates_are_not_read)
+{
+	pki p;
+	auto other_key = make_key();
+	auto other = make_certificate("other", other_key.get(), p.ca.get(), p.ca_key.get(), 3);
+	write(ocsp::response_file(p.certificate_file), p.response(3600, other.get()));
+	sni_solver sni;
+	sni.add_certificate(p.certificate_file, p.key_file, p.password_file);
+	ASSERT_TRUE(sni.load_certificates());
+	ASSERT_TRUE(ocsp::stapled(sni.default_context()->native_handle()).empty());
+}
+
+TEST(ocsp, fetcher_asks_the_responder_when_due)
+{
+	pki p;
+	std::string fetched;
+	{
+		responder r{p, 1};
+		auto f = std::make_shared<ocsp::fetcher>(r.url());
+		ASSERT_TRUE(f->due(p.certificate_file));
+
+		sni_solver sni;
+		sni.add_certificate(p.certificate_file, p.key_file, p.password_file);
+		sni.set_ocsp_fetcher(f);
+		ASSERT_TRUE(sni.fetches_ocsp());
+		ASSERT_TRUE(sni.load_certificates());
+		auto ctx = sni.default_context()->native_handle();
+		ASSERT_TRUE(ocsp::stapled(ctx).empty());
+
+		sni.refresh_staples();
+		ASSERT_EQ(f->fetched(), 1U);
+		ASSERT_EQ(f->failed(), 0U);
+		ASSERT_FALSE(f->due(p.certificate_file));
+		fetched = ocsp::stapled(ctx);
+		ASSERT_FALSE(fetched.empty());
+		ASSERT_EQ(handshake(ctx), fetched);
+
+		// not due: the responder is not asked again
+		sni.refresh_staples();
+		ASSERT_EQ(f->fetched(), 1U);
+	}
+
+	// the responder the certificate tells is not there
+	ocsp::fetcher f{{}, std::chrono::seconds{1}};
+	ASSERT_FALSE(f.fetch(p.certificate_file));
+	ASSERT_EQ(f.failed(), 1U);
+	std::ifstream in{ocsp::response_file(p.certificate_file), std::ios::binary};
+	ASSERT_EQ(std::string(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}), fetched);
+}
+
+#endif
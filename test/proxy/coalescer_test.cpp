@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include "src/proxy/coalescer.h"
+
+namespace
+{
+
+http::http_request make_request(http_method m, const std::string& path)
+{
+	http::http_request req;
+	req.protocol(http::proto_version::HTTP11);
+	req.method(m);
+	req.hostname("localhost");
+	req.path(path);
+	return req;
+}
+
+struct recorder
+{
+	proxy::flight::subscriber subscriber()
+	{
+		return proxy::flight::subscriber{
+			[this](const http::http_response&) { ++headers; },
+			[this](const proxy::shared_chunk& c) { body += *c; },
+			[this](const std::string&, const std::string&) { ++trailers; },
+			[this]() { finished = true; },
+			[this]() { abandoned = true; }
+		};
+	}
+
+	std::size_t headers{0};
+	std::string body;
+	std::size_t trailers{0};
+	bool finished{false};
+	bool abandoned{false};
+};
+
+}
+
+TEST(coalescer, only_safe_requests_are_coalesced)
+{
+	auto c = std::make_shared<proxy::coalescer>();
+	EXPECT_FALSE(c->key(make_request(HTTP_GET, "/a")).empty());
+	EXPECT_FALSE(c->key(make_request(HTTP_HEAD, "/a")).empty());
+	EXPECT_TRUE(c->key(make_request(HTTP_POST, "/a")).empty());
+	EXPECT_NE(c->key(make_request(HTTP_GET, "/a")), c->key(make_request(HTTP_GET, "/b")));
+	EXPECT_NE(c->key(make_request(HTTP_GET, "/a")), c->key(make_request(HTTP_HEAD, "/a")));
+}
+
+TEST(coalescer, requests_with_credentials_are_not_coalesced)
+{
+	auto c = std::make_shared<proxy::coalescer>([](const http::http_request& req) { return req.path(); });
+	auto authorized = make_request(HTTP_GET, "/a");
+	authorized.header("authorization", "Basic dXNlcjpwYXNz");
+	EXPECT_TRUE(c->key(authorized).empty());
+	auto with_cookie = make_request(HTTP_GET, "/a");
+	with_cookie.header("cookie", "session=1");
+	EXPECT_TRUE(c->key(with_cookie).empty());
+}
+
+TEST(coalescer, custom_key)
+{
+	auto c = std::make_shared<proxy::coalescer>([](const http::http_request& req) { return req.path(); });
+	EXPECT_EQ(c->key(make_request(HTTP_GET, "/a")), "/a");
+}
+
+TEST(coalescer, followers_receive_what_the_leader_publishes)
+{
+	auto c = std::make_shared<proxy::coalescer>();
+	auto leader = c->lead("k");
+	ASSERT_EQ(c->join("k"), leader);
+
+	recorder r1, r2;
+	leader->subscribe(r1.subscriber());
+	c->join("k")->subscribe(r2.subscriber());
+
+	http::http_response res;
+	res.status(200);
+	leader->headers(res);
+	leader->body(std::make_shared<const std::string>("hel"));
+	// the body started flowing: nobody else can join
+	EXPECT_FALSE(c->join("k"));
+	EXPECT_EQ(c->in_flight(), 0U);
+	leader->body(std::make_shared<const std::string>("lo"));
+	leader->trailer("k", "v");
+	leader->finished();
+
+	for(auto* r : {&r1, &r2})
+	{
+		EXPECT_EQ(r->headers, 1U);
+		EXPECT_EQ(r->body, "hello");
+		EXPECT_EQ(r->trailers, 1U);
+		EXPECT_TRUE(r->finished);
+		EXPECT_FALSE(r->abandoned);
+	}
+}
+
+TEST(coalescer, private_responses_are_not_shared)
+{
+	auto c = std::make_shared<proxy::coalescer>();
+	auto leader = c->lead("k");
+	recorder r;
+	leader->subscribe(r.subscriber());
+
+	http::http_response res;
+	res.status(200);
+	res.header("set-cookie", "session=1");
+	leader->headers(res);
+
+	EXPECT_EQ(r.headers, 0U);
+	EXPECT_TRUE(r.abandoned);
+	EXPECT_FALSE(c->join("k"));
+}
+
+TEST(coalescer, varying_responses_are_not_shared)
+{
+	auto c = std::make_shared<proxy::coalescer>();
+	auto leader = c->lead("k");
+	recorder r;
+	leader->subscribe(r.subscriber());
+
+	http::http_response res;
+	res.status(200);
+	res.header("vary", "accept-language");
+	leader->headers(res);
+
+	EXPECT_EQ(r.headers, 0U);
+	EXPECT_TRUE(r.abandoned);
+}
+
+TEST(coalescer, leader_failure_abandons_followers)
+{
+	auto c = std::make_shared<proxy::coalescer>();
+	auto leader = c->lead("k");
+	recorder r;
+	leader->subscribe(r.subscriber());
+	leader->abandon();
+	EXPECT_TRUE(r.abandoned);
+	EXPECT_FALSE(r.finished);
+	// a new flight can start
+	EXPECT_NE(c->lead("k"), leader);
+}
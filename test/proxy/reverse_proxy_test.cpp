@@ -0,0 +1,485 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+
+#include "src/proxy/reverse_proxy.h"
+#include "src/proxy/coalescer.h"
+#include "src/cache/http_cache.h"
+#include "src/protocol/handler_http1.h"
+#include "src/http/server/server_traits.h"
+#include "src/network/communicator/communicator_factory.h"
+#include "src/network/communicator/local_communicator_factory.h"
+#include "src/connector.h"
+#include "mocks/mock_connector/mock_connector.h"
+
+#include <array>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace
+{
+
+using server_connection_t = server::handler_http1<http::server_traits>;
+
+struct mock_connector_factory : network::connector_factory
+{
+	mock_connector_factory(boost::asio::io_service& io, MockConnector::wcb& cb) : io{io}, write_cb(cb) {}
+
+	void get_connector(const std::string&, uint16_t, bool, connector_callback_t ccb, error_callback_t ecb) override
+	{
+		++connects;
+		if(fail) return ecb(3);
+		connector = std::make_shared<MockConnector>(io, write_cb);
+		ccb(connector, http::proto_version::HTTP11);
+	}
+
+	void stop() override {}
+
+	boost::asio::io_service& io;
+	MockConnector::wcb& write_cb;
+	std::shared_ptr<MockConnector> connector;
+	std::size_t connects{0};
+	bool fail{false};
+};
+
+const std::string request = "POST /upload HTTP/1.1\r\n"
+	"host: localhost\r\n"
+	"proxy-connection: keep-alive\r\n"
+	"content-length: 4\r\n"
+	"\r\n"
+	"ciao";
+
+const std::string response = "HTTP/1.1 200 OK\r\n"
+	"content-length: 5\r\n"
+	"keep-alive: timeout=5\r\n"
+	"\r\n"
+	"hello";
+
+struct reverse_proxy_test : public ::testing::Test
+{
+	void SetUp() override
+	{
+		downstream_cb = [this](std::string d) { downstream_data += d; };
+		// the stand-in upstream answers as soon as it has received a whole request
+		upstream_cb = [this](std::string d)
+		{
+			upstream_data += d;
+			received += d;
+			bool get = received.compare(0, 3, "GET") == 0;
+			auto end = get ? std::string{"\r\n\r\n"} : std::string{"ciao"};
+			if(received.size() < end.size() || received.compare(received.size() - end.size(), end.size(), end) != 0)
+				return;
+			received.clear();
+			io.post([this]() { factory->connector->read(answer); });
+		};
+		auto f = std::make_unique<mock_connector_factory>(io, upstream_cb);
+		factory = f.get();
+		pool = std::make_shared<proxy::connection_pool>(std::move(f));
+		downstream = std::make_shared<MockConnector>(io, downstream_cb);
+		handler = std::make_shared<server_connection_t>();
+		downstream->handler(handler);
+		proxy::reverse_proxy{pool, [this](const http::http_request&) { return target; }}.attach(handler);
+	}
+
+	boost::asio::io_service io;
+	MockConnector::wcb downstream_cb;
+	MockConnector::wcb upstream_cb;
+	std::string downstream_data;
+	std::string upstream_data;
+	std::string received;
+	std::string answer{response};
+	mock_connector_factory* factory;
+	std::shared_ptr<proxy::connection_pool> pool;
+	std::shared_ptr<MockConnector> downstream;
+	std::shared_ptr<server_connection_t> handler;
+	proxy::upstream target{"127.0.0.1", 8454, false};
+};
+
+
+/** The proxy on real connectors: its clients come on socket pairs, its upstream answers on a Unix socket. Unlike
+ * MockConnector, they write asynchronously and tell when they drained, so that flow control is exercised as it
+ * is in a server. */
+struct reverse_proxy_sockets : public ::testing::Test
+{
+	using local = boost::asio::local::stream_protocol;
+
+	void SetUp() override
+	{
+		for(std::size_t i = 0; i < body.size(); ++i) body[i] = static_cast<char>('a' + i % 26);
+		answer = "HTTP/1.1 200 OK\r\ncontent-length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+		backend_accept();
+		// a stalled exchange fails the test instead of hanging it
+		deadline.expires_from_now(boost::posix_time::seconds(10));
+		deadline.async_wait([this](const boost::system::error_code& ec) { if(!ec) io.stop(); });
+	}
+
+	/** \brief the upstream answers each request of its connections once it has got its headers. */
+	void backend_accept()
+	{
+		auto s = std::make_shared<local::socket>(io);
+		backend.async_accept(*s, [this, s](const boost::system::error_code& ec)
+		{
+			if(ec) return;
+			backend_read(s, std::make_shared<std::string>());
+			backend_accept();
+		});
+	}
+
+	void backend_read(std::shared_ptr<local::socket> s, std::shared_ptr<std::string> received)
+	{
+		auto chunk = std::make_shared<std::array<char, 4096>>();
+		s->async_read_some(boost::asio::buffer(*chunk),
+			[this, s, received, chunk](const boost::system::error_code& ec, std::size_t n)
+			{
+				if(ec) return;
+				received->append(chunk->data(), n);
+				auto end = received->find("\r\n\r\n");
+				if(end != std::string::npos)
+				{
+					received->erase(0, end + 4);
+					++upstream_requests;
+					auto out = std::make_shared<std::string>(answer);
+					boost::asio::async_write(*s, boost::asio::buffer(*out), [out](const boost::system::error_code&, std::size_t) {});
+				}
+				backend_read(s, received);
+			});
+	}
+
+	/** \brief sends the request on a new connection to the proxy and reads the response; the io_service stops
+	 * once every response fetched so far is whole.
+	 * \returns what the client received
+	 * */
+	std::shared_ptr<std::string> fetch(const proxy::reverse_proxy& p, const std::string& request)
+	{
+		auto client = std::make_shared<local::socket>(io);
+		auto accepted = std::make_shared<server::local_socket>(io);
+		boost::asio::local::connect_pair(*client, *accepted);
+		auto c = std::make_shared<server::connector<server::local_socket>>(accepted);
+		auto h = std::make_shared<server_connection_t>();
+		c->handler(h);
+		p.attach(h);
+		c->start();
+		connections.push_back(c);
+
+		auto out = std::make_shared<std::string>(request);
+		boost::asio::async_write(*client, boost::asio::buffer(*out), [out](const boost::system::error_code&, std::size_t) {});
+		auto got = std::make_shared<std::string>();
+		++fetching;
+		client_read(client, got);
+		return got;
+	}
+
+	void client_read(std::shared_ptr<local::socket> client, std::shared_ptr<std::string> got)
+	{
+		auto chunk = std::make_shared<std::array<char, 16384>>();
+		client->async_read_some(boost::asio::buffer(*chunk),
+			[this, client, got, chunk](const boost::system::error_code& ec, std::size_t n)
+			{
+				if(ec) return;
+				got->append(chunk->data(), n);
+				if(!whole(*got)) return client_read(client, got);
+				if(--fetching == 0) io.stop();
+			});
+	}
+
+	/** \returns the body of the response, once it is whole */
+	static std::string body_of(const std::string& response)
+	{
+		auto end = response.find("\r\n\r\n");
+		return end == std::string::npos ? std::string{} : response.substr(end + 4);
+	}
+
+	bool whole(const std::string& response) const { return body_of(response).size() >= body.size(); }
+
+	proxy::reverse_proxy make_proxy()
+	{
+		auto pool = std::make_shared<proxy::connection_pool>(
+			std::make_unique<network::local_connector_factory>(io, std::chrono::milliseconds{10000}));
+		return proxy::reverse_proxy{pool, [this](const http::http_request&) { return target; }};
+	}
+
+	boost::asio::io_service io;
+	boost::asio::deadline_timer deadline{io};
+	const std::string address{"unix:@doormat-reverse-proxy-test-" + std::to_string(getpid())};
+	local::acceptor backend{io, network::local_connector_factory::endpoint(address)};
+	proxy::upstream target{address, 0, false};
+	/** Four times the high watermark */
+	std::string body = std::string(4 * proxy::reverse_proxy::default_high_watermark, '\0');
+	std::string answer;
+	std::size_t upstream_requests{0};
+	std::size_t fetching{0};
+	std::vector<std::shared_ptr<server::connector_interface>> connections;
+};
+
+
+}
+
+TEST(reverse_proxy, upstream_preamble_drops_hop_by_hop_headers)
+{
+	http::http_request received;
+	received.protocol(http::proto_version::HTTP11);
+	received.method(HTTP_GET);
+	received.path("/");
+	received.header("te", "trailers");
+	received.header("upgrade", "websocket");
+	received.header("x-custom", "kept");
+	received.origin(boost::asio::ip::address::from_string("10.0.0.1"));
+
+	auto sent = proxy::upstream_preamble(received, proxy::upstream{"backend", 80, false});
+	EXPECT_FALSE(sent.has("te"));
+	EXPECT_FALSE(sent.has("upgrade"));
+	EXPECT_EQ(sent.header("x-custom"), "kept");
+	EXPECT_EQ(sent.header("x-forwarded-for"), "10.0.0.1");
+	EXPECT_EQ(sent.hostname(), "backend");
+	EXPECT_EQ(sent.schema(), "http");
+	EXPECT_TRUE(sent.keepalive());
+}
+
+TEST(reverse_proxy, upstream_preamble_appends_to_forwarded_chain)
+{
+	http::http_request received;
+	received.protocol(http::proto_version::HTTP11);
+	received.header("x-forwarded-for", "192.168.1.1");
+	received.origin(boost::asio::ip::address::from_string("10.0.0.1"));
+
+	auto sent = proxy::upstream_preamble(received, proxy::upstream{"backend", 80, false});
+	EXPECT_EQ(sent.header("x-forwarded-for"), "192.168.1.1, 10.0.0.1");
+}
+
+TEST(reverse_proxy, downstream_preamble_unchunks_for_http10)
+{
+	http::http_request request;
+	request.protocol(http::proto_version::HTTP10);
+	request.method(HTTP_GET);
+
+	http::http_response received;
+	received.protocol(http::proto_version::HTTP11);
+	received.status(200);
+	received.chunked(true);
+
+	auto sent = proxy::downstream_preamble(received, request);
+	EXPECT_EQ(sent.protocol_version(), http::proto_version::HTTP10);
+	EXPECT_FALSE(sent.chunked());
+	EXPECT_FALSE(sent.keepalive());
+}
+
+TEST_F(reverse_proxy_test, streams_request_and_response)
+{
+	io.post([this]() { downstream->read(request); });
+	io.run();
+
+	EXPECT_EQ(upstream_data.find("POST /upload HTTP/1.1"), 0U);
+	EXPECT_EQ(upstream_data.find("proxy-connection"), std::string::npos);
+	EXPECT_NE(upstream_data.find("ciao"), std::string::npos);
+	EXPECT_EQ(downstream_data.find("HTTP/1.1 200 OK"), 0U);
+	EXPECT_EQ(downstream_data.find("keep-alive: timeout"), std::string::npos);
+	EXPECT_NE(downstream_data.find("hello"), std::string::npos);
+	EXPECT_EQ(pool->idle(target), 1U);
+}
+
+TEST_F(reverse_proxy_test, headers_named_by_connection_are_not_forwarded)
+{
+	answer = "HTTP/1.1 200 OK\r\n"
+		"content-length: 5\r\n"
+		"connection: x-bar\r\n"
+		"x-bar: upstream only\r\n"
+		"x-kept: answer\r\n"
+		"\r\n"
+		"hello";
+	io.post([this]()
+	{
+		downstream->read("POST /upload HTTP/1.1\r\n"
+			"host: localhost\r\n"
+			"connection: x-foo, content-length\r\n"
+			"x-foo: downstream only\r\n"
+			"x-kept: request\r\n"
+			"content-length: 4\r\n"
+			"\r\n"
+			"ciao");
+	});
+	io.run();
+
+	EXPECT_EQ(upstream_data.find("x-foo"), std::string::npos);
+	EXPECT_NE(upstream_data.find("x-kept: request"), std::string::npos);
+	// the body is still framed, whatever the connection header names
+	EXPECT_NE(upstream_data.find("content-length: 4"), std::string::npos);
+	EXPECT_NE(upstream_data.find("ciao"), std::string::npos);
+	EXPECT_EQ(downstream_data.find("x-bar"), std::string::npos);
+	EXPECT_NE(downstream_data.find("x-kept: answer"), std::string::npos);
+	EXPECT_NE(downstream_data.find("hello"), std::string::npos);
+}
+
+TEST_F(reverse_proxy_test, upstream_failure_becomes_bad_gateway)
+{
+	factory->fail = true;
+	io.post([this]() { downstream->read(request); });
+	io.run();
+
+	EXPECT_EQ(downstream_data.find("HTTP/1.1 502"), 0U);
+}
+
+TEST_F(reverse_proxy_test, idle_connection_is_reused)
+{
+	io.post([this]() { downstream->read(request); });
+	io.run();
+	io.reset();
+
+	io.post([this]() { downstream->read(request); });
+	io.run();
+
+	EXPECT_EQ(factory->connects, 1U);
+}
+
+TEST_F(reverse_proxy_test, identical_requests_are_coalesced)
+{
+	std::string second_data;
+	MockConnector::wcb second_cb = [&second_data](std::string d) { second_data += d; };
+	auto second = std::make_shared<MockConnector>(io, second_cb);
+	auto second_handler = std::make_shared<server_connection_t>();
+	second->handler(second_handler);
+
+	proxy::reverse_proxy coalescing{pool, [this](const http::http_request&) { return target; }};
+	coalescing.coalesce(std::make_shared<proxy::coalescer>());
+	coalescing.attach(handler);
+	coalescing.attach(second_handler);
+
+	const std::string get = "GET /popular HTTP/1.1\r\nhost: localhost\r\n\r\n";
+	io.post([&]()
+	{
+		downstream->read(get);
+		second->read(get);
+	});
+	io.run();
+
+	EXPECT_EQ(factory->connects, 1U);
+	EXPECT_EQ(upstream_data.find("GET /popular"), upstream_data.rfind("GET /popular"));
+	EXPECT_NE(downstream_data.find("hello"), std::string::npos);
+	EXPECT_NE(second_data.find("hello"), std::string::npos);
+}
+
+TEST_F(reverse_proxy_test, fresh_responses_are_served_from_the_cache)
+{
+	answer = "HTTP/1.1 200 OK\r\ncache-control: max-age=60\r\ncontent-length: 5\r\n\r\nhello";
+	proxy::reverse_proxy caching{pool, [this](const http::http_request&) { return target; }};
+	caching.use_cache(std::make_shared<cache::http_cache>(cache::http_cache::settings{}));
+	caching.attach(handler);
+
+	const std::string get = "GET /static HTTP/1.1\r\nhost: localhost\r\n\r\n";
+	io.post([&]() { downstream->read(get); });
+	io.run();
+	io.reset();
+	io.post([&]() { downstream->read(get); });
+	io.run();
+
+	EXPECT_EQ(upstream_data.find("GET /static"), upstream_data.rfind("GET /static"));
+	auto first = downstream_data.find("hello");
+	ASSERT_NE(first, std::string::npos);
+	EXPECT_NE(downstream_data.find("hello", first + 5), std::string::npos);
+	EXPECT_NE(downstream_data.find("age: "), std::string::npos);
+}
+
+TEST_F(reverse_proxy_test, clients_can_refuse_cached_responses)
+{
+	answer = "HTTP/1.1 200 OK\r\ncache-control: max-age=60\r\ncontent-length: 5\r\n\r\nhello";
+	proxy::reverse_proxy caching{pool, [this](const http::http_request&) { return target; }};
+	caching.use_cache(std::make_shared<cache::http_cache>(cache::http_cache::settings{}));
+	caching.attach(handler);
+
+	io.post([&]() { downstream->read("GET /static HTTP/1.1\r\nhost: localhost\r\n\r\n"); });
+	io.run();
+	io.reset();
+	io.post([&]() { downstream->read("GET /static HTTP/1.1\r\nhost: localhost\r\ncache-control: max-age=0\r\n\r\n"); });
+	io.run();
+	io.reset();
+	io.post([&]() { downstream->read("GET /static HTTP/1.1\r\nhost: localhost\r\npragma: no-cache\r\n\r\n"); });
+	io.run();
+
+	// every request reached the origin
+	std::size_t fetched{0};
+	for(auto at = upstream_data.find("GET /static"); at != std::string::npos; at = upstream_data.find("GET /static", at + 1))
+		++fetched;
+	EXPECT_EQ(fetched, 3U);
+}
+
+TEST_F(reverse_proxy_test, stale_responses_are_revalidated)
+{
+	answer = "HTTP/1.1 200 OK\r\ncache-control: max-age=0\r\netag: \"v1\"\r\ncontent-length: 5\r\n\r\nhello";
+	proxy::reverse_proxy caching{pool, [this](const http::http_request&) { return target; }};
+	caching.use_cache(std::make_shared<cache::http_cache>(cache::http_cache::settings{}));
+	caching.attach(handler);
+
+	const std::string get = "GET /static HTTP/1.1\r\nhost: localhost\r\n\r\n";
+	io.post([&]() { downstream->read(get); });
+	io.run();
+	io.reset();
+	answer = "HTTP/1.1 304 Not Modified\r\ncache-control: max-age=60\r\netag: \"v1\"\r\ncontent-length: 0\r\n\r\n";
+	io.post([&]() { downstream->read(get); });
+	io.run();
+
+	EXPECT_NE(upstream_data.find("if-none-match: \"v1\""), std::string::npos);
+	EXPECT_EQ(downstream_data.find("304"), std::string::npos);
+	auto first = downstream_data.find("hello");
+	ASSERT_NE(first, std::string::npos);
+	EXPECT_NE(downstream_data.find("hello", first + 5), std::string::npos);
+}
+
+TEST_F(reverse_proxy_sockets, bodies_beyond_the_high_watermark_are_streamed_over_http1)
+{
+	auto proxy = make_proxy();
+	auto got = fetch(proxy, "GET /big HTTP/1.1\r\nhost: localhost\r\n\r\n");
+	io.run();
+
+	EXPECT_EQ(got->find("HTTP/1.1 200 OK"), 0U);
+	ASSERT_EQ(body_of(*got).size(), body.size());
+	EXPECT_TRUE(body_of(*got) == body);
+	EXPECT_EQ(upstream_requests, 1U);
+}
+
+TEST_F(reverse_proxy_sockets, followers_get_bodies_beyond_the_high_watermark)
+{
+	auto proxy = make_proxy();
+	proxy.coalesce(std::make_shared<proxy::coalescer>());
+	auto leader = fetch(proxy, "GET /big HTTP/1.1\r\nhost: localhost\r\n\r\n");
+	auto follower = fetch(proxy, "GET /big HTTP/1.1\r\nhost: localhost\r\n\r\n");
+	io.run();
+
+	EXPECT_EQ(upstream_requests, 1U);
+	for(auto& got : {leader, follower})
+	{
+		EXPECT_EQ(got->find("HTTP/1.1 200 OK"), 0U);
+		ASSERT_EQ(body_of(*got).size(), body.size());
+		EXPECT_TRUE(body_of(*got) == body);
+	}
+}
+
+TEST_F(reverse_proxy_sockets, cache_hits_beyond_the_high_watermark_are_streamed_over_http1)
+{
+	answer = "HTTP/1.1 200 OK\r\ncache-control: max-age=60\r\ncontent-length: " + std::to_string(body.size())
+		+ "\r\n\r\n" + body;
+	char dir[] = "/tmp/doormat_proxy_cache_XXXXXX";
+	ASSERT_NE(mkdtemp(dir), nullptr);
+	cache::http_cache::settings s;
+	s.path = dir;
+	// too big for the memory tier: the hit is read from the disk
+	s.memory_capacity = 16 * 1024;
+	auto proxy = make_proxy();
+	auto c = std::make_shared<cache::http_cache>(s);
+	proxy.use_cache(c);
+
+	auto miss = fetch(proxy, "GET /big HTTP/1.1\r\nhost: localhost\r\n\r\n");
+	io.run();
+	io.reset();
+	auto hit = fetch(proxy, "GET /big HTTP/1.1\r\nhost: localhost\r\n\r\n");
+	io.run();
+
+	EXPECT_EQ(upstream_requests, 1U);
+	EXPECT_NE(hit->find("age: "), std::string::npos);
+	for(auto& got : {miss, hit})
+	{
+		EXPECT_EQ(got->find("HTTP/1.1 200 OK"), 0U);
+		ASSERT_EQ(body_of(*got).size(), body.size());
+		EXPECT_TRUE(body_of(*got) == body);
+	}
+	EXPECT_GT(c->disk()->used(), body.size());
+	std::system((std::string{"rm -rf "} + dir).c_str());
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include "src/routing/router.h"
+
+#include <stdexcept>
+
+namespace
+{
+
+/** \brief a router whose handlers are told apart by the id they store. */
+class router_test : public ::testing::Test
+{
+protected:
+	void add(routing::method_mask methods, const std::string& pattern, int id, const std::string& host = {})
+	{
+		r.add(host, methods, pattern, [this, id](std::shared_ptr<http::server_connection>,
+			std::shared_ptr<http::request>, std::shared_ptr<http::response>, const routing::match&)
+		{
+			called = id;
+		});
+	}
+
+	/** \returns the id of the handler of the request, 0 if none; the captures refer to the path */
+	int route(const std::string& path, http_method method = HTTP_GET, const std::string& host = "example.com")
+	{
+		called = 0;
+		if(auto handler = r.find(host, method, path, m))
+			(*handler)(nullptr, nullptr, nullptr, m);
+		return called;
+	}
+
+	routing::router r;
+	routing::match m;
+	int called{0};
+};
+
+const auto get = routing::method_bit(HTTP_GET);
+const auto post = routing::method_bit(HTTP_POST);
+
+}
+
+TEST_F(router_test, static_routes)
+{
+	add(get, "/", 1);
+	add(get, "/users", 2);
+	add(get, "/users/", 3);
+	add(get, "/user", 4);
+	add(get, "/users/new", 5);
+
+	EXPECT_EQ(route("/"), 1);
+	EXPECT_EQ(route("/users"), 2);
+	EXPECT_EQ(route("/users/"), 3);
+	EXPECT_EQ(route("/user"), 4);
+	EXPECT_EQ(route("/users/new"), 5);
+	EXPECT_EQ(route("/use"), 0);
+	EXPECT_EQ(route("/users/newer"), 0);
+	EXPECT_EQ(route(""), 0);
+	EXPECT_EQ(m.size(), 0U);
+	EXPECT_EQ(r.size(), 5U);
+}
+
+TEST_F(router_test, captures)
+{
+	add(get, "/users/{id}", 1);
+	add(get, "/users/{id}/posts/{post}", 2);
+	add(get, "/files/*path", 3);
+	add(get, "/users/new", 4);
+
+	const std::string path{"/users/42/posts/7"};
+	EXPECT_EQ(route(path), 2);
+	ASSERT_EQ(m.size(), 2U);
+	EXPECT_EQ(m.name(0), "id");
+	EXPECT_EQ(m["id"], "42");
+	EXPECT_EQ(m["post"], "7");
+	EXPECT_TRUE(m["missing"].empty());
+	// views into the path
+	EXPECT_EQ(m["id"].data(), path.data() + 7);
+
+	EXPECT_EQ(route(path.substr(0, 9)), 1);
+	EXPECT_EQ(m.size(), 1U);
+	EXPECT_EQ(route("/users/new"), 4);
+	EXPECT_EQ(m.size(), 0U);
+	// parameters match whole non-empty segments
+	EXPECT_EQ(route("/users/"), 0);
+	EXPECT_EQ(route("/users/42/"), 0);
+
+	const std::string file{"/files/css/style.css"};
+	EXPECT_EQ(route(file), 3);
+	EXPECT_EQ(m["path"], "css/style.css");
+	EXPECT_EQ(route("/files/"), 3);
+	EXPECT_TRUE(m["path"].empty());
+	EXPECT_EQ(route("/files"), 0);
+}
+
+TEST_F(router_test, backtracking)
+{
+	add(get, "/a/b/c", 1);
+	add(get, "/a/{x}/d", 2);
+	add(get, "/a/*rest", 3);
+
+	EXPECT_EQ(route("/a/b/c"), 1);
+	// the static branch is a dead end
+	const std::string d{"/a/b/d"}, e{"/a/b/e"};
+	EXPECT_EQ(route(d), 2);
+	EXPECT_EQ(m["x"], "b");
+	EXPECT_EQ(m.size(), 1U);
+	EXPECT_EQ(route(e), 3);
+	EXPECT_EQ(m.size(), 1U);
+	EXPECT_EQ(m["rest"], "b/e");
+}
+
+TEST_F(router_test, methods)
+{
+	add(get, "/items", 1);
+	add(post, "/items", 2);
+	add(routing::any_method, "/any", 3);
+	add(routing::method_bit(HTTP_PUT) | routing::method_bit(HTTP_DELETE), "/items/{id}", 4);
+
+	EXPECT_EQ(route("/items"), 1);
+	EXPECT_EQ(route("/items", HTTP_POST), 2);
+	EXPECT_EQ(route("/items", HTTP_HEAD), 1);
+	EXPECT_EQ(route("/any", HTTP_PATCH), 3);
+	EXPECT_EQ(route("/items/1", HTTP_DELETE), 4);
+
+	EXPECT_EQ(route("/items/1"), 0);
+	EXPECT_EQ(m.allowed(), routing::method_bit(HTTP_PUT) | routing::method_bit(HTTP_DELETE));
+	EXPECT_EQ(m.size(), 0U);
+	EXPECT_EQ(route("/nowhere"), 0);
+	EXPECT_EQ(m.allowed(), 0U);
+
+	EXPECT_THROW(add(post | routing::method_bit(HTTP_PUT), "/items", 5), std::invalid_argument);
+	EXPECT_THROW(add(0, "/other", 5), std::invalid_argument);
+}
+
+TEST_F(router_test, virtual_hosts)
+{
+	add(get, "/", 1);
+	add(get, "/", 2, "api.example.com");
+	add(get, "/v1/{name}", 3, "API.example.com");
+
+	EXPECT_EQ(route("/", HTTP_GET, "www.example.com"), 1);
+	EXPECT_EQ(route("/", HTTP_GET, "api.example.com"), 2);
+	EXPECT_EQ(route("/", HTTP_GET, "Api.Example.com:8443"), 2);
+	EXPECT_EQ(route("/v1/x", HTTP_GET, "api.example.com"), 3);
+	// hosts with routes of their own do not fall back to the others
+	EXPECT_EQ(route("/v1/x", HTTP_GET, "www.example.com"), 0);
+	EXPECT_EQ(route("/", HTTP_GET, "[::1]:80"), 1);
+	EXPECT_EQ(route("/", HTTP_GET, ""), 1);
+}
+
+TEST_F(router_test, malformed_patterns)
+{
+	EXPECT_THROW(add(get, "users", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/users/{}", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/users/{id", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/users/x{id}", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/files/*path/more", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/{a}/{a}", 1), std::invalid_argument);
+	EXPECT_THROW(add(get, "/{a}/{b}/{c}/{d}/{e}/{f}/{g}/{h}/{i}", 1), std::invalid_argument);
+
+	add(get, "/users/{id}", 1);
+	// one name per position
+	EXPECT_THROW(add(post, "/users/{name}", 2), std::invalid_argument);
+	EXPECT_EQ(r.size(), 1U);
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
 #include <vector>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
 
 #include "../src/utils/sni_solver.h"
 
@@ -20,6 +26,53 @@ static const std::vector<std::vector<std::string>> certificates =
 	}
 };
 
+namespace
+{
+
+/** \brief writes a self-signed certificate for the names, and its key, to files named after the first one */
+std::vector<std::string> make_certificate(const std::string& cn, std::string alt_names)
+{
+	const std::string prefix = "sni_solver_test." + std::to_string(std::hash<std::string>{}(cn));
+	std::vector<std::string> files{prefix + ".pem", prefix + ".key", prefix + ".pass"};
+
+	EVP_PKEY* key = nullptr;
+	auto keygen = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	EVP_PKEY_keygen_init(keygen);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(keygen, &key);
+	EVP_PKEY_CTX_free(keygen);
+
+	auto x509 = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_get_notBefore(x509), 0);
+	X509_gmtime_adj(X509_get_notAfter(x509), 3600);
+	X509_set_pubkey(x509, key);
+	auto name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(cn.c_str()), -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	if(!alt_names.empty())
+	{
+		auto extension = X509V3_EXT_conf_nid(nullptr, nullptr, NID_subject_alt_name, &alt_names[0]);
+		X509_add_ext(x509, extension, -1);
+		X509_EXTENSION_free(extension);
+	}
+	X509_sign(x509, key, EVP_sha256());
+
+	auto out = std::fopen(files[0].c_str(), "w");
+	PEM_write_X509(out, x509);
+	std::fclose(out);
+	out = std::fopen(files[1].c_str(), "w");
+	PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+	std::fclose(out);
+	out = std::fopen(files[2].c_str(), "w");
+	std::fclose(out);
+	X509_free(x509);
+	EVP_PKEY_free(key);
+	return files;
+}
+
+}
+
 TEST(sni_solver, valid)
 {
 	sni_solver tested;
@@ -29,7 +82,7 @@ TEST(sni_solver, valid)
 		tested.add_certificate( cert[0], cert[1], cert[2] );
 	}
 	ASSERT_TRUE(tested.load_certificates());
-	ASSERT_EQ((unsigned int) std::distance(tested.begin(), tested.end()), certificates.size());
+	ASSERT_EQ((unsigned int) tested.certificates().size(), certificates.size());
 }
 
 TEST(sni_solver, invalid)
@@ -39,7 +92,129 @@ TEST(sni_solver, invalid)
 	tested.add_certificate("pi","vu","elle");
 
 	ASSERT_FALSE(tested.load_certificates());
-	ASSERT_EQ( 0U, std::distance(tested.begin(), tested.end()));
+	ASSERT_EQ( 0U, tested.certificates().size());
 }
 
+TEST(sni_solver, find)
+{
+	sni_solver tested;
+	std::vector<std::vector<std::string>> generated
+	{
+		make_certificate("www.example.com", "DNS:example.com,DNS:static.example.com"),
+		make_certificate("*.example.com", ""),
+		make_certificate("other.org", "DNS:*.api.other.org,DNS:www.example.com")
+	};
+	for(auto&& cert : generated) tested.add_certificate(cert[0], cert[1], cert[2]);
+	ASSERT_TRUE(tested.load_certificates());
+
+	auto first = tested.find("www.example.com");
+	auto wildcard = tested.find("mail.example.com");
+	auto other = tested.find("other.org");
+	ASSERT_EQ(first, tested.default_context());
+	ASSERT_NE(wildcard, nullptr);
+	ASSERT_NE(other, nullptr);
+	ASSERT_NE(wildcard, other);
+	// by CN and SAN, whatever the case
+	ASSERT_EQ(tested.find("Static.Example.COM"), first);
+	ASSERT_EQ(tested.find("example.com."), first);
+	// exact names before wildcards
+	ASSERT_EQ(tested.find("v1.api.other.org"), other);
+	// a wildcard stands in for one label only
+	ASSERT_EQ(tested.find("a.b.example.com"), nullptr);
+	ASSERT_EQ(tested.find("api.other.org"), nullptr);
+	ASSERT_EQ(tested.find("unknown.net"), nullptr);
+	ASSERT_EQ(tested.find(""), nullptr);
+	ASSERT_EQ(tested.certificates().front().server_name, "www.example.com");
+	for(auto&& cert : generated) for(auto&& file : cert) std::remove(file.c_str());
+}
 
+TEST(sni_solver, lazy_contexts)
+{
+	sni_solver tested;
+	std::vector<std::vector<std::string>> generated
+	{
+		make_certificate("default.test", ""),
+		make_certificate("one.test", ""),
+		make_certificate("two.test", ""),
+		make_certificate("broken.test", "")
+	};
+	std::ofstream{generated[3][1]} << "not a key";
+	for(auto&& cert : generated) tested.add_certificate(cert[0], cert[1], cert[2]);
+	std::size_t built{0};
+	tested.on_context([&built](SSL_CTX*) { ++built; });
+	tested.set_context_cache(1);
+
+	ASSERT_TRUE(tested.load_certificates());
+	// only the default context is built at once
+	ASSERT_EQ(built, 1U);
+	ASSERT_EQ(tested.contexts(), 1U);
+	ASSERT_EQ(tested.certificates().size(), 4U);
+	ASSERT_GT(tested.certificates().front().not_after, std::chrono::system_clock::now());
+
+	auto one = tested.find("one.test");
+	ASSERT_NE(one, nullptr);
+	ASSERT_EQ(tested.find("one.test"), one);
+	ASSERT_EQ(built, 2U);
+	// the cache holds one context besides the default one
+	ASSERT_NE(tested.find("two.test"), nullptr);
+	ASSERT_EQ(built, 3U);
+	ASSERT_EQ(tested.contexts(), 2U);
+	ASSERT_NE(tested.find("one.test"), nullptr);
+	ASSERT_EQ(built, 4U);
+	ASSERT_EQ(tested.find("default.test"), tested.default_context());
+	ASSERT_EQ(built, 4U);
+
+	// a key that can not be read leaves the name to the default context
+	ASSERT_EQ(tested.find("broken.test"), nullptr);
+	ASSERT_EQ(tested.contexts(), 2U);
+	for(auto&& cert : generated) for(auto&& file : cert) std::remove(file.c_str());
+}
+
+TEST(sni_solver, reload)
+{
+	sni_solver tested;
+	auto old = make_certificate("old.test", "DNS:kept.test");
+	auto renewed = make_certificate("renewed.test", "DNS:kept.test");
+	tested.add_certificate(old[0], old[1], old[2]);
+	ASSERT_TRUE(tested.load_certificates());
+	auto in_use = tested.find("kept.test");
+	ASSERT_NE(in_use, nullptr);
+
+	// a failed reload keeps the certificates in use
+	ASSERT_FALSE(tested.reload({sni_solver::files{"pi", "vu", "elle"}}));
+	ASSERT_EQ(tested.find("old.test"), in_use);
+	ASSERT_EQ(tested.reloads(), 0U);
+
+	ASSERT_TRUE(tested.reload({sni_solver::files{renewed[0], renewed[1], renewed[2]}}));
+	ASSERT_EQ(tested.reloads(), 1U);
+	ASSERT_EQ(tested.find("old.test"), nullptr);
+	auto fresh = tested.find("kept.test");
+	ASSERT_NE(fresh, nullptr);
+	ASSERT_NE(fresh, in_use);
+	ASSERT_EQ(fresh, tested.default_context());
+	ASSERT_EQ(tested.certificates().front().server_name, "renewed.test");
+	// whoever holds a context of the previous certificates still can use it
+	ASSERT_NE(in_use->native_handle(), nullptr);
+	for(auto&& file : old) std::remove(file.c_str());
+	for(auto&& file : renewed) std::remove(file.c_str());
+}
+
+TEST(sni_solver, watch)
+{
+	sni_solver tested;
+	auto watched = make_certificate("watched.test", "");
+	tested.add_certificate(watched[0], watched[1], watched[2]);
+	ASSERT_TRUE(tested.load_certificates());
+	tested.watch(std::chrono::milliseconds{10});
+
+	// the renewed certificate takes the place of the old one, as a deployment would do
+	auto renewed = make_certificate("renewed.watched.test", "DNS:watched.test");
+	for(std::size_t i = 0; i < watched.size(); ++i) std::rename(renewed[i].c_str(), watched[i].c_str());
+	for(int i = 0; i < 200 && tested.certificates().front().server_name != "renewed.watched.test"; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds{10});
+	tested.unwatch();
+	ASSERT_GE(tested.reloads(), 1U);
+	ASSERT_NE(tested.find("watched.test"), nullptr);
+	ASSERT_EQ(tested.certificates().front().server_name, "renewed.watched.test");
+	for(auto&& file : watched) std::remove(file.c_str());
+}
@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <openssl/rand.h>
+
+#include "../src/utils/tls_sessions.h"
+
+using namespace ssl_utils;
+
+namespace
+{
+
+using context_ptr = std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)>;
+using session_ptr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+std::string password()
+{
+	std::ifstream in{"etc/doormat/certificates/npn1/keypass"};
+	std::string p;
+	std::getline(in, p);
+	return p;
+}
+
+void relax(SSL_CTX* ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	// the test certificate is signed with SHA-1; TLS 1.3 sends tickets after the handshake
+	SSL_CTX_set_security_level(ctx, 0);
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+#endif
+}
+
+context_ptr server_context()
+{
+	static const std::string pass = password();
+	context_ptr ctx{SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free};
+	relax(ctx.get());
+	// as the contexts of the server, which issue no ticket by default
+	SSL_CTX_set_options(ctx.get(), SSL_OP_NO_TICKET);
+	SSL_CTX_set_default_passwd_cb_userdata(ctx.get(), const_cast<char*>(pass.c_str()));
+	SSL_CTX_set_default_passwd_cb(ctx.get(), [](char* buf, int size, int, void* p)
+	{
+		return static_cast<int>(BUF_strlcpy(buf, static_cast<const char*>(p), size));
+	});
+	EXPECT_EQ(SSL_CTX_use_certificate_chain_file(ctx.get(), "etc/doormat/certificates/npn1/newcert.pem"), 1);
+	EXPECT_EQ(SSL_CTX_use_PrivateKey_file(ctx.get(), "etc/doormat/certificates/npn1/newkey.pem", SSL_FILETYPE_PEM), 1);
+	return ctx;
+}
+
+context_ptr client_context(bool tickets = true)
+{
+	context_ptr ctx{SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free};
+	relax(ctx.get());
+	if(!tickets) SSL_CTX_set_options(ctx.get(), SSL_OP_NO_TICKET);
+	return ctx;
+}
+
+/** \brief runs a handshake in memory, offering the session if any.
+ * \returns the session the client ends up with
+ * */
+session_ptr handshake(SSL_CTX* server, SSL_CTX* client, SSL_SESSION* session, bool& resumed,
+	resumption_counters* counters = nullptr)
+{
+	SSL* s = SSL_new(server);
+	SSL* c = SSL_new(client);
+	BIO* server_end;
+	BIO* client_end;
+	BIO_new_bio_pair(&server_end, 0, &client_end, 0);
+	SSL_set_bio(s, server_end, server_end);
+	SSL_set_bio(c, client_end, client_end);
+	SSL_set_accept_state(s);
+	SSL_set_connect_state(c);
+	if(session) SSL_set_session(c, session);
+
+	bool server_done = false, client_done = false;
+	for(int i = 0; i < 16 && !(server_done && client_done); ++i)
+	{
+		client_done = client_done || SSL_do_handshake(c) == 1;
+		server_done = server_done || SSL_do_handshake(s) == 1;
+	}
+	EXPECT_TRUE(server_done && client_done);
+	resumed = SSL_session_reused(c);
+	if(counters) counters->count(s);
+	session_ptr got{SSL_get1_session(c), SSL_SESSION_free};
+	// sessions of connections not closed cleanly are dropped
+	SSL_shutdown(c);
+	SSL_shutdown(s);
+	SSL_free(c);
+	SSL_free(s);
+	return got;
+}
+
+}
+
+TEST(ticket_keys, resume_across_contexts)
+{
+	auto keys = std::make_shared<ticket_keys>();
+	auto first = server_context();
+	auto second = server_context();
+	keys->attach(first.get());
+	keys->attach(second.get());
+	auto client = client_context();
+	resumption_counters counters;
+
+	bool resumed;
+	auto session = handshake(first.get(), client.get(), nullptr, resumed, &counters);
+	ASSERT_FALSE(resumed);
+	ASSERT_TRUE(SSL_SESSION_has_ticket(session.get()));
+	// another context, as one of another thread or certificate, takes the ticket
+	handshake(second.get(), client.get(), session.get(), resumed, &counters);
+	ASSERT_TRUE(resumed);
+
+	ASSERT_EQ(keys->issued(), 1U);
+	ASSERT_EQ(keys->resumed(), 1U);
+	ASSERT_EQ(keys->rejected(), 0U);
+	ASSERT_EQ(counters.handshakes(), 2U);
+	ASSERT_EQ(counters.resumed(), 1U);
+	ASSERT_DOUBLE_EQ(counters.hit_rate(), 0.5);
+}
+
+TEST(ticket_keys, no_tickets_unless_attached)
+{
+	auto server = server_context();
+	auto client = client_context();
+	bool resumed;
+	auto session = handshake(server.get(), client.get(), nullptr, resumed);
+	ASSERT_FALSE(SSL_SESSION_has_ticket(session.get()));
+}
+
+TEST(ticket_keys, tickets_outlive_rotations)
+{
+	auto keys = std::make_shared<ticket_keys>(std::chrono::seconds{0}, 1);
+	auto server = server_context();
+	keys->attach(server.get());
+	auto client = client_context();
+
+	bool resumed;
+	auto old = handshake(server.get(), client.get(), nullptr, resumed);
+	keys->rotate();
+	ASSERT_EQ(keys->size(), 2U);
+	// the older key still decrypts, and the client gets a ticket under the newer one
+	auto renewed = handshake(server.get(), client.get(), old.get(), resumed);
+	ASSERT_TRUE(resumed);
+	ASSERT_EQ(keys->renewed(), 1U);
+	ASSERT_EQ(keys->issued(), 2U);
+
+	keys->rotate();
+	ASSERT_EQ(keys->size(), 2U);
+	handshake(server.get(), client.get(), old.get(), resumed);
+	ASSERT_FALSE(resumed);
+	ASSERT_EQ(keys->rejected(), 1U);
+	handshake(server.get(), client.get(), renewed.get(), resumed);
+	ASSERT_TRUE(resumed);
+}
+
+TEST(ticket_keys, load)
+{
+	const std::string file{"tls_sessions_test.keys"};
+	unsigned char raw[160];
+	ASSERT_EQ(RAND_bytes(raw, sizeof(raw)), 1);
+	std::ofstream{file, std::ios::binary}.write(reinterpret_cast<const char*>(raw), sizeof(raw));
+
+	// two processes loading the same file resume the sessions of each other
+	auto one = std::make_shared<ticket_keys>();
+	auto other = std::make_shared<ticket_keys>();
+	one->load(file);
+	other->load(file);
+	ASSERT_EQ(one->size(), 2U);
+	auto first = server_context();
+	auto second = server_context();
+	one->attach(first.get());
+	other->attach(second.get());
+	auto client = client_context();
+
+	bool resumed;
+	auto session = handshake(first.get(), client.get(), nullptr, resumed);
+	handshake(second.get(), client.get(), session.get(), resumed);
+	ASSERT_TRUE(resumed);
+	ASSERT_EQ(other->resumed(), 1U);
+
+	std::ofstream{file, std::ios::binary}.write(reinterpret_cast<const char*>(raw), 79);
+	ASSERT_THROW(one->load(file), std::runtime_error);
+	std::remove(file.c_str());
+	ASSERT_THROW(one->load(file), std::runtime_error);
+	ASSERT_EQ(one->size(), 2U);
+}
+
+TEST(session_cache, resume_by_id)
+{
+	auto cache = std::make_shared<session_cache>();
+	auto first = server_context();
+	auto second = server_context();
+	cache->attach(first.get());
+	cache->attach(second.get());
+	auto client = client_context(false);
+
+	bool resumed;
+	auto session = handshake(first.get(), client.get(), nullptr, resumed);
+	ASSERT_FALSE(resumed);
+	ASSERT_EQ(cache->size(), 1U);
+	handshake(second.get(), client.get(), session.get(), resumed);
+	ASSERT_TRUE(resumed);
+	ASSERT_EQ(cache->hits(), 1U);
+
+	// a cache of its own knows nothing of the session
+	auto alone = std::make_shared<session_cache>();
+	auto third = server_context();
+	alone->attach(third.get());
+	handshake(third.get(), client.get(), session.get(), resumed);
+	ASSERT_FALSE(resumed);
+	ASSERT_EQ(alone->misses(), 1U);
+}
+
+TEST(session_cache, evicts_least_recently_used)
+{
+	auto cache = std::make_shared<session_cache>(2);
+	auto server = server_context();
+	cache->attach(server.get());
+	auto client = client_context(false);
+
+	bool resumed;
+	auto first = handshake(server.get(), client.get(), nullptr, resumed);
+	auto second = handshake(server.get(), client.get(), nullptr, resumed);
+	handshake(server.get(), client.get(), first.get(), resumed);
+	ASSERT_TRUE(resumed);
+	// the second session is the least recently used one
+	handshake(server.get(), client.get(), nullptr, resumed);
+	ASSERT_EQ(cache->size(), 2U);
+	handshake(server.get(), client.get(), first.get(), resumed);
+	ASSERT_TRUE(resumed);
+	handshake(server.get(), client.get(), second.get(), resumed);
+	ASSERT_FALSE(resumed);
+}
+
+TEST(session_cache, invalid)
+{
+	ASSERT_THROW(session_cache{0}, std::invalid_argument);
+}